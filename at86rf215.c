@@ -13,12 +13,30 @@
 #include <linux/of_gpio.h>
 #include <linux/ieee802154.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/hw_random.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/eventpoll.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/cpumask.h>
+#include <linux/crc-ccitt.h>
+#include <asm/unaligned.h>
+#include <linux/version.h>
 
 #include <net/mac802154.h>
 #include <net/cfg802154.h>
 
 #include "at86rf215.h"
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+typedef unsigned int __poll_t;
+#endif
+
 /* TODO: This structure will be deleted later: "rstn" will be used directly. */
 struct at86rf215_platform_data {
 	int rstn;
@@ -52,24 +70,418 @@ struct at86rf215_chip_data {
 	int	(*set_txpower)(struct at86rf215_local *, s32);
 };
 
-#define AT86RF215_MAX_BUF               (2047 + 3)
+/* Largest PSDU of the SUN PHYs (MR-FSK, MR-OFDM), FCS included */
+#define AT86RF215_MAX_PSDU              2047
+/* Command buffer of a context: 2 bytes address + register value(s) */
+#define AT86RF215_CMD_BUF               8
 /* We use the recommended 5 minutes timeout to recalibrate */
 #define AT86RF215_CAL_LOOP_TIMEOUT      (5 * 60 * HZ)
+/* Window before the deadline in which we recalibrate if the radio is idle */
+#define AT86RF215_CAL_SLACK             (30 * HZ)
+/* Polling period while waiting for an idle radio inside the slack window */
+#define AT86RF215_CAL_RETRY             (HZ)
+/* Runtime PM is disabled by default, see debugfs "pm_idle_ms" */
+#define AT86RF215_PM_IDLE_MS            0
+/* Number of RNDV reads batched in one SPI message */
+#define AT86RF215_RNG_BATCH             32
+/* A blocking hwrng read polls for RX this often, and gives up after */
+#define AT86RF215_RNG_RETRY_MS          10
+#define AT86RF215_RNG_WAIT              (HZ)
+/* Defaults of the traffic generator, see debugfs "txgen" */
+#define AT86RF215_TXGEN_COUNT           1000
+#define AT86RF215_TXGEN_LEN             127
+#define AT86RF215_TXGEN_MCS             3
+/* MR-OFDM option 1 MCS of the frames of the stack */
+#define AT86RF215_TX_MCS                3
+/* Frames from this PSDU length on are streamed into the TX frame buffer,
+ * see debugfs "tx_stream_min"; the head written before TX is at least the
+ * MHR and auxiliary security header of any frame */
+#define AT86RF215_TX_STREAM_MIN         256
+#define AT86RF215_TX_STREAM_HEAD        64
+/* Retransmission of the frames with AR set, see at86rf215_tx_sent(). The
+ * ACK wait covers the turnaround (1 ms) and the SHR and PHR of an MR-OFDM
+ * option 1 ACK; once its start is seen the wait lasts until it is read. The
+ * backoff before retry n is a random number of periods below
+ * 2^min(n, AT86RF215_TX_MAX_BE). */
+#define AT86RF215_TX_RETRIES            3
+#define AT86RF215_TX_MAX_RETRIES        7
+#define AT86RF215_TX_ACK_WAIT_US        2500
+#define AT86RF215_TX_BACKOFF_US         1000
+#define AT86RF215_TX_MAX_BE             5
+/* Periodic frames, see debugfs "beacon": the default interval is the base
+ * superframe duration of the O-QPSK PHYs, the radio is taken lead_us ahead
+ * of each TX time */
+#define AT86RF215_BCN_INTERVAL_US       15360
+#define AT86RF215_BCN_LEAD_US           300
+/* Simulated devices and frames per device of debugfs "wq_bench" */
+#define AT86RF215_WQ_BENCH_DEVS         4
+#define AT86RF215_WQ_BENCH_FRAMES       20000
+/* Highest channel of the sub-GHz (RF09) transceiver */
+#define AT86RF215_RF09_MAX_CHANNEL      10
+/* Default energy detection duration of a scan, per channel */
+#define AT86RF215_ED_SCAN_DWELL_US      128
+/* IRQ status reads in flight; the IRQ line is masked until the read is done,
+ * the second slot only covers the window before enable_irq() */
+#define AT86RF215_IRQ_SLOTS             2
+/* BBC0 IRQs routed to the pin. RXAM is added while the frame pending table
+ * has entries. Under RX load the frame start is not signalled, the poll loop
+ * finds it in BBC0_IRQS (IRQMM is set). */
+#define AT86RF215_BBC0_IRQM             (IRQS_0_RXFS | IRQS_1_RXFE | IRQS_4_TXFE)
+/* Received frames per second above which IRQs are moderated, see
+ * debugfs "rx_batch_fps"; we go back below half of it */
+#define AT86RF215_RX_BATCH_FPS          200
+/* Period of the poll loop, and polls per run of the poll work */
+#define AT86RF215_RX_POLL_US            500
+#define AT86RF215_RX_BUDGET             16
+/* Empty polls after which the poll loop waits for an IRQ again */
+#define AT86RF215_RX_IDLE_POLLS         4
+/* Configuration registers staged between two safe points. A register takes
+ * one slot however often it is staged, this covers every register staged:
+ * MACSHA0F0/1, MACPID0F0/1, MACEA0-7, AFC0, AMCS, CNL, CNM, PAC, AMEDT,
+ * IRQM and AMAACKPD */
+#define AT86RF215_CFG_REGS              20
+/* How long at86rf215_cfg_wait() waits for the staged writes to land */
+#define AT86RF215_CFG_TIMEOUT           (HZ / 2)
+/* Frame pending table: destinations with queued frames */
+#define AT86RF215_PEND_BITS             8
+#define AT86RF215_PEND_SLOTS            (1 << AT86RF215_PEND_BITS)
+/* Longest MHR up to the source address: FC, seq, 2 PAN IDs, 2 ext. addrs */
+#define AT86RF215_PEND_MHR              23
+/* Short addresses are keyed as PAN ID and address under this prefix */
+#define AT86RF215_PEND_SHORT            0xfffe000000000000ULL
+/* Highest SPI clock of the transceiver; the device tree rate is the floor */
+#define AT86RF215_SPI_MAX_HZ            25000000
+/* Write/read pattern rounds a rate must pass to be used */
+#define AT86RF215_SPI_VERIFY_ROUNDS     16
+/* Transactions issued per variant by the "spi_bench" debugfs file */
+#define AT86RF215_SPI_BENCH_COUNT       1000
+/* Sniffer ring geometry */
+#define AT86RF215_SNIFF_SLOTS           256
+#define AT86RF215_SNIFF_SLOT_SIZE \
+	ALIGN(sizeof(struct at86rf215_sniff_frame), 64)
+/* How long closing the sniffer waits for the frame being read out */
+#define AT86RF215_SNIFF_STOP_TIMEOUT    (HZ / 10)
 
 struct at86rf215_state_change {
 	struct at86rf215_local *lp;
 	int			irq;
 
 	struct hrtimer		timer;
+	/* Both messages are built once by at86rf215_setup_spi_messages():
+	 * msg reads the status register of the context (RF09_STATE, or
+	 * BBC0_IRQS for the IRQ contexts) into buf, cmd_msg writes RF09_CMD. */
 	struct spi_message	msg;
 	struct spi_transfer	trx;
-	u8			buf[AT86RF215_MAX_BUF];
+	struct spi_message	cmd_msg;
+	struct spi_transfer	cmd_trx;
+	bool			optimized;
+	/* Own cache line: DMA safe, not shared with the timer or the messages */
+	u8			buf[AT86RF215_CMD_BUF] ____cacheline_aligned;
+	u8			hdr[3];
+	u8			cmd[3];
 
 	void			(*complete)(void *context);
 	u8			from_state;
 	u8			to_state;
 
-	bool			free;
+	/* Bit 0 set while an operation owns the context */
+	unsigned long		owned;
+};
+
+/* Driver counters, exported through debugfs ("stats"). */
+struct at86rf215_stats {
+	u32	cal_count;      /* Recalibrations done */
+	u32	cal_forced;     /* Recalibrations forced between two frames */
+	u32	cal_deferred;   /* Deadlines missed because the radio was busy */
+	u64	cal_last_ns;    /* Duration of the last recalibration */
+	u64	cal_max_ns;
+	u64	cal_total_ns;
+	u32	pm_sleeps;
+	u32	pm_wakes;
+	u64	pm_asleep_ns;   /* Time spent in SLEEP/DEEP_SLEEP */
+	u64	pm_wake_last_ns;/* Wake request to TX start */
+	u64	pm_wake_max_ns;
+	u64	pm_wake_total_ns;
+	u32	pm_wake_tx;     /* Wakes which started a frame */
+	u64	rng_bytes;
+	u64	rng_ns;         /* Time spent reading RNDV */
+	u32	rng_busy;       /* Requests refused, radio not in RX */
+	u32	rx_frames;
+	u32	rx_drops;
+	u32	irq_ctx_busy;   /* IRQs dropped, no free status context */
+	u32	pend_lookups;   /* RXAM served */
+	u32	pend_hits;      /* ... for a source with frames pending */
+	u32	pend_late;      /* RXAM seen with RXFE, the ACK was gone */
+	u32	pend_full;      /* No free slot for a destination */
+	u64	pend_max_ns;    /* IRQS read to AMAACKPD written */
+	u32	cfg_staged;     /* Control plane register updates requested */
+	u32	cfg_applies;    /* Batches written to the chip */
+	u32	cfg_regs;       /* Registers in these batches */
+	u32	tx_cfg_deferred; /* Frames held back by a configuration write */
+	u32	irqs;
+	u64	irq_cpu_ns;     /* Time in the ISR, the status read completion
+				 * and the poll loop */
+	u32	rx_batch_enter;
+	u32	rx_batch_polls;
+	u32	spi_errors;     /* Invalid readbacks seen on the link */
+	u32	spi_fallbacks;  /* SPI clock steps down */
+	u64	spi_bench_prebuilt_ns;  /* Per transaction, see "spi_bench" */
+	u64	spi_bench_rebuilt_ns;
+	u32	tx_rx_deferred; /* Frames held back by a reception */
+	u32	tx_preloads;    /* Frames uploaded while the radio listened */
+	u32	tx_preload_late;/* ... still uploading once in TXPREP */
+	u32	tx_streamed;    /* Frames started before the upload was done */
+	u32	tx_underruns;   /* ... caught up by the modulator (TXUR) */
+	u32	tx_stream_head; /* Octets written before TX, last frame */
+	u32	tx_acked;       /* Frames with AR answered by their ACK */
+	u32	tx_no_ack;      /* ... given up after the last retry */
+	u32	tx_retries;     /* Frames sent again from the frame buffer */
+	u32	tx_retry_hist[AT86RF215_TX_MAX_RETRIES + 1]; /* Acked after n */
+	u32	ed_scans;
+	u64	ed_scan_last_ns;
+};
+
+/* Frame upload: TXFLL/TXFLH, then the frame buffer from skb->data. The
+ * 11 bits PSDU length is programmed for every frame. */
+struct at86rf215_tx_frame {
+	struct spi_message	msg;
+	struct spi_transfer	trx[3];
+	u8			len_buf[4] ____cacheline_aligned;
+	u8			cmd[2];
+	/* Preload: the upload and the change to TXPREP still to finish */
+	atomic_t		pending;
+	int			status;
+
+	/* Streaming: CMD=TX once the head is written, then the tail from
+	 * FBTXS + head, then on TXFE a PS read for TXUR */
+	struct spi_message	cmd_msg;
+	struct spi_transfer	cmd_trx;
+	struct spi_message	tail_msg;
+	struct spi_transfer	tail_trx[2];
+	struct spi_message	ps_msg;
+	struct spi_transfer	ps_trx;
+	u8			tx_cmd[3];
+	u8			tail_cmd[2];
+	u8			ps_cmd[3];
+	u8			ps_buf[3];
+	int			tail_status;
+	ktime_t			tail_ts;
+};
+
+/* Frame download on RXFE: RXFLL/RXFLH, then the frame buffer into an skb */
+struct at86rf215_rx_frame {
+	struct spi_message	len_msg;
+	struct spi_transfer	len_trx;
+	u8			len_buf[4] ____cacheline_aligned;
+	u8			len_hdr[4];
+	struct spi_message	msg;
+	struct spi_transfer	trx[2];
+	u8			cmd[2];
+	struct sk_buff *	skb;
+	unsigned long		busy;
+};
+
+enum {
+	AT86RF215_SNIFF_OPEN,
+	AT86RF215_SNIFF_BUSY,   /* A frame is being read out */
+};
+
+/* Sniffer mode: every frame is read straight into a slot of a ring which
+ * userspace maps, so no per-frame allocation nor syscall is needed. */
+struct at86rf215_sniffer {
+	struct miscdevice		misc;
+	char				name[32];
+	struct at86rf215_sniff_ring *	ring;
+	wait_queue_head_t		wait;
+	unsigned long			flags;
+	bool				keep_bad_fcs;
+	/* Restored when the sniffer is closed */
+	unsigned int			amcs;
+	unsigned int			afc0;
+	unsigned int			pc;
+	unsigned int			cntc;
+	unsigned int			edc;
+
+	/* On RXFE: PC..RXFLH, CNT0..CNT3 and EDV in one message */
+	struct spi_message		info_msg;
+	struct spi_transfer		info_trx[3];
+	u8				info_cmd[3][7];
+	u8				info_buf[3][7];
+	/* Then the frame buffer, read into the slot */
+	struct spi_message		frame_msg;
+	struct spi_transfer		frame_trx[2];
+	u8				frame_cmd[2];
+	u32				frame_len;
+};
+
+/* Traffic generator: sends count frames of len octets (FCS included) at the
+ * given MR-OFDM MCS, gap_us apart, without the netdev stack. The first frame
+ * is uploaded, the following ones only rewrite their sequence number in the
+ * TX frame buffer. TX2RX is off meanwhile so TXFE leaves the radio in
+ * TXPREP, ready for the next frame. */
+struct at86rf215_txgen {
+	u32			count;
+	u32			len;
+	u32			gap_us;
+	u32			mcs;
+
+	bool			running;
+	bool			uploaded;
+	u32			sent;
+	struct sk_buff *	skb;
+	ktime_t			start;
+	ktime_t			end;
+	ktime_t			spi_ts;
+	ktime_t			tx_ts;
+	u64			spi_ns;
+	u64			air_ns;
+	struct hrtimer		gap_timer;
+	struct work_struct	finish_work;
+	struct completion	done;
+
+	/* Sequence number rewrite, FBTXS + 2 */
+	struct spi_message	seq_msg;
+	struct spi_transfer	seq_trx;
+	u8			seq_buf[3] ____cacheline_aligned;
+};
+
+/* Periodic frames (beacons), sent every interval_us without the netdev
+ * stack. The frame stays in the TX frame buffer: lead_us ahead of each TX
+ * time the radio is taken (is_bcn) and put in TXPREP, and only the octets
+ * changed by the update hook are written; CMD=TX is then written from an
+ * hrtimer at the TX time. The counter, captured at each TX start, gives the
+ * periods on the chip clock: their deviation from interval_us is reported
+ * as the jitter and the host schedule is pulled towards it (adj_ns). A TX
+ * time the radio is busy for is skipped (missed). */
+struct at86rf215_bcn {
+	/* Serializes at86rf215_bcn_start() and at86rf215_bcn_stop() */
+	struct mutex		lock;
+	u32			interval_us;
+	u32			lead_us;
+	/* Called before each frame, from an SPI completion: returns the
+	 * offset in skb->data of the octets it changed and their count in
+	 * *len, or a negative value if none changed */
+	int			(*update)(struct sk_buff *skb, void *priv,
+					  unsigned int *len);
+	void *			priv;
+	struct sk_buff *	skb;
+
+	bool			running;
+	u32			period_us;      /* interval_us at start */
+	/* TXFL and the whole frame are in the TX frame buffer */
+	bool			in_fb;
+	/* The writes and the TX time still to come before CMD=TX */
+	atomic_t		pending;
+	int			status;
+	ktime_t			t0;
+	ktime_t			next;
+	s64			adj_ns;
+	u32			n;
+	struct hrtimer		timer;
+	struct hrtimer		tx_timer;
+	struct completion	done;
+
+	/* Counter at the TX start of the last frame, and of the first one
+	 * sent on time, the reference of the schedule */
+	bool			cnt_valid;
+	bool			ref_valid;
+	bool			tx_late;
+	u32			cnt_last;
+	u32			n_last;
+	u32			cnt0;
+	u32			n0;
+
+	u32			sent;
+	u32			missed;
+	u32			late;           /* CMD=TX after the TX time */
+	u32			update_len;     /* Octets written, last frame */
+	u32			jitter_count;
+	u32			jitter_max_us;
+	u64			jitter_sum_us;
+	u64			lat_max_ns;     /* TX time to CMD=TX issued */
+	u64			lat_sum_ns;
+
+	/* Upload (TXFLL/TXFLH, FBTXS), update (FBTXS + offset), CMD=TX and
+	 * the counter read after TXFE */
+	struct spi_message	up_msg;
+	struct spi_transfer	up_trx[3];
+	struct spi_message	upd_msg;
+	struct spi_transfer	upd_trx[2];
+	struct spi_message	tx_msg;
+	struct spi_transfer	tx_trx;
+	struct spi_message	cnt_msg;
+	struct spi_transfer	cnt_trx;
+	struct spi_message *	wr_msg;
+	u8			len_buf[4] ____cacheline_aligned;
+	u8			up_cmd[2];
+	u8			upd_cmd[2];
+	u8			tx_cmd[3];
+	u8			cnt_cmd[6];
+	u8			cnt_buf[6];
+};
+
+/* Control plane writes (TX power, CCA threshold, promiscuous mode, channel)
+ * are staged here and merged per register. They are written as one batch
+ * once the radio is not transmitting, receiving a frame, calibrating or
+ * scanning, contiguous registers in one burst. gen counts the staged
+ * updates, applied the ones done with, err is the result of the last
+ * batch. */
+struct at86rf215_cfg {
+	u16			reg[AT86RF215_CFG_REGS];
+	u8			mask[AT86RF215_CFG_REGS];
+	u8			val[AT86RF215_CFG_REGS];
+	unsigned int		count;
+	u32			gen;
+	u32			applied;
+	int			err;
+	wait_queue_head_t	wait;
+	struct work_struct	work;
+};
+
+/* Frame pending table. The ACK of a frame matching our address carries the
+ * pending bit of AMAACKPD, which the transceiver reads when it builds the ACK.
+ * On RXAM (addresses received, the frame is not over) the MHR is read from
+ * the RX frame buffer, the source is looked up and AMAACKPD is updated, well
+ * ahead of the end of frame plus the ACK turnaround.
+ *
+ * Slots are claimed with cmpxchg on their key and never released, count
+ * tracks the frames queued for the key: the TX path updates it without any
+ * lock. active counts the keys with frames, RXAM is only unmasked while it
+ * is not zero. */
+struct at86rf215_pend_slot {
+	atomic64_t		key;
+	atomic_t		count;
+};
+
+struct at86rf215_pend {
+	struct at86rf215_pend_slot	slot[AT86RF215_PEND_SLOTS];
+	atomic_t			active;
+	bool				rxam_on;
+	struct work_struct		work;
+
+	struct spi_message		msg;
+	struct spi_transfer		trx[2];
+	struct spi_message		pd_msg;
+	struct spi_transfer		pd_trx;
+	u8				mhr[AT86RF215_PEND_MHR]
+					____cacheline_aligned;
+	u8				hdr[2];
+	u8				pd[3];
+	u8				pd_cur;
+	ktime_t				irq_ts;
+	unsigned long			busy;
+};
+
+/* hwrng backed by RG_RF09_RNDV. The value is only random while the radio is
+ * in RX, so the batch is framed by two STATE reads in the same message. */
+struct at86rf215_rng {
+	struct hwrng		hwrng;
+	struct spi_message	msg;
+	struct spi_transfer	trx[AT86RF215_RNG_BATCH + 2];
+	u8			cmd_state[3];
+	u8			cmd_rndv[3];
+	u8			buf[AT86RF215_RNG_BATCH + 2][3];
+	bool			registered;
 };
 
 struct at86rf215_local {
@@ -80,14 +492,123 @@ struct at86rf215_local {
 	struct regmap *			regmap;
 
 	struct completion		state_complete;
-	struct at86rf215_state_change	state;
+	struct at86rf215_state_change *	state;
+
+	/* Protects is_tx, is_rx, is_cal, is_sleep, is_scan, is_sniff, is_cfg,
+	 * is_gen, is_ack, is_bcn, cal_pending, tx_deferred and the cfg staging
+	 * area. */
+	spinlock_t			lock;
 
 	unsigned long			cal_timeout;
+	struct delayed_work		cal_work;
+	ktime_t				cal_start;
+	u8				cal_restore;
+	bool				is_cal;
+	bool				cal_pending;
+	bool				is_rx;
+	bool				is_cfg;
+	struct at86rf215_cfg		cfg;
+	struct at86rf215_pend		pend;
+	u64				tx_pend_key;
+
+	/* IRQ moderation: in batch mode the ISR only schedules rx_poll_work,
+	 * which drains BBC0_IRQS for several frames before sleeping again */
+	bool				rx_batch;
+	u32				rx_batch_fps;
+	u32				rx_poll_us;
+	unsigned long			rx_win_start;
+	u32				rx_win_frames;
+	struct work_struct		rx_poll_work;
+	/* The IRQ line is disabled on behalf of rx_poll_work */
+	bool				rx_poll_irq_off;
 	bool				is_tx;
 	bool				is_tx_from_off;
+	bool				tx_deferred;
+	/* The frame is uploaded at xmit while the radio listens, see
+	 * at86rf215_tx_preload() */
+	bool				tx_preload;
+	bool				tx_preloaded;
+	/* TX is issued before the end of the upload of long frames, see
+	 * at86rf215_tx_stream_head(). tx_spi_ns is the upload time per octet
+	 * measured on the tails, 0 before the first one. */
+	bool				tx_stream;
+	bool				tx_streaming;
+	bool				tx_stream_retry;
+	u32				tx_stream_min;
+	/* MCS programmed in OFDMPHRTX, the rate the modulator takes octets */
+	u8				tx_mcs;
+	u32				tx_spi_ns;
+	/* A frame with AR waits for its ACK (is_ack) in RX, then for its
+	 * backoff, and is sent again from the frame buffer (tx_in_fb), see
+	 * at86rf215_tx_sent(). tx_retry counts the retries of the frame. */
+	bool				is_ack;
+	bool				tx_in_fb;
+	bool				tx_no_ack;
+	s8				tx_max_retries;
 	u8				tx_retry;
+	u8				tx_seq;
+	u32				tx_ack_wait_us;
+	u32				tx_backoff_us;
+	struct hrtimer			tx_ack_timer;
+	struct work_struct		tx_ack_work;
+	struct hrtimer			tx_backoff_timer;
+
+	/* Runtime PM: serializes entering and leaving SLEEP/DEEP_SLEEP */
+	struct mutex			pm_lock;
+	struct delayed_work		pm_work;
+	struct delayed_work		pm_rx_work;
+	struct work_struct		pm_wake_work;
+	ktime_t				pm_epoch;
+	ktime_t				pm_sleep_start;
+	ktime_t				pm_wake_req;
+	u32				pm_idle_ms;
+	u32				pm_rx_period_ms;
+	u32				pm_rx_window_ms;
+	bool				pm_deep_sleep;
+	bool				is_sleep;
+
+	struct at86rf215_rng		rng;
+
+	bool				is_scan;
+	u32				ed_scan_dwell_us;
+	u32				spi_bench_count;
+
+	/* Execution context of the device: every work item runs on wq, bound
+	 * to cpu, which is also where the IRQ is steered. Several radios are
+	 * spread over the CPUs instead of sharing system_wq. */
+	struct workqueue_struct *	wq;
+	u32				cpu;
+	/* On at86rf215_devs; irq_hint once the affinity of the IRQ is ours */
+	struct list_head		node;
+	bool				irq_hint;
+	u32				wq_bench_devs;
+	u32				wq_bench_frames;
+
+	/* SPI link: clock in use and device tree clock, the floor we fall
+	 * back to. spi_id holds PN and VN as read at the floor. */
+	u32				spi_hz;
+	u32				spi_dt_hz;
+	u8				spi_id[2];
+	struct work_struct		spi_work;
+	s8				ed_scan[AT86RF215_RF09_MAX_CHANNEL + 1];
+
+	bool				is_sniff;
+	bool				is_gen;
+	bool				is_bcn;
+	bool				started;
+	struct at86rf215_txgen		txgen;
+	struct at86rf215_bcn		bcn;
+	struct at86rf215_sniffer	sniff;
 	struct sk_buff *		tx_skb;
-	struct at86rf215_state_change	tx;
+	struct at86rf215_state_change *	tx;
+	struct at86rf215_state_change *	irq_ctx[AT86RF215_IRQ_SLOTS];
+	struct at86rf215_tx_frame	tx_frame;
+	struct at86rf215_rx_frame	rx_frame;
+	/* FCS length (2 or 4) selected by BBC0_PC.FCST */
+	u8				fcs_len;
+
+	struct at86rf215_stats		stats;
+	struct dentry *			debugfs_root;
 };
 
 static void
@@ -96,6 +617,94 @@ at86rf215_async_state_change(struct at86rf215_local *lp, struct
                              void (*complete)(void *context));
 static void at86rf215_async_state_change_start(void *context);
 static void at86rf215_write(void *context);
+static void at86rf215_tx_done(struct at86rf215_local *lp);
+static bool at86rf215_cal_between_frames(struct at86rf215_local *lp);
+static void at86rf215_pm_idle(struct at86rf215_local *lp);
+static void at86rf215_sniff_rx(struct at86rf215_local *lp);
+static void at86rf215_rx(struct at86rf215_local *lp);
+static bool at86rf215_tx_resume(struct at86rf215_local *lp);
+static void at86rf215_txgen_done(struct at86rf215_local *lp);
+static void at86rf215_txgen_uploaded(struct at86rf215_local *lp);
+static void at86rf215_txgen_stop(struct at86rf215_local *lp);
+static void at86rf215_bcn_done(struct at86rf215_local *lp);
+static void at86rf215_spi_error(struct at86rf215_local *lp);
+static void at86rf215_cfg_kick(struct at86rf215_local *lp);
+static int at86rf215_cfg_stage(struct at86rf215_local *lp, unsigned int addr,
+			       unsigned int mask, unsigned int shift,
+			       unsigned int val);
+
+/* Concurrency model
+ *
+ * Every SPI chain runs on a context it owns: lp->tx for the TX path, lp->state
+ * for the recalibration, one of lp->irq_ctx[] for each IRQ status read, and
+ * the dedicated frame/rng/sniffer messages. A context is claimed with
+ * at86rf215_ctx_claim() before its first spi_async() and handed back by the
+ * last completion of the chain, so two operations never share a buffer or a
+ * spi_message. The SPI core keeps each message atomic on the bus, which
+ * orders the synchronous regmap accesses of the control plane against them.
+ *
+ * Who may drive RF09_CMD is decided under lp->lock by the is_* flags. A
+ * reception (RXFS seen, RXFE not yet) has precedence over TX: a frame handed
+ * over meanwhile is deferred and started once the frame has been read out,
+ * as for a recalibration, a scan, the sniffer or a sleeping radio. The frame
+ * read itself uses lp->rx_frame, so it can overlap a TX preparation.
+ */
+
+/* Command contexts come from their own cache, the frame payloads never go
+ * through them (see at86rf215_tx_frame and at86rf215_rx_frame). */
+static struct kmem_cache *at86rf215_ctx_cache;
+/* Devices probed so far, spreads them over the CPUs */
+static atomic_t at86rf215_devices = ATOMIC_INIT(0);
+/* Devices bound, to find the radios sharing an IRQ line */
+static LIST_HEAD(at86rf215_devs);
+static DEFINE_MUTEX(at86rf215_devs_lock);
+
+/* CPU the work of lp is queued on, any if it went offline */
+static int at86rf215_cpu(struct at86rf215_local *lp)
+{
+	int cpu = READ_ONCE(lp->cpu);
+
+	return cpu_online(cpu) ? cpu : WORK_CPU_UNBOUND;
+}
+
+static bool at86rf215_queue_work(struct at86rf215_local *lp,
+				 struct work_struct *work)
+{
+	return queue_work_on(at86rf215_cpu(lp), lp->wq, work);
+}
+
+static bool at86rf215_queue_delayed(struct at86rf215_local *lp,
+				    struct delayed_work *dwork,
+				    unsigned long delay)
+{
+	return mod_delayed_work_on(at86rf215_cpu(lp), lp->wq, dwork, delay);
+}
+
+static inline bool at86rf215_ctx_claim(struct at86rf215_state_change *ctx)
+{
+	return !test_and_set_bit_lock(0, &ctx->owned);
+}
+
+static inline void at86rf215_ctx_release(struct at86rf215_state_change *ctx)
+{
+	clear_bit_unlock(0, &ctx->owned);
+}
+
+/* Nothing owns the radio. Must be called with lp->lock held. */
+static inline bool at86rf215_is_idle(struct at86rf215_local *lp)
+{
+	return !lp->is_tx && !lp->is_rx && !lp->is_cal && !lp->is_sleep &&
+	       !lp->is_scan && !lp->is_sniff && !lp->is_cfg && !lp->is_gen &&
+	       !lp->is_bcn;
+}
+
+/* Something else owns the radio, a frame has to wait. Must be called with
+ * lp->lock held. */
+static inline bool at86rf215_tx_blocked(struct at86rf215_local *lp)
+{
+	return lp->is_cal || lp->is_sleep || lp->is_scan || lp->is_sniff ||
+	       lp->is_rx || lp->is_cfg || lp->is_gen || lp->is_bcn;
+}
 
 static inline int at86rf215_read_subreg(struct at86rf215_local *lp,
 					unsigned int addr, unsigned int mask,
@@ -130,6 +739,7 @@ static bool at86rf215_reg_writeable(struct device *dev, unsigned int reg)
 	case RG_BBC0_FBTXS:
 	case RG_BBC0_OFDMPHRTX:
 	case RG_RF09_CMD:
+	case RG_RF24_CMD:
 	case RG_RF09_STATE:
 	case RG_BBC0_AMEDT:
 	case RG_BBC0_AMCS:
@@ -155,6 +765,7 @@ static bool at86rf215_reg_writeable(struct device *dev, unsigned int reg)
 	case RG_RF09_EDC:
 	case RG_BBC0_AFFTM:
 	case RG_BBC0_PS:
+	case RG_BBC0_CNTC:
 	case RG_RF09_RSSI:
 	case RG_RF09_RNDV:
 		return true;
@@ -178,6 +789,7 @@ static bool at86rf215_reg_readable(struct device *dev, unsigned int reg)
 	case RG_RF_VN:
 	case RG_RF09_CMD:
 	case RG_RF09_IRQS:
+	case RG_BBC0_IRQS:      /* Polled by the RX batch loop */
 		return true;
 	default:
 		return false;
@@ -190,9 +802,12 @@ static bool at86rf215_reg_volatile(struct device *dev, unsigned int reg)
 	/* Can be changed during runtime */
 	switch (reg) {
 	case RG_RF09_CMD:
+	case RG_RF24_CMD:
 	case RG_RF09_STATE:
 	case RG_RF09_IRQS:
 	case RG_BBC0_IRQS:
+	case RG_RF09_EDV:
+	case RG_BBC0_AMAACKPD:  /* Written by the RXAM path behind regmap */
 		return true;
 	default:
 		return false;
@@ -232,8 +847,7 @@ static void at86rf215_async_error_recover_complete(void *context)
 	struct at86rf215_state_change *ctx = context;
 	struct at86rf215_local *lp = ctx->lp;
 
-	if (ctx->free)
-		kfree(ctx);
+	at86rf215_ctx_release(ctx);
 
 	ieee802154_wake_queue(lp->hw);
 }
@@ -246,39 +860,35 @@ at86rf215_async_error(struct at86rf215_local *lp, struct
 	at86rf215_async_error_recover_complete(ctx);
 }
 
+/* Write RF09_CMD with the prebuilt cmd_msg: only the value byte changes */
 static void
-at86rf215_async_write_reg(struct at86rf215_local *lp, u16 reg, u8 val, struct
+at86rf215_async_write_cmd(struct at86rf215_local *lp, u8 val, struct
 			  at86rf215_state_change *ctx, void (*complete)(
 				  void *context))
 {
 	int rc;
 
-	ctx->buf[0] = ((reg & CMD_REG_MSB) >> 8) | CMD_WRITE;
-	ctx->buf[1] = reg & CMD_REG_LSB;
-	ctx->buf[2] = val;
-
-	ctx->msg.complete = complete;
-	rc = spi_async(lp->spi, &ctx->msg);
+	ctx->cmd[2] = val;
+	ctx->cmd_msg.complete = complete;
+	rc = spi_async(lp->spi, &ctx->cmd_msg);
 	if (rc) {
-		printk(KERN_DEBUG "spi_async failed in write_reg.");
+		printk(KERN_DEBUG "spi_async failed in write_cmd.");
 		at86rf215_async_error(lp, ctx, rc);
 	}
 }
 
+/* Read the status register of the context into ctx->buf[2] */
 static void
-at86rf215_async_read_reg(struct at86rf215_local *lp, u16 reg, struct
-			 at86rf215_state_change *ctx, void (*complete)(
-				 void *context))
+at86rf215_async_read_status(struct at86rf215_local *lp, struct
+			    at86rf215_state_change *ctx, void (*complete)(
+				    void *context))
 {
 	int rc;
-	u8 *tx_buf = ctx->buf;
 
-	tx_buf[0] = ((reg & CMD_REG_MSB) >> 8);
-	tx_buf[1] = reg & CMD_REG_LSB;
 	ctx->msg.complete = complete;
 	rc = spi_async(lp->spi, &ctx->msg);
 	if (rc) {
-		printk(KERN_DEBUG "spi_async failed in read_reg.");
+		printk(KERN_DEBUG "spi_async failed in read_status.");
 		at86rf215_async_error(lp, ctx, rc);
 	}
 }
@@ -308,87 +918,521 @@ static enum hrtimer_restart at86rf215_async_state_timer(struct hrtimer *timer)
 		container_of(timer, struct at86rf215_state_change, timer);
 	struct at86rf215_local *lp = ctx->lp;
 
-	at86rf215_async_read_reg(lp, RG_RF09_STATE, ctx,
-				 at86rf215_async_state_assert);
+	at86rf215_async_read_status(lp, ctx,
+				    at86rf215_async_state_assert);
 
 	return HRTIMER_NORESTART;
 }
 
-static void at86rf215_irq_status(void *context)
+/*************************** Frame pending table ****************************/
+
+static u64 at86rf215_pend_addr(unsigned int mode, u16 pan, const u8 *p,
+			       unsigned int len)
 {
-	struct at86rf215_state_change *ctx = context;
-	struct at86rf215_local *lp = ctx->lp;
-	const u8 *buf = ctx->buf;
-	u8 val = buf[2];
+	u16 addr;
+
+	if (mode == IEEE802154_ADDR_SHORT && len >= 2) {
+		addr = get_unaligned_le16(p);
+		if (addr == IEEE802154_ADDR_SHORT_BROADCAST)
+			return 0;
+		return AT86RF215_PEND_SHORT | (u64)pan << 16 | addr;
+	}
+	if (mode == IEEE802154_ADDR_LONG && len >= 8)
+		return get_unaligned_le64(p);
+
+	return 0;
+}
+
+/* Key of the source (src) or destination address of an MHR, 0 if there is
+ * none. PAN ID compression follows the 2003/2006 rules. */
+static u64 at86rf215_pend_key(const u8 *mhr, unsigned int len, bool src)
+{
+	unsigned int off = 3, dmode, smode;
+	u16 fc, dpan = 0, span;
+
+	if (len < 3)
+		return 0;
+
+	fc = get_unaligned_le16(mhr);
+	dmode = (fc >> 10) & 0x3;
+	smode = (fc >> 14) & 0x3;
+	/* 2015 frames may suppress the sequence number */
+	if (((fc >> 12) & 0x3) == 2 && (fc & BIT(8)))
+		off = 2;
+
+	if (dmode) {
+		if (len < off + 2)
+			return 0;
+		dpan = get_unaligned_le16(mhr + off);
+		off += 2;
+		if (!src)
+			return at86rf215_pend_addr(dmode, dpan, mhr + off,
+						   len - off);
+		off += dmode == IEEE802154_ADDR_LONG ? 8 : 2;
+	} else if (!src) {
+		return 0;
+	}
+
+	span = dpan;
+	if (!(fc & BIT(6))) {
+		if (len < off + 2)
+			return 0;
+		span = get_unaligned_le16(mhr + off);
+		off += 2;
+	}
+
+	return off < len ? at86rf215_pend_addr(smode, span, mhr + off,
+					       len - off) : 0;
+}
+
+static struct at86rf215_pend_slot *
+at86rf215_pend_find(struct at86rf215_pend *pd, u64 key, bool claim)
+{
+	struct at86rf215_pend_slot *slot;
+	u32 i, h = hash_64(key, AT86RF215_PEND_BITS);
+	u64 cur;
+
+	for (i = 0; i < AT86RF215_PEND_SLOTS; i++) {
+		slot = &pd->slot[(h + i) & (AT86RF215_PEND_SLOTS - 1)];
+		cur = atomic64_read(&slot->key);
+		if (cur == key)
+			return slot;
+		if (cur)
+			continue;
+		if (!claim)
+			return NULL;
+		cur = atomic64_cmpxchg(&slot->key, 0, key);
+		if (!cur || cur == key)
+			return slot;
+	}
+
+	return NULL;
+}
+
+/* One more (up) or one less frame queued for key. Lock free, any context. */
+static void at86rf215_pend_update(struct at86rf215_local *lp, u64 key, bool up)
+{
+	struct at86rf215_pend *pd = &lp->pend;
+	struct at86rf215_pend_slot *slot;
+
+	if (!key)
+		return;
+
+	slot = at86rf215_pend_find(pd, key, up);
+	if (!slot) {
+		if (up)
+			lp->stats.pend_full++;
+		return;
+	}
+
+	if (up) {
+		if (atomic_inc_return(&slot->count) == 1 &&
+		    atomic_inc_return(&pd->active) == 1)
+			at86rf215_queue_work(lp, &pd->work);
+	} else if (atomic_dec_if_positive(&slot->count) == 0 &&
+		   atomic_dec_and_test(&pd->active)) {
+		at86rf215_queue_work(lp, &pd->work);
+	}
+}
+
+static bool at86rf215_pend_lookup(struct at86rf215_local *lp, u64 key)
+{
+	struct at86rf215_pend_slot *slot;
+
+	slot = key ? at86rf215_pend_find(&lp->pend, key, false) : NULL;
+
+	return slot && atomic_read(&slot->count) > 0;
+}
+
+/* RXAM is only worth an IRQ while some destination has frames */
+static void at86rf215_pend_work(struct work_struct *work)
+{
+	struct at86rf215_pend *pd = container_of(work, struct at86rf215_pend,
+						 work);
+	struct at86rf215_local *lp = container_of(pd, struct at86rf215_local,
+						  pend);
+	bool on = atomic_read(&pd->active) > 0;
+
+	if (on == pd->rxam_on)
+		return;
+
+	if (at86rf215_cfg_stage(lp, RG_BBC0_IRQM, IRQS_2_RXAM, 2, on) ||
+	    (!on && at86rf215_cfg_stage(lp, RG_BBC0_AMAACKPD, 0xff, 0, 0)))
+		return;
+	if (!on)
+		pd->pd_cur = 0;
+	pd->rxam_on = on;
+	at86rf215_cfg_kick(lp);
+}
+
+static void at86rf215_pend_done(struct at86rf215_local *lp)
+{
+	struct at86rf215_pend *pd = &lp->pend;
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), pd->irq_ts));
+
+	if (ns > lp->stats.pend_max_ns)
+		lp->stats.pend_max_ns = ns;
+	clear_bit_unlock(0, &pd->busy);
+}
+
+static void at86rf215_pend_pd_complete(void *context)
+{
+	at86rf215_pend_done(context);
+}
+
+static void at86rf215_pend_mhr_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_pend *pd = &lp->pend;
+	bool pending;
+	u8 want;
+
+	if (pd->msg.status) {
+		at86rf215_pend_done(lp);
+		return;
+	}
+
+	pending = at86rf215_pend_lookup(lp, at86rf215_pend_key(pd->mhr,
+					sizeof(pd->mhr), true));
+	lp->stats.pend_lookups++;
+	if (pending)
+		lp->stats.pend_hits++;
+
+	want = pending ? AMAACKPD_PD0 : 0;
+	if (want == pd->pd_cur) {
+		at86rf215_pend_done(lp);
+		return;
+	}
+
+	pd->pd[2] = want;
+	pd->pd_cur = want;
+	if (spi_async(lp->spi, &pd->pd_msg))
+		at86rf215_pend_done(lp);
+}
+
+static void at86rf215_pend_rxam(struct at86rf215_local *lp, u8 val)
+{
+	struct at86rf215_pend *pd = &lp->pend;
+
+	/* Seen with RXFE: the frame is over, the ACK is on its way */
+	if (val & IRQS_1_RXFE) {
+		lp->stats.pend_late++;
+		return;
+	}
+
+	if (test_and_set_bit_lock(0, &pd->busy))
+		return;
+
+	pd->irq_ts = ktime_get();
+	if (spi_async(lp->spi, &pd->msg))
+		clear_bit_unlock(0, &pd->busy);
+}
+
+static void at86rf215_pend_setup(struct at86rf215_local *lp)
+{
+	struct at86rf215_pend *pd = &lp->pend;
+
+	INIT_WORK(&pd->work, at86rf215_pend_work);
+
+	/* MHR from the RX frame buffer */
+	pd->hdr[0] = (RG_BBC0_FBRXS & CMD_REG_MSB) >> 8;
+	pd->hdr[1] = RG_BBC0_FBRXS & CMD_REG_LSB;
+	pd->trx[0].tx_buf = pd->hdr;
+	pd->trx[0].len = 2;
+	pd->trx[1].rx_buf = pd->mhr;
+	pd->trx[1].len = sizeof(pd->mhr);
+	spi_message_init(&pd->msg);
+	pd->msg.complete = at86rf215_pend_mhr_complete;
+	pd->msg.context = lp;
+	spi_message_add_tail(&pd->trx[0], &pd->msg);
+	spi_message_add_tail(&pd->trx[1], &pd->msg);
+
+	/* AMAACKPD */
+	pd->pd[0] = ((RG_BBC0_AMAACKPD & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	pd->pd[1] = RG_BBC0_AMAACKPD & CMD_REG_LSB;
+	pd->pd_trx.tx_buf = pd->pd;
+	pd->pd_trx.len = 3;
+	spi_message_init(&pd->pd_msg);
+	pd->pd_msg.complete = at86rf215_pend_pd_complete;
+	pd->pd_msg.context = lp;
+	spi_message_add_tail(&pd->pd_trx, &pd->pd_msg);
+}
+
+/* Received frames per second, over 100 ms windows */
+static u32 at86rf215_rx_rate(struct at86rf215_local *lp, bool frame)
+{
+	if (time_after(jiffies, lp->rx_win_start + HZ / 10)) {
+		lp->rx_win_start = jiffies;
+		lp->rx_win_frames = 0;
+	}
+	if (frame)
+		lp->rx_win_frames++;
+
+	return lp->rx_win_frames * 10;
+}
+
+/* Handle one BBC0_IRQS value, read by the ISR path or by the poll loop */
+static void at86rf215_irq_dispatch(struct at86rf215_local *lp, u8 val)
+{
+	unsigned long flags;
 
-	enable_irq(lp->spi->irq);
 	if (val & IRQS_4_TXFE) {
 		printk(KERN_DEBUG "[INTERRUPTION]: Transmission complete!");
 		/*disable_irq(lp->spi->irq);*/
+		at86rf215_tx_done(lp);
+	}
+
+	if (val & IRQS_2_RXAM)
+		at86rf215_pend_rxam(lp, val);
+
+	if (val & IRQS_1_RXFE) {
+		/* Checked before RXFS: both are set for a short frame */
+		spin_lock_irqsave(&lp->lock, flags);
+		lp->is_rx = false;
+		spin_unlock_irqrestore(&lp->lock, flags);
+		if (lp->is_sniff)
+			at86rf215_sniff_rx(lp);
+		else
+			at86rf215_rx(lp);
+		if (!at86rf215_cal_between_frames(lp) &&
+		    !at86rf215_tx_resume(lp))
+			at86rf215_pm_idle(lp);
+
+		if (!lp->rx_batch && lp->rx_batch_fps &&
+		    at86rf215_rx_rate(lp, true) > lp->rx_batch_fps) {
+			lp->rx_batch = true;
+			lp->stats.rx_batch_enter++;
+		} else if (lp->rx_batch) {
+			at86rf215_rx_rate(lp, true);
+		}
 	} else if (val & IRQS_0_RXFS) {
 		printk(
 			KERN_DEBUG
 			"[INTERRUPTION]: A valid frame header is decoded.");
-		disable_irq(lp->spi->irq);
+		spin_lock_irqsave(&lp->lock, flags);
+		lp->is_rx = true;
+		spin_unlock_irqrestore(&lp->lock, flags);
 	} else if (val) {
 		printk(
 			KERN_DEBUG
 			"[INTERRUPTION]: Another interruption has occured.");
-	} else {
-		kfree(ctx);
 	}
 }
 
+static void at86rf215_irq_status(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	const u8 *buf = ctx->buf;
+	u8 val = buf[2];
+	ktime_t start = ktime_get();
+
+	at86rf215_ctx_release(ctx);
+	at86rf215_irq_dispatch(lp, val);
+
+	/* The poll loop takes over with the IRQ line still disabled */
+	if (lp->rx_batch) {
+		lp->rx_poll_irq_off = true;
+		at86rf215_queue_work(lp, &lp->rx_poll_work);
+	} else
+		enable_irq(lp->spi->irq);
+
+	lp->stats.irq_cpu_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/* NAPI-like RX: poll BBC0_IRQS every rx_poll_us for up to AT86RF215_RX_BUDGET
+ * polls, with the IRQ line disabled. After AT86RF215_RX_IDLE_POLLS empty polls
+ * the line is enabled again, with RXFS masked while the load stays high, or
+ * back to one IRQ per event when it dropped below half the threshold. */
+static void at86rf215_rx_poll_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(work, struct at86rf215_local, rx_poll_work);
+	unsigned int val;
+	int polls, idle = 0;
+	ktime_t start;
+
+	/* RXFS only: RXAM is owned by the frame pending table */
+	regmap_update_bits(lp->regmap, RG_BBC0_IRQM, IRQS_0_RXFS, 0);
+
+	for (polls = 0; polls < AT86RF215_RX_BUDGET; polls++) {
+		start = ktime_get();
+		if (regmap_read(lp->regmap, RG_BBC0_IRQS, &val))
+			break;
+		lp->stats.rx_batch_polls++;
+		if (val)
+			at86rf215_irq_dispatch(lp, val);
+		lp->stats.irq_cpu_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		idle = val ? 0 : idle + 1;
+		if (idle >= AT86RF215_RX_IDLE_POLLS)
+			break;
+		usleep_range(lp->rx_poll_us, lp->rx_poll_us + 100);
+	}
+
+	/* Budget spent on a busy channel: give the CPU back, keep polling */
+	if (polls == AT86RF215_RX_BUDGET) {
+		at86rf215_queue_work(lp, &lp->rx_poll_work);
+		return;
+	}
+
+	if (at86rf215_rx_rate(lp, false) < lp->rx_batch_fps / 2) {
+		lp->rx_batch = false;
+		regmap_update_bits(lp->regmap, RG_BBC0_IRQM, IRQS_0_RXFS,
+				   IRQS_0_RXFS);
+	}
+	lp->rx_poll_irq_off = false;
+	enable_irq(lp->spi->irq);
+}
+
 static void at86rf215_setup_spi_messages(struct at86rf215_local *	lp,
-					 struct at86rf215_state_change *state)
+					 struct at86rf215_state_change *state,
+					 u16				status_reg)
 {
 	state->lp = lp;
 	state->irq = lp->spi->irq;
+
+	/* Status read: fixed header, the value lands in buf[2] */
+	state->hdr[0] = (status_reg & CMD_REG_MSB) >> 8;
+	state->hdr[1] = status_reg & CMD_REG_LSB;
 	spi_message_init(&state->msg);  /* Initialize spi_message */
 	state->msg.context = state;
 	state->trx.len = 3;             /* 2 bytes(address) + 1 byte(value read/written) */
-	state->trx.tx_buf = state->buf;
+	state->trx.tx_buf = state->hdr;
 	state->trx.rx_buf = state->buf;
 	spi_message_add_tail(&state->trx, &state->msg); /* Add the message */
+
+	/* RF09_CMD write: the value byte is filled by each state change */
+	state->cmd[0] = ((RG_RF09_CMD & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	state->cmd[1] = RG_RF09_CMD & CMD_REG_LSB;
+	spi_message_init(&state->cmd_msg);
+	state->cmd_msg.context = state;
+	state->cmd_trx.len = 3;
+	state->cmd_trx.tx_buf = state->cmd;
+	spi_message_add_tail(&state->cmd_trx, &state->cmd_msg);
+
 	hrtimer_init(&state->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	state->timer.function = at86rf215_async_state_timer;
 }
 
+/* Since 6.9 a message can be validated (and prepared by the controller) once
+ * for all, spi_async() then skips the per-message checks. Older kernels do
+ * that work on every submission. */
+static void at86rf215_optimize_messages(struct at86rf215_local *	lp,
+					struct at86rf215_state_change * state)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	if (spi_optimize_message(lp->spi, &state->msg))
+		return;
+	if (spi_optimize_message(lp->spi, &state->cmd_msg)) {
+		spi_unoptimize_message(&state->msg);
+		return;
+	}
+	state->optimized = true;
+#endif
+}
+
+static void at86rf215_unoptimize_messages(struct at86rf215_state_change *state)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+	if (state->optimized) {
+		spi_unoptimize_message(&state->msg);
+		spi_unoptimize_message(&state->cmd_msg);
+	}
+#endif
+	state->optimized = false;
+}
+
+static void at86rf215_free_contexts(struct at86rf215_local *lp)
+{
+	int i;
+
+	/* kmem_cache_free() does not take NULL. The timers are set up with the
+	 * messages (ctx->lp set), not yet if the allocation failed halfway. */
+	if (lp->state) {
+		if (lp->state->lp)
+			hrtimer_cancel(&lp->state->timer);
+		at86rf215_unoptimize_messages(lp->state);
+		kmem_cache_free(at86rf215_ctx_cache, lp->state);
+	}
+	if (lp->tx) {
+		if (lp->tx->lp)
+			hrtimer_cancel(&lp->tx->timer);
+		at86rf215_unoptimize_messages(lp->tx);
+		kmem_cache_free(at86rf215_ctx_cache, lp->tx);
+	}
+	for (i = 0; i < AT86RF215_IRQ_SLOTS; i++) {
+		if (lp->irq_ctx[i]) {
+			at86rf215_unoptimize_messages(lp->irq_ctx[i]);
+			kmem_cache_free(at86rf215_ctx_cache, lp->irq_ctx[i]);
+		}
+	}
+}
+
+static int at86rf215_alloc_contexts(struct at86rf215_local *lp)
+{
+	int i;
+
+	lp->state = kmem_cache_zalloc(at86rf215_ctx_cache, GFP_KERNEL);
+	lp->tx = kmem_cache_zalloc(at86rf215_ctx_cache, GFP_KERNEL);
+	if (!lp->state || !lp->tx)
+		return -ENOMEM;
+
+	for (i = 0; i < AT86RF215_IRQ_SLOTS; i++) {
+		lp->irq_ctx[i] = kmem_cache_zalloc(at86rf215_ctx_cache,
+						   GFP_KERNEL);
+		if (!lp->irq_ctx[i])
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
 /* Request the IRQ and associate an interrupt handler with it */
 static irqreturn_t at86rf215_isr(int irq, void *data)
 {
 	struct at86rf215_local *lp = data;
-	struct at86rf215_state_change *ctx;
-	int rc;
+	struct at86rf215_state_change *ctx = NULL;
+	ktime_t start = ktime_get();
+	int rc, i;
 
 	/* Disables the interrupt associated with "irq" without waiting for any
 	 * currently executing instances of the interrupt handler to return*/
 	disable_irq_nosync(irq);
+	lp->stats.irqs++;
+
+	if (lp->rx_batch) {
+		lp->rx_poll_irq_off = true;
+		at86rf215_queue_work(lp, &lp->rx_poll_work);
+		lp->stats.irq_cpu_ns +=
+			ktime_to_ns(ktime_sub(ktime_get(), start));
+		return IRQ_HANDLED;
+	}
 
-	ctx = kzalloc(sizeof(*ctx), GFP_ATOMIC);
+	for (i = 0; i < AT86RF215_IRQ_SLOTS; i++) {
+		if (at86rf215_ctx_claim(lp->irq_ctx[i])) {
+			ctx = lp->irq_ctx[i];
+			break;
+		}
+	}
 	if (!ctx) {
+		lp->stats.irq_ctx_busy++;
 		enable_irq(irq);
 		return IRQ_NONE;
 	}
 
-	at86rf215_setup_spi_messages(lp, ctx);
-
-	/* Tell on error handling to free ctx*/
-	ctx->free = true;
-
-	/* Determine which IRQ has occurred : read the IRQ Status*/
-	ctx->buf[0] = (RG_BBC0_IRQS & CMD_REG_MSB) >> 8;
-	ctx->buf[1] = RG_BBC0_IRQS & CMD_REG_LSB;
-	ctx->msg.complete = at86rf215_irq_status;
-
+	/* Determine which IRQ has occurred : read the IRQ Status. The message
+	 * and its completion are set up at probe. */
 	rc = spi_async(lp->spi, &ctx->msg);
 	if (rc) {
 		printk(KERN_DEBUG "Failed to request IRQ.");
-		at86rf215_async_error(lp, ctx, rc);
+		at86rf215_ctx_release(ctx);
 		enable_irq(irq);
 		return IRQ_NONE;
 	}
 
+	lp->stats.irq_cpu_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
 	return IRQ_HANDLED;
 }
 
@@ -464,10 +1508,14 @@ static void at86rf215_async_state_change_start(void *context)
 
 	//printk(KERN_DEBUG "Actual state = %x", trx_state);
 
+	/* RF09_STATE only has 3 bits: anything else was garbled on the bus */
+	if (trx_state > STATE_RF_RESET)
+		at86rf215_spi_error(lp);
+
 	if (trx_state == STATE_RF_TRANSITION) {
 		printk(KERN_DEBUG "We're in a transition state.");
-		at86rf215_async_read_reg(lp, RG_RF09_STATE, ctx,
-					 at86rf215_async_state_change_start);
+		at86rf215_async_read_status(lp, ctx,
+					    at86rf215_async_state_change_start);
 		return;
 	}
 
@@ -491,7 +1539,7 @@ static void at86rf215_async_state_change_start(void *context)
 
 	/* Going into the next step for a state change which do a timing
 	 * relevant delay. */
-	at86rf215_async_write_reg(lp, RG_RF09_CMD, ctx->to_state, ctx,
+	at86rf215_async_write_cmd(lp, ctx->to_state, ctx,
 				  at86rf215_async_state_delay);
 }
 
@@ -505,8 +1553,8 @@ at86rf215_async_state_change(struct at86rf215_local *lp,
 	printk(KERN_DEBUG "to->state = %x", ctx->to_state);
 	if (complete)
 		ctx->complete = complete;
-	at86rf215_async_read_reg(lp, RG_RF09_STATE, ctx,
-				 at86rf215_async_state_change_start);
+	at86rf215_async_read_status(lp, ctx,
+				    at86rf215_async_state_change_start);
 }
 
 static void at86rf215_write_frame_complete(void *context)
@@ -514,509 +1562,3901 @@ static void at86rf215_write_frame_complete(void *context)
 	struct at86rf215_state_change *ctx = context;
 	struct at86rf215_local *lp = ctx->lp;
 
+	if (lp->is_gen)
+		at86rf215_txgen_uploaded(lp);
+
 	ctx->complete = NULL;
 	ctx->to_state = STATE_RF_TX;
-	at86rf215_async_read_reg(lp, RG_RF09_STATE, ctx,
-				 at86rf215_async_state_change_start);
+	at86rf215_async_read_status(lp, ctx,
+				    at86rf215_async_state_change_start);
 }
 
-static void at86rf215_write(void *context)
+/* MR-OFDM option 1: data bits per 120 us symbol, MCS0..6 */
+static const u16 at86rf215_ofdm_bits[] = { 12, 24, 48, 96, 144, 192, 288 };
+
+/* Octets of the frame (FCS excluded) written before TX is issued: all of
+ * them unless the frame is streamed. Once the SHR and PHR are out, the
+ * modulator takes one octet per octet_ns; the tail is written at the SPI
+ * rate measured on the previous tails (the clock rate before the first
+ * one), taken 1/8 slower for margin. An SPI faster than the PHY stays
+ * ahead with the minimal head, a slower one must still deliver the last
+ * octet before the modulator gets to it. */
+static u16 at86rf215_tx_stream_head(struct at86rf215_local *lp, u16 len)
+{
+	u32 octet_ns = 8 * 120000 / at86rf215_ofdm_bits[READ_ONCE(lp->tx_mcs)];
+	u32 spi_ns, lead_ns, head = AT86RF215_TX_STREAM_HEAD;
+
+	if (!lp->tx_stream || lp->tx_stream_retry || lp->is_gen ||
+	    len + lp->fcs_len < lp->tx_stream_min)
+		return len;
+
+	spi_ns = lp->tx_spi_ns ? lp->tx_spi_ns :
+				 DIV_ROUND_UP(8 * NSEC_PER_SEC, lp->spi_hz);
+	spi_ns += spi_ns / 8;
+	/* STF, LTF and PHR take 9 symbols, one less as an octet is needed
+	 * when the symbol carrying it starts */
+	lead_ns = lp->data->t_tx_start_delay * NSEC_PER_USEC + 8 * 120000;
+	if (spi_ns > octet_ns)
+		head = max_t(u32, head,
+			     len - min_t(u32, len, (lead_ns + (len - 1) *
+						    octet_ns) / spi_ns));
+
+	return min_t(u32, head, len);
+}
+
+static void at86rf215_tx_stream_tail_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
+	u32 ns;
+
+	txf->tail_status = txf->tail_msg.status;
+	if (txf->tail_status)
+		return;
+
+	/* CMD=TX and the tail: what the modulator waits for, per octet */
+	ns = div_u64(ktime_to_ns(ktime_sub(ktime_get(), txf->tail_ts)),
+		     txf->tail_trx[1].len);
+	lp->tx_spi_ns = lp->tx_spi_ns ? (3 * lp->tx_spi_ns + ns) / 4 : ns;
+}
+
+/* The head is in the frame buffer, TXPREP reached: TX, then the tail right
+ * behind it. The IRQ status read of TXFE is queued after the tail, which is
+ * thus done when at86rf215_tx_done() checks for an underrun. */
+static void at86rf215_tx_stream_head_complete(void *context)
 {
 	struct at86rf215_state_change *ctx = context;
 	struct at86rf215_local *lp = ctx->lp;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
 	struct sk_buff *skb = lp->tx_skb;
-	u8 *buf = ctx->buf;
+	u16 head = txf->trx[2].len;
+	u16 addr = RG_BBC0_FBTXS + head;
 	int rc;
 
-	/*lp->tx_skb = skb;*/
-	buf[0] = ((RG_BBC0_FBTXS & CMD_REG_MSB) >> 8) | CMD_WRITE;
-	buf[1] = RG_BBC0_FBTXS & CMD_REG_LSB;
-	memcpy(buf + 2, skb->data, skb->len);
-	ctx->trx.len = skb->len + 2;
-	ctx->msg.complete = at86rf215_write_frame_complete;
-	rc = spi_async(lp->spi, &ctx->msg);
+	if (txf->msg.status) {
+		at86rf215_async_error(lp, ctx, txf->msg.status);
+		return;
+	}
+
+	txf->tail_cmd[0] = ((addr & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	txf->tail_cmd[1] = addr & CMD_REG_LSB;
+	txf->tail_trx[1].tx_buf = skb->data + head;
+	txf->tail_trx[1].len = skb->len - head;
+	txf->tail_status = 0;
+	txf->tail_ts = ktime_get();
+	lp->tx_streaming = true;
+	lp->stats.tx_streamed++;
+	lp->stats.tx_stream_head = head;
+
+	rc = spi_async(lp->spi, &txf->cmd_msg);
+	if (rc) {
+		lp->tx_streaming = false;
+		at86rf215_async_error(lp, ctx, rc);
+		return;
+	}
+	/* On air with a partial frame: sent again on TXFE */
+	rc = spi_async(lp->spi, &txf->tail_msg);
+	if (rc)
+		txf->tail_status = rc;
+}
+
+/* Upload the PSDU length and the frame in one message. The FCS is inserted by
+ * the transceiver (TXAFCS) in the last fcs_len octets, which are counted in
+ * TXFL but not written. A long frame is only uploaded up to its head here,
+ * see at86rf215_tx_stream_head_complete(). */
+static void at86rf215_write(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
+	struct sk_buff *skb = lp->is_gen ? lp->txgen.skb : lp->tx_skb;
+	u16 len = skb->len + lp->fcs_len;
+	u16 head = at86rf215_tx_stream_head(lp, skb->len);
+	int rc;
+
+	lp->bcn.in_fb = false;
+	txf->len_buf[2] = len & 0xff;
+	txf->len_buf[3] = len >> 8;
+	txf->trx[2].tx_buf = skb->data;
+	txf->trx[2].len = head;
+	txf->msg.complete = head < skb->len ?
+			    at86rf215_tx_stream_head_complete :
+			    at86rf215_write_frame_complete;
+	txf->msg.context = ctx;
+	rc = spi_async(lp->spi, &txf->msg);
 	if (rc) {
 		printk(
 			KERN_ALERT "Impossible to write in BBC0_FBTXS registers");
-		ctx->trx.len = 2;
 		at86rf215_async_error(lp, ctx, rc);
 	}
 }
 
-static int at86rf215_xmit(struct ieee802154_hw *hw, struct sk_buff *skb)
+/* Last of the upload and the change to TXPREP: CMD=TX, or a new upload in
+ * TXPREP if the preload failed */
+static void at86rf215_tx_preload_step(struct at86rf215_local *lp)
 {
-	struct at86rf215_local *lp = hw->priv;
-	struct at86rf215_state_change *ctx = &lp->tx;
-	void *y;
-	int i;
-	u8 x[100];
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
 
-	/*buf = skb->data;*/
-	lp->tx_skb = skb;
-	for (i = 0; i < 100; i++)
-		x[i] = 0xcd;
+	if (!atomic_dec_and_test(&txf->pending))
+		return;
 
-	y = x;
-	skb->len = 100;
-	skb->data = y;
+	if (txf->status)
+		at86rf215_write(lp->tx);
+	else
+		at86rf215_write_frame_complete(lp->tx);
+}
 
-	printk(KERN_DEBUG "[xmit]: Starting ..");
-	/*Debugging*/
-	print_hex_dump(KERN_ALERT, "mem: ", DUMP_PREFIX_ADDRESS, 16, 1,
-		       skb->data, skb->len, 0);
-	at86rf215_async_state_change(lp, ctx, RF_TXPREP_STATUS,
-				     at86rf215_write);
+static void at86rf215_tx_preload_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
 
-	return 0;
+	txf->status = txf->msg.status;
+	if (atomic_read(&txf->pending) == 1)
+		lp->stats.tx_preload_late++;
+	at86rf215_tx_preload_step(lp);
 }
 
-static int at86rf215_ed(struct ieee802154_hw *hw, u8 *level)
+static void at86rf215_tx_prep_complete(void *context)
 {
-	printk(KERN_DEBUG "[CCA]: Starting ..");
-	WARN_ON(!level);
-	*level = 0xbe;
-	return 0;
+	struct at86rf215_state_change *ctx = context;
+
+	at86rf215_tx_preload_step(ctx->lp);
 }
 
-static int at86rf215_start(struct ieee802154_hw *hw)
+/* The TX frame buffer is separate from the RX one and can be written in any
+ * state but the sleep ones: TXFL and the frame are written at xmit, while
+ * the radio listens or is deferred by a reception, a calibration or a
+ * configuration write. Starting the frame then only takes the TXPREP and TX
+ * commands. Not used with the traffic generator, whose frame stays in the
+ * buffer between frames.
+ *
+ * Called under lp->lock with the frame deferral, so that a deferred start
+ * racing with xmit sees the preload set up. */
+static void at86rf215_tx_preload_prepare(struct at86rf215_local *lp)
 {
-	struct at86rf215_local *lp = hw->priv;
-
-	printk(KERN_DEBUG "[start]: called. ");
-	enable_irq(lp->spi->irq);
-	return 0;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
+	struct sk_buff *skb = lp->tx_skb;
+	u16 len = skb->len + lp->fcs_len;
+
+	txf->len_buf[2] = len & 0xff;
+	txf->len_buf[3] = len >> 8;
+	txf->trx[2].tx_buf = skb->data;
+	txf->trx[2].len = skb->len;
+	txf->msg.complete = at86rf215_tx_preload_complete;
+	txf->msg.context = lp;
+	txf->status = 0;
+	atomic_set(&txf->pending, 2);
+	lp->tx_preloaded = true;
+	lp->bcn.in_fb = false;
 }
 
-static void at86rf215_stop(struct ieee802154_hw *hw)
+static void at86rf215_tx_preload(struct at86rf215_local *lp)
 {
-	struct at86rf215_local *lp = hw->priv;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
 	int rc;
 
-	/* stop the continuous transmission.*/
-	rc = at86rf215_write_subreg(lp, SR_BBC0_PC_CTX, 0x0);
-	if (rc)
-		printk(
-			KERN_ALERT "Impossible to stop continuous transmission.");
+	rc = spi_async(lp->spi, &txf->msg);
+	if (rc) {
+		/* Uploaded again once in TXPREP */
+		txf->status = rc;
+		at86rf215_tx_preload_step(lp);
+		return;
+	}
+	lp->stats.tx_preloads++;
+}
 
-	disable_irq(lp->spi->irq);
+static void at86rf215_tx_start(struct at86rf215_local *lp)
+{
+	bool preloaded = lp->tx_preloaded;
+
+	/* lp->tx is handed back by at86rf215_tx_complete() */
+	if (WARN_ON_ONCE(!at86rf215_ctx_claim(lp->tx)))
+		return;
+
+	lp->tx_preloaded = false;
+	at86rf215_async_state_change(lp, lp->tx, RF_TXPREP_STATUS,
+				     preloaded ? at86rf215_tx_prep_complete :
+				     lp->tx_in_fb ?
+				     at86rf215_write_frame_complete :
+				     at86rf215_write);
 }
 
-/* TODO:
- * 1. Before setting the channel, check if the state is on TRXOFF
- * 2. See with Madani if we should add equations here to determine the "Channel
- * Center Frequency" and "The channel Spacing" or not. */
-/* The register CNM ( Both Channel Mode and Channel Number High Bit Settings
- * must be written "last". */
-/* The register SR_RF09_CNM_CNH is only needed for frequency range (2400-2483.5)MHz,
- * MR-OFDM Option 4 and MR-FSK mode #1 for: TotalNumChan=416. So in our case, it's
- * gonna be set at 0. */
-static int at86rf215_set_channel(struct at86rf215_local *lp, u8 page,
-				 u8 channel)
+/* Start a frame deferred by a reception, if nothing else owns the radio */
+static bool at86rf215_tx_resume(struct at86rf215_local *lp)
 {
-	int rc;
+	unsigned long flags;
+	bool start;
 
-	/*unsigned int cf_low=0, cf_high=0, cs=0;*/
+	spin_lock_irqsave(&lp->lock, flags);
+	start = lp->tx_deferred && !at86rf215_tx_blocked(lp);
+	if (start)
+		lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
 
-	printk(KERN_DEBUG "[channel]: Setting ..");
+	if (start)
+		at86rf215_tx_start(lp);
 
-	/*Channel Center Frequency*/
-/*      cf_low = channel_freq & 0x00ff;
- *      cf_high = ( channel_freq & 0xff00 ) >> 8;
- *      rc = (regmap_write( lp->regmap, RG_RF09_CCF0L, cf_low) &&
- *      regmap_write( lp->regmap, RG_RF09_CCF0H, cf_high));
- *      if (rc)
- *              return rc;
- */
-	/*Channel Spacing*/
-/*      rc = regmap_write(lp->regmap, RG_RF09_CS, cs);
- *      if (rc)
- *              return rc;
- */
-	if (channel > 10) {
-		printk(KERN_DEBUG "Please insert a channel from 0 to 10");
-		return rc;
+	return start;
+}
+
+static int at86rf215_xmit(struct ieee802154_hw *hw, struct sk_buff *skb)
+{
+	struct at86rf215_local *lp = hw->priv;
+	unsigned long flags;
+	bool wake, preload;
+
+	if (skb->len + lp->fcs_len > AT86RF215_MAX_PSDU)
+		return -EMSGSIZE;
+
+	lp->tx_skb = skb;
+	lp->tx_retry = 0;
+	lp->tx_in_fb = false;
+	/* Polls from this destination are answered with the pending bit
+	 * until the frame is out */
+	lp->tx_pend_key = at86rf215_pend_key(skb->data, skb->len, false);
+	at86rf215_pend_update(lp, lp->tx_pend_key, true);
+
+	printk(KERN_DEBUG "[xmit]: Starting ..");
+
+	/* A recalibration, a scan or a sleeping radio owns the radio: the
+	 * frame is started once it is done, resp. once the radio is awake. */
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_tx = true;
+	lp->tx_deferred = at86rf215_tx_blocked(lp);
+	if (lp->is_rx)
+		lp->stats.tx_rx_deferred++;
+	if (lp->is_cfg)
+		lp->stats.tx_cfg_deferred++;
+	wake = lp->is_sleep;
+	/* A frame started right away is streamed instead if it is long */
+	preload = lp->tx_preload && !lp->is_sleep && !lp->is_gen &&
+		  !lp->is_bcn &&
+		  (lp->tx_deferred || !lp->tx_stream ||
+		   skb->len + lp->fcs_len < lp->tx_stream_min);
+	if (preload)
+		at86rf215_tx_preload_prepare(lp);
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (preload)
+		at86rf215_tx_preload(lp);
+	if (wake) {
+		lp->pm_wake_req = ktime_get();
+		at86rf215_queue_work(lp, &lp->pm_wake_work);
 	}
+	if (lp->tx_deferred)
+		return 0;
+
+	at86rf215_tx_start(lp);
 
-	/*Channel Number*/
-/*	rc = (regmap_write(lp->regmap, RG_RF09_CNL, channel) ||
- *	at86rf215_write_subreg(lp, SR_RF09_CNM_CNH, 0x0));
- *      if (rc){
- *              printk(KERN_DEBUG "RG_RF09_CNL/SR_RF09_CNM_CNH can't be set");
- *              return rc;
- *      }
- */
-	/*Channel Mode 0 : IEEE compliant channel scheme*/
-/*      rc = at86rf215_write_subreg(lp, SR_RF09_CNM_CM, 0x0);
- *      if (rc){
- *              printk(KERN_DEBUG "SR_RF09_CNM_CM can't be set");
- *              return rc;
- *      }
- */
-/*      rc = at86rf215_write_subreg(lp, SR_RF09_CNM_CNH, 0x0);
- *      if (rc){
- *              printk(KERN_DEBUG "RG_RF09_CNM can't be set");
- *              return rc;
- *      }
- *
- *      rc = regmap_write(lp->regmap, RG_RF09_CNM, 0x00);
- *      if (rc){
- *              printk(KERN_ALERT "RG_RF09_CNM cant be written.");
- *      }
- */
 	return 0;
 }
 
-#define AT86RF215_MAX_ED_LEVELS 0xF /* 16 registers */
-/* TODO: These values are so random, they should be edited. */
-static const s32 at86rf215_ed_levels[AT86RF215_MAX_ED_LEVELS + 1] = {
-	-9800, -9600, -9400, -9200, -9000, -8800, -8600, -8400, -8200, -8000,
-	-7800, -7600, -7400, -7200, -7000, -6800
-};
+static void at86rf215_tx_complete(struct at86rf215_local *lp)
+{
+	struct sk_buff *skb = lp->tx_skb;
+	unsigned long flags;
+
+	at86rf215_ctx_release(lp->tx);
+	lp->tx_stream_retry = false;
+	lp->tx_in_fb = false;
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_tx = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	at86rf215_pend_update(lp, lp->tx_pend_key, false);
+	if (lp->tx_no_ack) {
+		lp->tx_no_ack = false;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+		ieee802154_xmit_error(lp->hw, skb, IEEE802154_NO_ACK);
+#else
+		/* No ieee802154_xmit_error(): dropped like a failed TX, see
+		 * "tx_no_ack" in stats */
+		dev_kfree_skb_any(skb);
+		ieee802154_wake_queue(lp->hw);
+#endif
+	} else {
+		ieee802154_xmit_complete(lp->hw, skb, false);
+	}
+	at86rf215_pm_idle(lp);
+}
 
-/* This function set the channel and the page + set the timeout to recalibrate
- * means form the current moment, set 5 minutes before the recalibration.
- * Jiffies : Kernel Internal value
- * TODO: WHY : + 10 ? */
-static int at86rf215_channel(struct ieee802154_hw *hw, u8 page, u8 channel)
+/* Sends the frame of the stack again, uploaded again unless tx_in_fb */
+static void at86rf215_tx_restart(struct at86rf215_local *lp)
 {
-	struct at86rf215_local *lp = hw->priv;
-	int rc;
+	unsigned long flags;
+	bool deferred;
+
+	at86rf215_ctx_release(lp->tx);
+	spin_lock_irqsave(&lp->lock, flags);
+	deferred = at86rf215_tx_blocked(lp);
+	lp->tx_deferred = deferred;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (!deferred)
+		at86rf215_tx_start(lp);
+}
 
-	printk(KERN_DEBUG "_channel is being called");
-	rc = lp->data->set_channel(lp, page, channel);
-	/* Wait for PLL */
-	usleep_range(lp->data->t_pll_ch_switch,
-		     lp->data->t_pll_ch_switch + 10);
+/* A missed recalibration deadline is served here, before the next frame is
+ * accepted from the stack. */
+static void at86rf215_tx_finish(struct at86rf215_local *lp)
+{
+	if (at86rf215_cal_between_frames(lp))
+		return;
 
-	lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	at86rf215_tx_complete(lp);
+}
 
-	return rc;
+/* The frame of the stack is on air. One with AR set waits for its ACK with
+ * the radio back in RX (TX2RX). Without it in time, the frame is sent again
+ * after a backoff, up to tx_max_retries times: it is still in the TX frame
+ * buffer, a retry only takes the state commands. */
+static void at86rf215_tx_sent(struct at86rf215_local *lp)
+{
+	struct sk_buff *skb = lp->tx_skb;
+	unsigned long flags;
+	u16 fc;
+
+	fc = skb->len >= 3 ? get_unaligned_le16(skb->data) : 0;
+	/* No ACK to match without a sequence number (2015 frames) */
+	if (lp->tx_max_retries < 0 || !(fc & BIT(5)) ||
+	    (((fc >> 12) & 0x3) == 2 && (fc & BIT(8)))) {
+		at86rf215_tx_finish(lp);
+		return;
+	}
+
+	lp->tx_seq = skb->data[2];
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_ack = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	hrtimer_start(&lp->tx_ack_timer, lp->tx_ack_wait_us * NSEC_PER_USEC,
+		      HRTIMER_MODE_REL);
 }
 
-#define AT86RF215_MAX_TX_POWERS 0x1F /* 32 registres */
-/* PLease check datasheet page 50, register concerned: TXPWR */
-static const s32 at86rf215_powers[AT86RF215_MAX_TX_POWERS + 1] =
-{ 0, 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100, 1200, 1300, 1400,
- 1500, 1600, 1700, 1800, 1900, 2000, 2100, 2200, 2300, 2400, 2500, 2600, 2700,
- 2800, 2900, 3000, 3100 };
+/* The ACK of the frame waiting for one: it is consumed here */
+static bool at86rf215_tx_ack_rx(struct at86rf215_local *lp,
+				struct sk_buff *skb)
+{
+	unsigned long flags;
+	bool match;
 
-/* Change  the corresponding register with the suitable power value */
-static int at86rf2xx_set_txpower(struct at86rf215_local *lp, s32 mbm)
+	if (skb->len != 3 || (skb->data[0] & 0x7) != IEEE802154_FC_TYPE_ACK)
+		return false;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	match = lp->is_ack && skb->data[2] == lp->tx_seq;
+	if (match)
+		lp->is_ack = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (!match)
+		return false;
+
+	/* Running, the timer sees !is_ack and leaves the frame to us */
+	hrtimer_try_to_cancel(&lp->tx_ack_timer);
+	lp->stats.tx_acked++;
+	lp->stats.tx_retry_hist[lp->tx_retry]++;
+	at86rf215_tx_finish(lp);
+
+	return true;
+}
+
+/* No ACK in time: the frame is sent again or given up, in process context
+ * (the completion towards the stack, PM and calibration are not for the
+ * hrtimer). is_ack is already cleared by the timer. */
+static void at86rf215_tx_ack_work(struct work_struct *work)
 {
-	u32 i;
+	struct at86rf215_local *lp =
+		container_of(work, struct at86rf215_local, tx_ack_work);
+	unsigned int be;
+	u64 backoff;
+
+	if (lp->tx_retry >= lp->tx_max_retries) {
+		lp->stats.tx_no_ack++;
+		lp->tx_no_ack = true;
+		at86rf215_tx_finish(lp);
+		return;
+	}
 
-	for (i = 0; i < lp->hw->phy->supported.tx_powers_size; i++)
-		if (lp->hw->phy->supported.tx_powers[i] == mbm)
-			return at86rf215_write_subreg(lp, SR_RF09_PAC_TXPWR, i);
+	lp->tx_retry++;
+	lp->stats.tx_retries++;
+	lp->tx_in_fb = true;
+	be = min_t(unsigned int, lp->tx_retry, AT86RF215_TX_MAX_BE);
+	backoff = (u64)(get_random_u32() & ((1 << be) - 1)) *
+		  lp->tx_backoff_us * NSEC_PER_USEC;
+	if (backoff)
+		hrtimer_start(&lp->tx_backoff_timer, backoff,
+			      HRTIMER_MODE_REL);
+	else
+		at86rf215_tx_restart(lp);
+}
 
-	return -EINVAL;
+static enum hrtimer_restart at86rf215_tx_ack_timer(struct hrtimer *timer)
+{
+	struct at86rf215_local *lp =
+		container_of(timer, struct at86rf215_local, tx_ack_timer);
+	unsigned long flags;
+	bool wait, rx;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	wait = lp->is_ack;
+	/* The frame being received or read out may be the ACK */
+	rx = lp->is_rx || test_bit(0, &lp->rx_frame.busy);
+	if (wait && !rx)
+		lp->is_ack = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (!wait)
+		return HRTIMER_NORESTART;
+	if (rx) {
+		hrtimer_forward_now(timer, lp->tx_ack_wait_us * NSEC_PER_USEC);
+		return HRTIMER_RESTART;
+	}
+
+	at86rf215_queue_work(lp, &lp->tx_ack_work);
+
+	return HRTIMER_NORESTART;
 }
 
-/* TODO: Combine "at86rf215_set_txpower" and "at86rf2xx_set_txpower" . */
-/* Set the transmitter power */
-static int at86rf215_set_txpower(struct ieee802154_hw *hw, s32 mbm)
+static enum hrtimer_restart at86rf215_tx_backoff_timer(struct hrtimer *timer)
 {
-	struct at86rf215_local *lp = hw->priv;
+	at86rf215_tx_restart(container_of(timer, struct at86rf215_local,
+					  tx_backoff_timer));
 
-	return lp->data->set_txpower(lp, mbm);
+	return HRTIMER_NORESTART;
 }
 
-/* This function search for the CCA level set ( in the function parameters )
-* if it is supported. Then affected to the registre RG_BBC0_AMEDT.
-* CCA reports a busy medium upon detecting energy above the ED threshold. */
-static int at86rf215_set_cca_ed_level(struct ieee802154_hw *hw, s32 mbm)
+/* Frames retried from the frame buffer, -1 to leave the ACK to the stack */
+static int at86rf215_set_frame_retries(struct ieee802154_hw *hw, s8 retries)
 {
 	struct at86rf215_local *lp = hw->priv;
-	u32 i;
 
-	for (i = 0; i < hw->phy->supported.cca_ed_levels_size; i++)
-		if (hw->phy->supported.cca_ed_levels[i] == mbm)
-			return regmap_write(lp->regmap, RG_BBC0_AMEDT, i);
+	if (retries > AT86RF215_TX_MAX_RETRIES)
+		return -EINVAL;
+
+	lp->tx_max_retries = retries;
 
-	return -EINVAL;
+	return 0;
 }
 
-/* Promiscuous mode : The Automatic Acknowledgement shoud be disabled (resp.
- * enabled) and the promiscuous mode shoud be enabled (resp. disabled). */
-static int at86rf215_set_promiscuous_mode(struct ieee802154_hw *hw,
-					  const bool		on)
+/* BBC0_PS after TXFE of a streamed frame. On TXUR (or a tail which never
+ * made it) the frame is sent again, uploaded whole before TX. */
+static void at86rf215_tx_stream_check(void *context)
 {
-	struct at86rf215_local *lp = hw->priv;
-	int rc;
+	struct at86rf215_local *lp = context;
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
 
-	if (on) {
-		rc = at86rf215_write_subreg(lp, SR_BBC0_AMCS_AACK, 1);
-		if (rc < 0)
-			return rc;
+	if (!txf->ps_msg.status && !txf->tail_status &&
+	    !(txf->ps_buf[2] & PS_0_TXUR)) {
+		at86rf215_tx_sent(lp);
+		return;
+	}
 
-		rc = at86rf215_write_subreg(lp, SR_BBC0_AFC0_PM, 1);
-		if (rc < 0)
-			return rc;
+	lp->stats.tx_underruns++;
+	lp->tx_stream_retry = true;
+	lp->tx_in_fb = false;
+	at86rf215_tx_restart(lp);
+}
+
+/* Called on TXFE */
+static void at86rf215_tx_done(struct at86rf215_local *lp)
+{
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
+
+	if (lp->is_bcn) {
+		at86rf215_bcn_done(lp);
+		return;
+	}
+
+	if (lp->is_gen) {
+		at86rf215_txgen_done(lp);
+		return;
+	}
+
+	if (!lp->is_tx)
+		return;
+
+	if (lp->tx_streaming) {
+		lp->tx_streaming = false;
+		if (!spi_async(lp->spi, &txf->ps_msg))
+			return;
+	}
+
+	at86rf215_tx_sent(lp);
+}
+
+static void at86rf215_rx_frame_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_rx_frame *rxf = &lp->rx_frame;
+	struct sk_buff *skb = rxf->skb;
+
+	rxf->skb = NULL;
+	if (rxf->msg.status) {
+		kfree_skb(skb);
+		lp->stats.rx_drops++;
+	} else if (at86rf215_tx_ack_rx(lp, skb)) {
+		kfree_skb(skb);
 	} else {
-		rc = at86rf215_write_subreg(lp, SR_BBC0_AMCS_AACK, 0);
-		if (rc < 0)
-			return rc;
+		/* The transceiver has no LQI, report the best one */
+		ieee802154_rx_irqsafe(lp->hw, skb, 0xff);
+		lp->stats.rx_frames++;
+	}
 
-		rc = at86rf215_write_subreg(lp, SR_BBC0_AFC0_PM, 0);
-		if (rc < 0)
-			return rc;
+	clear_bit_unlock(0, &rxf->busy);
+}
+
+static void at86rf215_rx_len_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_rx_frame *rxf = &lp->rx_frame;
+	u16 len;
+
+	len = rxf->len_buf[2] | (rxf->len_buf[3] & 0x07) << 8;
+	if (rxf->len_msg.status || len <= lp->fcs_len)
+		goto drop;
+
+	/* IEEE802154_HW_RX_OMIT_CKSUM: the FCS is not handed over */
+	len -= lp->fcs_len;
+	rxf->skb = dev_alloc_skb(len);
+	if (!rxf->skb)
+		goto drop;
+
+	rxf->trx[1].rx_buf = skb_put(rxf->skb, len);
+	rxf->trx[1].len = len;
+	if (spi_async(lp->spi, &rxf->msg)) {
+		kfree_skb(rxf->skb);
+		rxf->skb = NULL;
+		goto drop;
 	}
 
-	return 0;
+	return;
+
+drop:
+	lp->stats.rx_drops++;
+	clear_bit_unlock(0, &rxf->busy);
 }
 
-/* These functions represent callbacks that the 802.15.4 module call later */
-static const struct ieee802154_ops at86rf215_ops = {
-	/* It is mendatory to implement these functions. */
-	.owner			= THIS_MODULE,
-	.xmit_async		= at86rf215_xmit,
-	.ed			= at86rf215_ed,
-	.set_channel		= at86rf215_channel,
-	.start			= at86rf215_start,
-	.stop			= at86rf215_stop,
-	/* The following functions are optional. */
-	.set_txpower		= at86rf215_set_txpower,
-	.set_cca_ed_level	= at86rf215_set_cca_ed_level,
-	.set_promiscuous_mode	= at86rf215_set_promiscuous_mode,
+/* Called on RXFE. The chip has a single RX frame buffer: a frame ending
+ * while the previous one is still being read out is dropped. */
+static void at86rf215_rx(struct at86rf215_local *lp)
+{
+	struct at86rf215_rx_frame *rxf = &lp->rx_frame;
+
+	if (test_and_set_bit_lock(0, &rxf->busy)) {
+		lp->stats.rx_drops++;
+		return;
+	}
+
+	if (spi_async(lp->spi, &rxf->len_msg)) {
+		lp->stats.rx_drops++;
+		clear_bit_unlock(0, &rxf->busy);
+	}
+}
+
+static void at86rf215_setup_frame_messages(struct at86rf215_local *lp)
+{
+	struct at86rf215_tx_frame *txf = &lp->tx_frame;
+	struct at86rf215_rx_frame *rxf = &lp->rx_frame;
+
+	/* TXFLL, TXFLH */
+	txf->len_buf[0] = ((RG_BBC0_TXFLL & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	txf->len_buf[1] = RG_BBC0_TXFLL & CMD_REG_LSB;
+	txf->trx[0].tx_buf = txf->len_buf;
+	txf->trx[0].len = 4;
+	txf->trx[0].cs_change = 1;
+	/* FBTXS burst: the payload is sent from skb->data, no copy */
+	txf->cmd[0] = ((RG_BBC0_FBTXS & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	txf->cmd[1] = RG_BBC0_FBTXS & CMD_REG_LSB;
+	txf->trx[1].tx_buf = txf->cmd;
+	txf->trx[1].len = 2;
+	spi_message_init(&txf->msg);
+	txf->msg.complete = at86rf215_write_frame_complete;
+	spi_message_add_tail(&txf->trx[0], &txf->msg);
+	spi_message_add_tail(&txf->trx[1], &txf->msg);
+	spi_message_add_tail(&txf->trx[2], &txf->msg);
+	/* Streaming: RF09_CMD = TX, the tail burst, BBC0_PS */
+	txf->tx_cmd[0] = ((RG_RF09_CMD & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	txf->tx_cmd[1] = RG_RF09_CMD & CMD_REG_LSB;
+	txf->tx_cmd[2] = RF_TX_STATUS;
+	txf->cmd_trx.tx_buf = txf->tx_cmd;
+	txf->cmd_trx.len = 3;
+	spi_message_init(&txf->cmd_msg);
+	spi_message_add_tail(&txf->cmd_trx, &txf->cmd_msg);
+	txf->tail_trx[0].tx_buf = txf->tail_cmd;
+	txf->tail_trx[0].len = 2;
+	spi_message_init(&txf->tail_msg);
+	txf->tail_msg.complete = at86rf215_tx_stream_tail_complete;
+	txf->tail_msg.context = lp;
+	spi_message_add_tail(&txf->tail_trx[0], &txf->tail_msg);
+	spi_message_add_tail(&txf->tail_trx[1], &txf->tail_msg);
+	txf->ps_cmd[0] = (RG_BBC0_PS & CMD_REG_MSB) >> 8;
+	txf->ps_cmd[1] = RG_BBC0_PS & CMD_REG_LSB;
+	txf->ps_trx.tx_buf = txf->ps_cmd;
+	txf->ps_trx.rx_buf = txf->ps_buf;
+	txf->ps_trx.len = 3;
+	spi_message_init(&txf->ps_msg);
+	txf->ps_msg.complete = at86rf215_tx_stream_check;
+	txf->ps_msg.context = lp;
+	spi_message_add_tail(&txf->ps_trx, &txf->ps_msg);
+
+	/* RXFLL, RXFLH */
+	rxf->len_hdr[0] = (RG_BBC0_RXFLL & CMD_REG_MSB) >> 8;
+	rxf->len_hdr[1] = RG_BBC0_RXFLL & CMD_REG_LSB;
+	rxf->len_trx.tx_buf = rxf->len_hdr;
+	rxf->len_trx.rx_buf = rxf->len_buf;
+	rxf->len_trx.len = 4;
+	spi_message_init(&rxf->len_msg);
+	rxf->len_msg.complete = at86rf215_rx_len_complete;
+	rxf->len_msg.context = lp;
+	spi_message_add_tail(&rxf->len_trx, &rxf->len_msg);
+	/* FBRXS burst, straight into the skb */
+	rxf->cmd[0] = (RG_BBC0_FBRXS & CMD_REG_MSB) >> 8;
+	rxf->cmd[1] = RG_BBC0_FBRXS & CMD_REG_LSB;
+	rxf->trx[0].tx_buf = rxf->cmd;
+	rxf->trx[0].len = 2;
+	spi_message_init(&rxf->msg);
+	rxf->msg.complete = at86rf215_rx_frame_complete;
+	rxf->msg.context = lp;
+	spi_message_add_tail(&rxf->trx[0], &rxf->msg);
+	spi_message_add_tail(&rxf->trx[1], &rxf->msg);
+}
+
+/****************************** SPI link ********************************/
+
+/* The device tree clock is the one known to work. At probe, faster clocks are
+ * tried from the top; a clock is kept if PN/VN read back unchanged and burst
+ * patterns written to a scratch area read back intact. At runtime a garbled
+ * readback steps the clock down until the checks pass again, the device
+ * tree clock being the floor. The transceiver has no CRC on its SPI, so the
+ * readbacks are the only integrity signal. */
+static const u32 at86rf215_spi_rates[] = {
+	AT86RF215_SPI_MAX_HZ, 20000000, 16000000, 12500000, 10000000, 8000000,
 };
 
-/* Datasheet : page 189 (Transition time) */
-static struct at86rf215_chip_data at86rf215_data = {
-	.t_power_to_off		= 500,  /*us*/
-	.t_sleep_to_off		= 1,    /*us*/
-	.t_dsleep_to_off	= 500,  /*us*/
-	.t_reset_to_off		= 1,    /*us*/
-	.t_off_to_prep		= 200,  /*us*/
-	.t_off_to_rx		= 90,   /*us*/
-	.t_prep_to_tx		= 200,  /*ns*/
-	.t_tx_start_delay	= 4,    /*us*/
-	.t_prep_to_rx		= 200,  /*ns*/
-	.t_prep_to_off		= 200,  /*ns*/
-	.t_rx_to_off		= 200,  /*ns*/
-	.t_rx_to_prep		= 200,  /*ns*/
-	.t_txfe_to_prep		= 200,  /*ns*/ /*TX (TXFE) ==> TXPREP */
-	.t_txprep_to_prep	= 33,   /*us*/ /*TX (CMD=TXPREP) ==> TXPREP */
-	.t_tx_to_off		= 200,  /*ns*/ /*TX (CMD=TRXOFF) ==> TRXOFF */
-	.t_vreg_settl		= 35,   /*us*/ /*Settling time of AVDD/DVDD */
-	.t_xosc_settl		= 150,  /*us*/ /*Settling time of crystal OCS*/
-	.t_pll_ch_switch	= 100,  /*us*/ /*Freq channel switch time PLL*/
+static int at86rf215_spi_read(struct at86rf215_local *lp, u16 reg, u8 *buf,
+			      size_t len)
+{
+	u8 cmd[2];
+
+	cmd[0] = (reg & CMD_REG_MSB) >> 8;
+	cmd[1] = reg & CMD_REG_LSB;
+	/* spi_write_then_read() bounces through a DMA safe buffer */
+	return spi_write_then_read(lp->spi, cmd, 2, buf, len);
+}
+
+static int at86rf215_spi_check_id(struct at86rf215_local *lp)
+{
+	u8 id[2];
+	int rc;
+
+	rc = at86rf215_spi_read(lp, RG_RF_PN, id, 2);
+	if (rc)
+		return rc;
+
+	return memcmp(id, lp->spi_id, 2) ? -EIO : 0;
+}
+
+static int at86rf215_spi_verify(struct at86rf215_local *lp)
+{
+	static const u8 patterns[] = {
+		0x00, 0xff, 0x55, 0xaa, 0x0f, 0xf0, 0x33, 0xcc,
+	};
+	u8 cmd[2 + ARRAY_SIZE(patterns)], buf[ARRAY_SIZE(patterns)];
+	int rc, i, j;
+
+	cmd[0] = ((RG_BBC1_MACEA0 & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	cmd[1] = RG_BBC1_MACEA0 & CMD_REG_LSB;
+
+	for (i = 0; i < AT86RF215_SPI_VERIFY_ROUNDS; i++) {
+		rc = at86rf215_spi_check_id(lp);
+		if (rc)
+			return rc;
+
+		for (j = 0; j < ARRAY_SIZE(patterns); j++)
+			cmd[2 + j] = patterns[(i + j) % ARRAY_SIZE(patterns)];
+		rc = spi_write_then_read(lp->spi, cmd, sizeof(cmd), NULL, 0) ||
+		     at86rf215_spi_read(lp, RG_BBC1_MACEA0, buf, sizeof(buf));
+		if (rc)
+			return -EIO;
+		if (memcmp(buf, cmd + 2, sizeof(buf)))
+			return -EIO;
+	}
+
+	memset(cmd + 2, 0, sizeof(buf));
+	return spi_write_then_read(lp->spi, cmd, sizeof(cmd), NULL, 0);
+}
+
+static void at86rf215_msg_set_speed(struct spi_message *msg, u32 hz)
+{
+	struct spi_transfer *xfer;
+
+	/* Message not set up yet (lp is zeroed) */
+	if (!msg->transfers.next)
+		return;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		xfer->speed_hz = hz;
+}
+
+/* The SPI core copies spi->max_speed_hz into a transfer the first time it
+ * is sent, so the prebuilt messages are updated by hand. A message in flight
+ * may still go out at the previous clock. */
+static int at86rf215_spi_set_rate(struct at86rf215_local *lp, u32 hz)
+{
+	struct at86rf215_state_change *ctx[2 + AT86RF215_IRQ_SLOTS] = {
+		lp->state, lp->tx,
+	};
+	int rc, i;
+
+	lp->spi->max_speed_hz = hz;
+	rc = spi_setup(lp->spi);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < AT86RF215_IRQ_SLOTS; i++)
+		ctx[2 + i] = lp->irq_ctx[i];
+	for (i = 0; i < ARRAY_SIZE(ctx); i++) {
+		at86rf215_msg_set_speed(&ctx[i]->msg, hz);
+		at86rf215_msg_set_speed(&ctx[i]->cmd_msg, hz);
+	}
+	at86rf215_msg_set_speed(&lp->tx_frame.msg, hz);
+	at86rf215_msg_set_speed(&lp->tx_frame.cmd_msg, hz);
+	at86rf215_msg_set_speed(&lp->tx_frame.tail_msg, hz);
+	at86rf215_msg_set_speed(&lp->tx_frame.ps_msg, hz);
+	at86rf215_msg_set_speed(&lp->rx_frame.len_msg, hz);
+	at86rf215_msg_set_speed(&lp->rx_frame.msg, hz);
+	at86rf215_msg_set_speed(&lp->rng.msg, hz);
+	at86rf215_msg_set_speed(&lp->sniff.info_msg, hz);
+	at86rf215_msg_set_speed(&lp->sniff.frame_msg, hz);
+	at86rf215_msg_set_speed(&lp->pend.msg, hz);
+	at86rf215_msg_set_speed(&lp->pend.pd_msg, hz);
+	at86rf215_msg_set_speed(&lp->txgen.seq_msg, hz);
+	at86rf215_msg_set_speed(&lp->bcn.up_msg, hz);
+	at86rf215_msg_set_speed(&lp->bcn.upd_msg, hz);
+	at86rf215_msg_set_speed(&lp->bcn.tx_msg, hz);
+	at86rf215_msg_set_speed(&lp->bcn.cnt_msg, hz);
+	lp->spi_hz = hz;
+	/* Streamed frames go by the clock rate until the next tail */
+	lp->tx_spi_ns = 0;
+
+	return 0;
+}
+
+static void at86rf215_spi_train(struct at86rf215_local *lp)
+{
+	u32 max = lp->spi->controller->max_speed_hz;
+	int i;
+
+	lp->spi_dt_hz = lp->spi->max_speed_hz;
+	lp->spi_hz = lp->spi_dt_hz;
+	if (at86rf215_spi_read(lp, RG_RF_PN, lp->spi_id, 2))
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(at86rf215_spi_rates); i++) {
+		if (at86rf215_spi_rates[i] <= lp->spi_dt_hz)
+			break;
+		if (max && at86rf215_spi_rates[i] > max)
+			continue;
+		if (!at86rf215_spi_set_rate(lp, at86rf215_spi_rates[i]) &&
+		    !at86rf215_spi_verify(lp)) {
+			dev_info(&lp->spi->dev, "SPI clock: %u Hz\n",
+				 lp->spi_hz);
+			return;
+		}
+	}
+
+	at86rf215_spi_set_rate(lp, lp->spi_dt_hz);
+}
+
+static void at86rf215_spi_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(work, struct at86rf215_local, spi_work);
+	u32 hz, from = lp->spi_hz;
+	int i;
+
+	while (lp->spi_hz > lp->spi_dt_hz) {
+		hz = lp->spi_dt_hz;
+		for (i = 0; i < ARRAY_SIZE(at86rf215_spi_rates); i++) {
+			if (at86rf215_spi_rates[i] < lp->spi_hz &&
+			    at86rf215_spi_rates[i] > lp->spi_dt_hz) {
+				hz = at86rf215_spi_rates[i];
+				break;
+			}
+		}
+
+		lp->stats.spi_fallbacks++;
+		if (!at86rf215_spi_set_rate(lp, hz) &&
+		    !at86rf215_spi_verify(lp))
+			break;
+	}
+
+	if (lp->spi_hz != from)
+		dev_warn(&lp->spi->dev, "SPI errors, clock lowered to %u Hz\n",
+			 lp->spi_hz);
+}
+
+/* May be called from any context */
+static void at86rf215_spi_error(struct at86rf215_local *lp)
+{
+	lp->stats.spi_errors++;
+	if (lp->spi_hz > lp->spi_dt_hz)
+		at86rf215_queue_work(lp, &lp->spi_work);
+}
+
+/*********************** Periodic recalibration ************************/
+
+/* The PLL and the filters are calibrated by the transceiver on every
+ * TRXOFF ==> TXPREP transition. Recalibrating is thus just a walk through
+ * TRXOFF and TXPREP, then back to the state we found the radio in. It runs
+ * on the "state" context so it never touches the TX context. */
+static void at86rf215_cal_complete(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	struct at86rf215_stats *st = &lp->stats;
+	unsigned long flags;
+	bool tx_deferred;
+	u64 ns;
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), lp->cal_start));
+	at86rf215_ctx_release(ctx);
+	st->cal_count++;
+	st->cal_last_ns = ns;
+	st->cal_total_ns += ns;
+	if (ns > st->cal_max_ns)
+		st->cal_max_ns = ns;
+
+	lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	/* Finished after stop(): start() arms the loop again */
+	if (READ_ONCE(lp->started))
+		at86rf215_queue_delayed(lp, &lp->cal_work,
+					AT86RF215_CAL_LOOP_TIMEOUT -
+					AT86RF215_CAL_SLACK);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_cal = false;
+	lp->cal_pending = false;
+	tx_deferred = lp->tx_deferred;
+	lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (tx_deferred)
+		at86rf215_tx_start(lp);
+	else if (lp->is_tx)
+		at86rf215_tx_complete(lp);
+	else
+		at86rf215_pm_idle(lp);
+}
+
+static void at86rf215_cal_prep(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+
+	at86rf215_async_state_change(lp, ctx, lp->cal_restore,
+				     at86rf215_cal_complete);
+}
+
+static void at86rf215_cal_off(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+
+	at86rf215_async_state_change(ctx->lp, ctx, RF_TXPREP_STATUS,
+				     at86rf215_cal_prep);
+}
+
+static void at86rf215_cal_read_state(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	u8 trx_state = ctx->buf[2];
+
+	/* Only stable states can be restored, default to TRXOFF otherwise */
+	switch (trx_state) {
+	case STATE_RF_TXPREP:
+	case STATE_RF_RX:
+		lp->cal_restore = trx_state;
+		break;
+	default:
+		lp->cal_restore = RF_TRXOFF_STATUS;
+		break;
+	}
+
+	at86rf215_async_state_change(lp, ctx, RF_TRXOFF_STATUS,
+				     at86rf215_cal_off);
+}
+
+/* The caller must have set lp->is_cal. */
+static void at86rf215_cal_start(struct at86rf215_local *lp)
+{
+	if (WARN_ON_ONCE(!at86rf215_ctx_claim(lp->state)))
+		return;
+
+	lp->cal_start = ktime_get();
+	at86rf215_async_read_status(lp, lp->state,
+				    at86rf215_cal_read_state);
+}
+
+/* Serve a pending recalibration between two frames. It returns true if a
+ * recalibration has been started, the caller must then leave the radio
+ * alone until at86rf215_cal_complete() runs. */
+static bool at86rf215_cal_between_frames(struct at86rf215_local *lp)
+{
+	unsigned long flags;
+	bool start;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	start = lp->cal_pending && !lp->is_rx && !lp->is_cal && !lp->is_scan &&
+		!lp->is_cfg && !lp->is_ack && !lp->is_bcn;
+	if (start)
+		lp->is_cal = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (start) {
+		lp->stats.cal_forced++;
+		at86rf215_cal_start(lp);
+	}
+
+	return start;
+}
+
+static void at86rf215_cal_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(to_delayed_work(work), struct at86rf215_local,
+			     cal_work);
+	unsigned long flags;
+	bool idle, missed = false;
+
+	/* PN/VN is readable in any state, it checks the link on the way */
+	if (!lp->is_sleep && at86rf215_spi_check_id(lp))
+		at86rf215_spi_error(lp);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	idle = at86rf215_is_idle(lp);
+	if (lp->is_sleep) {
+		/* The wake up goes through TRXOFF ==> TXPREP before any TX,
+		 * which recalibrates anyway. */
+		lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	} else if (idle) {
+		lp->is_cal = true;
+	} else if (time_after_eq(jiffies, lp->cal_timeout)) {
+		/* Deadline missed: the data path will do it between frames */
+		missed = !lp->cal_pending;
+		lp->cal_pending = true;
+	}
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (idle) {
+		at86rf215_cal_start(lp);
+		return;
+	}
+
+	if (missed)
+		lp->stats.cal_deferred++;
+	else if (lp->is_sleep)
+		at86rf215_queue_delayed(lp, &lp->cal_work,
+					AT86RF215_CAL_LOOP_TIMEOUT -
+					AT86RF215_CAL_SLACK);
+	else if (!lp->cal_pending)
+		at86rf215_queue_delayed(lp, &lp->cal_work,
+					AT86RF215_CAL_RETRY);
+}
+
+/************************** Runtime power management ***********************/
+
+/* After pm_idle_ms without any activity the transceiver is put in SLEEP. If
+ * pm_deep_sleep is set, the unused RF24 transceiver is put in SLEEP as well,
+ * which makes the chip enter DEEP_SLEEP: the current drops further but the
+ * registers are lost. They are then restored from the regmap cache by one
+ * regcache_sync(), whose rbtree backend writes contiguous registers in
+ * auto-increment bursts.
+ *
+ * The radio is woken up by xmit (the frame is deferred the same way as during
+ * a recalibration) or, if pm_rx_period_ms is set, periodically to listen
+ * for pm_rx_window_ms. */
+
+/* (Re)arm the idle timer. Called whenever the radio becomes idle. */
+static void at86rf215_pm_idle(struct at86rf215_local *lp)
+{
+	u32 idle_ms = READ_ONCE(lp->pm_idle_ms);
+
+	/* Down: the config ops kick their own writes, nothing sleeps */
+	if (!READ_ONCE(lp->started))
+		return;
+
+	/* The radio just became idle: staged configuration goes first */
+	at86rf215_cfg_kick(lp);
+
+	if (idle_ms)
+		at86rf215_queue_delayed(lp, &lp->pm_work,
+					msecs_to_jiffies(idle_ms));
+}
+
+static int at86rf215_pm_suspend(struct at86rf215_local *lp)
+{
+	int rc;
+
+	if (lp->pm_deep_sleep) {
+		rc = regmap_write(lp->regmap, RG_RF24_CMD, RF_SLEEP_STATUS);
+		if (rc)
+			return rc;
+	}
+
+	rc = regmap_write(lp->regmap, RG_RF09_CMD, RF_SLEEP_STATUS);
+	if (rc)
+		return rc;
+
+	/* Registers written while we sleep only land in the cache */
+	if (lp->pm_deep_sleep) {
+		regcache_cache_only(lp->regmap, true);
+		regcache_mark_dirty(lp->regmap);
+	}
+
+	return 0;
+}
+
+static int at86rf215_pm_resume(struct at86rf215_local *lp)
+{
+	struct at86rf215_chip_data *c = lp->data;
+	int rc;
+
+	if (lp->pm_deep_sleep)
+		regcache_cache_only(lp->regmap, false);
+
+	rc = regmap_write(lp->regmap, RG_RF09_CMD, RF_TRXOFF_STATUS);
+	if (rc)
+		return rc;
+
+	if (lp->pm_deep_sleep) {
+		usleep_range(c->t_dsleep_to_off, c->t_dsleep_to_off + 10);
+		return regcache_sync(lp->regmap);
+	}
+
+	udelay(c->t_sleep_to_off);
+	return 0;
+}
+
+/* Wake the radio up if it sleeps and start the deferred frame, if any. If no
+ * frame is waiting and @rx is set, the radio listens until the idle timer
+ * puts it back to sleep. */
+static void at86rf215_pm_wake(struct at86rf215_local *lp, bool rx)
+{
+	struct at86rf215_stats *st = &lp->stats;
+	unsigned long flags;
+	bool tx_deferred;
+	ktime_t now;
+	u64 ns;
+	int rc;
+
+	mutex_lock(&lp->pm_lock);
+	if (!lp->is_sleep) {
+		mutex_unlock(&lp->pm_lock);
+		return;
+	}
+
+	rc = at86rf215_pm_resume(lp);
+	if (rc)
+		dev_err(&lp->spi->dev, "failed to wake up: %d\n", rc);
+
+	now = ktime_get();
+	st->pm_wakes++;
+	st->pm_asleep_ns += ktime_to_ns(ktime_sub(now, lp->pm_sleep_start));
+
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_sleep = false;
+	tx_deferred = lp->tx_deferred;
+	lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	mutex_unlock(&lp->pm_lock);
+
+	if (tx_deferred) {
+		ns = ktime_to_ns(ktime_sub(now, lp->pm_wake_req));
+		st->pm_wake_tx++;
+		st->pm_wake_last_ns = ns;
+		st->pm_wake_total_ns += ns;
+		if (ns > st->pm_wake_max_ns)
+			st->pm_wake_max_ns = ns;
+
+		at86rf215_tx_start(lp);
+		return;
+	}
+
+	if (rx && lp->pm_rx_window_ms) {
+		regmap_write(lp->regmap, RG_RF09_CMD, RF_RX_STATUS);
+		at86rf215_queue_delayed(lp, &lp->pm_work,
+					msecs_to_jiffies(lp->pm_rx_window_ms));
+		return;
+	}
+
+	at86rf215_pm_idle(lp);
+}
+
+static void at86rf215_pm_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(to_delayed_work(work), struct at86rf215_local,
+			     pm_work);
+	unsigned long flags;
+	bool idle;
+	int rc;
+
+	mutex_lock(&lp->pm_lock);
+	spin_lock_irqsave(&lp->lock, flags);
+	idle = READ_ONCE(lp->started) && at86rf215_is_idle(lp) &&
+	       !READ_ONCE(lp->bcn.running);
+	if (idle)
+		lp->is_sleep = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	/* Whoever is busy rearms the idle timer when it is done, start()
+	 * does it once the radio is up again and at86rf215_bcn_stop() once
+	 * the beacons are over. */
+	if (!idle) {
+		mutex_unlock(&lp->pm_lock);
+		return;
+	}
+
+	rc = at86rf215_pm_suspend(lp);
+	if (rc) {
+		dev_err(&lp->spi->dev, "failed to enter sleep: %d\n", rc);
+		spin_lock_irqsave(&lp->lock, flags);
+		lp->is_sleep = false;
+		spin_unlock_irqrestore(&lp->lock, flags);
+		mutex_unlock(&lp->pm_lock);
+		return;
+	}
+
+	lp->pm_sleep_start = ktime_get();
+	lp->stats.pm_sleeps++;
+	mutex_unlock(&lp->pm_lock);
+
+	if (lp->pm_rx_period_ms)
+		at86rf215_queue_delayed(lp, &lp->pm_rx_work,
+					msecs_to_jiffies(lp->pm_rx_period_ms));
+}
+
+static void at86rf215_pm_rx_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(to_delayed_work(work), struct at86rf215_local,
+			     pm_rx_work);
+
+	at86rf215_pm_wake(lp, true);
+}
+
+static void at86rf215_pm_wake_work(struct work_struct *work)
+{
+	struct at86rf215_local *lp =
+		container_of(work, struct at86rf215_local, pm_wake_work);
+
+	at86rf215_pm_wake(lp, false);
+}
+
+static int at86rf215_ed(struct ieee802154_hw *hw, u8 *level)
+{
+	printk(KERN_DEBUG "[CCA]: Starting ..");
+	WARN_ON(!level);
+	*level = 0xbe;
+	return 0;
+}
+
+static int at86rf215_start(struct ieee802154_hw *hw)
+{
+	struct at86rf215_local *lp = hw->priv;
+
+	printk(KERN_DEBUG "[start]: called. ");
+	/* Asleep since probe or since the last stop: wake up before RX */
+	at86rf215_pm_wake(lp, false);
+	enable_irq(lp->spi->irq);
+	WRITE_ONCE(lp->started, true);
+
+	/* Listen; after each TX the radio returns to RX by itself (TX2RX) */
+	regmap_write(lp->regmap, RG_RF09_CMD, RF_RX_STATUS);
+
+	if (time_after_eq(jiffies + AT86RF215_CAL_SLACK, lp->cal_timeout))
+		lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	at86rf215_queue_delayed(lp, &lp->cal_work,
+				lp->cal_timeout - jiffies -
+				AT86RF215_CAL_SLACK);
+	at86rf215_pm_idle(lp);
+	return 0;
+}
+
+static void at86rf215_stop(struct ieee802154_hw *hw)
+{
+	struct at86rf215_local *lp = hw->priv;
+	unsigned long flags;
+	bool backoff;
+
+	/* From here at86rf215_pm_idle() leaves the idle timer alone and the
+	 * generator and the beacons can not be started again */
+	WRITE_ONCE(lp->started, false);
+
+	/* The registers must be reachable again before we touch them */
+	cancel_delayed_work_sync(&lp->pm_work);
+	cancel_delayed_work_sync(&lp->pm_rx_work);
+	cancel_work_sync(&lp->pm_wake_work);
+	at86rf215_pm_wake(lp, false);
+
+	/* The generator and the beacons need TXFE, stop them while the IRQ
+	 * is still on */
+	at86rf215_txgen_stop(lp);
+	at86rf215_bcn_stop(hw);
+
+	cancel_delayed_work_sync(&lp->cal_work);
+
+	/* A frame waiting for its ACK or its retry is given up. The ACK work
+	 * may arm the backoff timer, it is cancelled last. */
+	hrtimer_cancel(&lp->tx_ack_timer);
+	backoff = cancel_work_sync(&lp->tx_ack_work);
+	backoff |= hrtimer_cancel(&lp->tx_backoff_timer);
+	spin_lock_irqsave(&lp->lock, flags);
+	backoff |= lp->is_ack;
+	lp->is_ack = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (backoff) {
+		lp->stats.tx_no_ack++;
+		lp->tx_no_ack = true;
+		at86rf215_tx_complete(lp);
+	}
+
+	/* Leave the IRQ moderation, the line is disabled once below */
+	cancel_work_sync(&lp->rx_poll_work);
+	if (lp->rx_poll_irq_off) {
+		lp->rx_poll_irq_off = false;
+		enable_irq(lp->spi->irq);
+	}
+	if (lp->rx_batch) {
+		lp->rx_batch = false;
+		regmap_update_bits(lp->regmap, RG_BBC0_IRQM, IRQS_0_RXFS,
+				   IRQS_0_RXFS);
+	}
+	disable_irq(lp->spi->irq);
+}
+
+/************************ Control plane staging ************************/
+
+/* Stage (addr & mask) = val << shift, takes the SR_* triplets */
+static int at86rf215_cfg_stage(struct at86rf215_local *lp, unsigned int addr,
+			       unsigned int mask, unsigned int shift,
+			       unsigned int val)
+{
+	struct at86rf215_cfg *cfg = &lp->cfg;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	/* A register staged twice keeps its first slot, so CNL stays before
+	 * CNM (written last, it triggers the channel switch) */
+	for (i = 0; i < cfg->count; i++)
+		if (cfg->reg[i] == addr)
+			break;
+	if (i == AT86RF215_CFG_REGS) {
+		spin_unlock_irqrestore(&lp->lock, flags);
+		return -ENOSPC;
+	}
+	if (i == cfg->count) {
+		cfg->reg[i] = addr;
+		cfg->mask[i] = 0;
+		cfg->val[i] = 0;
+		cfg->count++;
+	}
+	cfg->mask[i] |= mask;
+	cfg->val[i] = (cfg->val[i] & ~mask) | ((val << shift) & mask);
+	cfg->gen++;
+	lp->stats.cfg_staged++;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	return 0;
+}
+
+static void at86rf215_cfg_kick(struct at86rf215_local *lp)
+{
+	if (READ_ONCE(lp->cfg.count))
+		at86rf215_queue_work(lp, &lp->cfg.work);
+}
+
+/* Wait until everything staged so far is on the chip */
+static int at86rf215_cfg_wait(struct at86rf215_local *lp)
+{
+	struct at86rf215_cfg *cfg = &lp->cfg;
+	u32 gen = READ_ONCE(cfg->gen);
+
+	if (!wait_event_timeout(cfg->wait,
+				(s32)(READ_ONCE(cfg->applied) - gen) >= 0,
+				AT86RF215_CFG_TIMEOUT))
+		return -ETIMEDOUT;
+
+	return READ_ONCE(cfg->err);
+}
+
+static void at86rf215_cfg_work(struct work_struct *work)
+{
+	struct at86rf215_cfg *cfg = container_of(work, struct at86rf215_cfg,
+						 work);
+	struct at86rf215_local *lp = container_of(cfg, struct at86rf215_local,
+						  cfg);
+	u16 reg[AT86RF215_CFG_REGS];
+	u8 mask[AT86RF215_CFG_REGS], val[AT86RF215_CFG_REGS];
+	unsigned int i, j, k, n, cur;
+	unsigned long flags;
+	u32 gen;
+	int rc = 0;
+
+	/* Keeps SLEEP/DEEP_SLEEP transitions out of the way */
+	mutex_lock(&lp->pm_lock);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	n = cfg->count;
+	if (!n || lp->is_tx || lp->is_rx || lp->is_cal || lp->is_scan ||
+	    lp->is_cfg || lp->is_gen || lp->is_bcn) {
+		/* Kicked again by the owner through at86rf215_pm_idle() */
+		spin_unlock_irqrestore(&lp->lock, flags);
+		mutex_unlock(&lp->pm_lock);
+		return;
+	}
+	lp->is_cfg = true;
+	memcpy(reg, cfg->reg, n * sizeof(reg[0]));
+	memcpy(mask, cfg->mask, n);
+	memcpy(val, cfg->val, n);
+	cfg->count = 0;
+	gen = cfg->gen;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	/* Through regmap, so in DEEP_SLEEP (cache only) the writes land in the
+	 * cache which the resume syncs back. Registers staged one after the
+	 * other at consecutive addresses (CNL/CNM, MACEA0-7, MACPID/MACSHA) go
+	 * in one auto-increment burst, in staging order so CNM stays last.
+	 * Whole registers are always written: writing CNM applies the channel
+	 * even if its value did not change. Partial ones are merged with the
+	 * cached value. */
+	for (i = 0; i < n && !rc; i = j) {
+		for (j = i + 1; j < n && reg[j] == reg[j - 1] + 1; j++)
+			;
+
+		if (j - i == 1 && mask[i] != 0xff) {
+			rc = regmap_update_bits(lp->regmap, reg[i], mask[i],
+						val[i]);
+			continue;
+		}
+
+		for (k = i; k < j && !rc; k++) {
+			if (mask[k] == 0xff)
+				continue;
+			rc = regmap_read(lp->regmap, reg[k], &cur);
+			val[k] = (cur & ~mask[k]) | (val[k] & mask[k]);
+		}
+		if (!rc)
+			rc = regmap_bulk_write(lp->regmap, reg[i], &val[i],
+					       j - i);
+	}
+
+	if (!rc) {
+		lp->stats.cfg_applies++;
+		lp->stats.cfg_regs += n;
+	} else {
+		dev_err(&lp->spi->dev, "configuration write failed: %d\n", rc);
+	}
+
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_cfg = false;
+	/* On error the rest of the batch is dropped, the waiters get the
+	 * errno */
+	WRITE_ONCE(cfg->err, rc);
+	WRITE_ONCE(cfg->applied, gen);
+	spin_unlock_irqrestore(&lp->lock, flags);
+	mutex_unlock(&lp->pm_lock);
+
+	wake_up_all(&cfg->wait);
+	if (!at86rf215_tx_resume(lp))
+		at86rf215_pm_idle(lp);
+}
+
+/* TODO:
+ * 1. Before setting the channel, check if the state is on TRXOFF
+ * 2. See with Madani if we should add equations here to determine the "Channel
+ * Center Frequency" and "The channel Spacing" or not. */
+/* The register CNM ( Both Channel Mode and Channel Number High Bit Settings
+ * must be written "last". */
+/* The register SR_RF09_CNM_CNH is only needed for frequency range (2400-2483.5)MHz,
+ * MR-OFDM Option 4 and MR-FSK mode #1 for: TotalNumChan=416. So in our case, it's
+ * gonna be set at 0. */
+static int at86rf215_set_channel(struct at86rf215_local *lp, u8 page,
+				 u8 channel)
+{
+	int rc;
+
+	/*unsigned int cf_low=0, cf_high=0, cs=0;*/
+
+	printk(KERN_DEBUG "[channel]: Setting ..");
+
+	/*Channel Center Frequency*/
+/*      cf_low = channel_freq & 0x00ff;
+ *      cf_high = ( channel_freq & 0xff00 ) >> 8;
+ *      rc = (regmap_write( lp->regmap, RG_RF09_CCF0L, cf_low) &&
+ *      regmap_write( lp->regmap, RG_RF09_CCF0H, cf_high));
+ *      if (rc)
+ *              return rc;
+ */
+	/*Channel Spacing*/
+/*      rc = regmap_write(lp->regmap, RG_RF09_CS, cs);
+ *      if (rc)
+ *              return rc;
+ */
+	if (channel > AT86RF215_RF09_MAX_CHANNEL) {
+		printk(KERN_DEBUG "Please insert a channel from 0 to 10");
+		return -EINVAL;
+	}
+
+	/* Channel number, then CNM which applies it: IEEE compliant channel
+	 * scheme (CM = 0), CNH = 0 */
+	rc = at86rf215_cfg_stage(lp, RG_RF09_CNL, 0xff, 0, channel);
+	if (rc)
+		return rc;
+
+	return at86rf215_cfg_stage(lp, RG_RF09_CNM, 0xff, 0, 0x00);
+
+	/*Channel Number*/
+/*	rc = (regmap_write(lp->regmap, RG_RF09_CNL, channel) ||
+ *	at86rf215_write_subreg(lp, SR_RF09_CNM_CNH, 0x0));
+ *      if (rc){
+ *              printk(KERN_DEBUG "RG_RF09_CNL/SR_RF09_CNM_CNH can't be set");
+ *              return rc;
+ *      }
+ */
+	/*Channel Mode 0 : IEEE compliant channel scheme*/
+/*      rc = at86rf215_write_subreg(lp, SR_RF09_CNM_CM, 0x0);
+ *      if (rc){
+ *              printk(KERN_DEBUG "SR_RF09_CNM_CM can't be set");
+ *              return rc;
+ *      }
+ */
+/*      rc = at86rf215_write_subreg(lp, SR_RF09_CNM_CNH, 0x0);
+ *      if (rc){
+ *              printk(KERN_DEBUG "RG_RF09_CNM can't be set");
+ *              return rc;
+ *      }
+ *
+ *      rc = regmap_write(lp->regmap, RG_RF09_CNM, 0x00);
+ *      if (rc){
+ *              printk(KERN_ALERT "RG_RF09_CNM cant be written.");
+ *      }
+ */
+}
+
+#define AT86RF215_MAX_ED_LEVELS 0xF /* 16 registers */
+/* TODO: These values are so random, they should be edited. */
+static const s32 at86rf215_ed_levels[AT86RF215_MAX_ED_LEVELS + 1] = {
+	-9800, -9600, -9400, -9200, -9000, -8800, -8600, -8400, -8200, -8000,
+	-7800, -7600, -7400, -7200, -7000, -6800
+};
+
+/* This function set the channel and the page + set the timeout to recalibrate
+ * means form the current moment, set 5 minutes before the recalibration.
+ * Jiffies : Kernel Internal value
+ * TODO: WHY : + 10 ? */
+static int at86rf215_channel(struct ieee802154_hw *hw, u8 page, u8 channel)
+{
+	struct at86rf215_local *lp = hw->priv;
+	int rc;
+
+	printk(KERN_DEBUG "_channel is being called");
+	rc = lp->data->set_channel(lp, page, channel);
+	if (rc)
+		return rc;
+
+	/* The stack expects the new channel once we return */
+	at86rf215_cfg_kick(lp);
+	rc = at86rf215_cfg_wait(lp);
+	/* Wait for PLL */
+	usleep_range(lp->data->t_pll_ch_switch,
+		     lp->data->t_pll_ch_switch + 10);
+
+	/* The next TXPREP recalibrates for the new channel. */
+	lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	if (READ_ONCE(lp->started))
+		at86rf215_queue_delayed(lp, &lp->cal_work,
+					AT86RF215_CAL_LOOP_TIMEOUT -
+					AT86RF215_CAL_SLACK);
+
+	return rc;
+}
+
+#define AT86RF215_MAX_TX_POWERS 0x1F /* 32 registres */
+/* PLease check datasheet page 50, register concerned: TXPWR */
+static const s32 at86rf215_powers[AT86RF215_MAX_TX_POWERS + 1] =
+{ 0, 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100, 1200, 1300, 1400,
+ 1500, 1600, 1700, 1800, 1900, 2000, 2100, 2200, 2300, 2400, 2500, 2600, 2700,
+ 2800, 2900, 3000, 3100 };
+
+/* Change  the corresponding register with the suitable power value */
+static int at86rf2xx_set_txpower(struct at86rf215_local *lp, s32 mbm)
+{
+	u32 i;
+	int rc;
+
+	for (i = 0; i < lp->hw->phy->supported.tx_powers_size; i++) {
+		if (lp->hw->phy->supported.tx_powers[i] == mbm) {
+			rc = at86rf215_cfg_stage(lp, SR_RF09_PAC_TXPWR, i);
+			if (rc)
+				return rc;
+			at86rf215_cfg_kick(lp);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* TODO: Combine "at86rf215_set_txpower" and "at86rf2xx_set_txpower" . */
+/* Set the transmitter power */
+static int at86rf215_set_txpower(struct ieee802154_hw *hw, s32 mbm)
+{
+	struct at86rf215_local *lp = hw->priv;
+
+	return lp->data->set_txpower(lp, mbm);
+}
+
+/* This function search for the CCA level set ( in the function parameters )
+* if it is supported. Then affected to the registre RG_BBC0_AMEDT.
+* CCA reports a busy medium upon detecting energy above the ED threshold. */
+static int at86rf215_set_cca_ed_level(struct ieee802154_hw *hw, s32 mbm)
+{
+	struct at86rf215_local *lp = hw->priv;
+	u32 i;
+	int rc;
+
+	for (i = 0; i < hw->phy->supported.cca_ed_levels_size; i++) {
+		if (hw->phy->supported.cca_ed_levels[i] == mbm) {
+			rc = at86rf215_cfg_stage(lp, RG_BBC0_AMEDT, 0xff, 0, i);
+			if (rc)
+				return rc;
+			at86rf215_cfg_kick(lp);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+/* Promiscuous mode : The Automatic Acknowledgement shoud be disabled (resp.
+ * enabled) and the promiscuous mode shoud be enabled (resp. disabled). */
+static int at86rf215_set_promiscuous_mode(struct ieee802154_hw *hw,
+					  const bool		on)
+{
+	struct at86rf215_local *lp = hw->priv;
+	int rc;
+
+	/* Both land in the same batch */
+	if (on) {
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AMCS_AACK, 0);
+		if (rc < 0)
+			return rc;
+
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AFC0_PM, 1);
+		if (rc < 0)
+			return rc;
+	} else {
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AMCS_AACK, 1);
+		if (rc < 0)
+			return rc;
+
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AFC0_PM, 0);
+		if (rc < 0)
+			return rc;
+	}
+	at86rf215_cfg_kick(lp);
+
+	return 0;
+}
+
+/* Address filter of frame filter unit 0, which also selects the frames we
+ * acknowledge. The ACK is built by the transceiver (AACKS = 0): sending it
+ * from the TX frame buffer (AACKS/AACKFT) would clobber a frame waiting
+ * there, the pending bit is set through AMAACKPD instead. */
+static int at86rf215_set_hw_addr_filt(struct ieee802154_hw *		hw,
+				      struct ieee802154_hw_addr_filt *	filt,
+				      unsigned long			changed)
+{
+	struct at86rf215_local *lp = hw->priv;
+	u16 addr;
+	u64 ext;
+	int rc = 0, i;
+
+	if (changed & IEEE802154_AFILT_SADDR_CHANGED) {
+		addr = le16_to_cpu(filt->short_addr);
+		rc = at86rf215_cfg_stage(lp, RG_BBC0_MACSHA0F0, 0xff, 0,
+					 addr & 0xff);
+		if (!rc)
+			rc = at86rf215_cfg_stage(lp, RG_BBC0_MACSHA0F0 + 1, 0xff,
+						 0, addr >> 8);
+	}
+
+	if (!rc && (changed & IEEE802154_AFILT_PANID_CHANGED)) {
+		addr = le16_to_cpu(filt->pan_id);
+		rc = at86rf215_cfg_stage(lp, RG_BBC0_MACPID0F0, 0xff, 0,
+					 addr & 0xff);
+		if (!rc)
+			rc = at86rf215_cfg_stage(lp, RG_BBC0_MACPID0F0 + 1, 0xff,
+						 0, addr >> 8);
+	}
+
+	if (!rc && (changed & IEEE802154_AFILT_IEEEADDR_CHANGED)) {
+		ext = le64_to_cpu(filt->ieee_addr);
+		for (i = 0; i < 8 && !rc; i++)
+			rc = at86rf215_cfg_stage(lp, RG_BBC0_MACEA0 + i, 0xff,
+						 0, (ext >> (8 * i)) & 0xff);
+	}
+
+	if (!rc)
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AFC0_AFEN0, 1);
+	if (!rc)
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AMCS_AACKS, 0);
+	if (!rc)
+		rc = at86rf215_cfg_stage(lp, SR_BBC0_AMCS_AACK, 1);
+	if (rc)
+		return rc;
+
+	at86rf215_cfg_kick(lp);
+
+	return 0;
+}
+
+/* These functions represent callbacks that the 802.15.4 module call later */
+static const struct ieee802154_ops at86rf215_ops = {
+	/* It is mendatory to implement these functions. */
+	.owner			= THIS_MODULE,
+	.xmit_async		= at86rf215_xmit,
+	.ed			= at86rf215_ed,
+	.set_channel		= at86rf215_channel,
+	.start			= at86rf215_start,
+	.stop			= at86rf215_stop,
+	/* The following functions are optional. */
+	.set_txpower		= at86rf215_set_txpower,
+	.set_cca_ed_level	= at86rf215_set_cca_ed_level,
+	.set_promiscuous_mode	= at86rf215_set_promiscuous_mode,
+	.set_hw_addr_filt	= at86rf215_set_hw_addr_filt,
+	.set_frame_retries	= at86rf215_set_frame_retries,
+};
+
+/* Datasheet : page 189 (Transition time) */
+static struct at86rf215_chip_data at86rf215_data = {
+	.t_power_to_off		= 500,  /*us*/
+	.t_sleep_to_off		= 1,    /*us*/
+	.t_dsleep_to_off	= 500,  /*us*/
+	.t_reset_to_off		= 1,    /*us*/
+	.t_off_to_prep		= 200,  /*us*/
+	.t_off_to_rx		= 90,   /*us*/
+	.t_prep_to_tx		= 200,  /*ns*/
+	.t_tx_start_delay	= 4,    /*us*/
+	.t_prep_to_rx		= 200,  /*ns*/
+	.t_prep_to_off		= 200,  /*ns*/
+	.t_rx_to_off		= 200,  /*ns*/
+	.t_rx_to_prep		= 200,  /*ns*/
+	.t_txfe_to_prep		= 200,  /*ns*/ /*TX (TXFE) ==> TXPREP */
+	.t_txprep_to_prep	= 33,   /*us*/ /*TX (CMD=TXPREP) ==> TXPREP */
+	.t_tx_to_off		= 200,  /*ns*/ /*TX (CMD=TRXOFF) ==> TRXOFF */
+	.t_vreg_settl		= 35,   /*us*/ /*Settling time of AVDD/DVDD */
+	.t_xosc_settl		= 150,  /*us*/ /*Settling time of crystal OCS*/
+	.t_pll_ch_switch	= 100,  /*us*/ /*Freq channel switch time PLL*/
 	.t_rxfe			= 100,  /*us*/ /*RX(RXFE) depends on PHY mode*/
 	.rssi_base_val		= -117,
 	.set_channel		= at86rf215_set_channel,
 	.set_txpower		= at86rf2xx_set_txpower,
 };
 
-static int at86rf215_hw_init(struct at86rf215_local *lp)
+static int at86rf215_hw_init(struct at86rf215_local *lp)
+{
+	int rc, irq_type, irq_pol = IRQ_ACTIVE_HIGH;
+	unsigned int val;
+
+	/* TODO: This should be replaced with an async function. */
+	/* Check if we're in state TRXOFF */
+	rc = regmap_read(lp->regmap, RG_RF09_STATE, &val);
+	if ((rc) || (val != RF_TRXOFF_STATUS)) {
+		printk(KERN_DEBUG "Hardware Initialisation: FAILED!");
+		return rc;
+	}
+
+	/* Configuring the IRQ pin polarity. */
+	irq_type = irq_get_trigger_type(lp->spi->irq);
+	if (irq_type == IRQ_TYPE_EDGE_FALLING || irq_type == IRQ_TYPE_LEVEL_LOW)
+		irq_pol = IRQ_ACTIVE_LOW;
+	rc = at86rf215_write_subreg(lp, SR_RF_CFG_IRQP, irq_pol);
+	if (rc) {
+		printk(KERN_DEBUG "IRQ configuration: FAILED!");
+		return rc;
+	}
+
+	/* Masked IRQs are still reported in IRQS, for the RX poll loop */
+	rc = at86rf215_write_subreg(lp, SR_RF_CFG_IRQMM, 1);
+	if (rc) {
+		printk(KERN_DEBUG "IRQ mask mode configuration: FAILED!");
+		return rc;
+	}
+
+	return 0;
+}
+
+/* This configuration is custom for our application, just for test.*/
+static int at86rf215_config(struct at86rf215_local *lp)
+{
+	unsigned int val;
+	int rc;
+
+	/* None of the radio IRQs is handled, and RF09_IRQS is never read:
+	 * left enabled they would hold a level triggered line */
+	rc = regmap_write(lp->regmap, RG_RF09_IRQM, 0x00);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_IRQM: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_CS, 0x30);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_CS: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_CCF0L, 0x20);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_CCF0L: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_CCF0H, 0x8D);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_CCF0H: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_CNL, 0x03);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_CNL: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_RXBWC, 0x09);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_RXBWC: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_RXDFE, 0x83);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_RXDFE: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_EDD, 0x7A);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_EDD: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_TXCUTC, 0x0B);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_TXCUTC: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_TXDFE, 0x83);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_TXDFE: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_RF09_PAC, 0x7C);
+	if (rc) {
+		printk(KERN_DEBUG "RG_RF09_PAC: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_BBC0_IRQM, AT86RF215_BBC0_IRQM);
+	if (rc)
+		printk(KERN_ALERT "RG_BBC0_IRQM: Impossible to write in.");
+	rc = regmap_write(lp->regmap, RG_BBC0_PC, 0x56);
+	if (rc) {
+		printk(KERN_ALERT "RG_BBC0_PC: Impossible to write in.");
+		return rc;
+	}
+	rc = at86rf215_read_subreg(lp, SR_BBC0_PC_FCST, &val);
+	if (rc) {
+		printk(KERN_ALERT "RG_BBC0_PC: Impossible to read.");
+		return rc;
+	}
+	lp->fcs_len = val ? 2 : 4;
+	rc = at86rf215_write_subreg(lp, SR_BBC0_AMCS_TX2RX, 1);
+	if (rc) {
+		printk(KERN_ALERT "RG_BBC0_AMCS: Impossible to write in.");
+		return rc;
+	}
+	rc = regmap_write(lp->regmap, RG_BBC0_OFDMPHRTX, AT86RF215_TX_MCS);
+	if (rc) {
+		printk(KERN_ALERT "RG_BBC0_OFDMPHRTX: Impossible to write in.");
+		return rc;
+	}
+	lp->tx_mcs = AT86RF215_TX_MCS;
+	rc = regmap_write(lp->regmap, RG_RF09_CNM, 0x00);
+	if (rc) {
+		printk(KERN_ALERT "RG_RF09_CNM: Impossible to write in.");
+		return rc;
+	}
+	return 0;
+}
+
+/* Check if device tree definition for the spi device is correct. */
+static int at86rf215_get_pdata(struct spi_device *spi, int *rstn)
+{
+	struct at86rf215_platform_data *pdata = spi->dev.platform_data;
+
+	/* dev.of_node :associated device tree node */
+	if (!IS_ENABLED(CONFIG_OF) || !spi->dev.of_node) {
+		if (!pdata)
+			return -ENOENT;
+
+		*rstn = pdata->rstn;
+		return 0;
+	}
+
+	/* Get RESET GPIO Number */
+	*rstn = of_get_named_gpio(spi->dev.of_node, "reset-gpio", 0);
+
+	return 0;
+}
+
+static int at86rf215_detect_device(struct at86rf215_local *lp)
+{
+	unsigned int part, version;
+	int rc;
+
+	rc = regmap_read(lp->regmap, RG_RF_VN, &version);
+	if (rc)
+		return rc;
+	printk(KERN_DEBUG "[Detecting]: AT86RF215 version: %x", version);
+
+	rc = regmap_read(lp->regmap, RG_RF_PN, &part);
+	if (rc)
+		return rc;
+	/* printk (KERN_DEBUG "[Detecting]: AT86RF215 PN: %x", part); */
+
+	/* TODO: Check this stupid test. */
+/*        if ( (version != 1) || (version != 3)) {
+ *              dev_err(&lp->spi->dev, "VN %x doesn't exist. ", version);
+ *              return -EINVAL;
+ *      }
+ *      if ((part != 52) | (part != 53) || (part != 54)) {
+ *              dev_err(&lp->spi->dev, "PN %x doesn't exist.", part);
+ *              return -EINVAL;
+ *      }
+ */
+
+	/* Please check mac802154.h */
+	lp->hw->flags = IEEE802154_HW_TX_OMIT_CKSUM |   /*Tx will add FCS aut*/
+			IEEE802154_HW_RX_OMIT_CKSUM |   /*Rx will add FCS aut*/
+			IEEE802154_HW_PROMISCUOUS |     /*Support promiscuous mode*/
+			IEEE802154_HW_AFILT |           /*Address filter, AACK*/
+			IEEE802154_HW_FRAME_RETRIES;    /*Retries from the FB*/
+
+	/* Please check cfg802154.h */
+	lp->hw->phy->flags = WPAN_PHY_FLAG_TXPOWER |      /*TXPWR setting*/
+			     WPAN_PHY_FLAG_CCA_ED_LEVEL | /*cca ED threshold */
+			     WPAN_PHY_FLAG_CCA_MODE;      /*cca mode setting*/
+
+	/* NL802154_CCA_ENERGY :Energy above threshold */
+	/* (CCA-ED) is supported only, please refer to Datasheet (p148) */
+	lp->hw->phy->supported.cca_modes = BIT(NL802154_CCA_ENERGY);
+	lp->hw->phy->supported.cca_opts =
+		BIT(NL802154_CCA_OPT_ENERGY_CARRIER_OR);
+	lp->hw->phy->cca.mode = NL802154_CCA_ENERGY;
+
+	lp->data = &at86rf215_data;
+
+	/* 868 MHz BPSK 802.15.4-2003 */
+	lp->hw->phy->supported.channels[0] |= 1;
+	/* 915 MHz BPSK 802.15.4-2003 */
+	lp->hw->phy->supported.channels[0] |= 0x7fe;
+	/* 2.4 GHz O-QPSK 802.15.4-2003 */
+	lp->hw->phy->supported.channels[0] |= 0x7FFF800;
+	/* 868 MHz ASK 802.15.4-2006 */
+	lp->hw->phy->supported.channels[1] |= 1;
+	/* 915 MHz ASK 802.15.4-2006 */
+	lp->hw->phy->supported.channels[1] |= 0x7fe;
+	/* 868 MHz O-QPSK 802.15.4-2006 */
+	lp->hw->phy->supported.channels[2] |= 1;
+	/* 915 MHz O-QPSK 802.15.4-2006 */
+	lp->hw->phy->supported.channels[2] |= 0x7fe;
+
+	/* Select page and channel by default. */
+	lp->hw->phy->current_channel = 3;
+	lp->hw->phy->current_page = 2;
+
+	/* Symbol_duration: la duree d'un symbole PSDU module et code */
+	lp->hw->phy->symbol_duration = 4; /*(ttx_start_delay)*/
+	lp->hw->phy->supported.min_frame_retries = -1;
+	lp->hw->phy->supported.max_frame_retries = AT86RF215_TX_MAX_RETRIES;
+	lp->hw->phy->supported.tx_powers = at86rf215_powers;
+	lp->hw->phy->supported.tx_powers_size = ARRAY_SIZE(at86rf215_powers);
+	lp->hw->phy->supported.cca_ed_levels = at86rf215_ed_levels;
+	lp->hw->phy->supported.cca_ed_levels_size = ARRAY_SIZE(
+		at86rf215_ed_levels);
+
+	/* Define the ED threshold + the transmitter power */
+	lp->hw->phy->cca_ed_level = lp->hw->phy->supported.cca_ed_levels[7];
+	lp->hw->phy->transmit_power = lp->hw->phy->supported.tx_powers[28];
+
+	return rc;
+}
+
+/************************* Energy detection scan ***************************/
+
+/* Write @state to RG_RF09_CMD and poll RG_RF09_STATE until it is reached.
+ * Process context only. */
+static int at86rf215_sync_state(struct at86rf215_local *lp, u8 state)
+{
+	unsigned int val, tries = 10;
+	int rc;
+
+	rc = regmap_write(lp->regmap, RG_RF09_CMD, state);
+	if (rc)
+		return rc;
+
+	do {
+		rc = regmap_read(lp->regmap, RG_RF09_STATE, &val);
+		if (rc)
+			return rc;
+		if (val == state)
+			return 0;
+		usleep_range(lp->data->t_off_to_prep,
+			     lp->data->t_off_to_prep + 10);
+	} while (--tries);
+
+	return -ETIMEDOUT;
+}
+
+/* Smallest EDD (time basis, factor) covering @dwell_us */
+static u8 at86rf215_ed_duration(u32 dwell_us)
+{
+	static const u8 dtb_us[] = { 2, 8, 32, 128 };
+	unsigned int dtb, df;
+
+	for (dtb = 0; dtb < ARRAY_SIZE(dtb_us) - 1; dtb++)
+		if (DIV_ROUND_UP(dwell_us, dtb_us[dtb]) <= 0x3f)
+			break;
+
+	df = clamp_t(unsigned int, DIV_ROUND_UP(dwell_us, dtb_us[dtb]), 1,
+		     0x3f);
+
+	return df << 2 | dtb;
+}
+
+/* The whole sweep of at86rf215_ed_scan(), one SPI message. Per channel: the
+ * CNL/CNM burst, RX then the settle time in delay_usecs, the EDV read and
+ * back to TXPREP, each in its own chip select frame. */
+struct at86rf215_ed_msg {
+	struct spi_message	msg;
+	struct spi_transfer	trx[AT86RF215_RF09_MAX_CHANNEL + 1][4];
+	u8			cn[AT86RF215_RF09_MAX_CHANNEL + 1][4];
+	u8			edv[AT86RF215_RF09_MAX_CHANNEL + 1][3];
+	u8			edv_cmd[3];
+	u8			rx_cmd[3];
+	u8			prep_cmd[3];
+};
+
+static void at86rf215_ed_msg_setup(struct at86rf215_local *lp,
+				   struct at86rf215_ed_msg *ed, u8 cnm,
+				   u16 settle_us)
+{
+	struct spi_transfer *t;
+	u8 ch;
+
+	ed->edv_cmd[0] = (RG_RF09_EDV & CMD_REG_MSB) >> 8;
+	ed->edv_cmd[1] = RG_RF09_EDV & CMD_REG_LSB;
+	ed->rx_cmd[0] = ((RG_RF09_CMD & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	ed->rx_cmd[1] = RG_RF09_CMD & CMD_REG_LSB;
+	ed->rx_cmd[2] = RF_RX_STATUS;
+	memcpy(ed->prep_cmd, ed->rx_cmd, 2);
+	ed->prep_cmd[2] = RF_TXPREP_STATUS;
+
+	spi_message_init(&ed->msg);
+	for (ch = 0; ch <= AT86RF215_RF09_MAX_CHANNEL; ch++) {
+		t = ed->trx[ch];
+
+		/* CNM must be written last, it triggers the PLL */
+		ed->cn[ch][0] = ((RG_RF09_CNL & CMD_REG_MSB) >> 8) | CMD_WRITE;
+		ed->cn[ch][1] = RG_RF09_CNL & CMD_REG_LSB;
+		ed->cn[ch][2] = ch;
+		ed->cn[ch][3] = cnm & ~0x01;
+		t[0].tx_buf = ed->cn[ch];
+		t[0].len = 4;
+
+		t[1].tx_buf = ed->rx_cmd;
+		t[1].len = 3;
+		t[1].delay_usecs = settle_us;
+
+		t[2].tx_buf = ed->edv_cmd;
+		t[2].rx_buf = ed->edv[ch];
+		t[2].len = 3;
+
+		t[3].tx_buf = ed->prep_cmd;
+		t[3].len = 3;
+
+		t[0].cs_change = t[1].cs_change = t[2].cs_change = 1;
+		t[3].cs_change = ch != AT86RF215_RF09_MAX_CHANNEL;
+
+		spi_message_add_tail(&t[0], &ed->msg);
+		spi_message_add_tail(&t[1], &ed->msg);
+		spi_message_add_tail(&t[2], &ed->msg);
+		spi_message_add_tail(&t[3], &ed->msg);
+	}
+	at86rf215_msg_set_speed(&ed->msg, lp->spi_hz);
+}
+
+/* Measure the energy on every RF09 channel. The energy does not depend on the
+ * page, only on the channel frequency, so each channel is measured once.
+ *
+ * The ED runs continuously while the radio is in RX. For each channel the
+ * PLL is retuned in TXPREP by a CNL/CNM burst, then the radio goes to RX for
+ * one ED duration and EDV is read back: a channel costs
+ * t_pll_ch_switch + ED duration. The sweep is a single SPI message, the
+ * settle times are chip select delays so no round trip to the CPU is left
+ * between two channels. A sleeping radio is woken up first. */
+static int at86rf215_ed_scan(struct at86rf215_local *lp)
+{
+	struct at86rf215_ed_msg *ed;
+	unsigned int cnl, cnm, edc, edd, state;
+	unsigned long flags;
+	u32 settle_us;
+	ktime_t start;
+	bool idle, tx_deferred;
+	u8 ch, buf[2];
+	int rc;
+
+	ed = kzalloc(sizeof(*ed), GFP_KERNEL);
+	if (!ed)
+		return -ENOMEM;
+
+	at86rf215_pm_wake(lp, false);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	idle = at86rf215_is_idle(lp);
+	if (idle)
+		lp->is_scan = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (!idle) {
+		kfree(ed);
+		return -EBUSY;
+	}
+
+	start = ktime_get();
+	rc = regmap_read(lp->regmap, RG_RF09_STATE, &state) ||
+	     regmap_read(lp->regmap, RG_RF09_CNL, &cnl) ||
+	     regmap_read(lp->regmap, RG_RF09_CNM, &cnm) ||
+	     regmap_read(lp->regmap, RG_RF09_EDC, &edc) ||
+	     regmap_read(lp->regmap, RG_RF09_EDD, &edd);
+	if (rc) {
+		rc = -EIO;
+		goto out;
+	}
+
+	rc = at86rf215_sync_state(lp, RF_TRXOFF_STATUS);
+	if (rc)
+		goto out;
+
+	rc = regmap_write(lp->regmap, RG_RF09_EDD,
+			  at86rf215_ed_duration(lp->ed_scan_dwell_us));
+	if (rc)
+		goto restore;
+	rc = at86rf215_write_subreg(lp, SR_RF09_EDC_EDM, RF_EDCONT);
+	if (rc)
+		goto restore;
+	rc = at86rf215_sync_state(lp, RF_TXPREP_STATUS);
+	if (rc)
+		goto restore;
+
+	settle_us = lp->data->t_pll_ch_switch + lp->ed_scan_dwell_us;
+	at86rf215_ed_msg_setup(lp, ed, cnm, min_t(u32, settle_us, USHRT_MAX));
+	rc = spi_sync(lp->spi, &ed->msg);
+	if (rc)
+		goto restore;
+	for (ch = 0; ch <= AT86RF215_RF09_MAX_CHANNEL; ch++)
+		lp->ed_scan[ch] = (s8)ed->edv[ch][2];
+
+restore:
+	/* CNL/CNM went around regmap: the burst below writes the cached
+	 * values back */
+	at86rf215_sync_state(lp, RF_TRXOFF_STATUS);
+	buf[0] = cnl;
+	buf[1] = cnm;
+	regmap_write(lp->regmap, RG_RF09_EDD, edd);
+	regmap_write(lp->regmap, RG_RF09_EDC, edc);
+	regmap_bulk_write(lp->regmap, RG_RF09_CNL, buf, 2);
+	if (state == STATE_RF_TXPREP || state == STATE_RF_RX)
+		at86rf215_sync_state(lp, state);
+
+	lp->stats.ed_scans++;
+	lp->stats.ed_scan_last_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+out:
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_scan = false;
+	tx_deferred = lp->tx_deferred;
+	lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (tx_deferred)
+		at86rf215_tx_start(lp);
+	else
+		at86rf215_pm_idle(lp);
+
+	kfree(ed);
+	return rc;
+}
+
+/* Reading the "ed_scan" debugfs file runs a scan and lists the energy of
+ * every advertised channel once, with the pages it is advertised on. The
+ * 2.4 GHz channels (11-26) belong to RF24, which is not driven: they are
+ * listed as unsupported. */
+static int at86rf215_ed_scan_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct wpan_phy *phy = lp->hw->phy;
+	bool first;
+	u8 page, ch;
+	int rc;
+
+	rc = at86rf215_ed_scan(lp);
+	if (rc)
+		return rc;
+
+	seq_printf(file, "# scan_us: %llu, dwell_us: %u\n",
+		   lp->stats.ed_scan_last_ns / 1000, lp->ed_scan_dwell_us);
+	seq_puts(file, "channel\tpages\ted_dbm\n");
+	for (ch = 0; ch <= IEEE802154_MAX_CHANNEL; ch++) {
+		first = true;
+		for (page = 0; page <= IEEE802154_MAX_PAGE; page++) {
+			if (!(phy->supported.channels[page] & BIT(ch)))
+				continue;
+			if (first)
+				seq_printf(file, "%u\t%u", ch, page);
+			else
+				seq_printf(file, ",%u", page);
+			first = false;
+		}
+		if (first)
+			continue;
+
+		if (ch > AT86RF215_RF09_MAX_CHANNEL)
+			seq_puts(file, "\tunsupported\n");
+		else if (lp->ed_scan[ch] == RF_EDV_INVALID)
+			seq_puts(file, "\tinvalid\n");
+		else
+			seq_printf(file, "\t%d\n", lp->ed_scan[ch]);
+	}
+
+	return 0;
+}
+
+static int at86rf215_ed_scan_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at86rf215_ed_scan_show, inode->i_private);
+}
+
+static const struct file_operations at86rf215_ed_scan_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_ed_scan_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/****************************** Sniffer mode ********************************/
+
+static struct at86rf215_sniff_frame *
+at86rf215_sniff_slot(struct at86rf215_sniffer *sn, u32 index)
+{
+	return (void *)sn->ring + AT86RF215_SNIFF_DATA_OFF +
+	       (index % AT86RF215_SNIFF_SLOTS) * AT86RF215_SNIFF_SLOT_SIZE;
+}
+
+static void at86rf215_sniff_frame_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	struct at86rf215_sniff_ring *ring = sn->ring;
+
+	if (sn->frame_msg.status) {
+		ring->drops++;
+	} else {
+		/* Publish the slot content before the new head */
+		smp_store_release(&ring->head, ring->head + 1);
+		ring->frames++;
+	}
+
+	/* Readers in poll and sniff_stop() */
+	clear_bit_unlock(AT86RF215_SNIFF_BUSY, &sn->flags);
+	wake_up(&sn->wait);
+}
+
+static void at86rf215_sniff_info_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	struct at86rf215_sniff_ring *ring = sn->ring;
+	struct at86rf215_sniff_frame *slot;
+	const u8 *pc = sn->info_buf[0] + 2;
+	const u8 *cnt = sn->info_buf[1] + 2;
+	u32 len;
+	int rc;
+
+	/* PC, PS, -, RXFLL, RXFLH */
+	len = pc[3] | (pc[4] & 0x07) << 8;
+	if (sn->info_msg.status || !len ||
+	    ring->head - smp_load_acquire(&ring->tail) >=
+	    AT86RF215_SNIFF_SLOTS)
+		goto drop;
+
+	slot = at86rf215_sniff_slot(sn, ring->head);
+	slot->tstamp_ns = ktime_get_ns();
+	slot->hw_tstamp = cnt[0] | cnt[1] << 8 | cnt[2] << 16 | cnt[3] << 24;
+	slot->len = len;
+	slot->rssi = (s8)sn->info_buf[2][2];
+	slot->flags = (pc[0] & 0x20) ? AT86RF215_SNIFF_FCS_OK : 0;
+
+	sn->frame_trx[1].rx_buf = slot->data;
+	sn->frame_trx[1].len = len;
+	rc = spi_async(lp->spi, &sn->frame_msg);
+	if (rc)
+		goto drop;
+
+	return;
+
+drop:
+	ring->drops++;
+	clear_bit_unlock(AT86RF215_SNIFF_BUSY, &sn->flags);
+	wake_up(&sn->wait);
+}
+
+/* Called on RXFE. A frame ending while the previous one is still being read
+ * out is dropped: the chip has a single RX frame buffer. */
+static void at86rf215_sniff_rx(struct at86rf215_local *lp)
+{
+	struct at86rf215_sniffer *sn = &lp->sniff;
+
+	if (test_and_set_bit_lock(AT86RF215_SNIFF_BUSY, &sn->flags)) {
+		sn->ring->drops++;
+		return;
+	}
+
+	if (spi_async(lp->spi, &sn->info_msg)) {
+		sn->ring->drops++;
+		clear_bit_unlock(AT86RF215_SNIFF_BUSY, &sn->flags);
+		wake_up(&sn->wait);
+	}
+}
+
+static void at86rf215_sniff_setup_spi_messages(struct at86rf215_local *lp)
+{
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	static const struct {
+		u16 reg;
+		u8 len;
+	} info[] = {
+		{ RG_BBC0_PC, 5 },      /* PC, PS, -, RXFLL, RXFLH */
+		{ RG_BBC0_CNT0, 4 },
+		/* Measured at RXFS (EDM = auto), kept until the next frame;
+		 * RSSI would be the noise floor by RXFE */
+		{ RG_RF09_EDV, 1 },
+	};
+	unsigned int i;
+
+	spi_message_init(&sn->info_msg);
+	sn->info_msg.complete = at86rf215_sniff_info_complete;
+	sn->info_msg.context = lp;
+	for (i = 0; i < ARRAY_SIZE(info); i++) {
+		sn->info_cmd[i][0] = (info[i].reg & CMD_REG_MSB) >> 8;
+		sn->info_cmd[i][1] = info[i].reg & CMD_REG_LSB;
+		sn->info_trx[i].tx_buf = sn->info_cmd[i];
+		sn->info_trx[i].rx_buf = sn->info_buf[i];
+		sn->info_trx[i].len = 2 + info[i].len;
+		sn->info_trx[i].cs_change = i != ARRAY_SIZE(info) - 1;
+		spi_message_add_tail(&sn->info_trx[i], &sn->info_msg);
+	}
+
+	sn->frame_cmd[0] = (RG_BBC0_FBRXS & CMD_REG_MSB) >> 8;
+	sn->frame_cmd[1] = RG_BBC0_FBRXS & CMD_REG_LSB;
+	spi_message_init(&sn->frame_msg);
+	sn->frame_msg.complete = at86rf215_sniff_frame_complete;
+	sn->frame_msg.context = lp;
+	sn->frame_trx[0].tx_buf = sn->frame_cmd;
+	sn->frame_trx[0].len = 2;
+	spi_message_add_tail(&sn->frame_trx[0], &sn->frame_msg);
+	spi_message_add_tail(&sn->frame_trx[1], &sn->frame_msg);
+}
+
+static int at86rf215_sniff_start(struct at86rf215_local *lp)
+{
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	struct at86rf215_sniff_ring *ring = sn->ring;
+	unsigned long flags;
+	bool idle;
+	int rc;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	idle = at86rf215_is_idle(lp);
+	if (idle)
+		lp->is_sniff = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (!idle)
+		return -EBUSY;
+
+	ieee802154_stop_queue(lp->hw);
+
+	memset(ring, 0, sizeof(*ring));
+	ring->slots = AT86RF215_SNIFF_SLOTS;
+	ring->slot_size = AT86RF215_SNIFF_SLOT_SIZE;
+
+	rc = regmap_read(lp->regmap, RG_BBC0_AMCS, &sn->amcs) ||
+	     regmap_read(lp->regmap, RG_BBC0_AFC0, &sn->afc0) ||
+	     regmap_read(lp->regmap, RG_BBC0_PC, &sn->pc) ||
+	     regmap_read(lp->regmap, RG_BBC0_CNTC, &sn->cntc) ||
+	     regmap_read(lp->regmap, RG_RF09_EDC, &sn->edc);
+	if (rc)
+		goto err;
+
+	/* No ACK, no address filter, optionally keep frames with a bad FCS,
+	 * timestamp and measure the energy of every frame start. */
+	rc = at86rf215_sync_state(lp, RF_TRXOFF_STATUS) ||
+	     at86rf215_write_subreg(lp, SR_BBC0_AMCS_AACK, 0) ||
+	     at86rf215_write_subreg(lp, SR_BBC0_AFC0_PM, 1) ||
+	     at86rf215_write_subreg(lp, SR_BBC0_PC_CTX, 0) ||
+	     at86rf215_write_subreg(lp, SR_BBC0_PC_FCSFE, !sn->keep_bad_fcs) ||
+	     regmap_write(lp->regmap, RG_BBC0_CNTC, CNTC_EN | CNTC_CAPRXS) ||
+	     at86rf215_write_subreg(lp, SR_RF09_EDC_EDM, RF_EDAUTO) ||
+	     at86rf215_sync_state(lp, RF_RX_STATUS);
+	if (rc)
+		goto err;
+
+	return 0;
+
+err:
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_sniff = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	ieee802154_wake_queue(lp->hw);
+	return -EIO;
+}
+
+static void at86rf215_sniff_stop(struct at86rf215_local *lp)
+{
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	unsigned long flags;
+	bool tx_deferred;
+
+	at86rf215_sync_state(lp, RF_TRXOFF_STATUS);
+	regmap_write(lp->regmap, RG_BBC0_AMCS, sn->amcs);
+	regmap_write(lp->regmap, RG_BBC0_AFC0, sn->afc0);
+	regmap_write(lp->regmap, RG_BBC0_PC, sn->pc);
+	regmap_write(lp->regmap, RG_BBC0_CNTC, sn->cntc);
+	regmap_write(lp->regmap, RG_RF09_EDC, sn->edc);
+
+	/* Let a read out in progress finish before the ring is reused */
+	if (!wait_event_timeout(sn->wait,
+				!test_bit(AT86RF215_SNIFF_BUSY, &sn->flags),
+				AT86RF215_SNIFF_STOP_TIMEOUT))
+		dev_warn(&lp->spi->dev, "sniffer read out did not finish\n");
+
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_sniff = false;
+	tx_deferred = lp->tx_deferred;
+	lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	ieee802154_wake_queue(lp->hw);
+	if (tx_deferred)
+		at86rf215_tx_start(lp);
+	else
+		at86rf215_pm_idle(lp);
+}
+
+static int at86rf215_sniff_open(struct inode *inode, struct file *file)
+{
+	struct at86rf215_sniffer *sn =
+		container_of(file->private_data, struct at86rf215_sniffer,
+			     misc);
+	struct at86rf215_local *lp =
+		container_of(sn, struct at86rf215_local, sniff);
+	int rc;
+
+	if (test_and_set_bit(AT86RF215_SNIFF_OPEN, &sn->flags))
+		return -EBUSY;
+
+	/* The radio may sleep, wake it up first */
+	at86rf215_pm_wake(lp, false);
+
+	rc = at86rf215_sniff_start(lp);
+	if (rc) {
+		clear_bit(AT86RF215_SNIFF_OPEN, &sn->flags);
+		return rc;
+	}
+
+	file->private_data = lp;
+	return nonseekable_open(inode, file);
+}
+
+static int at86rf215_sniff_release(struct inode *inode, struct file *file)
+{
+	struct at86rf215_local *lp = file->private_data;
+
+	at86rf215_sniff_stop(lp);
+	clear_bit(AT86RF215_SNIFF_OPEN, &lp->sniff.flags);
+
+	return 0;
+}
+
+static int at86rf215_sniff_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct at86rf215_local *lp = file->private_data;
+
+	return remap_vmalloc_range(vma, lp->sniff.ring, vma->vm_pgoff);
+}
+
+/* Only needed to sleep while the ring is empty */
+static __poll_t at86rf215_sniff_poll(struct file *file, poll_table *wait)
+{
+	struct at86rf215_local *lp = file->private_data;
+	struct at86rf215_sniff_ring *ring = lp->sniff.ring;
+
+	poll_wait(file, &lp->sniff.wait, wait);
+
+	if (READ_ONCE(ring->head) != READ_ONCE(ring->tail))
+		return EPOLLIN | EPOLLRDNORM;
+
+	return 0;
+}
+
+static const struct file_operations at86rf215_sniff_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_sniff_open,
+	.release	= at86rf215_sniff_release,
+	.mmap		= at86rf215_sniff_mmap,
+	.poll		= at86rf215_sniff_poll,
+};
+
+static int at86rf215_sniff_register(struct at86rf215_local *lp)
+{
+	struct at86rf215_sniffer *sn = &lp->sniff;
+	int rc;
+
+	sn->ring = vmalloc_user(AT86RF215_SNIFF_DATA_OFF +
+				AT86RF215_SNIFF_SLOTS *
+				AT86RF215_SNIFF_SLOT_SIZE);
+	if (!sn->ring)
+		return -ENOMEM;
+
+	init_waitqueue_head(&sn->wait);
+	at86rf215_sniff_setup_spi_messages(lp);
+
+	snprintf(sn->name, sizeof(sn->name), "at86rf215-%s",
+		 dev_name(&lp->spi->dev));
+	sn->misc.minor = MISC_DYNAMIC_MINOR;
+	sn->misc.name = sn->name;
+	sn->misc.fops = &at86rf215_sniff_fops;
+	sn->misc.parent = &lp->spi->dev;
+
+	rc = misc_register(&sn->misc);
+	if (rc) {
+		vfree(sn->ring);
+		sn->ring = NULL;
+	}
+
+	return rc;
+}
+
+static void at86rf215_sniff_unregister(struct at86rf215_local *lp)
+{
+	if (!lp->sniff.ring)
+		return;
+
+	misc_deregister(&lp->sniff.misc);
+	vfree(lp->sniff.ring);
+}
+
+/**************************** Traffic generator *****************************/
+
+static void at86rf215_txgen_write(void *context);
+
+/* Next frame: the radio is in TXPREP (or RX for the first one) */
+static void at86rf215_txgen_send(struct at86rf215_local *lp)
+{
+	/* lp->tx is handed back by at86rf215_txgen_done() */
+	if (WARN_ON_ONCE(!at86rf215_ctx_claim(lp->tx)))
+		return;
+
+	at86rf215_async_state_change(lp, lp->tx, RF_TXPREP_STATUS,
+				     at86rf215_txgen_write);
+}
+
+static enum hrtimer_restart at86rf215_txgen_timer(struct hrtimer *timer)
+{
+	struct at86rf215_txgen *gen =
+		container_of(timer, struct at86rf215_txgen, gap_timer);
+
+	at86rf215_txgen_send(container_of(gen, struct at86rf215_local, txgen));
+
+	return HRTIMER_NORESTART;
+}
+
+/* The whole frame once, then only the sequence number */
+static void at86rf215_txgen_write(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	struct at86rf215_txgen *gen = &lp->txgen;
+	int rc;
+
+	gen->spi_ts = ktime_get();
+	if (!gen->uploaded) {
+		gen->uploaded = true;
+		at86rf215_write(context);
+		return;
+	}
+
+	gen->seq_buf[2] = gen->sent;
+	gen->seq_msg.context = ctx;
+	rc = spi_async(lp->spi, &gen->seq_msg);
+	if (rc)
+		at86rf215_async_error(lp, ctx, rc);
+}
+
+/* Frame in the buffer, the TX command follows */
+static void at86rf215_txgen_uploaded(struct at86rf215_local *lp)
+{
+	struct at86rf215_txgen *gen = &lp->txgen;
+
+	gen->tx_ts = ktime_get();
+	gen->spi_ns += ktime_to_ns(ktime_sub(gen->tx_ts, gen->spi_ts));
+}
+
+/* TXFE. The airtime is counted from the end of the upload, so it includes
+ * the STATE read and CMD write that start the frame. */
+static void at86rf215_txgen_done(struct at86rf215_local *lp)
+{
+	struct at86rf215_txgen *gen = &lp->txgen;
+	ktime_t now = ktime_get();
+
+	gen->air_ns += ktime_to_ns(ktime_sub(now, gen->tx_ts));
+	gen->sent++;
+	at86rf215_ctx_release(lp->tx);
+
+	if (!READ_ONCE(gen->running) || gen->sent >= gen->count) {
+		gen->end = now;
+		at86rf215_queue_work(lp, &gen->finish_work);
+		return;
+	}
+
+	if (gen->gap_us)
+		hrtimer_start(&gen->gap_timer, gen->gap_us * NSEC_PER_USEC,
+			      HRTIMER_MODE_REL);
+	else
+		at86rf215_txgen_send(lp);
+}
+
+/* Back to RX with TX2RX and the MCS of hw_init, hand the radio back */
+static void at86rf215_txgen_finish_work(struct work_struct *work)
+{
+	struct at86rf215_txgen *gen =
+		container_of(work, struct at86rf215_txgen, finish_work);
+	struct at86rf215_local *lp =
+		container_of(gen, struct at86rf215_local, txgen);
+	unsigned long flags;
+	bool tx_deferred;
+
+	at86rf215_write_subreg(lp, SR_BBC0_AMCS_TX2RX, 1);
+	if (!at86rf215_write_subreg(lp, SR_BBC0_OFDMPHRTX_MCS,
+				    AT86RF215_TX_MCS))
+		WRITE_ONCE(lp->tx_mcs, AT86RF215_TX_MCS);
+	at86rf215_sync_state(lp, RF_RX_STATUS);
+	kfree_skb(gen->skb);
+	gen->skb = NULL;
+	WRITE_ONCE(gen->running, false);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_gen = false;
+	tx_deferred = lp->tx_deferred;
+	lp->tx_deferred = false;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	complete_all(&gen->done);
+	ieee802154_wake_queue(lp->hw);
+	if (tx_deferred)
+		at86rf215_tx_start(lp);
+	else
+		at86rf215_pm_idle(lp);
+}
+
+static int at86rf215_txgen_start(struct at86rf215_local *lp)
+{
+	struct at86rf215_txgen *gen = &lp->txgen;
+	unsigned int payload;
+	unsigned long flags;
+	bool idle;
+	u8 *p;
+	int rc;
+
+	if (!gen->count || gen->len <= lp->fcs_len + 3 ||
+	    gen->len > AT86RF215_MAX_PSDU || gen->mcs > 6)
+		return -EINVAL;
+	if (!lp->started)
+		return -ENETDOWN;
+
+	/* Broadcast data frame, short addresses, PAN ID compression */
+	payload = gen->len - lp->fcs_len;
+	gen->skb = dev_alloc_skb(payload);
+	if (!gen->skb)
+		return -ENOMEM;
+	p = skb_put(gen->skb, payload);
+	memset(p, 0x5a, payload);
+	if (payload >= 9) {
+		put_unaligned_le16(0x8841, p);
+		p[2] = 0;
+		put_unaligned_le16(0xffff, p + 3);
+		put_unaligned_le16(IEEE802154_ADDR_SHORT_BROADCAST, p + 5);
+		put_unaligned_le16(0, p + 7);
+	}
+
+	at86rf215_pm_wake(lp, false);
+
+	spin_lock_irqsave(&lp->lock, flags);
+	idle = at86rf215_is_idle(lp);
+	if (idle)
+		lp->is_gen = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+	if (!idle) {
+		kfree_skb(gen->skb);
+		gen->skb = NULL;
+		return -EBUSY;
+	}
+
+	ieee802154_stop_queue(lp->hw);
+
+	rc = at86rf215_write_subreg(lp, SR_BBC0_OFDMPHRTX_MCS, gen->mcs);
+	if (!rc)
+		WRITE_ONCE(lp->tx_mcs, gen->mcs);
+	if (rc || at86rf215_write_subreg(lp, SR_BBC0_AMCS_TX2RX, 0)) {
+		gen->sent = 0;
+		gen->running = false;
+		gen->end = ktime_get();
+		reinit_completion(&gen->done);
+		at86rf215_queue_work(lp, &gen->finish_work);
+		return -EIO;
+	}
+
+	gen->uploaded = false;
+	gen->sent = 0;
+	gen->spi_ns = 0;
+	gen->air_ns = 0;
+	reinit_completion(&gen->done);
+	WRITE_ONCE(gen->running, true);
+	gen->start = ktime_get();
+	at86rf215_txgen_send(lp);
+
+	return 0;
+}
+
+/* Stops after the frame on the air, may sleep */
+static void at86rf215_txgen_stop(struct at86rf215_local *lp)
+{
+	struct at86rf215_txgen *gen = &lp->txgen;
+
+	if (!lp->is_gen)
+		return;
+
+	WRITE_ONCE(gen->running, false);
+	if (!wait_for_completion_timeout(&gen->done, HZ))
+		dev_warn(&lp->spi->dev, "traffic generator did not stop\n");
+}
+
+static void at86rf215_txgen_setup(struct at86rf215_local *lp)
+{
+	struct at86rf215_txgen *gen = &lp->txgen;
+
+	gen->count = AT86RF215_TXGEN_COUNT;
+	gen->len = AT86RF215_TXGEN_LEN;
+	gen->mcs = AT86RF215_TXGEN_MCS;
+	hrtimer_init(&gen->gap_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	gen->gap_timer.function = at86rf215_txgen_timer;
+	INIT_WORK(&gen->finish_work, at86rf215_txgen_finish_work);
+	init_completion(&gen->done);
+	complete_all(&gen->done);
+
+	gen->seq_buf[0] = (((RG_BBC0_FBTXS + 2) & CMD_REG_MSB) >> 8) |
+			  CMD_WRITE;
+	gen->seq_buf[1] = (RG_BBC0_FBTXS + 2) & CMD_REG_LSB;
+	gen->seq_trx.tx_buf = gen->seq_buf;
+	gen->seq_trx.len = 3;
+	spi_message_init(&gen->seq_msg);
+	gen->seq_msg.complete = at86rf215_write_frame_complete;
+	spi_message_add_tail(&gen->seq_trx, &gen->seq_msg);
+}
+
+static int at86rf215_txgen_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_txgen *gen = &lp->txgen;
+	bool running = READ_ONCE(gen->running);
+	u64 ns, fps = 0, air = 0, spi = 0;
+
+	ns = ktime_to_ns(ktime_sub(running ? ktime_get() : gen->end,
+				   gen->start));
+	if (ns > 0) {
+		fps = div64_u64((u64)gen->sent * NSEC_PER_SEC, ns);
+		air = div64_u64(gen->air_ns * 1000, ns);
+		spi = div64_u64(gen->spi_ns * 1000, ns);
+	}
+
+	seq_printf(file, "state:\t\t%s\n", running ? "running" : "idle");
+	seq_printf(file, "len:\t\t%u\n", gen->len);
+	seq_printf(file, "mcs:\t\t%u\n", gen->mcs);
+	seq_printf(file, "gap_us:\t\t%u\n", gen->gap_us);
+	seq_printf(file, "sent:\t\t%u/%u\n", gen->sent, gen->count);
+	seq_printf(file, "elapsed_us:\t%llu\n", div_u64(ns, NSEC_PER_USEC));
+	seq_printf(file, "fps:\t\t%llu\n", fps);
+	seq_printf(file, "airtime:\t%llu.%llu%%\n", air / 10, air % 10);
+	seq_printf(file, "spi:\t\t%llu.%llu%%\n", spi / 10, spi % 10);
+
+	return 0;
+}
+
+static int at86rf215_txgen_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at86rf215_txgen_show, inode->i_private);
+}
+
+/* "start" or "stop" */
+static ssize_t at86rf215_txgen_write_file(struct file *file,
+					  const char __user *ubuf, size_t len,
+					  loff_t *ppos)
+{
+	struct at86rf215_local *lp =
+		((struct seq_file *)file->private_data)->private;
+	char buf[8];
+	int rc;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	if (sysfs_streq(buf, "start")) {
+		rc = at86rf215_txgen_start(lp);
+		if (rc)
+			return rc;
+	} else if (sysfs_streq(buf, "stop")) {
+		at86rf215_txgen_stop(lp);
+	} else {
+		return -EINVAL;
+	}
+
+	return len;
+}
+
+static const struct file_operations at86rf215_txgen_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_txgen_open,
+	.read		= seq_read,
+	.write		= at86rf215_txgen_write_file,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/***************************** Periodic frames ******************************/
+
+static void at86rf215_bcn_end(struct at86rf215_local *lp);
+
+/* TX time of frame n on the host clock */
+static void at86rf215_bcn_schedule(struct at86rf215_bcn *bcn)
+{
+	bcn->next = ktime_sub(ktime_add_ns(bcn->t0, (u64)bcn->n *
+					   bcn->period_us * NSEC_PER_USEC),
+			      ns_to_ktime(bcn->adj_ns));
+}
+
+/* Next frame whose lead time is still ahead, the ones before are missed */
+static void at86rf215_bcn_advance(struct at86rf215_bcn *bcn)
+{
+	ktime_t now = ktime_get();
+
+	bcn->n++;
+	at86rf215_bcn_schedule(bcn);
+	while (ktime_before(ktime_sub_us(bcn->next, bcn->lead_us), now)) {
+		bcn->missed++;
+		bcn->n++;
+		at86rf215_bcn_schedule(bcn);
+	}
+}
+
+/* Last of the write and the TX time: CMD=TX, or back to RX on an error */
+static void at86rf215_bcn_step(struct at86rf215_local *lp, bool at_time)
+{
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	s64 lat;
+
+	if (!atomic_dec_and_test(&bcn->pending))
+		return;
+
+	bcn->tx_late = !at_time;
+	if (!bcn->status) {
+		lat = ktime_to_ns(ktime_sub(ktime_get(), bcn->next));
+		if (!at_time)
+			bcn->late++;
+		if (lat > 0) {
+			bcn->lat_sum_ns += lat;
+			bcn->lat_max_ns = max_t(u64, bcn->lat_max_ns, lat);
+		}
+	}
+
+	bcn->tx_cmd[2] = bcn->status ? RF_RX_STATUS : RF_TX_STATUS;
+	if (spi_async(lp->spi, &bcn->tx_msg)) {
+		bcn->missed++;
+		at86rf215_bcn_end(lp);
+	}
+}
+
+/* Done with CMD=TX: TXFE follows, unless the frame was given up */
+static void at86rf215_bcn_tx_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+
+	if (bcn->status || bcn->tx_msg.status) {
+		bcn->missed++;
+		at86rf215_bcn_end(lp);
+	}
+}
+
+static void at86rf215_bcn_write_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+
+	if (bcn->wr_msg->status) {
+		bcn->status = bcn->wr_msg->status;
+		bcn->in_fb = false;
+	}
+	at86rf215_bcn_step(lp, false);
+}
+
+/* In TXPREP: the whole frame if the TX frame buffer was used meanwhile,
+ * else only the octets changed by the update hook */
+static void at86rf215_bcn_write(void *context)
+{
+	struct at86rf215_state_change *ctx = context;
+	struct at86rf215_local *lp = ctx->lp;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	struct sk_buff *skb = bcn->skb;
+	unsigned int len = 0;
+	int off, rc;
+
+	off = bcn->update ? bcn->update(skb, bcn->priv, &len) : -1;
+	if (!bcn->in_fb) {
+		bcn->in_fb = true;
+		bcn->update_len = skb->len;
+		bcn->wr_msg = &bcn->up_msg;
+	} else if (off >= 0 && len && off + len <= skb->len) {
+		bcn->upd_cmd[0] = (((RG_BBC0_FBTXS + off) & CMD_REG_MSB) >> 8) |
+				  CMD_WRITE;
+		bcn->upd_cmd[1] = (RG_BBC0_FBTXS + off) & CMD_REG_LSB;
+		bcn->upd_trx[1].tx_buf = skb->data + off;
+		bcn->upd_trx[1].len = len;
+		bcn->update_len = len;
+		bcn->wr_msg = &bcn->upd_msg;
+	} else {
+		bcn->update_len = 0;
+		at86rf215_bcn_step(lp, false);
+		return;
+	}
+
+	rc = spi_async(lp->spi, bcn->wr_msg);
+	if (rc) {
+		bcn->status = rc;
+		bcn->in_fb = false;
+		at86rf215_bcn_step(lp, false);
+	}
+}
+
+/* lead_us ahead of the TX time: take the radio, or skip this frame */
+static enum hrtimer_restart at86rf215_bcn_timer(struct hrtimer *timer)
+{
+	struct at86rf215_local *lp =
+		container_of(timer, struct at86rf215_local, bcn.timer);
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	unsigned long flags;
+	bool running, idle;
+
+	spin_lock_irqsave(&lp->lock, flags);
+	running = READ_ONCE(bcn->running);
+	idle = running && at86rf215_is_idle(lp);
+	if (idle)
+		lp->is_bcn = true;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (!running)
+		return HRTIMER_NORESTART;
+
+	/* lp->tx is handed back by at86rf215_bcn_end() */
+	if (idle && WARN_ON_ONCE(!at86rf215_ctx_claim(lp->tx))) {
+		spin_lock_irqsave(&lp->lock, flags);
+		lp->is_bcn = false;
+		spin_unlock_irqrestore(&lp->lock, flags);
+		idle = false;
+	}
+	if (!idle) {
+		bcn->missed++;
+		at86rf215_bcn_advance(bcn);
+		hrtimer_set_expires(timer, ktime_sub_us(bcn->next,
+							bcn->lead_us));
+		return HRTIMER_RESTART;
+	}
+
+	bcn->status = 0;
+	atomic_set(&bcn->pending, 2);
+	hrtimer_start(&bcn->tx_timer, bcn->next, HRTIMER_MODE_ABS);
+	at86rf215_async_state_change(lp, lp->tx, RF_TXPREP_STATUS,
+				     at86rf215_bcn_write);
+
+	return HRTIMER_NORESTART;
+}
+
+static enum hrtimer_restart at86rf215_bcn_tx_timer(struct hrtimer *timer)
+{
+	at86rf215_bcn_step(container_of(timer, struct at86rf215_local,
+					bcn.tx_timer), true);
+
+	return HRTIMER_NORESTART;
+}
+
+/* TXFE: the counter captured at the TX start follows */
+static void at86rf215_bcn_done(struct at86rf215_local *lp)
+{
+	struct at86rf215_bcn *bcn = &lp->bcn;
+
+	bcn->sent++;
+	if (spi_async(lp->spi, &bcn->cnt_msg))
+		at86rf215_bcn_end(lp);
+}
+
+/* Deviation of the period from the counter, and the phase error from the
+ * reference, a quarter of which is taken off the host schedule. Frames sent
+ * late are off by the write, they do not move the schedule. */
+static void at86rf215_bcn_cnt_complete(void *context)
+{
+	struct at86rf215_local *lp = context;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	u32 cnt, dev;
+	s32 err;
+
+	if (bcn->cnt_msg.status)
+		goto end;
+
+	cnt = get_unaligned_le32(bcn->cnt_buf + 2);
+	/* Counter and interval count both wrap at 2^32 us */
+	if (bcn->cnt_valid) {
+		err = cnt - bcn->cnt_last -
+		      (bcn->n - bcn->n_last) * bcn->period_us;
+		dev = err < 0 ? -err : err;
+		bcn->jitter_count++;
+		bcn->jitter_sum_us += dev;
+		bcn->jitter_max_us = max(bcn->jitter_max_us, dev);
+	}
+	bcn->cnt_valid = true;
+	bcn->cnt_last = cnt;
+	bcn->n_last = bcn->n;
+
+	if (bcn->tx_late)
+		goto end;
+	if (!bcn->ref_valid) {
+		bcn->ref_valid = true;
+		bcn->cnt0 = cnt;
+		bcn->n0 = bcn->n;
+	} else {
+		err = cnt - bcn->cnt0 - (bcn->n - bcn->n0) * bcn->period_us;
+		bcn->adj_ns += (s64)err * NSEC_PER_USEC / 4;
+	}
+end:
+	at86rf215_bcn_end(lp);
+}
+
+/* Hand the radio back, arm the next frame */
+static void at86rf215_bcn_end(struct at86rf215_local *lp)
+{
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	unsigned long flags;
+	bool running;
+
+	at86rf215_ctx_release(lp->tx);
+	spin_lock_irqsave(&lp->lock, flags);
+	lp->is_bcn = false;
+	running = READ_ONCE(bcn->running);
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	if (running) {
+		at86rf215_bcn_advance(bcn);
+		hrtimer_start(&bcn->timer, ktime_sub_us(bcn->next, bcn->lead_us),
+			      HRTIMER_MODE_ABS);
+	} else {
+		complete_all(&bcn->done);
+	}
+
+	if (!at86rf215_cal_between_frames(lp) && !at86rf215_tx_resume(lp))
+		at86rf215_pm_idle(lp);
+}
+
+/* Default update hook: the beacon sequence number */
+static int at86rf215_bcn_update_bsn(struct sk_buff *skb, void *priv,
+				    unsigned int *len)
+{
+	skb->data[2]++;
+	*len = 1;
+
+	return 2;
+}
+
+/* Sends skb (MPDU, no FCS) every interval_us from lead_us on, until
+ * at86rf215_bcn_stop(). update is called before each frame, see struct
+ * at86rf215_bcn. The skb belongs to the driver from here on. The radio is
+ * kept awake until the beacons stop. May sleep. */
+int at86rf215_bcn_start(struct ieee802154_hw *hw, struct sk_buff *skb,
+			u32 interval_us,
+			int (*update)(struct sk_buff *skb, void *priv,
+				      unsigned int *len),
+			void *priv)
+{
+	struct at86rf215_local *lp = hw->priv;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	u16 len = skb->len + lp->fcs_len;
+	int rc = 0;
+
+	mutex_lock(&bcn->lock);
+	if (bcn->skb)
+		rc = -EBUSY;
+	else if (!lp->started)
+		rc = -ENETDOWN;
+	else if (!interval_us || bcn->lead_us >= interval_us ||
+		 skb->len < 3 || len > AT86RF215_MAX_PSDU)
+		rc = -EINVAL;
+
+	/* pm_work leaves the radio alone while running is set */
+	if (!rc) {
+		at86rf215_pm_wake(lp, false);
+		rc = regmap_update_bits(lp->regmap, RG_BBC0_CNTC,
+					CNTC_EN | CNTC_CAPTXS,
+					CNTC_EN | CNTC_CAPTXS);
+	}
+	if (rc) {
+		mutex_unlock(&bcn->lock);
+		kfree_skb(skb);
+		return rc;
+	}
+
+	bcn->len_buf[2] = len & 0xff;
+	bcn->len_buf[3] = len >> 8;
+	bcn->up_trx[2].tx_buf = skb->data;
+	bcn->up_trx[2].len = skb->len;
+	bcn->skb = skb;
+	bcn->update = update;
+	bcn->priv = priv;
+	bcn->in_fb = false;
+	bcn->cnt_valid = false;
+	bcn->ref_valid = false;
+	bcn->sent = 0;
+	bcn->missed = 0;
+	bcn->late = 0;
+	bcn->update_len = 0;
+	bcn->jitter_count = 0;
+	bcn->jitter_max_us = 0;
+	bcn->jitter_sum_us = 0;
+	bcn->lat_max_ns = 0;
+	bcn->lat_sum_ns = 0;
+	bcn->adj_ns = 0;
+	bcn->n = 0;
+	bcn->period_us = interval_us;
+	bcn->t0 = ktime_add_us(ktime_get(), bcn->lead_us);
+	at86rf215_bcn_schedule(bcn);
+	reinit_completion(&bcn->done);
+	WRITE_ONCE(bcn->running, true);
+	hrtimer_start(&bcn->timer, ktime_sub_us(bcn->next, bcn->lead_us),
+		      HRTIMER_MODE_ABS);
+	mutex_unlock(&bcn->lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(at86rf215_bcn_start);
+
+/* Stops after the frame in progress, may sleep */
+void at86rf215_bcn_stop(struct ieee802154_hw *hw)
+{
+	struct at86rf215_local *lp = hw->priv;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	unsigned long flags;
+	bool busy;
+
+	mutex_lock(&bcn->lock);
+	if (!bcn->skb) {
+		mutex_unlock(&bcn->lock);
+		return;
+	}
+
+	spin_lock_irqsave(&lp->lock, flags);
+	WRITE_ONCE(bcn->running, false);
+	busy = lp->is_bcn;
+	spin_unlock_irqrestore(&lp->lock, flags);
+
+	/* Not re-armed once running is clear */
+	hrtimer_cancel(&bcn->timer);
+	if (busy && !wait_for_completion_timeout(&bcn->done, HZ))
+		dev_warn(&lp->spi->dev, "beacon did not stop\n");
+
+	kfree_skb(bcn->skb);
+	bcn->skb = NULL;
+	mutex_unlock(&bcn->lock);
+
+	/* The idle timer was left alone while the beacons ran */
+	at86rf215_pm_idle(lp);
+}
+EXPORT_SYMBOL_GPL(at86rf215_bcn_stop);
+
+static void at86rf215_bcn_setup(struct at86rf215_local *lp)
+{
+	struct at86rf215_bcn *bcn = &lp->bcn;
+
+	mutex_init(&bcn->lock);
+	bcn->interval_us = AT86RF215_BCN_INTERVAL_US;
+	bcn->lead_us = AT86RF215_BCN_LEAD_US;
+	hrtimer_init(&bcn->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	bcn->timer.function = at86rf215_bcn_timer;
+	hrtimer_init(&bcn->tx_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	bcn->tx_timer.function = at86rf215_bcn_tx_timer;
+	init_completion(&bcn->done);
+
+	/* TXFLL, TXFLH, then FBTXS */
+	bcn->len_buf[0] = ((RG_BBC0_TXFLL & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	bcn->len_buf[1] = RG_BBC0_TXFLL & CMD_REG_LSB;
+	bcn->up_trx[0].tx_buf = bcn->len_buf;
+	bcn->up_trx[0].len = 4;
+	bcn->up_trx[0].cs_change = 1;
+	bcn->up_cmd[0] = ((RG_BBC0_FBTXS & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	bcn->up_cmd[1] = RG_BBC0_FBTXS & CMD_REG_LSB;
+	bcn->up_trx[1].tx_buf = bcn->up_cmd;
+	bcn->up_trx[1].len = 2;
+	spi_message_init(&bcn->up_msg);
+	bcn->up_msg.complete = at86rf215_bcn_write_complete;
+	bcn->up_msg.context = lp;
+	spi_message_add_tail(&bcn->up_trx[0], &bcn->up_msg);
+	spi_message_add_tail(&bcn->up_trx[1], &bcn->up_msg);
+	spi_message_add_tail(&bcn->up_trx[2], &bcn->up_msg);
+	/* FBTXS + offset, set per frame */
+	bcn->upd_trx[0].tx_buf = bcn->upd_cmd;
+	bcn->upd_trx[0].len = 2;
+	spi_message_init(&bcn->upd_msg);
+	bcn->upd_msg.complete = at86rf215_bcn_write_complete;
+	bcn->upd_msg.context = lp;
+	spi_message_add_tail(&bcn->upd_trx[0], &bcn->upd_msg);
+	spi_message_add_tail(&bcn->upd_trx[1], &bcn->upd_msg);
+	/* RF09_CMD */
+	bcn->tx_cmd[0] = ((RG_RF09_CMD & CMD_REG_MSB) >> 8) | CMD_WRITE;
+	bcn->tx_cmd[1] = RG_RF09_CMD & CMD_REG_LSB;
+	bcn->tx_trx.tx_buf = bcn->tx_cmd;
+	bcn->tx_trx.len = 3;
+	spi_message_init(&bcn->tx_msg);
+	bcn->tx_msg.complete = at86rf215_bcn_tx_complete;
+	bcn->tx_msg.context = lp;
+	spi_message_add_tail(&bcn->tx_trx, &bcn->tx_msg);
+	/* CNT0..CNT3 */
+	bcn->cnt_cmd[0] = (RG_BBC0_CNT0 & CMD_REG_MSB) >> 8;
+	bcn->cnt_cmd[1] = RG_BBC0_CNT0 & CMD_REG_LSB;
+	bcn->cnt_trx.tx_buf = bcn->cnt_cmd;
+	bcn->cnt_trx.rx_buf = bcn->cnt_buf;
+	bcn->cnt_trx.len = 6;
+	spi_message_init(&bcn->cnt_msg);
+	bcn->cnt_msg.complete = at86rf215_bcn_cnt_complete;
+	bcn->cnt_msg.context = lp;
+	spi_message_add_tail(&bcn->cnt_trx, &bcn->cnt_msg);
+}
+
+static int at86rf215_bcn_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_bcn *bcn = &lp->bcn;
+	u32 n = max(bcn->jitter_count, 1U);
+
+	seq_printf(file, "state:\t\t%s\n",
+		   READ_ONCE(bcn->running) ? "running" : "idle");
+	seq_printf(file, "interval_us:\t%u\n", bcn->interval_us);
+	seq_printf(file, "sent:\t\t%u\n", bcn->sent);
+	seq_printf(file, "missed:\t\t%u\n", bcn->missed);
+	seq_printf(file, "late:\t\t%u\n", bcn->late);
+	seq_printf(file, "update_len:\t%u\n", bcn->update_len);
+	seq_printf(file, "jitter_avg_us:\t%llu\n",
+		   div_u64(bcn->jitter_sum_us, n));
+	seq_printf(file, "jitter_max_us:\t%u\n", bcn->jitter_max_us);
+	seq_printf(file, "tx_lat_avg_us:\t%llu\n",
+		   div_u64(div_u64(bcn->lat_sum_ns, max(bcn->sent, 1U)),
+			   NSEC_PER_USEC));
+	seq_printf(file, "tx_lat_max_us:\t%llu\n",
+		   div_u64(bcn->lat_max_ns, NSEC_PER_USEC));
+	seq_printf(file, "adj_ns:\t\t%lld\n", bcn->adj_ns);
+
+	return 0;
+}
+
+static int at86rf215_bcn_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at86rf215_bcn_show, inode->i_private);
+}
+
+/* Beacon with the PAN ID and short address of the address filter, BO = SO =
+ * 15 in its superframe specification, the sequence number updated */
+static int at86rf215_bcn_start_default(struct at86rf215_local *lp)
+{
+	unsigned int pan[2], sha[2];
+	struct sk_buff *skb;
+	u8 *p;
+
+	if (regmap_read(lp->regmap, RG_BBC0_MACPID0F0, &pan[0]) ||
+	    regmap_read(lp->regmap, RG_BBC0_MACPID0F0 + 1, &pan[1]) ||
+	    regmap_read(lp->regmap, RG_BBC0_MACSHA0F0, &sha[0]) ||
+	    regmap_read(lp->regmap, RG_BBC0_MACSHA0F0 + 1, &sha[1]))
+		return -EIO;
+
+	skb = dev_alloc_skb(11);
+	if (!skb)
+		return -ENOMEM;
+	p = skb_put(skb, 11);
+	put_unaligned_le16(IEEE802154_FC_TYPE_BEACON |
+			   IEEE802154_ADDR_SHORT << 14, p);
+	p[2] = 0;
+	p[3] = pan[0];
+	p[4] = pan[1];
+	p[5] = sha[0];
+	p[6] = sha[1];
+	/* BO, SO, final CAP slot, PAN coordinator */
+	put_unaligned_le16(0x4fff, p + 7);
+	p[9] = 0;       /* GTS specification */
+	p[10] = 0;      /* Pending address specification */
+
+	return at86rf215_bcn_start(lp->hw, skb, READ_ONCE(lp->bcn.interval_us),
+				   at86rf215_bcn_update_bsn, NULL);
+}
+
+/* "start" or "stop" */
+static ssize_t at86rf215_bcn_write_file(struct file *file,
+					const char __user *ubuf, size_t len,
+					loff_t *ppos)
+{
+	struct at86rf215_local *lp =
+		((struct seq_file *)file->private_data)->private;
+	char buf[8];
+	int rc;
+
+	if (len >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+
+	if (sysfs_streq(buf, "start")) {
+		rc = at86rf215_bcn_start_default(lp);
+		if (rc)
+			return rc;
+	} else if (sysfs_streq(buf, "stop")) {
+		at86rf215_bcn_stop(lp->hw);
+	} else {
+		return -EINVAL;
+	}
+
+	return len;
+}
+
+static const struct file_operations at86rf215_bcn_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_bcn_open,
+	.read		= seq_read,
+	.write		= at86rf215_bcn_write_file,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/* Fill up to AT86RF215_RNG_BATCH bytes with one spi_sync(). If the radio is
+ * busy or not listening, nothing is returned without wait, the caller
+ * retries. With wait we sleep until it listens (the interface is up and no
+ * TX, calibration, scan or sleep is in the way), -EAGAIN after
+ * AT86RF215_RNG_WAIT. */
+static int at86rf215_rng_read(struct hwrng *hwrng, void *data, size_t max,
+			      bool wait)
+{
+	struct at86rf215_local *lp = (struct at86rf215_local *)hwrng->priv;
+	struct at86rf215_rng *rng = &lp->rng;
+	unsigned long timeout = jiffies + AT86RF215_RNG_WAIT;
+	u8 *out = data;
+	unsigned long flags;
+	ktime_t start;
+	size_t i, len;
+	bool busy;
+	int rc;
+
+	for (;;) {
+		spin_lock_irqsave(&lp->lock, flags);
+		busy = !lp->started || lp->is_tx || lp->is_cal ||
+		       lp->is_sleep || lp->is_scan;
+		spin_unlock_irqrestore(&lp->lock, flags);
+
+		if (!busy) {
+			start = ktime_get();
+			rc = spi_sync(lp->spi, &rng->msg);
+			if (rc)
+				return rc;
+			lp->stats.rng_ns += ktime_to_ns(ktime_sub(ktime_get(),
+								  start));
+
+			if (rng->buf[0][2] == STATE_RF_RX &&
+			    rng->buf[AT86RF215_RNG_BATCH + 1][2] == STATE_RF_RX)
+				break;
+		}
+
+		lp->stats.rng_busy++;
+		if (!wait)
+			return 0;
+		if (time_after(jiffies, timeout))
+			return -EAGAIN;
+		if (msleep_interruptible(AT86RF215_RNG_RETRY_MS))
+			return -EINTR;
+	}
+
+	len = min_t(size_t, max, AT86RF215_RNG_BATCH);
+	for (i = 0; i < len; i++)
+		out[i] = rng->buf[i + 1][2];
+
+	lp->stats.rng_bytes += len;
+	return len;
+}
+
+static int at86rf215_rng_register(struct at86rf215_local *lp)
+{
+	struct at86rf215_rng *rng = &lp->rng;
+	unsigned int i, last = ARRAY_SIZE(rng->trx) - 1;
+	int rc;
+
+	rng->cmd_state[0] = (RG_RF09_STATE & CMD_REG_MSB) >> 8;
+	rng->cmd_state[1] = RG_RF09_STATE & CMD_REG_LSB;
+	rng->cmd_rndv[0] = (RG_RF09_RNDV & CMD_REG_MSB) >> 8;
+	rng->cmd_rndv[1] = RG_RF09_RNDV & CMD_REG_LSB;
+
+	/* RNDV is a single register: a burst would auto-increment past it, so
+	 * every read is its own chip select cycle within the message. */
+	spi_message_init(&rng->msg);
+	for (i = 0; i <= last; i++) {
+		rng->trx[i].tx_buf = (i == 0 || i == last) ? rng->cmd_state :
+				     rng->cmd_rndv;
+		rng->trx[i].rx_buf = rng->buf[i];
+		rng->trx[i].len = 3;
+		rng->trx[i].cs_change = i != last;
+		spi_message_add_tail(&rng->trx[i], &rng->msg);
+	}
+
+	rng->hwrng.name = dev_name(&lp->spi->dev);
+	rng->hwrng.read = at86rf215_rng_read;
+	rng->hwrng.priv = (unsigned long)lp;
+
+	/* Not devm: lp is freed in remove(), before devres runs. */
+	rc = hwrng_register(&rng->hwrng);
+	rng->registered = !rc;
+
+	return rc;
+}
+
+/*************************** Execution context ******************************/
+
+/* Moves the work and the IRQ of lp to cpu. An IRQ line shared with another
+ * radio keeps the affinity it has: whichever device moved last would win,
+ * so only the work moves and we say so. Sharing with other drivers is not
+ * seen here. */
+static int at86rf215_set_cpu(struct at86rf215_local *lp, u32 cpu)
+{
+	struct at86rf215_local *other;
+	bool shared = false;
+	int rc = 0;
+
+	if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+		return -EINVAL;
+
+	WRITE_ONCE(lp->cpu, cpu);
+
+	mutex_lock(&at86rf215_devs_lock);
+	list_for_each_entry(other, &at86rf215_devs, node)
+		if (other != lp && other->spi->irq == lp->spi->irq)
+			shared = true;
+	if (shared) {
+		dev_warn(&lp->spi->dev,
+			 "IRQ %d is shared with another radio, its affinity is left alone\n",
+			 lp->spi->irq);
+	} else {
+		rc = irq_set_affinity_hint(lp->spi->irq, cpumask_of(cpu));
+		lp->irq_hint = !rc;
+	}
+	mutex_unlock(&at86rf215_devs_lock);
+
+	return rc;
+}
+
+static void at86rf215_devs_del(struct at86rf215_local *lp)
+{
+	mutex_lock(&at86rf215_devs_lock);
+	list_del_init(&lp->node);
+	mutex_unlock(&at86rf215_devs_lock);
+	if (lp->irq_hint)
+		irq_set_affinity_hint(lp->spi->irq, NULL);
+	lp->irq_hint = false;
+}
+
+static int at86rf215_cpu_get(void *data, u64 *val)
+{
+	struct at86rf215_local *lp = data;
+
+	*val = lp->cpu;
+
+	return 0;
+}
+
+static int at86rf215_cpu_set(void *data, u64 val)
+{
+	return at86rf215_set_cpu(data, val);
+}
+
+DEFINE_SIMPLE_ATTRIBUTE(at86rf215_cpu_fops, at86rf215_cpu_get,
+			at86rf215_cpu_set, "%llu\n");
+
+/* One simulated radio of debugfs "wq_bench": runs the per-frame CPU work of
+ * the RX path (MHR parse, pending table lookup, FCS) for its frames. This
+ * only measures how the work items scale over the CPUs: no SPI, no IRQ, no
+ * chip. bench/multiradio.sh measures the TX path of the real radios. */
+struct at86rf215_wq_sim {
+	struct work_struct		work;
+	struct at86rf215_local *	lp;
+	u32				frames;
+	u32				hits;
+	atomic_t *			left;
+	struct completion *		done;
+};
+
+static void at86rf215_wq_sim_work(struct work_struct *work)
 {
-	int rc, irq_type, irq_pol = IRQ_ACTIVE_HIGH;
-	unsigned int val;
+	struct at86rf215_wq_sim *sim =
+		container_of(work, struct at86rf215_wq_sim, work);
+	u8 frame[IEEE802154_MTU];
+	u32 i;
 
-	/* TODO: This should be replaced with an async function. */
-	/* Check if we're in state TRXOFF */
-	rc = regmap_read(lp->regmap, RG_RF09_STATE, &val);
-	if ((rc) || (val != RF_TRXOFF_STATUS)) {
-		printk(KERN_DEBUG "Hardware Initialisation: FAILED!");
-		return rc;
+	/* Data frame, short addresses, PAN ID compression */
+	memset(frame, 0xa5, sizeof(frame));
+	put_unaligned_le16(0x8841, frame);
+	for (i = 0; i < sim->frames; i++) {
+		frame[2] = i;
+		put_unaligned_le16(i, frame + 7);
+		if (at86rf215_pend_lookup(sim->lp, at86rf215_pend_key(frame,
+					  sizeof(frame), true)))
+			sim->hits++;
+		if (crc_ccitt(0, frame, sizeof(frame)) == 0)
+			sim->hits++;
 	}
 
-	/* Configuring the IRQ pin polarity. */
-	irq_type = irq_get_trigger_type(lp->spi->irq);
-	if (irq_type == IRQ_TYPE_EDGE_FALLING || irq_type == IRQ_TYPE_LEVEL_LOW)
-		irq_pol = IRQ_ACTIVE_LOW;
-	rc = at86rf215_write_subreg(lp, SR_RF_CFG_IRQP, irq_pol);
-	if (rc) {
-		printk(KERN_DEBUG "IRQ configuration: FAILED!");
-		return rc;
+	if (atomic_dec_and_test(sim->left))
+		complete(sim->done);
+}
+
+/* Aggregate frames/s of devs simulated radios, each with its own work item,
+ * spread over the CPUs (spread) or all on the CPU of lp */
+static u64 at86rf215_wq_bench_run(struct at86rf215_local *lp,
+				  struct at86rf215_wq_sim *sim, u32 devs,
+				  bool spread)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t left;
+	ktime_t start;
+	u64 ns;
+	u32 i;
+
+	atomic_set(&left, devs);
+	start = ktime_get();
+	for (i = 0; i < devs; i++) {
+		INIT_WORK(&sim[i].work, at86rf215_wq_sim_work);
+		sim[i].lp = lp;
+		sim[i].frames = lp->wq_bench_frames;
+		sim[i].left = &left;
+		sim[i].done = &done;
+		queue_work_on(spread ? cpumask_local_spread(i,
+						dev_to_node(&lp->spi->dev)) :
+			      at86rf215_cpu(lp), lp->wq, &sim[i].work);
 	}
+	wait_for_completion(&done);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	for (i = 0; i < devs; i++)
+		flush_work(&sim[i].work);
+
+	return div64_u64((u64)devs * lp->wq_bench_frames * NSEC_PER_SEC,
+			 ns ?: 1);
+}
+
+static int at86rf215_wq_bench_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_wq_sim *sim;
+	u32 devs = lp->wq_bench_devs;
+	u64 single, spread;
+
+	if (!devs || !lp->wq_bench_frames)
+		return -EINVAL;
+
+	sim = kcalloc(devs, sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return -ENOMEM;
+
+	single = at86rf215_wq_bench_run(lp, sim, devs, false);
+	spread = at86rf215_wq_bench_run(lp, sim, devs, true);
+	kfree(sim);
+
+	seq_printf(file, "devices:\t%u\n", devs);
+	seq_printf(file, "cpus:\t\t%u\n", num_online_cpus());
+	seq_printf(file, "single_fps:\t%llu\n", single);
+	seq_printf(file, "spread_fps:\t%llu\n", spread);
 
 	return 0;
 }
 
-/* This configuration is custom for our application, just for test.*/
-static int at86rf215_config(struct at86rf215_local *lp)
+static int at86rf215_wq_bench_open(struct inode *inode, struct file *file)
 {
-	int rc;
+	return single_open(file, at86rf215_wq_bench_show, inode->i_private);
+}
 
-	rc = regmap_write(lp->regmap, RG_RF09_IRQM, 0x1F);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_IRQM: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_CS, 0x30);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_CS: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_CCF0L, 0x20);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_CCF0L: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_CCF0H, 0x8D);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_CCF0H: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_CNL, 0x03);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_CNL: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_RXBWC, 0x09);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_RXBWC: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_RXDFE, 0x83);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_RXDFE: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_EDD, 0x7A);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_EDD: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_TXCUTC, 0x0B);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_TXCUTC: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_TXDFE, 0x83);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_TXDFE: Impossible to write in.");
-		return rc;
+static const struct file_operations at86rf215_wq_bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_wq_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int at86rf215_stats_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_stats *st = &lp->stats;
+	ktime_t now = ktime_get();
+	unsigned int i;
+	u64 asleep_ns;
+
+	seq_printf(file, "cal_count:\t\t%u\n", st->cal_count);
+	seq_printf(file, "cal_forced:\t\t%u\n", st->cal_forced);
+	seq_printf(file, "cal_deferred:\t\t%u\n", st->cal_deferred);
+	seq_printf(file, "cal_last_us:\t\t%llu\n", st->cal_last_ns / 1000);
+	seq_printf(file, "cal_max_us:\t\t%llu\n", st->cal_max_ns / 1000);
+	seq_printf(file, "cal_total_us:\t\t%llu\n", st->cal_total_ns / 1000);
+	seq_printf(file, "cal_next_ms:\t\t%d\n",
+		   jiffies_to_msecs(lp->cal_timeout - jiffies));
+
+	asleep_ns = st->pm_asleep_ns;
+	if (lp->is_sleep)
+		asleep_ns += ktime_to_ns(ktime_sub(now, lp->pm_sleep_start));
+	seq_printf(file, "pm_sleeps:\t\t%u\n", st->pm_sleeps);
+	seq_printf(file, "pm_wakes:\t\t%u\n", st->pm_wakes);
+	seq_printf(file, "pm_asleep_us:\t\t%llu\n", asleep_ns / 1000);
+	seq_printf(file, "pm_elapsed_us:\t\t%llu\n",
+		   ktime_to_us(ktime_sub(now, lp->pm_epoch)));
+	seq_printf(file, "pm_wake_tx:\t\t%u\n", st->pm_wake_tx);
+	seq_printf(file, "pm_wake_last_us:\t%llu\n",
+		   st->pm_wake_last_ns / 1000);
+	seq_printf(file, "pm_wake_max_us:\t\t%llu\n",
+		   st->pm_wake_max_ns / 1000);
+	seq_printf(file, "pm_wake_total_us:\t%llu\n",
+		   st->pm_wake_total_ns / 1000);
+
+	seq_printf(file, "rng_bytes:\t\t%llu\n", st->rng_bytes);
+	seq_printf(file, "rng_busy:\t\t%u\n", st->rng_busy);
+	seq_printf(file, "rng_bytes_per_s:\t%llu\n", st->rng_ns ?
+		   div64_u64(st->rng_bytes * NSEC_PER_SEC, st->rng_ns) : 0);
+
+	seq_printf(file, "rx_frames:\t\t%u\n", st->rx_frames);
+	seq_printf(file, "rx_drops:\t\t%u\n", st->rx_drops);
+	seq_printf(file, "irq_ctx_busy:\t\t%u\n", st->irq_ctx_busy);
+	seq_printf(file, "pend_active:\t\t%d\n",
+		   atomic_read(&lp->pend.active));
+	seq_printf(file, "pend_lookups:\t\t%u\n", st->pend_lookups);
+	seq_printf(file, "pend_hits:\t\t%u\n", st->pend_hits);
+	seq_printf(file, "pend_late:\t\t%u\n", st->pend_late);
+	seq_printf(file, "pend_full:\t\t%u\n", st->pend_full);
+	seq_printf(file, "pend_max_us:\t\t%llu\n", st->pend_max_ns / 1000);
+	seq_printf(file, "cfg_staged:\t\t%u\n", st->cfg_staged);
+	seq_printf(file, "cfg_applies:\t\t%u\n", st->cfg_applies);
+	seq_printf(file, "cfg_regs:\t\t%u\n", st->cfg_regs);
+	seq_printf(file, "tx_cfg_deferred:\t%u\n", st->tx_cfg_deferred);
+	seq_printf(file, "irqs:\t\t\t%u\n", st->irqs);
+	seq_printf(file, "irq_cpu_ns:\t\t%llu\n", st->irq_cpu_ns);
+	seq_printf(file, "rx_batch:\t\t%u\n", lp->rx_batch);
+	seq_printf(file, "rx_batch_enter:\t\t%u\n", st->rx_batch_enter);
+	seq_printf(file, "rx_batch_polls:\t\t%u\n", st->rx_batch_polls);
+	seq_printf(file, "spi_hz:\t\t\t%u\n", lp->spi_hz);
+	seq_printf(file, "spi_dt_hz:\t\t%u\n", lp->spi_dt_hz);
+	seq_printf(file, "spi_errors:\t\t%u\n", st->spi_errors);
+	seq_printf(file, "spi_fallbacks:\t\t%u\n", st->spi_fallbacks);
+	seq_printf(file, "tx_rx_deferred:\t\t%u\n", st->tx_rx_deferred);
+	seq_printf(file, "tx_preloads:\t\t%u\n", st->tx_preloads);
+	seq_printf(file, "tx_preload_late:\t%u\n", st->tx_preload_late);
+	seq_printf(file, "tx_streamed:\t\t%u\n", st->tx_streamed);
+	seq_printf(file, "tx_underruns:\t\t%u\n", st->tx_underruns);
+	seq_printf(file, "tx_stream_head:\t\t%u\n", st->tx_stream_head);
+	seq_printf(file, "tx_spi_ns:\t\t%u\n", lp->tx_spi_ns);
+	seq_printf(file, "tx_acked:\t\t%u\n", st->tx_acked);
+	seq_printf(file, "tx_no_ack:\t\t%u\n", st->tx_no_ack);
+	seq_printf(file, "tx_retries:\t\t%u\n", st->tx_retries);
+	seq_printf(file, "tx_retry_hist:\t\t");
+	for (i = 0; i <= AT86RF215_TX_MAX_RETRIES; i++)
+		seq_printf(file, "%u%c", st->tx_retry_hist[i],
+			   i < AT86RF215_TX_MAX_RETRIES ? ' ' : '\n');
+	seq_printf(file, "ed_scans:\t\t%u\n", st->ed_scans);
+	seq_printf(file, "ed_scan_last_us:\t%llu\n",
+		   st->ed_scan_last_ns / 1000);
+
+	if (lp->sniff.ring) {
+		seq_printf(file, "sniff_frames:\t\t%llu\n",
+			   lp->sniff.ring->frames);
+		seq_printf(file, "sniff_drops:\t\t%llu\n",
+			   lp->sniff.ring->drops);
 	}
-	rc = regmap_write(lp->regmap, RG_RF09_PAC, 0x7C);
-	if (rc) {
-		printk(KERN_DEBUG "RG_RF09_PAC: Impossible to write in.");
-		return rc;
+	return 0;
+}
+
+/* Issue spi_bench_count RF09_STATE reads with the prebuilt message, then as
+ * many with a message rebuilt for each transaction, as the driver used to do.
+ * The difference is the per-transaction setup cost; on a mocked controller
+ * (no bus time) it is the whole submission cost. */
+static int at86rf215_spi_bench_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_stats *st = &lp->stats;
+	struct at86rf215_state_change *ctx;
+	struct spi_message msg;
+	struct spi_transfer trx;
+	u32 i, count = lp->spi_bench_count;
+	ktime_t start;
+	int rc = 0;
+
+	if (!count)
+		return -EINVAL;
+
+	ctx = kmem_cache_zalloc(at86rf215_ctx_cache, GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	at86rf215_setup_spi_messages(lp, ctx, RG_RF09_STATE);
+	at86rf215_optimize_messages(lp, ctx);
+
+	start = ktime_get();
+	for (i = 0; i < count && !rc; i++)
+		rc = spi_sync(lp->spi, &ctx->msg);
+	st->spi_bench_prebuilt_ns =
+		div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), count);
+
+	start = ktime_get();
+	for (i = 0; i < count && !rc; i++) {
+		memset(&trx, 0, sizeof(trx));
+		ctx->buf[0] = (RG_RF09_STATE & CMD_REG_MSB) >> 8;
+		ctx->buf[1] = RG_RF09_STATE & CMD_REG_LSB;
+		trx.tx_buf = ctx->buf;
+		trx.rx_buf = ctx->buf;
+		trx.len = 3;
+		spi_message_init(&msg);
+		spi_message_add_tail(&trx, &msg);
+		rc = spi_sync(lp->spi, &msg);
 	}
-	rc = regmap_write(lp->regmap, RG_BBC0_IRQM, 0x1f);
+	st->spi_bench_rebuilt_ns =
+		div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), count);
+
+	at86rf215_unoptimize_messages(ctx);
+	kmem_cache_free(at86rf215_ctx_cache, ctx);
 	if (rc)
-		printk(KERN_ALERT "RG_BBC0_IRQM: Impossible to write in.");
-	rc = regmap_write(lp->regmap, RG_BBC0_PC, 0x56);
-	if (rc) {
-		printk(KERN_ALERT "RG_BBC0_PC: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_BBC0_OFDMPHRTX, 0x03);
-	if (rc) {
-		printk(KERN_ALERT "RG_BBC0_OFDMPHRTX: Impossible to write in.");
-		return rc;
-	}
-	rc = regmap_write(lp->regmap, RG_RF09_CNM, 0x00);
-	if (rc) {
-		printk(KERN_ALERT "RG_RF09_CNM: Impossible to write in.");
 		return rc;
-	}
+
+	seq_printf(file, "transactions:\t%u\n", count);
+	seq_printf(file, "prebuilt_ns:\t%llu\n", st->spi_bench_prebuilt_ns);
+	seq_printf(file, "rebuilt_ns:\t%llu\n", st->spi_bench_rebuilt_ns);
+
 	return 0;
 }
 
-/* Check if device tree definition for the spi device is correct. */
-static int at86rf215_get_pdata(struct spi_device *spi, int *rstn)
+static int at86rf215_spi_bench_open(struct inode *inode, struct file *file)
 {
-	struct at86rf215_platform_data *pdata = spi->dev.platform_data;
+	return single_open(file, at86rf215_spi_bench_show, inode->i_private);
+}
 
-	/* dev.of_node :associated device tree node */
-	if (!IS_ENABLED(CONFIG_OF) || !spi->dev.of_node) {
-		if (!pdata)
-			return -ENOENT;
+static const struct file_operations at86rf215_spi_bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_spi_bench_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-		*rstn = pdata->rstn;
-		return 0;
+static int at86rf215_pending_show(struct seq_file *file, void *offset)
+{
+	struct at86rf215_local *lp = file->private;
+	struct at86rf215_pend_slot *slot;
+	u64 key;
+	int i, count;
+
+	for (i = 0; i < AT86RF215_PEND_SLOTS; i++) {
+		slot = &lp->pend.slot[i];
+		key = atomic64_read(&slot->key);
+		count = atomic_read(&slot->count);
+		if (!key || !count)
+			continue;
+		if ((key & AT86RF215_PEND_SHORT) == AT86RF215_PEND_SHORT)
+			seq_printf(file, "%04llx:%04llx\t%d\n",
+				   (key >> 16) & 0xffff, key & 0xffff, count);
+		else
+			seq_printf(file, "%016llx\t%d\n", key, count);
 	}
 
-	/* Get RESET GPIO Number */
-	*rstn = of_get_named_gpio(spi->dev.of_node, "reset-gpio", 0);
-
 	return 0;
 }
 
-static int at86rf215_detect_device(struct at86rf215_local *lp)
+static int at86rf215_pending_open(struct inode *inode, struct file *file)
 {
-	unsigned int part, version;
-	int rc;
+	return single_open(file, at86rf215_pending_show, inode->i_private);
+}
 
-	rc = regmap_read(lp->regmap, RG_RF_VN, &version);
-	if (rc)
-		return rc;
-	printk(KERN_DEBUG "[Detecting]: AT86RF215 version: %x", version);
+/* "+pan:short" or "+ext" (hex) adds a frame held by an upper layer for
+ * that destination, "-" removes one */
+static ssize_t at86rf215_pending_write(struct file *file,
+				       const char __user *ubuf, size_t len,
+				       loff_t *ppos)
+{
+	struct at86rf215_local *lp =
+		((struct seq_file *)file->private_data)->private;
+	char buf[24];
+	unsigned int pan, addr;
+	u64 key;
 
-	rc = regmap_read(lp->regmap, RG_RF_PN, &part);
-	if (rc)
-		return rc;
-	/* printk (KERN_DEBUG "[Detecting]: AT86RF215 PN: %x", part); */
+	if (len >= sizeof(buf) || len < 2)
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
 
-	/* TODO: Check this stupid test. */
-/*        if ( (version != 1) || (version != 3)) {
- *              dev_err(&lp->spi->dev, "VN %x doesn't exist. ", version);
- *              return -EINVAL;
- *      }
- *      if ((part != 52) | (part != 53) || (part != 54)) {
- *              dev_err(&lp->spi->dev, "PN %x doesn't exist.", part);
- *              return -EINVAL;
- *      }
- */
+	if (buf[0] != '+' && buf[0] != '-')
+		return -EINVAL;
 
-	/* Please check mac802154.h */
-	lp->hw->flags = IEEE802154_HW_TX_OMIT_CKSUM |   /*Tx will add FCS aut*/
-			IEEE802154_HW_RX_OMIT_CKSUM |   /*Rx will add FCS aut*/
-			IEEE802154_HW_PROMISCUOUS;      /*Support promiscuous mode*/
+	if (sscanf(buf + 1, "%x:%x", &pan, &addr) == 2) {
+		if (pan > 0xffff || addr >= IEEE802154_ADDR_SHORT_BROADCAST)
+			return -EINVAL;
+		key = AT86RF215_PEND_SHORT | (u64)pan << 16 | addr;
+	} else if (kstrtou64(strim(buf + 1), 16, &key) || !key) {
+		return -EINVAL;
+	}
 
-	/* Please check cfg802154.h */
-	lp->hw->phy->flags = WPAN_PHY_FLAG_TXPOWER |      /*TXPWR setting*/
-			     WPAN_PHY_FLAG_CCA_ED_LEVEL | /*cca ED threshold */
-			     WPAN_PHY_FLAG_CCA_MODE;      /*cca mode setting*/
+	at86rf215_pend_update(lp, key, buf[0] == '+');
 
-	/* NL802154_CCA_ENERGY :Energy above threshold */
-	/* (CCA-ED) is supported only, please refer to Datasheet (p148) */
-	lp->hw->phy->supported.cca_modes = BIT(NL802154_CCA_ENERGY);
-	lp->hw->phy->supported.cca_opts =
-		BIT(NL802154_CCA_OPT_ENERGY_CARRIER_OR);
-	lp->hw->phy->cca.mode = NL802154_CCA_ENERGY;
+	return len;
+}
 
-	lp->data = &at86rf215_data;
+static const struct file_operations at86rf215_pending_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_pending_open,
+	.read		= seq_read,
+	.write		= at86rf215_pending_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-	/* 868 MHz BPSK 802.15.4-2003 */
-	lp->hw->phy->supported.channels[0] |= 1;
-	/* 915 MHz BPSK 802.15.4-2003 */
-	lp->hw->phy->supported.channels[0] |= 0x7fe;
-	/* 2.4 GHz O-QPSK 802.15.4-2003 */
-	lp->hw->phy->supported.channels[0] |= 0x7FFF800;
-	/* 868 MHz ASK 802.15.4-2006 */
-	lp->hw->phy->supported.channels[1] |= 1;
-	/* 915 MHz ASK 802.15.4-2006 */
-	lp->hw->phy->supported.channels[1] |= 0x7fe;
-	/* 868 MHz O-QPSK 802.15.4-2006 */
-	lp->hw->phy->supported.channels[2] |= 1;
-	/* 915 MHz O-QPSK 802.15.4-2006 */
-	lp->hw->phy->supported.channels[2] |= 0x7fe;
+static int at86rf215_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, at86rf215_stats_show, inode->i_private);
+}
 
-	/* Select page and channel by default. */
-	lp->hw->phy->current_channel = 3;
-	lp->hw->phy->current_page = 2;
+static const struct file_operations at86rf215_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= at86rf215_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
 
-	/* Symbol_duration: la duree d'un symbole PSDU module et code */
-	lp->hw->phy->symbol_duration = 4; /*(ttx_start_delay)*/
-	lp->hw->phy->supported.tx_powers = at86rf215_powers;
-	lp->hw->phy->supported.tx_powers_size = ARRAY_SIZE(at86rf215_powers);
-	lp->hw->phy->supported.cca_ed_levels = at86rf215_ed_levels;
-	lp->hw->phy->supported.cca_ed_levels_size = ARRAY_SIZE(
-		at86rf215_ed_levels);
+static void at86rf215_debugfs_init(struct at86rf215_local *lp)
+{
+	char debugfs_dir_name[DNAME_INLINE_LEN + 1] = "at86rf215-";
 
-	/* Define the ED threshold + the transmitter power */
-	lp->hw->phy->cca_ed_level = lp->hw->phy->supported.cca_ed_levels[7];
-	lp->hw->phy->transmit_power = lp->hw->phy->supported.tx_powers[28];
+	strncat(debugfs_dir_name, dev_name(&lp->spi->dev), DNAME_INLINE_LEN -
+		strlen(debugfs_dir_name));
 
-	return rc;
+	lp->debugfs_root = debugfs_create_dir(debugfs_dir_name, NULL);
+	if (!lp->debugfs_root)
+		return;
+
+	debugfs_create_file("stats", 0444, lp->debugfs_root, lp,
+			    &at86rf215_stats_fops);
+	debugfs_create_u32("pm_idle_ms", 0644, lp->debugfs_root,
+			   &lp->pm_idle_ms);
+	debugfs_create_bool("pm_deep_sleep", 0644, lp->debugfs_root,
+			    &lp->pm_deep_sleep);
+	debugfs_create_u32("pm_rx_period_ms", 0644, lp->debugfs_root,
+			   &lp->pm_rx_period_ms);
+	debugfs_create_u32("pm_rx_window_ms", 0644, lp->debugfs_root,
+			   &lp->pm_rx_window_ms);
+	debugfs_create_file("ed_scan", 0444, lp->debugfs_root, lp,
+			    &at86rf215_ed_scan_fops);
+	debugfs_create_u32("ed_scan_dwell_us", 0644, lp->debugfs_root,
+			   &lp->ed_scan_dwell_us);
+	debugfs_create_file("spi_bench", 0444, lp->debugfs_root, lp,
+			    &at86rf215_spi_bench_fops);
+	debugfs_create_u32("rx_batch_fps", 0644, lp->debugfs_root,
+			   &lp->rx_batch_fps);
+	debugfs_create_u32("rx_poll_us", 0644, lp->debugfs_root,
+			   &lp->rx_poll_us);
+	debugfs_create_u32("spi_hz", 0444, lp->debugfs_root, &lp->spi_hz);
+	debugfs_create_u32("spi_bench_count", 0644, lp->debugfs_root,
+			   &lp->spi_bench_count);
+	debugfs_create_bool("sniff_keep_bad_fcs", 0644, lp->debugfs_root,
+			    &lp->sniff.keep_bad_fcs);
+	debugfs_create_bool("tx_preload", 0644, lp->debugfs_root,
+			    &lp->tx_preload);
+	debugfs_create_bool("tx_stream", 0644, lp->debugfs_root,
+			    &lp->tx_stream);
+	debugfs_create_u32("tx_stream_min", 0644, lp->debugfs_root,
+			   &lp->tx_stream_min);
+	debugfs_create_u32("tx_ack_wait_us", 0644, lp->debugfs_root,
+			   &lp->tx_ack_wait_us);
+	debugfs_create_u32("tx_backoff_us", 0644, lp->debugfs_root,
+			   &lp->tx_backoff_us);
+	debugfs_create_file("pending", 0644, lp->debugfs_root, lp,
+			    &at86rf215_pending_fops);
+	debugfs_create_file("cpu", 0644, lp->debugfs_root, lp,
+			    &at86rf215_cpu_fops);
+	debugfs_create_file("txgen", 0644, lp->debugfs_root, lp,
+			    &at86rf215_txgen_fops);
+	debugfs_create_u32("txgen_count", 0644, lp->debugfs_root,
+			   &lp->txgen.count);
+	debugfs_create_u32("txgen_len", 0644, lp->debugfs_root,
+			   &lp->txgen.len);
+	debugfs_create_u32("txgen_gap_us", 0644, lp->debugfs_root,
+			   &lp->txgen.gap_us);
+	debugfs_create_u32("txgen_mcs", 0644, lp->debugfs_root,
+			   &lp->txgen.mcs);
+	debugfs_create_file("beacon", 0644, lp->debugfs_root, lp,
+			    &at86rf215_bcn_fops);
+	debugfs_create_u32("beacon_interval_us", 0644, lp->debugfs_root,
+			   &lp->bcn.interval_us);
+	debugfs_create_u32("beacon_lead_us", 0644, lp->debugfs_root,
+			   &lp->bcn.lead_us);
+	debugfs_create_file("wq_bench", 0444, lp->debugfs_root, lp,
+			    &at86rf215_wq_bench_fops);
+	debugfs_create_u32("wq_bench_devs", 0644, lp->debugfs_root,
+			   &lp->wq_bench_devs);
+	debugfs_create_u32("wq_bench_frames", 0644, lp->debugfs_root,
+			   &lp->wq_bench_frames);
 }
 
 static int at86rf215_probe(struct spi_device *spi)
 {
 	struct ieee802154_hw *hw;
 	struct at86rf215_local *lp;
-	int rc, rstn, irq_type;
+	int rc, rstn, irq_type, i;
 	unsigned int status;
 
 	pr_info("[Probing]: AT86RF215 probe function is called ..\n");
@@ -1063,8 +5503,21 @@ static int at86rf215_probe(struct spi_device *spi)
 	lp = hw->priv;
 	lp->hw = hw;
 	lp->spi = spi;
+	INIT_LIST_HEAD(&lp->node);
 	hw->parent = &spi->dev;
 
+	/* Each radio gets its own high priority workqueue and CPU */
+	lp->wq = alloc_workqueue("at86rf215/%s", WQ_HIGHPRI | WQ_MEM_RECLAIM,
+				 0, dev_name(&spi->dev));
+	if (!lp->wq) {
+		rc = -ENOMEM;
+		goto free_dev;
+	}
+	i = atomic_inc_return(&at86rf215_devices) - 1;
+	lp->cpu = cpumask_local_spread(i, dev_to_node(&spi->dev));
+	lp->wq_bench_devs = AT86RF215_WQ_BENCH_DEVS;
+	lp->wq_bench_frames = AT86RF215_WQ_BENCH_FRAMES;
+
 	/* TODO: Necessary ? */
 	ieee802154_random_extended_addr(&hw->phy->perm_extended_addr);
 
@@ -1077,9 +5530,21 @@ static int at86rf215_probe(struct spi_device *spi)
 		goto free_dev;
 	}
 
+	rc = at86rf215_alloc_contexts(lp);
+	if (rc)
+		goto free_dev;
+
 	/* TODO: The following may be edited */
-	at86rf215_setup_spi_messages(lp, &lp->state);
-	at86rf215_setup_spi_messages(lp, &lp->tx);
+	at86rf215_setup_spi_messages(lp, lp->state, RG_RF09_STATE);
+	at86rf215_setup_spi_messages(lp, lp->tx, RG_RF09_STATE);
+	at86rf215_optimize_messages(lp, lp->state);
+	at86rf215_optimize_messages(lp, lp->tx);
+	for (i = 0; i < AT86RF215_IRQ_SLOTS; i++) {
+		at86rf215_setup_spi_messages(lp, lp->irq_ctx[i], RG_BBC0_IRQS);
+		lp->irq_ctx[i]->msg.complete = at86rf215_irq_status;
+		at86rf215_optimize_messages(lp, lp->irq_ctx[i]);
+	}
+	at86rf215_setup_frame_messages(lp);
 
 	rc = at86rf215_detect_device(lp);
 	if (rc) {
@@ -1087,9 +5552,43 @@ static int at86rf215_probe(struct spi_device *spi)
 		goto free_dev;
 	}
 
+	INIT_WORK(&lp->spi_work, at86rf215_spi_work);
+	at86rf215_spi_train(lp);
+
 	/* This function initialize a dynamically allocated completion pointer
 	 * for completion structure that is to be initialized */
 	init_completion(&lp->state_complete);
+	spin_lock_init(&lp->lock);
+	INIT_DELAYED_WORK(&lp->cal_work, at86rf215_cal_work);
+	lp->cal_timeout = jiffies + AT86RF215_CAL_LOOP_TIMEOUT;
+	mutex_init(&lp->pm_lock);
+	INIT_DELAYED_WORK(&lp->pm_work, at86rf215_pm_work);
+	INIT_DELAYED_WORK(&lp->pm_rx_work, at86rf215_pm_rx_work);
+	INIT_WORK(&lp->pm_wake_work, at86rf215_pm_wake_work);
+	lp->pm_idle_ms = AT86RF215_PM_IDLE_MS;
+	lp->pm_epoch = ktime_get();
+	lp->ed_scan_dwell_us = AT86RF215_ED_SCAN_DWELL_US;
+	lp->spi_bench_count = AT86RF215_SPI_BENCH_COUNT;
+	INIT_WORK(&lp->rx_poll_work, at86rf215_rx_poll_work);
+	INIT_WORK(&lp->cfg.work, at86rf215_cfg_work);
+	at86rf215_pend_setup(lp);
+	at86rf215_txgen_setup(lp);
+	at86rf215_bcn_setup(lp);
+	init_waitqueue_head(&lp->cfg.wait);
+	lp->rx_batch_fps = AT86RF215_RX_BATCH_FPS;
+	lp->rx_poll_us = AT86RF215_RX_POLL_US;
+	lp->rx_win_start = jiffies;
+	lp->tx_preload = true;
+	lp->tx_stream = true;
+	lp->tx_stream_min = AT86RF215_TX_STREAM_MIN;
+	lp->tx_max_retries = AT86RF215_TX_RETRIES;
+	lp->tx_ack_wait_us = AT86RF215_TX_ACK_WAIT_US;
+	lp->tx_backoff_us = AT86RF215_TX_BACKOFF_US;
+	hrtimer_init(&lp->tx_ack_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lp->tx_ack_timer.function = at86rf215_tx_ack_timer;
+	INIT_WORK(&lp->tx_ack_work, at86rf215_tx_ack_work);
+	hrtimer_init(&lp->tx_backoff_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	lp->tx_backoff_timer.function = at86rf215_tx_backoff_timer;
 
 	spi_set_drvdata(spi, lp); /* spi->dev->driver_data = lp */
 
@@ -1116,42 +5615,45 @@ static int at86rf215_probe(struct spi_device *spi)
 	/* disable_irq by default and wait for starting hardware */
 	disable_irq(spi->irq);
 
+	mutex_lock(&at86rf215_devs_lock);
+	list_add_tail(&lp->node, &at86rf215_devs);
+	mutex_unlock(&at86rf215_devs_lock);
+	rc = at86rf215_set_cpu(lp, lp->cpu);
+	if (rc)
+		dev_warn(&spi->dev, "failed to set the IRQ affinity: %d\n", rc);
+
 	rc = ieee802154_register_hw(lp->hw);
 	if (rc) {
 		printk(KERN_ALERT "Unable to register the device");
-		return rc;
+		goto free_dev;
 	}
 	printk(KERN_DEBUG "Device REGISTRED !");
 
-
 	rc = at86rf215_config(lp);
 	if (rc) {
 		printk(KERN_ALERT "at86rf215_config FAILED.");
-		goto free_dev;
+		goto unregister_hw;
 	}
 
 	rc = regmap_read(lp->regmap, RG_RF09_STATE, &status);
 	if (rc) {
 		printk(KERN_DEBUG "Error while reading RG_RF09_CMD");
-		return rc;
+		goto unregister_hw;
 	}
 	if (status != RF_TRXOFF_STATUS)
 		printk(KERN_DEBUG "The radio is OFF or bad wiring!");
 
-	/* Set the frame length. Exple : 100 bytes */
-	rc = regmap_write(lp->regmap, RG_BBC0_TXFLL, 0x64) ||
-	     at86rf215_write_subreg(lp, SR_BBC0_TXFLH, 0x0);
-	if (rc) {
-		printk(KERN_ALERT "Error while writing frame length");
-		return rc;
-	}
+	/* Nothing can fail past this point: free_dev does not undo these */
+	at86rf215_debugfs_init(lp);
 
-	/* Continuous Transmition. */
-	rc = at86rf215_write_subreg(lp, SR_BBC0_PC_CTX, 0x1);
-	if (rc) {
-		printk(KERN_ALERT "Error while writing RG_BBC0_PC_CTX");
-		return rc;
-	}
+	/* The radio works without it: don't fail the probe. */
+	rc = at86rf215_rng_register(lp);
+	if (rc)
+		dev_warn(&spi->dev, "failed to register hwrng: %d\n", rc);
+
+	rc = at86rf215_sniff_register(lp);
+	if (rc)
+		dev_warn(&spi->dev, "failed to register sniffer: %d\n", rc);
 
 /*        rc = regmap_write(lp->regmap, RG_RF09_AUXS, 0x6);
  *      if (rc){
@@ -1170,8 +5672,14 @@ static int at86rf215_probe(struct spi_device *spi)
  */
 	return 0;
 
+unregister_hw:
+	ieee802154_unregister_hw(lp->hw);
 free_dev:
 	printk(KERN_ALERT "free_dev!");
+	at86rf215_devs_del(lp);
+	if (lp->wq)
+		destroy_workqueue(lp->wq);
+	at86rf215_free_contexts(lp);
 	ieee802154_free_hw(lp->hw);
 
 	return rc;
@@ -1181,8 +5689,34 @@ static int at86rf215_remove(struct spi_device *spi)
 {
 	struct at86rf215_local *lp = spi_get_drvdata(spi);
 
-	regmap_write(lp->regmap, RG_RF09_IRQM, 0x0000);
+	/* Stops the radio if it is up, nothing is armed by the stack after */
 	ieee802154_unregister_hw(lp->hw);
+	if (lp->rng.registered)
+		hwrng_unregister(&lp->rng.hwrng);
+	at86rf215_sniff_unregister(lp);
+	debugfs_remove_recursive(lp->debugfs_root);
+	at86rf215_devs_del(lp);
+	regmap_write(lp->regmap, RG_RF09_IRQM, 0x0000);
+
+	/* Nothing left to re-arm them: a delayed work still pending would
+	 * fire into the destroyed workqueue */
+	hrtimer_cancel(&lp->txgen.gap_timer);
+	hrtimer_cancel(&lp->bcn.timer);
+	hrtimer_cancel(&lp->bcn.tx_timer);
+	hrtimer_cancel(&lp->tx_ack_timer);
+	hrtimer_cancel(&lp->tx_backoff_timer);
+	cancel_delayed_work_sync(&lp->cal_work);
+	cancel_delayed_work_sync(&lp->pm_work);
+	cancel_delayed_work_sync(&lp->pm_rx_work);
+	cancel_work_sync(&lp->pm_wake_work);
+	cancel_work_sync(&lp->txgen.finish_work);
+	cancel_work_sync(&lp->spi_work);
+	cancel_work_sync(&lp->rx_poll_work);
+	cancel_work_sync(&lp->tx_ack_work);
+	cancel_work_sync(&lp->pend.work);
+	cancel_work_sync(&lp->cfg.work);
+	destroy_workqueue(lp->wq);
+	at86rf215_free_contexts(lp);
 	ieee802154_free_hw(lp->hw);
 	dev_dbg(&spi->dev, "[AT85RF215] The driver is unregistered.");
 
@@ -1214,7 +5748,29 @@ static struct spi_driver at86rf215_driver = {
 	.remove			= at86rf215_remove,
 };
 
-module_spi_driver(at86rf215_driver);
+static int __init at86rf215_init(void)
+{
+	int rc;
+
+	at86rf215_ctx_cache = KMEM_CACHE(at86rf215_state_change,
+					 SLAB_HWCACHE_ALIGN);
+	if (!at86rf215_ctx_cache)
+		return -ENOMEM;
+
+	rc = spi_register_driver(&at86rf215_driver);
+	if (rc)
+		kmem_cache_destroy(at86rf215_ctx_cache);
+
+	return rc;
+}
+module_init(at86rf215_init);
+
+static void __exit at86rf215_exit(void)
+{
+	spi_unregister_driver(&at86rf215_driver);
+	kmem_cache_destroy(at86rf215_ctx_cache);
+}
+module_exit(at86rf215_exit);
 
 MODULE_DESCRIPTION("AT86RF215 Transceiver Driver");
 MODULE_LICENSE("GPL v2");
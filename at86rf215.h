@@ -36,6 +36,8 @@
 
 /* STATUS register: state we wanna reach */
 #define RG_RF09_CMD         (0x0103)
+/* The chip enters DEEP_SLEEP only when both transceivers are in SLEEP. */
+#define RG_RF24_CMD         (0x0203)
 
 #define RF_NOP_STATUS        0X0
 #define RF_SLEEP_STATUS      0X1
@@ -114,20 +116,21 @@
 #define SR_BBC0_PC_CTX       0x301,0x80, 7 //Continuous transmission mode
 
 /** 2. AACK + From Tx to Rx + CCA **/
-#define RG_BBC0_AMCS        (0x0440) // Auto Mode Configuration and Status
-#define SR_BBC0_AMCS_TX2RX   0x0440, 0X01, 0 //The transceiver switches automatically to state RX if a transmit is completed.
-#define SR_BBC0_AMCS_CCATX   0x0440, 0X02, 1 //CCA Measurement and automatic Transmit: If this bit is set to 1, the auto mode feature CCA with automatic transmit is enabled.
-#define SR_BBC0_AMCS_CCAED   0x0440, 0X04, 2 //CCA Energy Detection Result: indicates the status of the result of the last CCA measurement. It is updated with "the finished ED measurement", while the procedure CCATX is active.
-#define SR_BBC0_AMCS_AACK    0x0440, 0X08, 3 //Auto Acknowledgement: If this bit is set to 1, the automatic ACK feature is enabled.
-#define SR_BBC0_AMCS_AACKS   0x0440, 0X10, 4 //Auto Acknowledgement Source: The automatick ACK is either sent by the transceiver respective to IEEE Std 802.15.4-2006 or from the transmit frame buffer.
-#define SR_BBC0_AMCS_AACKDR  0x0440, 0X20, 5 //Auto Acknowledgement Data Rate: if set to 1, the automatic ACK is sent using the modulation settings of the received frame. If not, the automatic ACK is transmitted using the current PHY settings.
-#define SR_BBC0_AMCS_AACKFA  0x0440, 0X40, 6 //Auto Acknowledgement FCS Adaption : if set to 1, the FCS type si derived from the FCS type of the received frame. Otherwise, from sub-register PC.FCST (Frame Check Sequence Type)
-#define SR_BBC0_AMCS_AACKFT  0x0440, 0X80, 7 //Auto Acknowledgement Frame Transmit
-
-#define RG_BBC0_AMEDT       (0x0441)         //Auto Mode Energy Detection Threshold:it contains the ED threshold for a CCA measurement. It is stored as a signed number in a range of [-127..128].
-#define RG_BBC0_AMAACKPD    (0x0442)         //Auto Mode Automatic ACK Pending Data: This register configures the behaviour of the pending data bit of an automatic acknowledgement frame.
-#define RG_BBC0_AMAACKTL    (0x0443)         //The transceiver switches automatically to state RX if a transmit is completed. (low byte)
-#define RG_BBC0_AMAACKTH    (0x0444)         //The transceiver switches automatically to state RX if a transmit is completed. (high byte)
+#define RG_BBC0_AMCS        (0x0340) // Auto Mode Configuration and Status
+#define SR_BBC0_AMCS_TX2RX   0x0340, 0X01, 0 //The transceiver switches automatically to state RX if a transmit is completed.
+#define SR_BBC0_AMCS_CCATX   0x0340, 0X02, 1 //CCA Measurement and automatic Transmit: If this bit is set to 1, the auto mode feature CCA with automatic transmit is enabled.
+#define SR_BBC0_AMCS_CCAED   0x0340, 0X04, 2 //CCA Energy Detection Result: indicates the status of the result of the last CCA measurement. It is updated with "the finished ED measurement", while the procedure CCATX is active.
+#define SR_BBC0_AMCS_AACK    0x0340, 0X08, 3 //Auto Acknowledgement: If this bit is set to 1, the automatic ACK feature is enabled.
+#define SR_BBC0_AMCS_AACKS   0x0340, 0X10, 4 //Auto Acknowledgement Source: The automatick ACK is either sent by the transceiver respective to IEEE Std 802.15.4-2006 or from the transmit frame buffer.
+#define SR_BBC0_AMCS_AACKDR  0x0340, 0X20, 5 //Auto Acknowledgement Data Rate: if set to 1, the automatic ACK is sent using the modulation settings of the received frame. If not, the automatic ACK is transmitted using the current PHY settings.
+#define SR_BBC0_AMCS_AACKFA  0x0340, 0X40, 6 //Auto Acknowledgement FCS Adaption : if set to 1, the FCS type si derived from the FCS type of the received frame. Otherwise, from sub-register PC.FCST (Frame Check Sequence Type)
+#define SR_BBC0_AMCS_AACKFT  0x0340, 0X80, 7 //Auto Acknowledgement Frame Transmit
+
+#define RG_BBC0_AMEDT       (0x0341)         //Auto Mode Energy Detection Threshold:it contains the ED threshold for a CCA measurement. It is stored as a signed number in a range of [-127..128].
+#define RG_BBC0_AMAACKPD    (0x0342)         //Auto Mode Automatic ACK Pending Data: This register configures the behaviour of the pending data bit of an automatic acknowledgement frame.
+#define AMAACKPD_PD0         BIT(0)           //Pending data bit of the ACK of frames matched by frame filter unit 0
+#define RG_BBC0_AMAACKTL    (0x0343)         //The transceiver switches automatically to state RX if a transmit is completed. (low byte)
+#define RG_BBC0_AMAACKTH    (0x0344)         //The transceiver switches automatically to state RX if a transmit is completed. (high byte)
 
 
 /********** RESET register **********/
@@ -208,12 +211,18 @@
 #define RG_RF09_RSSI (0x10D)
 //Energy Detection Configuration
 #define RG_RF09_EDC (0x010E)
+#define SR_RF09_EDC_EDM   0x010E, 0x03, 0 //Energy detection mode
+#define RF_EDAUTO          0x0 //Measurement triggered by a frame reception
+#define RF_EDSINGLE        0x1 //Single measurement
+#define RF_EDCONT          0x2 //Continuous measurement
+#define RF_EDOFF           0x3 //Measurements off
 //Receiver Energy Detection Averaging Duration
 #define RG_RF09_EDD      (0x10f)
-#define SR_RF09_EDD_DTB
-#define SR_RF09_EDD_DF
+#define SR_RF09_EDD_DTB   0x010F, 0x03, 0 //Time basis: 2, 8, 32 or 128 us
+#define SR_RF09_EDD_DF    0x010F, 0xfc, 2 //Multiplication factor
 //Receiver Energy Detection Value
-#define RG_RF09_EDV
+#define RG_RF09_EDV      (0x0110) //Signed, in dBm. 127 means invalid.
+#define RF_EDV_INVALID    127
 /** 3) Frequency Synthesizer (PLL) **/
 //Channel Spacing
 #define RG_RF09_CS       (0x0104)
@@ -254,25 +263,88 @@
 /** 10) MR-FSK PHY **/
 /** 11) MR-OFDM PHY **/
 #define RG_BBC0_OFDMPHRTX  (0x030C)
+#define SR_BBC0_OFDMPHRTX_MCS 0x030C, 0x07, 0 //Modulation and coding scheme of the transmitted frames
 /** 12) O-QPSK PHY **/
 /** 13) Frame Buffer **/
+#define RG_BBC0_RXFLL      (0x0304)
+#define RG_BBC0_RXFLH      (0x0305)
+#define RG_BBC0_FBRXS      (0x2000)
+#define RG_BBC0_FBRXE      (0x27FE)
 #define RG_BBC0_TXFLL      (0x0306)
 #define RG_BBC0_TXFLH      (0x0307)
 #define SR_BBC0_TXFLH       0x0307, 0x07, 0
 #define RG_BBC0_FBTXS      (0x2800)
 #define RG_BBC0_FBTXE      (0x2FFE)
-#define RG_BBC0_PS         (0X0402)
-#define SR_BBC0_PS_TXUR     0X0402, 0x01, 0
+#define RG_BBC0_PS         (0x0302)         //TXUR: frame buffer underrun of the last frame sent
+/* BBC1 is not used by the driver: its MAC extended address is a scratch area
+ * for the SPI link checks */
+#define RG_BBC1_MACEA0     (0x0425)
+#define SR_BBC0_PS_TXUR     0x0302, 0x01, 0
+#define PS_0_TXUR           BIT(0)
 /** 14) Frame Check Sequence ( see frame filter ) **/
 /** 15) IEEE MAC Support **/
 #define RG_BBC0_AFC0       (0x320)
+#define SR_BBC0_AFC0_AFEN0  0x320, 0x01, 0 //Enables frame filter unit 0
 #define SR_BBC0_AFC0_PM     0x320, 0x10, 4
+#define RG_BBC0_MACEA0     (0x325)         //Extended address, 8 bytes up to 0x32C
+#define RG_BBC0_MACPID0F0  (0x32D)         //PAN ID of frame filter unit 0 (low, high)
+#define RG_BBC0_MACSHA0F0  (0x32F)         //Short address of frame filter unit 0 (low, high)
 #define RG_BBC0_AFFTM          (0x322)
 /** 16) Random Number Generator **/
 /** 17) Phase Measurement Unit**/
 /** 18) Timestamp Counter **/
+#define RG_BBC0_CNTC       (0x0390)
+#define CNTC_EN             BIT(0) //Counter enable
+#define CNTC_RSTRXS         BIT(1) //Reset the counter at RXFS
+#define CNTC_RSTTXS         BIT(2) //Reset the counter at TXFS
+#define CNTC_CAPRXS         BIT(3) //Capture the counter at RXFS
+#define CNTC_CAPTXS         BIT(4) //Capture the counter at TXFS
+#define RG_BBC0_CNT0       (0x0391) //Counter value, LSB first (4 bytes)
 
 #define RG_RF09_RNDV  (0x111)
 
+/*************** Sniffer capture ring (shared with userspace) ***************/
+/* The ring is mapped from offset 0 of the sniffer character device. It starts
+ * with struct at86rf215_sniff_ring, slots start at AT86RF215_SNIFF_DATA_OFF.
+ * The driver only writes head, the reader only writes tail: slot
+ * (tail % slots) is valid while tail != head. */
+#define AT86RF215_SNIFF_MAX_PSDU    2047
+#define AT86RF215_SNIFF_DATA_OFF    4096
+#define AT86RF215_SNIFF_FCS_OK      0x01
+
+struct at86rf215_sniff_ring {
+	__u32	head;
+	__u32	__pad0[15];
+	__u32	tail;
+	__u32	__pad1[15];
+	__u32	slots;
+	__u32	slot_size;
+	__u64	frames;
+	__u64	drops;
+};
+
+struct at86rf215_sniff_frame {
+	__u64	tstamp_ns;      /* ktime_get_ns() at RXFE */
+	__u32	hw_tstamp;      /* BBC0_CNT captured at RXFS */
+	__u16	len;            /* PSDU length, FCS included */
+	__s8	rssi;           /* dBm, energy at RXFS (EDV), 127 invalid */
+	__u8	flags;
+	__u8	data[AT86RF215_SNIFF_MAX_PSDU];
+};
+
+/******************************* Periodic frames ******************************/
+/* Beacons sent by the driver on the counter schedule, see struct
+ * at86rf215_bcn in at86rf215.c. The debugfs "beacon" file drives them with
+ * a default beacon. */
+struct ieee802154_hw;
+struct sk_buff;
+
+int at86rf215_bcn_start(struct ieee802154_hw *hw, struct sk_buff *skb,
+			u32 interval_us,
+			int (*update)(struct sk_buff *skb, void *priv,
+				      unsigned int *len),
+			void *priv);
+void at86rf215_bcn_stop(struct ieee802154_hw *hw);
+
 #endif /* !_AT86RF230_H */
 
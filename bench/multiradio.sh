@@ -0,0 +1,77 @@
+#!/bin/sh
+# Multi-radio scaling, in two parts.
+#
+# debugfs "wq_bench" is synthetic: it runs the per-frame CPU work of the RX
+# path (MHR parse, pending table lookup, FCS) for 1..N simulated radios, each
+# with its own work item, all on the CPU of the device and spread over the
+# CPUs. It shows how the work items scale, without SPI, IRQs or the chip.
+#
+# The real TX path is then measured on the probed radios: the traffic
+# generators of the first 1..M radios run at the same time, COUNT frames of
+# LEN octets back to back, and the aggregate frames/s and IRQs are printed.
+#
+# Also lists where every probed radio runs and where its IRQ is steered.
+#
+# Usage: bench/multiradio.sh [MAX_DEVICES] [FRAMES_PER_DEVICE]
+# Environment: COUNT, LEN (real radios)
+
+MAX=${1:-$(nproc)}
+FRAMES=${2:-20000}
+DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+
+for dir in /sys/kernel/debug/at86rf215-*; do
+	dev=${dir#/sys/kernel/debug/at86rf215-}
+	irq=$(grep -w "$dev" /proc/interrupts | awk -F: '{ print $1 }' | tr -d ' ')
+	echo "$dev: cpu $(cat $dir/cpu)," \
+	     "irq $irq affinity $(cat /proc/irq/$irq/smp_affinity_list 2> /dev/null)"
+done
+
+echo $FRAMES > $DBG/wq_bench_frames
+printf "%8s %12s %12s\n" devices single_fps spread_fps
+n=1
+while [ $n -le $MAX ]; do
+	echo $n > $DBG/wq_bench_devs
+	cat $DBG/wq_bench | awk -v n=$n '
+		/^single_fps:/ { single = $2 }
+		/^spread_fps:/ { spread = $2 }
+		END { printf "%8d %12d %12d\n", n, single, spread }'
+	n=$((n + 1))
+done
+
+COUNT=${COUNT:-1000}
+LEN=${LEN:-127}
+DIRS=$(ls -d /sys/kernel/debug/at86rf215-*)
+
+# Sum of one counter of debugfs "stats" over the radios in $run
+irqs() {
+	for dir in $run; do
+		grep "^irqs:" $dir/stats | awk '{ print $2 }'
+	done | awk '{ sum += $1 } END { print sum + 0 }'
+}
+
+printf "\n%8s %12s %12s\n" radios txgen_fps irqs/frame
+n=0
+run=
+for dir in $DIRS; do
+	n=$((n + 1))
+	run="$run $dir"
+	for d in $run; do
+		echo $COUNT > $d/txgen_count
+		echo 0 > $d/txgen_gap_us
+		echo $LEN > $d/txgen_len
+	done
+	irqs0=$(irqs)
+	for d in $run; do
+		echo start > $d/txgen
+	done
+	for d in $run; do
+		while grep -q "^state:.*running" $d/txgen; do
+			sleep 0.2
+		done
+	done
+	fps=$(for d in $run; do awk '/fps:/ { print $2 }' $d/txgen; done |
+	      awk '{ sum += $1 } END { print sum + 0 }')
+	printf "%8d %12d %12s\n" $n $fps \
+	       $(echo "$(irqs) $irqs0 $n $COUNT" |
+		 awk '{ printf "%.2f", ($1 - $2) / ($3 * $4) }')
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Runtime PM benchmark: sends COUNT pings of SIZE bytes every DELAY ms and
+# reports the wake-to-TX latency and the fraction of time the radio slept.
+#
+# Usage: bench/pm.sh [IDLE_MS] [DEEP_SLEEP] [COUNT] [SIZE] [DELAY_MS]
+
+IDLE_MS=${1:-10}
+DEEP=${2:-0}
+COUNT=${3:-100}
+SIZE=${4:-20}
+DELAY=${5:-200}
+DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+
+stat() {
+	grep "^$1:" $DBG/stats | awk '{ print $2 }'
+}
+
+iwpan dev wpan0 set pan_id 0x1111
+iwpan dev wpan0 set short_addr 0x0001
+ip link set wpan0 up
+
+echo $DEEP > $DBG/pm_deep_sleep
+echo $IDLE_MS > $DBG/pm_idle_ms
+
+asleep0=$(stat pm_asleep_us)
+elapsed0=$(stat pm_elapsed_us)
+wakes0=$(stat pm_wake_tx)
+wake0=$(stat pm_wake_total_us)
+
+wpan-ping -a 0x0001 -c $COUNT -s $SIZE -d $DELAY > /dev/null
+
+asleep=$(($(stat pm_asleep_us) - asleep0))
+elapsed=$(($(stat pm_elapsed_us) - elapsed0))
+wakes=$(($(stat pm_wake_tx) - wakes0))
+wake=$(($(stat pm_wake_total_us) - wake0))
+
+echo 0 > $DBG/pm_idle_ms
+ip link set wpan0 down
+
+echo "idle_ms=$IDLE_MS deep_sleep=$DEEP count=$COUNT size=$SIZE delay_ms=$DELAY"
+echo "asleep:          $((asleep * 100 / elapsed)) % ($asleep us / $elapsed us)"
+echo "wakes on xmit:   $wakes"
+[ $wakes -gt 0 ] && echo "wake latency:    $((wake / wakes)) us avg, $(stat pm_wake_max_us) us max"
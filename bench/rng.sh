@@ -0,0 +1,26 @@
+#!/bin/sh
+# hwrng benchmark: reads SIZE KiB from /dev/hwrng while the radio listens and
+# reports the throughput measured by the driver.
+#
+# Usage: bench/rng.sh [SIZE_KIB]
+
+SIZE=${1:-64}
+DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+RNG=/sys/class/misc/hw_random
+
+stat() {
+	grep "^$1:" $DBG/stats | awk '{ print $2 }'
+}
+
+ip link set wpan0 up
+echo $(basename $DBG | sed 's/^at86rf215-//') > $RNG/rng_current
+
+busy0=$(stat rng_busy)
+start=$(date +%s%N)
+dd if=/dev/hwrng of=/dev/null bs=1024 count=$SIZE iflag=fullblock 2> /dev/null
+end=$(date +%s%N)
+
+echo "read:            $SIZE KiB in $(((end - start) / 1000000)) ms"
+echo "wall throughput: $((SIZE * 1024 * 1000000000 / (end - start))) B/s"
+echo "bus throughput:  $(stat rng_bytes_per_s) B/s"
+echo "busy retries:    $(($(stat rng_busy) - busy0))"
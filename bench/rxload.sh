@@ -0,0 +1,63 @@
+#!/bin/sh
+# RX load benchmark: while a peer sends frames at a given offered load, reads
+# the driver counters over DURATION seconds and reports interrupts and CPU
+# time per received frame. Run it once per offered load, e.g. with and
+# without IRQ moderation (echo 0 > $DBG/rx_batch_fps disables it).
+#
+# With "sim" the simulator receives FRAMES frames of 20 octets for each
+# inter-frame gap in GAPS (us), once without moderation and once with the
+# default threshold, and prints IRQs, SPI traffic and latency per frame. CPU
+# time is not modelled there: irq_cpu_ns only counts simulated bus waits.
+#
+# Usage: bench/rxload.sh [DURATION] [LABEL]
+#        bench/rxload.sh sim [FRAMES]
+# Environment: GAPS, SIM
+
+if [ "$1" = sim ]; then
+	FRAMES=${2:-2000}
+	GAPS=${GAPS:-"2000 1000 500 300"}
+	SIM=${SIM:-$(dirname $0)/../sim/at86rf215-sim}
+	[ -x $SIM ] || { echo "$SIM: build it with make sim/at86rf215-sim"; exit 1; }
+
+	echo "gap_us batch_fps irqs/frame msgs/frame bus_us/frame lat_p50_us lat_p99_us"
+	for gap in $GAPS; do
+		for fps in 0 200; do
+			$SIM -n $FRAMES -l 20 -g $gap -d rx_batch_fps=$fps rx stats |
+			awk -v gap=$gap -v fps=$fps '
+				$1 == "rx" { msgs = $3; bus = $5; p50 = $7; p99 = $8 }
+				$1 == "irqs:" { irqs = $2 }
+				$1 == "rx_frames:" { frames = $2 }
+				END {
+					printf "%6d %9d %10.2f %10s %12s %10s %10s\n",
+					       gap, fps, irqs / frames, msgs, bus, p50, p99
+				}'
+		done
+	done
+	exit 0
+fi
+
+DURATION=${1:-10}
+LABEL=${2:-load}
+DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+
+stat() {
+	grep "^$1:" $DBG/stats | awk '{ print $2 }'
+}
+
+ip link set wpan0 up
+
+frames0=$(stat rx_frames)
+irqs0=$(stat irqs)
+cpu0=$(stat irq_cpu_ns)
+enter0=$(stat rx_batch_enter)
+sleep $DURATION
+frames=$(($(stat rx_frames) - frames0))
+irqs=$(($(stat irqs) - irqs0))
+cpu=$(($(stat irq_cpu_ns) - cpu0))
+
+echo "$LABEL: $((frames / DURATION)) frames/s, batch mode entered" \
+     "$(($(stat rx_batch_enter) - enter0)) times"
+if [ $frames -gt 0 ]; then
+	echo "irqs/frame:      $((irqs / frames)).$((irqs * 100 / frames % 100))"
+	echo "cpu ns/frame:    $((cpu / frames))"
+fi
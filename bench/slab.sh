@@ -0,0 +1,31 @@
+#!/bin/sh
+# Slab footprint of the driver: snapshots /proc/slabinfo before loading the
+# module and once the device is probed, then prints every cache that grew
+# (bytes = objects * object size). The command contexts show up in their own
+# cache, at86rf215_state_change.
+#
+# Usage: bench/slab.sh [MODULE]
+
+MODULE=${1:-./at86rf215.ko}
+BEFORE=$(mktemp)
+AFTER=$(mktemp)
+
+snapshot() {
+	tail -n +3 /proc/slabinfo | awk '{ print $1, $2, $4 }' | sort > $1
+}
+
+rmmod at86rf215 2> /dev/null
+snapshot $BEFORE
+insmod $MODULE
+sleep 1
+snapshot $AFTER
+
+echo "cache                            objs     bytes"
+join -a 2 -e 0 -o 0,1.2,2.2,2.3 $BEFORE $AFTER | awk '
+	$3 > $2 {
+		printf "%-32s %5d %9d\n", $1, $3 - $2, ($3 - $2) * $4
+		total += ($3 - $2) * $4
+	}
+	END { printf "%-32s %5s %9d\n", "total", "", total }'
+
+rm -f $BEFORE $AFTER
@@ -0,0 +1,202 @@
+#!/bin/sh
+# Throughput and latency benchmark suite. Sweeps channel, PHY profile (MR-OFDM
+# MCS), frame size and count over two workloads and writes one CSV row per
+# run to RESULTS/results.csv, plus the debugfs "stats" of the driver before
+# and after each run in RESULTS/stats/.
+#
+# Workloads:
+#   ping  COUNT wpan-ping requests of SIZE bytes to $DST: RTT percentiles,
+#         loss, frames/s. Stack frames always go out with MCS 3. On hw the
+#         stack MTU is 127 bytes: SIZEs over PING_MAX (the wpan-ping payload
+#         left by the MAC header and the FCS) are skipped, so is a run where
+#         wpan-ping fails.
+#   bulk  the in-driver traffic generator (debugfs "txgen"), COUNT frames of
+#         SIZE bytes back to back for every MCS: frames/s and kbit/s.
+#
+# Targets:
+#   hw    the radio behind wpan0, counters from /sys/kernel/debug, CPU use
+#         from /proc/stat.
+#   sim   the userspace build of the driver against the chip model
+#         (make sim/at86rf215-sim), on any Linux box. ping is the "tx"
+#         scenario there: no peer answers, latency is xmit to TX done and
+#         there is no loss on air. CPU use is not measured.
+#
+# The rev column (git revision of the tree, or srcversion of the loaded
+# module) keeps results of different driver revisions apart.
+#
+# Usage: bench/suite.sh [hw|sim] [RESULTS]
+# Environment: CHANNELS, MCS, SIZES, COUNT, WORKLOADS, DST, PING_MAX, SIM
+
+TARGET=${1:-hw}
+OUT=${2:-bench-results/$(date +%Y%m%d-%H%M%S)-$TARGET}
+CHANNELS=${CHANNELS:-"0 5 10"}
+MCS=${MCS:-"0 1 2 3 4 5 6"}
+SIZES=${SIZES:-"20 100 500 1000"}
+COUNT=${COUNT:-100}
+WORKLOADS=${WORKLOADS:-"ping bulk"}
+DST=${DST:-0x0001}
+PING_MAX=${PING_MAX:-105}
+SIM=${SIM:-$(dirname $0)/../sim/at86rf215-sim}
+
+case $TARGET in
+hw)
+	DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+	REV=$(cat /sys/module/at86rf215/srcversion 2> /dev/null)
+	;;
+sim)
+	[ -x $SIM ] || { echo "$SIM: build it with make sim/at86rf215-sim"; exit 1; }
+	REV=$(git -C $(dirname $0) describe --always --dirty 2> /dev/null)
+	;;
+*)
+	echo "usage: $0 [hw|sim] [RESULTS]"
+	exit 2
+	;;
+esac
+
+mkdir -p $OUT/stats || exit 1
+CSV=$OUT/results.csv
+echo "target,rev,workload,channel,mcs,size,count,sent,received,loss_pct," \
+     "fps,kbps,lat_p50_us,lat_p99_us,lat_max_us,cpu_pct,irqs,spi_errors," \
+     "rx_drops" | tr -d ' ' > $CSV
+
+# Difference of one counter between two snapshots of debugfs "stats"
+delta() {
+	awk -v name="$1:" '
+		FNR == 1 { file++ }
+		$1 == name { v[file] = $2 }
+		END { print v[2] - v[1] }' $2 $3
+}
+
+# Busy and total jiffies of all CPUs
+cpu_now() {
+	awk '/^cpu / { print $2 + $3 + $4 + $7 + $8, $2 + $3 + $4 + $5 + $6 + $7 + $8 }' /proc/stat
+}
+
+# p50 p99 max of a column of numbers
+percentiles() {
+	sort -n | awk '
+		{ v[NR] = $1 }
+		END {
+			if (!NR) { print "-", "-", "-"; exit }
+			print v[int((NR - 1) * 0.50) + 1], v[int((NR - 1) * 0.99) + 1], v[NR]
+		}'
+}
+
+row() {
+	echo "$TARGET,$REV,$workload,$ch,$mcs,$size,$COUNT,$sent,$received,$loss,$fps,$kbps,$p50,$p99,$max,$cpu,$(delta irqs $before $after),$(delta spi_errors $before $after),$(delta rx_drops $before $after)" >> $CSV
+	echo "$workload ch=$ch mcs=$mcs size=$size: $sent sent, $received received, $fps frames/s, latency p50 $p50 p99 $p99 us"
+}
+
+hw_channel() {
+	ip link set wpan0 down
+	iwpan phy $(iwpan dev wpan0 info | awk '/wiphy/ { print "phy" $2 }') \
+		set channel 0 $1
+	iwpan dev wpan0 set pan_id 0x1111
+	iwpan dev wpan0 set short_addr 0x0001
+	ip link set wpan0 up
+}
+
+hw_ping() {
+	cat $DBG/stats > $before
+	c0=$(cpu_now)
+	t0=$(date +%s%N)
+	wpan-ping -a $DST -c $COUNT -s $size > $run.log 2>&1 || return 1
+	t1=$(date +%s%N)
+	c1=$(cpu_now)
+	cat $DBG/stats > $after
+
+	sent=$(awk '/packets transmitted/ { print $1 }' $run.log)
+	[ -n "$sent" ] && [ $sent -gt 0 ] || return 1
+	received=$(grep -c "time=" $run.log)
+	set -- $(sed -n 's/.*time=\([0-9.]*\).*/\1/p' $run.log |
+		 awk '{ printf "%d\n", $1 * 1000 }' | percentiles)
+	p50=$1 p99=$2 max=$3
+	loss=$(((sent - received) * 100 / sent))
+	fps=$((received * 1000000000 / (t1 - t0)))
+	kbps=$((received * size * 8 * 1000000 / (t1 - t0)))
+	set -- $c0 $c1
+	cpu=$((($3 - $1) * 100 / ($4 - $2 + 1)))
+}
+
+hw_bulk() {
+	echo $COUNT > $DBG/txgen_count
+	echo 0 > $DBG/txgen_gap_us
+	echo $mcs > $DBG/txgen_mcs
+	echo $size > $DBG/txgen_len
+	cat $DBG/stats > $before
+	c0=$(cpu_now)
+	echo start > $DBG/txgen || return 1
+	while grep -q "^state:.*running" $DBG/txgen; do
+		sleep 0.2
+	done
+	c1=$(cpu_now)
+	cat $DBG/stats > $after
+	cat $DBG/txgen > $run.log
+	txgen_result
+	set -- $c0 $c1
+	cpu=$((($3 - $1) * 100 / ($4 - $2 + 1)))
+}
+
+# Fields of a debugfs "txgen" report in $run.log
+txgen_result() {
+	sent=$(awk '/sent:/ { split($2, s, "/"); print s[1] }' $run.log)
+	fps=$(awk '/fps:/ { print $2 }' $run.log)
+	received=-
+	loss=-
+	kbps=$((fps * size * 8 / 1000))
+	p50=- p99=- max=-
+}
+
+# Splits the two "--- stats" blocks of a simulator run
+sim_stats() {
+	awk -v before=$before -v after=$after '
+		/^--- stats/ { n++; next }
+		/^[a-z_0-9]+:/ { print > (n == 1 ? before : after) }' $run.log
+}
+
+sim_ping() {
+	$SIM -k $ch -n $COUNT -l $size stats tx stats > $run.log 2>&1
+	sim_stats
+	set -- $(awk '$1 == "tx" { print $2, $7, $8, $9; exit }' $run.log)
+	sent=$1 p50=${2%.*} p99=${3%.*} max=${4%.*}
+	received=$(awk '/ sent, / { split($1, s, "/"); print s[1] }' $run.log)
+	fps=$(awk '/ sent, / { printf "%d", $3 }' $run.log)
+	loss=$(((sent - received) * 100 / sent))
+	kbps=$((fps * size * 8 / 1000))
+	cpu=-
+}
+
+sim_bulk() {
+	$SIM -k $ch -d txgen_count=$COUNT -d txgen_gap_us=0 -d txgen_mcs=$mcs \
+	     -d txgen_len=$size stats txgen stats > $run.log 2>&1
+	sim_stats
+	sed -i 's/^  //' $run.log
+	txgen_result
+	cpu=-
+}
+
+[ $TARGET = hw ] && ip link set wpan0 up
+for ch in $CHANNELS; do
+	[ $TARGET = hw ] && hw_channel $ch
+	for workload in $WORKLOADS; do
+		case $workload in
+		ping) profiles=3 ;;
+		bulk) profiles=$MCS ;;
+		*) echo "unknown workload $workload"; exit 2 ;;
+		esac
+		for mcs in $profiles; do
+			for size in $SIZES; do
+				if [ $TARGET-$workload = hw-ping ] &&
+				   [ $size -gt $PING_MAX ]; then
+					echo "ping size=$size: over the $PING_MAX byte payload of a 127 byte frame, skipped"
+					continue
+				fi
+				run=$OUT/stats/$workload-ch$ch-mcs$mcs-$size
+				before=$run.before
+				after=$run.after
+				${TARGET}_$workload && row || echo "$run failed"
+			done
+		done
+	done
+done
+echo "results in $CSV"
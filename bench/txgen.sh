@@ -0,0 +1,35 @@
+#!/bin/sh
+# TX throughput per PHY mode: runs the in-driver traffic generator for every
+# MR-OFDM MCS and frame length given, and prints the achieved frames per
+# second, the share of time on the air and the share of time spent on SPI
+# uploads. No frames go through the netdev stack.
+#
+# Usage: bench/txgen.sh [COUNT] [GAP_US] [LENGTHS...]
+
+COUNT=${1:-1000}
+GAP=${2:-0}
+shift 2 2> /dev/null
+LENS=${*:-"20 127 500 2047"}
+DBG=${DBG:-$(ls -d /sys/kernel/debug/at86rf215-* | head -n 1)}
+
+ip link set wpan0 up
+
+echo $COUNT > $DBG/txgen_count
+echo $GAP > $DBG/txgen_gap_us
+printf "%4s %6s %8s %9s %7s\n" mcs len fps airtime spi
+for mcs in 0 1 2 3 4 5 6; do
+	for len in $LENS; do
+		echo $mcs > $DBG/txgen_mcs
+		echo $len > $DBG/txgen_len
+		echo start > $DBG/txgen || continue
+		while grep -q "^state:.*running" $DBG/txgen; do
+			sleep 0.2
+		done
+		awk -v mcs=$mcs -v len=$len '
+			/^fps:/ { fps = $2 }
+			/^airtime:/ { air = $2 }
+			/^spi:/ { spi = $2 }
+			END { printf "%4d %6d %8d %9s %7s\n", mcs, len, fps, air, spi }' \
+			$DBG/txgen
+	done
+done
@@ -1,38 +1,241 @@
-# NOTE : The CSV file must be saved with HEX values.
-
+#!/usr/bin/env python3
+# Decodes an SPI capture of the logic analyser (CSV export with the columns
+# "Time [s],Packet ID,MOSI,MISO", values in HEX) into AT86RF215 register
+# accesses.
+#
+# Bytes are grouped into transactions (one chip select) by the Packet ID
+# column. Captures exported without it are split on gaps between bytes longer
+# than --gap instead. The first two bytes are the command: bit 7 of the first
+# one is set for a write, the next 14 bits are the address. Every following
+# byte is one register, the address auto-increments, so a frame buffer burst
+# or the IRQS burst of the driver decodes as one transaction of any length.
+#
+# The register names are read at startup from at86rf215.txt (vendor header)
+# and ../at86rf215.h (driver header, for names the vendor one lacks).
+#
+# The capture is read line by line: memory does not grow with its size.
+#
+# Usage: ./extract_data.py [-r] [-f] [--gap US] [CAPTURE.csv]
 
+import argparse
 import csv
-myDict={'0x0401': 'RG_BBC1_PC', '0x0435': 'RG_BBC1_MACPID0F2', '0x0406': 'RG_BBC1_TXFLL', '0x0373': 'RG_BBC0_FSKPE0', '0x0441': 'RG_BBC1_AMEDT', '0x0424': 'RG_BBC1_AFS', '0x033A': 'RG_BBC0_MACPID1F3', '0x033B': 'RG_BBC0_MACSHA0F3', '0x033C': 'RG_BBC0_MACSHA1F3', '0x0420': 'RG_BBC1_AFC0', '0x0404': 'RG_BBC1_RXFLL', '0x0422': 'RG_BBC1_AFFTM', '0x0423': 'RG_BBC1_AFFVM', '0x0384': 'RG_BBC0_PMUQ', '0x000D': 'RG_RF_PN', '0x000E': 'RG_RF_VN', '0x000B': 'RF_FLC1000KHZ', '0x000C': 'RG_RF_IQIFC2', '0x0383': 'RG_BBC0_PMUI', '0x000A': 'RF_FLC800KHZ', '0x0305': 'RG_BBC0_RXFLH', '0x0304': 'RG_BBC0_RXFLL', '0x0307': 'RG_BBC0_TXFLH', '0x0306': 'RG_BBC0_TXFLL', '0x0301': 'RG_BBC0_PC', '0x0300': 'RG_BBC0_IRQM', '0x0371': 'RG_BBC0_FSKRRXFLH', '0x0302': 'RG_BBC0_PS', '0x0309': 'RG_BBC0_FBLH', '0x0308': 'RG_BBC0_FBLL', '0x0428': 'RG_BBC1_MACEA3', '0x0429': 'RG_BBC1_MACEA4', '0x0393': 'RG_BBC0_CNT2', '0x042D': 'RG_BBC1_MACPID0F0', '0x046A': 'RG_BBC1_FSKPHRTX', '0x042E': 'RG_BBC1_MACPID1F0', '0x0409': 'RG_BBC1_FBLH', '0x042F': 'RG_BBC1_MACSHA0F0', '0x0369': 'RG_BBC0_FSKSFD1H', '0x030E': 'RG_BBC0_OFDMC', '0x030D': 'RG_BBC0_OFDMPHRRX', '0x0431': 'RG_BBC1_MACPID0F1', '0x030F': 'RG_BBC0_OFDMSW', '0x030A': 'RG_BBC0_FBLIL', '0x0436': 'RG_BBC1_MACPID1F2', '0x030C': 'RG_BBC0_OFDMPHRTX', '0x030B': 'RG_BBC0_FBLIH', '0x0433': 'RG_BBC1_MACSHA0F1', '0x3FFE': 'RG_BBC1_FBTXE', '0x37FE': 'RG_BBC1_FBRXE', '0x042A': 'RG_BBC1_MACEA5', '0x0330': 'RG_BBC0_MACSHA1F0', '0x0331': 'RG_BBC0_MACPID0F1', '0x0332': 'RG_BBC0_MACPID1F1', '0x0333': 'RG_BBC0_MACSHA0F1', '0x0334': 'RG_BBC0_MACSHA1F1', '0x0335': 'RG_BBC0_MACPID0F2', '0x0008': 'RF_FLC500KHZ', '0x0009': 'RF_FLC625KHZ', '0x0006': 'RF_FLC315KHZ', '0x0007': 'RF_FLC400KHZ', '0x0004': 'RF_FLC200KHZ', '0x0005': 'RF_FLC250KHZ', '0x0002': 'BB_FCHIP1000', '0x0003': 'BB_FCHIP2000', '0x0000': 'BB_CH_CLEAR', '0x0001': 'BB_CH_BUSY', '0x0338': 'RG_BBC0_MACSHA1F2', '0x0427': 'RG_BBC1_MACEA2', '0x27FE': 'RG_BBC0_FBRXE', '0x0432': 'RG_BBC1_MACPID1F1', '0x0339': 'RG_BBC0_MACPID0F3', '0x046D': 'RG_BBC1_FSKRPCONT', '0x0475': 'RG_BBC1_FSKPE2', '0x0421': 'RG_BBC1_AFC1', '0x0474': 'RG_BBC1_FSKPE1', '0x0473': 'RG_BBC1_FSKPE0', '0x040F': 'RG_BBC1_OFDMSW', '0x0472': 'RG_BBC1_FSKDM', '0x046E': 'RG_BBC1_FSKRPCOFFT', '0x0437': 'RG_BBC1_MACSHA0F2', '0x0470': 'RG_BBC1_FSKRRXFLL', '0x0444': 'RG_BBC1_AMAACKTH', '0x0442': 'RG_BBC1_AMAACKPD', '0x0443': 'RG_BBC1_AMAACKTL', '0x0329': 'RG_BBC0_MACEA4', '0x0328': 'RG_BBC0_MACEA3', '0x0327': 'RG_BBC0_MACEA2', '0x0326': 'RG_BBC0_MACEA1', '0x0325': 'RG_BBC0_MACEA0', '0x0324': 'RG_BBC0_AFS', '0x0323': 'RG_BBC0_AFFVM', '0x0322': 'RG_BBC0_AFFTM', '0x0321': 'RG_BBC0_AFC1', '0x0320': 'RG_BBC0_AFC0', '0x0438': 'RG_BBC1_MACSHA1F2', '0x0382': 'RG_BBC0_PMUQF', '0x043C': 'RG_BBC1_MACSHA1F3', '0x043B': 'RG_BBC1_MACSHA0F3', '0x040D': 'RG_BBC1_OFDMPHRRX', '0x0434': 'RG_BBC1_MACSHA1F1', '0x043A': 'RG_BBC1_MACPID1F3', '0x0222': 'RG_RF24_PLLCF', '0x0221': 'RG_RF24_PLL', '0x0226': 'RG_RF24_TXCQ', '0x0227': 'RG_RF24_TXDACI', '0x0225': 'RG_RF24_TXCI', '0x032F': 'RG_BBC0_MACSHA0F0', '0x0228': 'RG_RF24_TXDACQ', '0x032D': 'RG_BBC0_MACPID0F0', '0x032C': 'RG_BBC0_MACEA7', '0x032B': 'RG_BBC0_MACEA6', '0x032A': 'RG_BBC0_MACEA5', '0x0425': 'RG_BBC1_MACEA0', '0x040E': 'RG_BBC1_OFDMC', '0x0340': 'RG_BBC0_AMCS', '0x0341': 'RG_BBC0_AMEDT', '0x020E': 'RG_RF24_EDC', '0x042C': 'RG_BBC1_MACEA7', '0x0343': 'RG_BBC0_AMAACKTL', '0x0426': 'RG_BBC1_MACEA1', '0x0394': 'RG_BBC0_CNT3', '0x3800': 'RG_BBC1_FBTXS', '0x042B': 'RG_BBC1_MACEA6', '0x0344': 'RG_BBC0_AMAACKTH', '0x2000': 'RG_BBC0_FBRXS', '0x032E': 'RG_BBC0_MACPID1F0', '0x0460': 'RG_BBC1_FSKC0', '0x0461': 'RG_BBC1_FSKC1', '0x0462': 'RG_BBC1_FSKC2', '0x0463': 'RG_BBC1_FSKC3', '0x0464': 'RG_BBC1_FSKC4', '0x0465': 'RG_BBC1_FSKPLL', '0x0466': 'RG_BBC1_FSKSFD0L', '0x0467': 'RG_BBC1_FSKSFD0H', '0x020D': 'RG_RF24_RSSI', '0x2FFE': 'RG_BBC0_FBTXE', '0x020F': 'RG_RF24_EDD', '0x0342': 'RG_BBC0_AMAACKPD', '0x020A': 'RG_RF24_RXDFE', '0x020B': 'RG_RF24_AGCC', '0x020C': 'RG_RF24_AGCS', '0x0390': 'RG_BBC0_CNTC', '0x036E': 'RG_BBC0_FSKRPCOFFT', '0x0391': 'RG_BBC0_CNT0', '0x036A': 'RG_BBC0_FSKPHRTX', '0x0468': 'RG_BBC1_FSKSFD1L', '0x0374': 'RG_BBC0_FSKPE1', '0x0375': 'RG_BBC0_FSKPE2', '0x046B': 'RG_BBC1_FSKPHRRX', '0x046C': 'RG_BBC1_FSKRPC', '0x0208': 'RG_RF24_CNM', '0x0209': 'RG_RF24_RXBWC', '0x0372': 'RG_BBC0_FSKDM', '0x036D': 'RG_BBC0_FSKRPCONT', '0x0204': 'RG_RF24_CS', '0x0205': 'RG_RF24_CCF0L', '0x0206': 'RG_RF24_CCF0H', '0x0207': 'RG_RF24_CNL', '0x0200': 'RG_RF24_IRQM', '0x0201': 'RG_RF24_AUXS', '0x0202': 'RG_RF24_STATE', '0x0203': 'RG_RF24_CMD', '0x0128': 'RG_RF09_TXDACQ', '0x0125': 'RG_RF09_TXCI', '0x0127': 'RG_RF09_TXDACI', '0x0126': 'RG_RF09_TXCQ', '0x0121': 'RG_RF09_PLL', '0x0469': 'RG_BBC1_FSKSFD1H', '0x0471': 'RG_BBC1_FSKRRXFLH', '0x0122': 'RG_RF09_PLLCF', '0x0482': 'RG_BBC1_PMUQF', '0x0483': 'RG_BBC1_PMUI', '0x0480': 'RG_BBC1_PMUC', '0x0481': 'RG_BBC1_PMUVAL', '0x0439': 'RG_BBC1_MACPID0F3', '0x0484': 'RG_BBC1_PMUQ', '0x0363': 'RG_BBC0_FSKC3', '0x0362': 'RG_BBC0_FSKC2', '0x0361': 'RG_BBC0_FSKC1', '0x0360': 'RG_BBC0_FSKC0', '0x0367': 'RG_BBC0_FSKSFD0H', '0x0366': 'RG_BBC0_FSKSFD0L', '0x0365': 'RG_BBC0_FSKPLL', '0x0364': 'RG_BBC0_FSKC4', '0x0213': 'RG_RF24_TXDFE', '0x0212': 'RG_RF24_TXCUTC', '0x0211': 'RG_RF24_RNDV', '0x0210': 'RG_RF24_EDV', '0x0216': 'RG_RF24_PADFE', '0x0214': 'RG_RF24_PAC', '0x010F': 'RG_RF09_EDD', '0x010E': 'RG_RF09_EDC', '0x010D': 'RG_RF09_RSSI', '0x010C': 'RG_RF09_AGCS', '0x010B': 'RG_RF09_AGCC', '0x010A': 'RG_RF09_RXDFE', '0x0110': 'RG_RF09_EDV', '0x0111': 'RG_RF09_RNDV', '0x0400': 'RG_BBC1_IRQM', '0x0113': 'RG_RF09_TXDFE', '0x0114': 'RG_RF09_PAC', '0x0407': 'RG_BBC1_TXFLH', '0x0116': 'RG_RF09_PADFE', '0x0405': 'RG_BBC1_RXFLH', '0x0491': 'RG_BBC1_CNT0', '0x0490': 'RG_BBC1_CNTC', '0x0493': 'RG_BBC1_CNT2', '0x0492': 'RG_BBC1_CNT1', '0x0494': 'RG_BBC1_CNT3', '0x0380': 'RG_BBC0_PMUC', '0x0408': 'RG_BBC1_FBLL', '0x0107': 'RG_RF09_CNL', '0x0106': 'RG_RF09_CCF0H', '0x0105': 'RG_RF09_CCF0L', '0x0104': 'RG_RF09_CS', '0x0103': 'RG_RF09_CMD', '0x0102': 'RG_RF09_STATE', '0x0101': 'RG_RF09_AUXS', '0x0100': 'RG_RF09_IRQM', '0x040B': 'RG_BBC1_FBLIH', '0x040C': 'RG_BBC1_OFDMPHRTX', '0x0381': 'RG_BBC0_PMUVAL', '0x040A': 'RG_BBC1_FBLIL', '0x0392': 'RG_BBC0_CNT1', '0x0336': 'RG_BBC0_MACPID1F2', '0x0109': 'RG_RF09_RXBWC', '0x0108': 'RG_RF09_CNM', '0x036C': 'RG_BBC0_FSKRPC', '0x036B': 'RG_BBC0_FSKPHRRX', '0x0314': 'RG_BBC0_OQPSKPHRTX', '0x0315': 'RG_BBC0_OQPSKPHRRX', '0x0312': 'RG_BBC0_OQPSKC2', '0x0313': 'RG_BBC0_OQPSKC3', '0x0310': 'RG_BBC0_OQPSKC0', '0x0311': 'RG_BBC0_OQPSKC1', '0x0411': 'RG_BBC1_OQPSKC1', '0x0410': 'RG_BBC1_OQPSKC0', '0x0413': 'RG_BBC1_OQPSKC3', '0x0412': 'RG_BBC1_OQPSKC2', '0x0415': 'RG_BBC1_OQPSKPHRRX', '0x0414': 'RG_BBC1_OQPSKPHRTX', '0x0368': 'RG_BBC0_FSKSFD1L', '0x0440': 'RG_BBC1_AMCS', '0x2800': 'RG_BBC0_FBTXS', '0x0402': 'RG_BBC1_PS', '0x0430': 'RG_BBC1_MACSHA1F0', '0x0370': 'RG_BBC0_FSKRRXFLL', '0x0337': 'RG_BBC0_MACSHA0F2', '0x0112': 'RG_RF09_TXCUTC', '0x3000': 'RG_BBC1_FBRXS'}
-#myDict = { '0x0000':['RF09_IRQS','0,1'],'0x000D':['RF_PN','0x34,0x35,0x36'], '0x000E':['RF_VN','0x01,0x03']}
+import os
+import re
+import sys
+from collections import namedtuple
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+HEADERS = (os.path.join(HERE, 'at86rf215.txt'),
+	   os.path.join(HERE, '..', 'at86rf215.h'))
+
+CMD_WRITE = 0x80
+ADDR_MASK = 0x3FFF
+
+DEFINE = re.compile(r'^\s*#define\s+(RG_\w+)\s+\(?\s*(0[xX][0-9a-fA-F]+)\s*\)?')
+
+# "0x3a" / "0x3A" -> 58, without calling int() for every byte of the capture
+HEX = {}
+for _v in range(256):
+	for _s in ('0x%02X' % _v, '0x%02x' % _v):
+		HEX[_s] = _v
+
+
+class Transaction(namedtuple('Transaction',
+			     'pid start end write addr mosi miso')):
+	"""One chip select: command bytes and data bytes, both directions."""
+	__slots__ = ()
+
+	@property
+	def data(self):
+		"""Register values: sent for a write, received for a read."""
+		return self.mosi[2:] if self.write else self.miso[2:]
+
+	@property
+	def valid(self):
+		return len(self.mosi) >= 2
+
+
+def load_registers(paths=HEADERS):
+	"""Address -> register name, and the frame buffer ranges (start, end,
+	name of the start register). The first header wins on a conflict."""
+	regs = {}
+	for path in paths:
+		try:
+			f = open(path, errors='replace')
+		except IOError:
+			continue
+		with f:
+			for line in f:
+				m = DEFINE.match(line)
+				if not m:
+					continue
+				addr = int(m.group(2), 16)
+				if addr <= ADDR_MASK and addr not in regs:
+					regs[addr] = m.group(1)
+
+	# RG_BBCn_FBRXS..FBRXE, FBTXS..FBTXE
+	by_name = dict((name, addr) for addr, name in regs.items())
+	ranges = []
+	for name, addr in by_name.items():
+		if name.endswith('S') and name[:-1] + 'E' in by_name and \
+		   '_FB' in name:
+			ranges.append((addr, by_name[name[:-1] + 'E'] + 1, name))
+	ranges.sort()
+	return regs, ranges
+
+
+class Names(object):
+	"""Register name of any address, frame buffer bytes as FBTXS+n."""
+
+	def __init__(self, paths=HEADERS):
+		self.regs, self.ranges = load_registers(paths)
+		self.cache = {}
+
+	def __call__(self, addr):
+		name = self.cache.get(addr)
+		if name is None:
+			name = self.regs.get(addr)
+			if name is None:
+				for start, end, fb in self.ranges:
+					if start <= addr < end:
+						name = '%s+%d' % (fb, addr - start)
+						break
+				else:
+					name = 'UNKNOWN'
+			self.cache[addr] = name
+		return name
+
 
-with open('./HEX/Capture.csv') as csv_file:
-	csv_reader = csv.reader(csv_file, delimiter=',')
+def _rows(f):
+	"""(time string, packet id string, mosi, miso) of each byte."""
+	header = f.readline()
+	cols = [c.strip().lower() for c in header.split(',')]
+
+	def col(prefix, default):
+		for i, c in enumerate(cols):
+			if c.startswith(prefix):
+				return i
+		return default
+
+	t, p, o, i = (col('time', 0), col('packet', 1), col('mosi', 2),
+		      col('miso', 3))
+	if (t, p, o, i) == (0, 1, 2, 3):
+		# Export of the analyser: split the line, no csv module
+		for line in f:
+			try:
+				ts, pid, mosi, miso = line.split(',', 3)
+			except ValueError:
+				continue
+			yield ts, pid, HEX.get(mosi.strip(), 0), \
+			      HEX.get(miso.strip(), 0)
+		return
+
+	width = max(t, p, o, i) + 1
+	for row in csv.reader(f):
+		if len(row) < width:
+			continue
+		yield row[t], row[p], HEX.get(row[o].strip(), 0), \
+		      HEX.get(row[i].strip(), 0)
+
+
+def transactions(f, gap_us=4.0):
+	"""Transactions of a capture, as they end. f is a path or a file."""
+	if isinstance(f, str):
+		f = open(f, newline='')
+	with f:
+		for tr in _transactions(f, gap_us * 1e-6):
+			yield tr
+
+
+def _transactions(f, gap):
+	pid = None
 	count = 0
-	for row in csv_reader:
-		if count == 0:
-#			print(f'Column names are {", ".join(row)}')
-			print("\nName          Adress     Value     Write/Read")
-			count += 1
+	start = last = None
+	mosi = bytearray()
+	miso = bytearray()
+
+	def flush():
+		write = bool(mosi[0] & CMD_WRITE) if mosi else False
+		addr = ((mosi[0] << 8) | mosi[1]) & ADDR_MASK \
+			if len(mosi) >= 2 else 0
+		return Transaction(pid, float(start), float(last), write, addr,
+				   bytes(mosi), bytes(miso))
+
+	for ts, p, o, i in _rows(f):
+		if p:
+			new = p != pid
 		else:
-#First Row
-			if count % 3 == 1:
-				x= row[2]
-#Second Row
-			elif count % 3 == 2:
-				x += row[2][2:4]
-#Third Row
-			else:
-				if x in myDict:	
-					op = "read"
-					if row[3] == "0x00":
-						op = "write"
-					string = myDict[x][:]    ,  str(x)   ,   str(row[3])  , op 
-					print "      ".join(string)
-				else:
-					print("OUPS! The address --" + str(x) + "-- does NOT exist")
-			count +=1
+			# No Packet ID: a new chip select after a long gap, numbered
+			# after the transactions seen so far
+			new = last is None or float(ts) - float(last) > gap
+			p = '#%d' % count if new else pid
+		if new and mosi:
+			yield flush()
+			del mosi[:]
+			del miso[:]
+		if new:
+			pid = p
+			count += 1
+			start = ts
+		last = ts
+		mosi.append(o)
+		miso.append(i)
+	if mosi:
+		yield flush()
+
 
-	print ("\n")
+def _hex(data, full):
+	if not full and len(data) > 16:
+		return ' '.join('%02X' % b for b in data[:16]) + \
+			' ... (%d bytes)' % len(data)
+	return ' '.join('%02X' % b for b in data)
 
 
+def main():
+	ap = argparse.ArgumentParser(
+		description='Decode an AT86RF215 SPI capture into register '
+			    'accesses.')
+	ap.add_argument('capture', nargs='?',
+			default=os.path.join(HERE, 'HEX', 'FinalCapture.csv'))
+	ap.add_argument('-r', '--registers', action='store_true',
+			help='one line per register instead of per burst')
+	ap.add_argument('-f', '--full', action='store_true',
+			help='print every byte of long bursts')
+	ap.add_argument('--gap', type=float, default=4.0, metavar='US',
+			help='split on gaps longer than this when the capture '
+			     'has no Packet ID (default 4)')
+	args = ap.parse_args()
+
+	name = Names()
+	out = sys.stdout
+	if args.registers:
+		out.write('Time [s]           Name                   Address  '
+			  'Value  Write/Read\n')
+	else:
+		out.write('Time [s]           Packet  W/R  Address  Len   '
+			  'Name                   Data\n')
+
+	for tr in transactions(args.capture, args.gap):
+		if not tr.valid:
+			out.write('%.9f  %6s  short transaction: %s\n' %
+				  (tr.start, tr.pid, _hex(tr.mosi, True)))
+			continue
+		op = 'write' if tr.write else 'read'
+		data = tr.data
+		if args.registers:
+			for n, v in enumerate(data):
+				out.write('%.9f  %-22s 0x%04X   0x%02X   %s\n' %
+					  (tr.start, name(tr.addr + n),
+					   tr.addr + n, v, op))
+		else:
+			out.write('%.9f  %6s  %-3s  0x%04X  %4d   %-22s %s\n' %
+				  (tr.start, tr.pid, 'W' if tr.write else 'R',
+				   tr.addr, len(data), name(tr.addr),
+				   _hex(data, args.full)))
+
 
+if __name__ == '__main__':
+	try:
+		main()
+	except BrokenPipeError:
+		sys.stderr.close()
@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# Compares the register operations of a baseline capture with those of
+# another capture, or of the current driver run in the simulator (sim/).
+#
+# Both sides are decoded with extract_data.py into a sequence of operations
+# (read/write, register, length; --values also compares the written bytes).
+# The report gives the transaction and byte counts of each side, the count
+# per operation class (see spi_profile.py) and the differences in the order
+# of the sequences, as a diff.
+#
+# The exit status is 1 when the new side needs more transactions or bytes
+# than the baseline, so it can gate a change that adds bus traffic.
+#
+# Usage: ./replay.py [--values] [-q] BASELINE.csv CAPTURE.csv
+#        ./replay.py [--values] [-q] BASELINE.csv --sim [SIM ARGS...]
+#
+# With --sim the simulator is run with -w and the given arguments, e.g.
+# "--sim budget" replays the operations of the SPI budget check.
+
+import argparse
+import difflib
+import os
+import subprocess
+import sys
+import tempfile
+
+from extract_data import HERE, Names, transactions
+from spi_profile import OPS, classify
+
+SIM = os.path.join(HERE, '..', 'sim', 'at86rf215-sim')
+
+
+class Side(object):
+	def __init__(self, path, values):
+		self.path = path
+		self.ops = []
+		self.bytes = 0
+		self.classes = dict((name, 0) for name in OPS)
+		for tr in transactions(path):
+			cls = classify(tr)
+			self.classes[cls] += 1
+			self.bytes += len(tr.mosi)
+			if not tr.valid:
+				self.ops.append(('?', 0, len(tr.mosi), b''))
+				continue
+			data = bytes(tr.data) if values and tr.write else b''
+			self.ops.append(('W' if tr.write else 'R', tr.addr,
+					 len(tr.data), data))
+
+
+def describe(op, name):
+	rw, addr, n, data = op
+	s = '%s %-22s 0x%04X %4d' % (rw, name(addr), addr, n)
+	if data:
+		s += '  ' + ' '.join('%02X' % b for b in data[:16])
+		if len(data) > 16:
+			s += ' ...'
+	return s
+
+
+def run_sim(args):
+	if not os.path.exists(SIM):
+		sys.exit('%s not found, build it with "make sim/at86rf215-sim"'
+			 % os.path.relpath(SIM))
+	fd, path = tempfile.mkstemp(suffix='.csv')
+	os.close(fd)
+	rc = subprocess.call([SIM, '-w', path] + args,
+			     stdout=subprocess.DEVNULL)
+	if rc:
+		os.unlink(path)
+		sys.exit('simulator failed (%d)' % rc)
+	return path
+
+
+def main():
+	ap = argparse.ArgumentParser(
+		description='Compare the SPI operations of a capture or of the '
+			    'simulated driver with a baseline capture.')
+	ap.add_argument('baseline')
+	ap.add_argument('capture', nargs='?')
+	ap.add_argument('--sim', nargs=argparse.REMAINDER, metavar='ARGS',
+			help='run the simulator with these arguments instead '
+			     'of reading a capture')
+	ap.add_argument('--values', action='store_true',
+			help='also compare the values written')
+	ap.add_argument('-q', '--quiet', action='store_true',
+			help='counts only, no sequence diff')
+	args = ap.parse_args()
+	if (args.capture is None) == (args.sim is None):
+		ap.error('give either a capture or --sim')
+
+	path = run_sim(args.sim) if args.sim is not None else args.capture
+	try:
+		old = Side(args.baseline, args.values)
+		new = Side(path, args.values)
+	finally:
+		if args.sim is not None:
+			os.unlink(path)
+
+	name = Names()
+	out = sys.stdout
+	out.write('%-16s %9s %9s %7s\n' % ('', 'baseline', 'new', 'delta'))
+	out.write('%-16s %9d %9d %+7d\n' % ('transactions', len(old.ops),
+					    len(new.ops),
+					    len(new.ops) - len(old.ops)))
+	out.write('%-16s %9d %9d %+7d\n' % ('bytes', old.bytes, new.bytes,
+					    new.bytes - old.bytes))
+	for cls in OPS:
+		a, b = old.classes[cls], new.classes[cls]
+		if a or b:
+			out.write('%-16s %9d %9d %+7d\n' % (cls, a, b, b - a))
+
+	sm = difflib.SequenceMatcher(None, old.ops, new.ops, autojunk=False)
+	same = sum(n for _, _, n in sm.get_matching_blocks())
+	out.write('\n%d operations in the same order, %d removed, %d added\n'
+		  % (same, len(old.ops) - same, len(new.ops) - same))
+
+	if not args.quiet:
+		for tag, i1, i2, j1, j2 in sm.get_opcodes():
+			if tag == 'equal':
+				continue
+			out.write('@@ baseline %d-%d, new %d-%d @@\n' %
+				  (i1, i2, j1, j2))
+			for op in old.ops[i1:i2]:
+				out.write('- %s\n' % describe(op, name))
+			for op in new.ops[j1:j2]:
+				out.write('+ %s\n' % describe(op, name))
+
+	return 1 if len(new.ops) > len(old.ops) or new.bytes > old.bytes \
+		else 0
+
+
+if __name__ == '__main__':
+	try:
+		sys.exit(main())
+	except BrokenPipeError:
+		sys.stderr.close()
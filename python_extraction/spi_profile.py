@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+# Timing profile of an SPI capture of the logic analyser, see extract_data.py
+# for the format and the decoding.
+#
+# Every transaction is classified as one driver level operation (IRQ status
+# read, state poll, CMD write, frame buffer burst, ...). The report gives:
+# - bus utilisation: time with chip select active over the capture span,
+# - the gaps between transactions,
+# - per operation: count, bytes, bus time and the distribution of durations
+#   and of the gap before it,
+# - state poll loops: consecutive STATE reads of one radio,
+# - the TX critical path: from the first TXFL/frame buffer write of a frame
+#   to the CMD=TX write, with the operations in between.
+#
+# Distributions are log histograms (2% resolution), memory does not grow
+# with the capture.
+#
+# Usage: ./spi_profile.py [--csv DIR] [--gap US] [CAPTURE.csv]
+
+import argparse
+import csv
+import math
+import os
+import sys
+
+from extract_data import HERE, Names, transactions
+
+RG_RF09_STATE = 0x0102
+RG_RF24_STATE = 0x0202
+RG_RF09_CMD = 0x0103
+RG_RF24_CMD = 0x0203
+RG_BBC0_TXFLL = 0x0306
+RG_BBC1_TXFLL = 0x0406
+RF_TX = 0x4
+
+OPS = ('irq status read', 'irq mask write', 'state poll', 'cmd write',
+       'tx length write', 'fb tx write', 'fb rx read', 'reg read',
+       'reg write', 'short')
+
+
+def classify(tr):
+	if not tr.valid:
+		return 'short'
+	a = tr.addr
+	if tr.write:
+		if a in (RG_RF09_CMD, RG_RF24_CMD):
+			return 'cmd write'
+		if a in (0x0100, 0x0200, 0x0300, 0x0400):
+			return 'irq mask write'
+		if a in (RG_BBC0_TXFLL, RG_BBC1_TXFLL):
+			return 'tx length write'
+		if 0x2800 <= a < 0x3000 or 0x3800 <= a < 0x4000:
+			return 'fb tx write'
+		return 'reg write'
+	if a <= 0x0003:
+		return 'irq status read'
+	if a in (RG_RF09_STATE, RG_RF24_STATE):
+		return 'state poll'
+	if 0x2000 <= a < 0x2800 or 0x3000 <= a < 0x3800:
+		return 'fb rx read'
+	return 'reg read'
+
+
+class Hist(object):
+	"""Count, sum, min/max and percentiles of positive values (seconds),
+	in log buckets of 2%."""
+	STEP = math.log(1.02)
+
+	def __init__(self):
+		self.n = 0
+		self.sum = 0.0
+		self.min = None
+		self.max = 0.0
+		self.buckets = {}
+
+	def add(self, v):
+		self.n += 1
+		self.sum += v
+		if self.min is None or v < self.min:
+			self.min = v
+		if v > self.max:
+			self.max = v
+		b = int(math.log(max(v, 1e-9) * 1e9) / self.STEP)
+		self.buckets[b] = self.buckets.get(b, 0) + 1
+
+	def pct(self, p):
+		if not self.n:
+			return 0.0
+		rank = max(1, int(math.ceil(self.n * p / 100.0)))
+		seen = 0
+		for b in sorted(self.buckets):
+			seen += self.buckets[b]
+			if seen >= rank:
+				# Bucket midpoint, clamped to what was seen
+				v = math.exp((b + 0.5) * self.STEP) * 1e-9
+				return min(max(v, self.min), self.max)
+		return self.max
+
+	def avg(self):
+		return self.sum / self.n if self.n else 0.0
+
+
+class Op(object):
+	def __init__(self, name):
+		self.name = name
+		self.count = 0
+		self.bytes = 0
+		self.busy = 0.0
+		self.dur = Hist()
+		self.gap = Hist()
+
+
+class Profile(object):
+	def __init__(self, byte_time=None, tx_sink=None):
+		self.ops = dict((name, Op(name)) for name in OPS)
+		self.gaps = Hist()
+		self.first = self.last_end = None
+		self.busy = 0.0
+		self.count = 0
+		self.bytes = 0
+		# Byte time: median spacing of bytes inside the first bursts
+		self.byte_time = byte_time
+		self.spacing = []
+		self.pending = []
+
+		# STATE poll loop in progress: (radio address, start, polls, end)
+		self.poll = None
+		self.poll_len = Hist()
+		self.poll_time = Hist()
+
+		# TX path in progress: start time and the operations on the way
+		self.tx_start = None
+		self.tx_ops = {}
+		self.tx_sink = tx_sink
+		self.tx_time = Hist()
+		self.tx_breakdown = dict((name, 0) for name in OPS)
+		self.tx_count = 0
+
+	def _byte_time(self, tr):
+		n = len(tr.mosi)
+		if n > 1 and len(self.spacing) < 1000:
+			self.spacing.append((tr.end - tr.start) / (n - 1))
+		if self.byte_time is None and len(self.spacing) >= 1000:
+			self.byte_time = sorted(self.spacing)[len(self.spacing) // 2]
+		return self.byte_time
+
+	def add(self, tr):
+		"""Feed one transaction; the first ones wait for the byte time."""
+		bt = self._byte_time(tr)
+		if bt is None:
+			self.pending.append(tr)
+			return []
+		done = []
+		if self.pending:
+			for p in self.pending:
+				done.append(self._add(p))
+			self.pending = []
+		done.append(self._add(tr))
+		return done
+
+	def flush(self):
+		if self.byte_time is None:
+			s = sorted(self.spacing)
+			self.byte_time = s[len(s) // 2] if s else 1e-6
+		done = [self._add(p) for p in self.pending]
+		self.pending = []
+		self._poll_end()
+		return done
+
+	def _poll_end(self):
+		if self.poll:
+			addr, start, polls, last = self.poll
+			self.poll_len.add(polls)
+			self.poll_time.add(last - start)
+			self.poll = None
+
+	def _add(self, tr):
+		"""Account one transaction, returns its CSV row."""
+		op = self.ops[classify(tr)]
+		dur = tr.end - tr.start + self.byte_time
+		end = tr.start + dur
+		gap = None
+		if self.first is None:
+			self.first = tr.start
+		else:
+			gap = max(tr.start - self.last_end, 0.0)
+			self.gaps.add(gap)
+			op.gap.add(gap)
+		self.last_end = end
+		self.count += 1
+		self.bytes += len(tr.mosi)
+		self.busy += dur
+		op.count += 1
+		op.bytes += len(tr.mosi)
+		op.busy += dur
+		op.dur.add(dur)
+
+		# State poll loops
+		if op.name == 'state poll':
+			if self.poll and self.poll[0] == tr.addr:
+				a, s, n, l = self.poll
+				self.poll = (a, s, n + 1, end)
+			else:
+				self._poll_end()
+				self.poll = (tr.addr, tr.start, 1, end)
+		else:
+			self._poll_end()
+
+		# TX critical path
+		if op.name in ('tx length write', 'fb tx write') and \
+		   self.tx_start is None:
+			self.tx_start = tr.start
+			self.tx_ops = {}
+		if self.tx_start is not None:
+			self.tx_ops[op.name] = self.tx_ops.get(op.name, 0) + 1
+			if op.name == 'cmd write' and tr.data[:1] == bytes([RF_TX]):
+				lat = end - self.tx_start
+				self.tx_time.add(lat)
+				self.tx_count += 1
+				for name, n in self.tx_ops.items():
+					self.tx_breakdown[name] += n
+				if self.tx_sink:
+					self.tx_sink(self.tx_start, lat,
+						     sum(self.tx_ops.values()))
+				self.tx_start = None
+
+		return (tr.start, tr.pid, op.name, 'W' if tr.write else 'R',
+			tr.addr, len(tr.mosi), dur, gap)
+
+
+def us(v):
+	return v * 1e6
+
+
+def report(prof, out):
+	span = prof.last_end - prof.first if prof.count else 0.0
+	out.write('transactions:       %d (%d bytes)\n' %
+		  (prof.count, prof.bytes))
+	out.write('span:               %.1f us\n' % us(span))
+	out.write('bus busy:           %.1f us (%.1f%%)\n' %
+		  (us(prof.busy), 100.0 * prof.busy / span if span else 0.0))
+	out.write('byte time:          %.3f us (~%.2f MHz SCK, '
+		  'with inter-byte delays)\n' %
+		  (us(prof.byte_time), 8e-6 / prof.byte_time
+		   if prof.byte_time else 0.0))
+	g = prof.gaps
+	out.write('gaps (us):          avg %.2f p50 %.2f p99 %.2f max %.2f\n\n'
+		  % (us(g.avg()), us(g.pct(50)), us(g.pct(99)), us(g.max)))
+
+	out.write('%-16s %7s %7s %10s %6s %9s %9s %9s %9s %9s\n' %
+		  ('operation', 'count', 'bytes', 'bus_us', 'bus%',
+		   'dur_avg', 'dur_p99', 'dur_max', 'gap_avg', 'gap_p99'))
+	for row in op_rows(prof):
+		out.write('%-16s %7d %7d %10.1f %6.1f %9.2f %9.2f %9.2f %9.2f '
+			  '%9.2f\n' % row)
+
+	out.write('\nstate poll loops:   %d, polls avg %.1f max %d, '
+		  'time avg %.1f us max %.1f us\n' %
+		  (prof.poll_len.n, prof.poll_len.avg(), prof.poll_len.max,
+		   us(prof.poll_time.avg()), us(prof.poll_time.max)))
+
+	t = prof.tx_time
+	out.write('TX path (TXFL/FB write -> CMD=TX): %d frames' %
+		  prof.tx_count)
+	if t.n:
+		out.write(', avg %.1f p50 %.1f p99 %.1f max %.1f us\n' %
+			  (us(t.avg()), us(t.pct(50)), us(t.pct(99)), us(t.max)))
+		for name in OPS:
+			n = prof.tx_breakdown[name]
+			if n:
+				out.write('  %-16s %.1f per frame\n' %
+					  (name, float(n) / prof.tx_count))
+	else:
+		out.write('\n')
+
+
+def op_rows(prof):
+	busy = prof.busy or 1.0
+	for name in OPS:
+		op = prof.ops[name]
+		if not op.count:
+			continue
+		yield (name, op.count, op.bytes, us(op.busy),
+		       100.0 * op.busy / busy, us(op.dur.avg()),
+		       us(op.dur.pct(99)), us(op.dur.max), us(op.gap.avg()),
+		       us(op.gap.pct(99)))
+
+
+def main():
+	ap = argparse.ArgumentParser(
+		description='Bus utilisation, gaps and per-operation latency '
+			    'of an AT86RF215 SPI capture.')
+	ap.add_argument('capture', nargs='?',
+			default=os.path.join(HERE, 'HEX', 'FinalCapture.csv'))
+	ap.add_argument('--csv', metavar='DIR',
+			help='also write transactions.csv, operations.csv '
+			     'and tx_paths.csv to DIR')
+	ap.add_argument('--gap', type=float, default=4.0, metavar='US',
+			help='see extract_data.py')
+	ap.add_argument('--byte-time', type=float, metavar='US',
+			help='SPI byte time, instead of the measured one')
+	args = ap.parse_args()
+
+	name = Names()
+	trw = txw = None
+	if args.csv:
+		if not os.path.isdir(args.csv):
+			os.makedirs(args.csv)
+		trf = open(os.path.join(args.csv, 'transactions.csv'), 'w',
+			   newline='')
+		trw = csv.writer(trf)
+		trw.writerow(['start_s', 'packet', 'operation', 'rw', 'address',
+			      'register', 'bytes', 'duration_us', 'gap_us'])
+		txf = open(os.path.join(args.csv, 'tx_paths.csv'), 'w',
+			   newline='')
+		txw = csv.writer(txf)
+		txw.writerow(['start_s', 'latency_us', 'transactions'])
+
+	def tx_path(start, lat, n):
+		if txw is not None:
+			txw.writerow(['%.9f' % start, '%.3f' % us(lat), n])
+
+	prof = Profile(args.byte_time * 1e-6 if args.byte_time else None,
+		       tx_path)
+
+	def emit(rows):
+		if trw is None:
+			return
+		for start, pid, op, rw, addr, n, dur, gap in rows:
+			trw.writerow(['%.9f' % start, pid, op, rw,
+				      '0x%04X' % addr, name(addr), n,
+				      '%.3f' % us(dur),
+				      '' if gap is None else '%.3f' % us(gap)])
+
+	for tr in transactions(args.capture, args.gap):
+		emit(prof.add(tr))
+	emit(prof.flush())
+
+	report(prof, sys.stdout)
+
+	if args.csv:
+		trf.close()
+		txf.close()
+		with open(os.path.join(args.csv, 'operations.csv'), 'w',
+			  newline='') as f:
+			w = csv.writer(f)
+			w.writerow(['operation', 'count', 'bytes', 'bus_us',
+				    'bus_pct', 'dur_avg_us', 'dur_p99_us',
+				    'dur_max_us', 'gap_avg_us', 'gap_p99_us'])
+			for row in op_rows(prof):
+				w.writerow([row[0]] + ['%.3f' % v if
+					   isinstance(v, float) else v
+					   for v in row[1:]])
+
+
+if __name__ == '__main__':
+	try:
+		main()
+	except BrokenPipeError:
+		sys.stderr.close()
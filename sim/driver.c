@@ -0,0 +1,2 @@
+/* The driver, built unchanged against the shim headers in include/ */
+#include "../at86rf215.c"
@@ -0,0 +1,1194 @@
+/* Userspace stand-in for the parts of the 4.14 kernel API at86rf215.c uses.
+ *
+ * Everything runs on one thread in simulated time: hrtimers, delayed works,
+ * SPI completions and the IRQ line are events of the loop in kernel.c.
+ * Sleeping calls (udelay, spi_sync, wait_for_completion, ...) run the loop
+ * until they return, so the driver code is unchanged. */
+#ifndef SIM_KERNEL_H
+#define SIM_KERNEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u8 __u8;
+typedef u16 __u16;
+typedef u32 __u32;
+typedef u64 __u64;
+typedef s8 __s8;
+typedef s16 __s16;
+typedef s32 __s32;
+typedef u16 __le16;
+typedef u32 __le32;
+typedef u64 __le64;
+typedef u16 __be16;
+typedef s64 ktime_t;
+typedef unsigned int gfp_t;
+typedef unsigned short umode_t;
+typedef unsigned long dma_addr_t;
+
+/************************* compiler and bit helpers *************************/
+
+#define __init
+#define __exit
+#define __user
+#define __iomem
+#define __packed		__attribute__((packed))
+#define __aligned(x)		__attribute__((aligned(x)))
+#define __maybe_unused		__attribute__((unused))
+#define ____cacheline_aligned	__attribute__((aligned(64)))
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define barrier()		__asm__ __volatile__("" ::: "memory")
+#define smp_mb()		__sync_synchronize()
+#define smp_wmb()		__sync_synchronize()
+#define smp_rmb()		__sync_synchronize()
+#define smp_store_release(p, v)	do { smp_mb(); WRITE_ONCE(*(p), v); } while (0)
+#define smp_load_acquire(p)	({ __typeof__(*(p)) __v = READ_ONCE(*(p)); smp_mb(); __v; })
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+#define cpu_relax()		barrier()
+#define cond_resched()		do { } while (0)
+
+#define BIT(n)			(1UL << (n))
+#define BIT_ULL(n)		(1ULL << (n))
+#define GENMASK(h, l)		(((~0UL) << (l)) & (~0UL >> (63 - (h))))
+#define BITS_PER_LONG		64
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define container_of(p, t, m)	((t *)((char *)(p) - offsetof(t, m)))
+#define BUILD_BUG_ON(x)		((void)sizeof(char[1 - 2 * !!(x)]))
+#define USHRT_MAX		((u16)~0U)
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)		((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, a, b)		min(max(v, a), b)
+#define clamp_t(t, v, a, b)	min_t(t, max_t(t, v, a), b)
+#define clamp_val(v, a, b)	clamp(v, a, b)
+#define swap(a, b) \
+	do { __typeof__(a) __t = (a); (a) = (b); (b) = __t; } while (0)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define DIV_ROUND_CLOSEST(x, d)	(((x) + ((d) / 2)) / (d))
+#define roundup(x, y)		((((x) + ((y) - 1)) / (y)) * (y))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+#define div_u64(a, b)		((u64)(a) / (b))
+#define div64_u64(a, b)		((u64)(a) / (b))
+#define div_s64(a, b)		((s64)(a) / (b))
+#define do_div(n, b) \
+	({ u32 __r = (u64)(n) % (b); (n) = (u64)(n) / (b); __r; })
+#define upper_32_bits(n)	((u32)((u64)(n) >> 32))
+#define lower_32_bits(n)	((u32)(n))
+
+#define IS_ENABLED(x)		0
+#define MAX_ERRNO		4095
+#define IS_ERR_VALUE(x)		((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr) { return IS_ERR_VALUE(ptr); }
+static inline bool IS_ERR_OR_NULL(const void *ptr)
+{
+	return !ptr || IS_ERR_VALUE(ptr);
+}
+
+#define EPERM		1
+#define ENOENT		2
+#define EINTR		4
+#define EIO		5
+#define ENXIO		6
+#define EAGAIN		11
+#define ENOMEM		12
+#define EFAULT		14
+#define EBUSY		16
+#define ENODEV		19
+#define EINVAL		22
+#define ENOSPC		28
+#define ESPIPE		29
+#define ERANGE		34
+#define ECOMM		70
+#define EMSGSIZE	90
+#define EOPNOTSUPP	95
+#define ENETDOWN	100
+#define ENOBUFS		105
+#define ETIMEDOUT	110
+#define EALREADY	114
+#define EINPROGRESS	115
+#define ERESTARTSYS	512
+#define ENOTSUPP	524
+
+void sim_fatal(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+#define BUG_ON(x) \
+	do { if (x) sim_fatal("BUG at %s:%d\n", __FILE__, __LINE__); } while (0)
+#define WARN_ON(x)		({ int __w = !!(x); if (__w) sim_warn(__FILE__, __LINE__); __w; })
+#define WARN_ON_ONCE(x)		WARN_ON(x)
+#define WARN_ONCE(x, ...)	WARN_ON(x)
+void sim_warn(const char *file, int line);
+
+/******************************** printk ********************************/
+
+#define KERN_EMERG	""
+#define KERN_ALERT	""
+#define KERN_CRIT	""
+#define KERN_ERR	""
+#define KERN_WARNING	""
+#define KERN_NOTICE	""
+#define KERN_INFO	""
+#define KERN_DEBUG	""
+
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define pr_err(...)		printk(__VA_ARGS__)
+#define pr_warn(...)		printk(__VA_ARGS__)
+#define pr_info(...)		printk(__VA_ARGS__)
+#define pr_debug(...)		printk(__VA_ARGS__)
+#define dev_err(d, ...)		printk(__VA_ARGS__)
+#define dev_warn(d, ...)	printk(__VA_ARGS__)
+#define dev_info(d, ...)	printk(__VA_ARGS__)
+#define dev_dbg(d, ...)		printk(__VA_ARGS__)
+#define dev_err_ratelimited(d, ...)	printk(__VA_ARGS__)
+#define dev_warn_ratelimited(d, ...)	printk(__VA_ARGS__)
+
+/********************************* module *********************************/
+
+struct module;
+#define THIS_MODULE		((struct module *)0)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_LICENSE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DEVICE_TABLE(type, name)
+#define module_param(n, t, p)
+#define MODULE_PARM_DESC(n, d)
+#define EXPORT_SYMBOL(x)
+#define EXPORT_SYMBOL_GPL(x)
+#define module_init(fn)		int sim_module_init(void) { return fn(); }
+#define module_exit(fn)		void sim_module_exit(void) { fn(); }
+
+/********************************* lists *********************************/
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->prev = head->prev;
+	new->next = head;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member) \
+	list_entry((ptr)->next, type, member)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, __typeof__(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_entry(pos->member.next, __typeof__(*pos), member))
+
+/****************************** time ******************************/
+
+#define HZ			100
+#define NSEC_PER_USEC		1000L
+#define NSEC_PER_MSEC		1000000L
+#define NSEC_PER_SEC		1000000000L
+#define USEC_PER_MSEC		1000L
+#define USEC_PER_SEC		1000000L
+#define MSEC_PER_SEC		1000L
+
+/* Simulated time since the start of the run, in ns */
+u64 sim_now(void);
+
+extern unsigned long jiffies;
+
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+#define time_before_eq(a, b)	time_after_eq(b, a)
+
+unsigned long msecs_to_jiffies(unsigned int m);
+unsigned long usecs_to_jiffies(unsigned int u);
+unsigned int jiffies_to_msecs(unsigned long j);
+
+static inline ktime_t ktime_get(void) { return sim_now(); }
+static inline u64 ktime_get_ns(void) { return sim_now(); }
+#define ktime_sub(a, b)		((a) - (b))
+#define ktime_add(a, b)		((a) + (b))
+#define ktime_add_ns(a, b)	((a) + (b))
+#define ktime_add_us(a, b)	((a) + (b) * NSEC_PER_USEC)
+#define ktime_sub_us(a, b)	((a) - (b) * NSEC_PER_USEC)
+#define ktime_to_ns(a)		((s64)(a))
+#define ktime_to_us(a)		((s64)(a) / NSEC_PER_USEC)
+#define ns_to_ktime(a)		((ktime_t)(a))
+#define ktime_set(s, n)		((ktime_t)(s) * NSEC_PER_SEC + (n))
+#define ktime_us_delta(a, b)	(((a) - (b)) / NSEC_PER_USEC)
+#define ktime_before(a, b)	((a) < (b))
+#define ktime_after(a, b)	((a) > (b))
+#define ktime_compare(a, b)	((a) < (b) ? -1 : ((a) > (b) ? 1 : 0))
+
+void udelay(unsigned long usecs);
+void ndelay(unsigned long nsecs);
+void mdelay(unsigned long msecs);
+void usleep_range(unsigned long min, unsigned long max);
+void msleep(unsigned int msecs);
+unsigned long msleep_interruptible(unsigned int msecs);
+
+/**************************** atomics and bits ****************************/
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+#define ATOMIC_INIT(i)		{ (i) }
+
+static inline int atomic_read(const atomic_t *v) { return v->counter; }
+static inline void atomic_set(atomic_t *v, int i) { v->counter = i; }
+static inline void atomic_inc(atomic_t *v) { v->counter++; }
+static inline void atomic_dec(atomic_t *v) { v->counter--; }
+static inline int atomic_inc_return(atomic_t *v) { return ++v->counter; }
+static inline int atomic_dec_return(atomic_t *v) { return --v->counter; }
+static inline bool atomic_dec_and_test(atomic_t *v) { return --v->counter == 0; }
+static inline void atomic_add(int i, atomic_t *v) { v->counter += i; }
+
+static inline int atomic_cmpxchg(atomic_t *v, int old, int new)
+{
+	int cur = v->counter;
+
+	if (cur == old)
+		v->counter = new;
+	return cur;
+}
+
+static inline int atomic_xchg(atomic_t *v, int new)
+{
+	int cur = v->counter;
+
+	v->counter = new;
+	return cur;
+}
+
+static inline int atomic_dec_if_positive(atomic_t *v)
+{
+	int dec = v->counter - 1;
+
+	if (dec >= 0)
+		v->counter = dec;
+	return dec;
+}
+
+static inline s64 atomic64_read(const atomic64_t *v) { return v->counter; }
+static inline void atomic64_set(atomic64_t *v, s64 i) { v->counter = i; }
+static inline void atomic64_inc(atomic64_t *v) { v->counter++; }
+static inline void atomic64_add(s64 i, atomic64_t *v) { v->counter += i; }
+
+static inline s64 atomic64_cmpxchg(atomic64_t *v, s64 old, s64 new)
+{
+	s64 cur = v->counter;
+
+	if (cur == old)
+		v->counter = new;
+	return cur;
+}
+
+#define BIT_WORD(nr)		((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr)		(1UL << ((nr) % BITS_PER_LONG))
+
+static inline bool test_bit(long nr, const volatile unsigned long *addr)
+{
+	return addr[BIT_WORD(nr)] & BIT_MASK(nr);
+}
+
+static inline void set_bit(long nr, volatile unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] |= BIT_MASK(nr);
+}
+
+static inline void clear_bit(long nr, volatile unsigned long *addr)
+{
+	addr[BIT_WORD(nr)] &= ~BIT_MASK(nr);
+}
+
+static inline bool test_and_set_bit(long nr, volatile unsigned long *addr)
+{
+	bool old = test_bit(nr, addr);
+
+	set_bit(nr, addr);
+	return old;
+}
+
+static inline bool test_and_clear_bit(long nr, volatile unsigned long *addr)
+{
+	bool old = test_bit(nr, addr);
+
+	clear_bit(nr, addr);
+	return old;
+}
+
+#define test_and_set_bit_lock(nr, addr)	test_and_set_bit(nr, addr)
+#define clear_bit_unlock(nr, addr)	clear_bit(nr, addr)
+
+static inline int hweight8(unsigned int w) { return __builtin_popcount(w & 0xff); }
+static inline int hweight32(unsigned int w) { return __builtin_popcount(w); }
+static inline int fls(unsigned int x) { return x ? 32 - __builtin_clz(x) : 0; }
+static inline int ilog2(unsigned long v) { return 63 - __builtin_clzl(v); }
+
+/*************************** locks and waiting ***************************/
+
+/* One thread: locks only document the driver's intent. A mutex taken twice
+ * would deadlock the real driver and stops the simulation. */
+typedef struct { int unused; } spinlock_t;
+struct mutex { int locked; const char *owner; };
+
+static inline void spin_lock_init(spinlock_t *l) { (void)l; }
+static inline void spin_lock(spinlock_t *l) { (void)l; }
+static inline void spin_unlock(spinlock_t *l) { (void)l; }
+#define spin_lock_irqsave(l, f)		do { spin_lock(l); (f) = 0; } while (0)
+#define spin_unlock_irqrestore(l, f)	do { (void)(f); spin_unlock(l); } while (0)
+#define spin_lock_bh(l)			spin_lock(l)
+#define spin_unlock_bh(l)		spin_unlock(l)
+
+void mutex_init(struct mutex *lock);
+void mutex_lock(struct mutex *lock);
+void mutex_unlock(struct mutex *lock);
+#define DEFINE_MUTEX(m)		struct mutex m = { 0 }
+
+bool in_interrupt(void);
+#define might_sleep()		do { } while (0)
+
+struct completion {
+	unsigned int done;
+};
+
+#define DECLARE_COMPLETION_ONSTACK(n)	struct completion n = { 0 }
+
+static inline void init_completion(struct completion *x) { x->done = 0; }
+static inline void reinit_completion(struct completion *x) { x->done = 0; }
+static inline bool completion_done(struct completion *x) { return x->done; }
+
+static inline void complete(struct completion *x)
+{
+	if (x->done != ~0U)
+		x->done++;
+}
+
+static inline void complete_all(struct completion *x) { x->done = ~0U; }
+
+void wait_for_completion(struct completion *x);
+unsigned long wait_for_completion_timeout(struct completion *x,
+					  unsigned long timeout);
+
+typedef struct { int unused; } wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *q) { (void)q; }
+#define wake_up(q)			do { (void)(q); } while (0)
+#define wake_up_all(q)			do { (void)(q); } while (0)
+#define wake_up_interruptible(q)	do { (void)(q); } while (0)
+
+/* Runs the event loop until @deadline or until the caller's condition may
+ * have changed; false once the deadline passed. */
+bool sim_wait_step(u64 deadline);
+u64 sim_jiffies_to_ns(unsigned long j);
+
+#define wait_event_timeout(wq, cond, timeout) \
+	({ \
+		u64 __dl = sim_now() + sim_jiffies_to_ns(timeout); \
+		long __ret = 0; \
+		(void)(wq); \
+		while (!(cond) && sim_wait_step(__dl)) \
+			; \
+		if (cond) \
+			__ret = max(1L, (long)((__dl - sim_now()) / \
+					       (NSEC_PER_SEC / HZ))); \
+		__ret; \
+	})
+
+/******************************** timers ********************************/
+
+/* An event of the simulation loop */
+struct sim_timer {
+	struct list_head	node;
+	u64			expires;
+	u64			seq;
+	bool			queued;
+	void			(*fn)(struct sim_timer *t);
+};
+
+void sim_timer_add(struct sim_timer *t, u64 expires);
+bool sim_timer_del(struct sim_timer *t);
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+	HRTIMER_MODE_REL_PINNED,
+	HRTIMER_MODE_ABS_PINNED,
+};
+
+#define CLOCK_MONOTONIC		1
+
+struct hrtimer {
+	struct sim_timer	t;
+	ktime_t			expires;
+	enum hrtimer_restart	(*function)(struct hrtimer *timer);
+};
+
+void hrtimer_init(struct hrtimer *timer, int clock, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval);
+
+static inline ktime_t hrtimer_get_expires(const struct hrtimer *timer)
+{
+	return timer->expires;
+}
+
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t time)
+{
+	timer->expires = time;
+}
+
+static inline bool hrtimer_active(const struct hrtimer *timer)
+{
+	return timer->t.queued;
+}
+
+/******************************* workqueues *******************************/
+
+struct workqueue_struct;
+
+struct work_struct {
+	struct list_head	entry;
+	void			(*func)(struct work_struct *work);
+	struct workqueue_struct	*wq;
+	bool			pending;
+};
+
+struct delayed_work {
+	struct work_struct	work;
+	struct sim_timer	timer;
+	struct workqueue_struct	*wq;
+};
+
+#define WQ_UNBOUND		BIT(1)
+#define WQ_FREEZABLE		BIT(2)
+#define WQ_MEM_RECLAIM		BIT(3)
+#define WQ_HIGHPRI		BIT(4)
+#define WQ_CPU_INTENSIVE	BIT(5)
+#define WORK_CPU_UNBOUND	64
+
+extern struct workqueue_struct *system_wq;
+extern struct workqueue_struct *system_highpri_wq;
+
+void sim_init_work(struct work_struct *work, void (*func)(struct work_struct *));
+void sim_init_delayed_work(struct delayed_work *dwork,
+			   void (*func)(struct work_struct *));
+#define INIT_WORK(w, f)		sim_init_work(w, f)
+#define INIT_DELAYED_WORK(w, f)	sim_init_delayed_work(w, f)
+#define to_delayed_work(w)	container_of(w, struct delayed_work, work)
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					 int max_active, ...);
+void destroy_workqueue(struct workqueue_struct *wq);
+bool queue_work_on(int cpu, struct workqueue_struct *wq,
+		   struct work_struct *work);
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			 struct delayed_work *dwork, unsigned long delay);
+bool cancel_work_sync(struct work_struct *work);
+bool cancel_delayed_work(struct delayed_work *dwork);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+bool flush_work(struct work_struct *work);
+
+#define queue_work(wq, w)	queue_work_on(WORK_CPU_UNBOUND, wq, w)
+#define schedule_work(w)	queue_work(system_wq, w)
+#define mod_delayed_work(wq, dw, d) \
+	mod_delayed_work_on(WORK_CPU_UNBOUND, wq, dw, d)
+#define queue_delayed_work(wq, dw, d)	mod_delayed_work(wq, dw, d)
+#define schedule_delayed_work(dw, d)	mod_delayed_work(system_wq, dw, d)
+
+/******************************* CPUs and IRQs *******************************/
+
+struct cpumask {
+	unsigned long bits[1];
+};
+
+extern int sim_nr_cpus;
+#define nr_cpu_ids		((unsigned int)sim_nr_cpus)
+
+static inline int num_online_cpus(void) { return sim_nr_cpus; }
+static inline bool cpu_online(unsigned int cpu) { return cpu < (unsigned)sim_nr_cpus; }
+const struct cpumask *cpumask_of(int cpu);
+unsigned int cpumask_local_spread(unsigned int i, int node);
+
+typedef enum {
+	IRQ_NONE,
+	IRQ_HANDLED,
+	IRQ_WAKE_THREAD,
+} irqreturn_t;
+
+#define IRQ_TYPE_NONE		0
+#define IRQ_TYPE_EDGE_RISING	1
+#define IRQ_TYPE_EDGE_FALLING	2
+#define IRQ_TYPE_LEVEL_HIGH	4
+#define IRQ_TYPE_LEVEL_LOW	8
+#define IRQF_TRIGGER_HIGH	0x04
+#define IRQF_TRIGGER_LOW	0x08
+#define IRQF_SHARED		0x80
+#define IRQF_ONESHOT		0x2000
+
+typedef irqreturn_t (*irq_handler_t)(int irq, void *dev_id);
+
+void disable_irq(unsigned int irq);
+void disable_irq_nosync(unsigned int irq);
+void enable_irq(unsigned int irq);
+unsigned int irq_get_trigger_type(unsigned int irq);
+int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m);
+
+/****************************** devices ******************************/
+
+struct device_node;
+
+struct device {
+	const char		*init_name;
+	void			*platform_data;
+	struct device_node	*of_node;
+	void			*driver_data;
+};
+
+static inline const char *dev_name(const struct device *dev)
+{
+	return dev->init_name;
+}
+
+static inline int dev_to_node(struct device *dev) { (void)dev; return 0; }
+
+int devm_request_irq(struct device *dev, unsigned int irq,
+		     irq_handler_t handler, unsigned long flags,
+		     const char *name, void *dev_id);
+
+#define GPIOF_OUT_INIT_HIGH	2
+
+static inline bool gpio_is_valid(int number) { return number >= 0; }
+static inline int of_get_named_gpio(struct device_node *np, const char *name,
+				    int index)
+{
+	return -ENOENT;
+}
+static inline int devm_gpio_request_one(struct device *dev, unsigned int gpio,
+					unsigned long flags, const char *label)
+{
+	return 0;
+}
+static inline void gpio_set_value_cansleep(unsigned int gpio, int value) { }
+
+/******************************* memory *******************************/
+
+#define GFP_KERNEL		0x01
+#define GFP_ATOMIC		0x02
+#define GFP_DMA			0x04
+#define __GFP_ZERO		0x08
+#define PAGE_SIZE		4096UL
+#define PAGE_SHIFT		12
+#define PAGE_ALIGN(x)		ALIGN(x, PAGE_SIZE)
+#define SLAB_HWCACHE_ALIGN	0x2000
+#define SLAB_CACHE_DMA		0x4000
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return flags & __GFP_ZERO ? calloc(1, size) : malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags) { return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+	return calloc(n, size);
+}
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void *vmalloc_user(unsigned long size)
+{
+	return calloc(1, PAGE_ALIGN(size));
+}
+static inline void vfree(const void *p) { free((void *)p); }
+
+struct kmem_cache;
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+				     unsigned int align, unsigned long flags,
+				     void (*ctor)(void *));
+void kmem_cache_destroy(struct kmem_cache *s);
+void *kmem_cache_zalloc(struct kmem_cache *s, gfp_t flags);
+void kmem_cache_free(struct kmem_cache *s, void *p);
+#define KMEM_CACHE(__struct, __flags) \
+	kmem_cache_create(#__struct, sizeof(struct __struct), \
+			  __alignof__(struct __struct), (__flags), NULL)
+
+/****************************** strings and hashes ******************************/
+
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+					   unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+					 unsigned long n)
+{
+	memcpy(to, from, n);
+	return 0;
+}
+
+char *strim(char *s);
+bool sysfs_streq(const char *s1, const char *s2);
+int kstrtou64(const char *s, unsigned int base, u64 *res);
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+int kstrtoint(const char *s, unsigned int base, int *res);
+int kstrtobool(const char *s, bool *res);
+
+#define GOLDEN_RATIO_64		0x61C8864680B583EBull
+
+static inline u32 hash_64(u64 val, unsigned int bits)
+{
+	return val * GOLDEN_RATIO_64 >> (64 - bits);
+}
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	return (val * 0x61C88647u) >> (32 - bits);
+}
+
+u16 crc_ccitt(u16 crc, const u8 *buffer, size_t len);
+
+static inline u16 get_unaligned_le16(const void *p)
+{
+	const u8 *b = p;
+
+	return b[0] | b[1] << 8;
+}
+
+static inline u32 get_unaligned_le32(const void *p)
+{
+	const u8 *b = p;
+
+	return b[0] | b[1] << 8 | b[2] << 16 | (u32)b[3] << 24;
+}
+
+static inline u64 get_unaligned_le64(const void *p)
+{
+	return get_unaligned_le32(p) |
+	       (u64)get_unaligned_le32((const u8 *)p + 4) << 32;
+}
+
+static inline void put_unaligned_le16(u16 val, void *p)
+{
+	u8 *b = p;
+
+	b[0] = val;
+	b[1] = val >> 8;
+}
+
+static inline void put_unaligned_le64(u64 val, void *p)
+{
+	u8 *b = p;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		b[i] = val >> (8 * i);
+}
+
+#define cpu_to_le16(x)		((u16)(x))
+#define le16_to_cpu(x)		((u16)(x))
+#define cpu_to_le64(x)		((u64)(x))
+#define le64_to_cpu(x)		((u64)(x))
+
+void get_random_bytes(void *buf, int nbytes);
+u32 prandom_u32(void);
+u32 get_random_u32(void);
+
+/************************** debugfs and files **************************/
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void		*private_data;
+	struct inode	*f_inode;
+};
+
+struct vm_area_struct {
+	unsigned long	vm_start, vm_end, vm_pgoff, vm_flags;
+};
+
+struct poll_table_struct;
+typedef struct poll_table_struct poll_table;
+
+#define POLLIN			0x0001
+#define POLLRDNORM		0x0040
+#define EPOLLIN			0x0001
+#define EPOLLRDNORM		0x0040
+#define VM_WRITE		0x0002
+#define VM_MAYWRITE		0x0020
+#define VM_DONTEXPAND		0x00040000
+#define VM_DONTDUMP		0x04000000
+
+struct file_operations {
+	struct module	*owner;
+	int		(*open)(struct inode *, struct file *);
+	ssize_t		(*read)(struct file *, char __user *, size_t, loff_t *);
+	ssize_t		(*write)(struct file *, const char __user *, size_t,
+				 loff_t *);
+	loff_t		(*llseek)(struct file *, loff_t, int);
+	int		(*release)(struct inode *, struct file *);
+	int		(*mmap)(struct file *, struct vm_area_struct *);
+	unsigned int	(*poll)(struct file *, struct poll_table_struct *);
+	long		(*unlocked_ioctl)(struct file *, unsigned int,
+					  unsigned long);
+	/* DEFINE_SIMPLE_ATTRIBUTE */
+	int		(*attr_get)(void *, u64 *);
+	int		(*attr_set)(void *, u64);
+};
+
+#define DEFINE_SIMPLE_ATTRIBUTE(fops, get, set, fmt) \
+	static const struct file_operations fops = { \
+		.owner = THIS_MODULE, .attr_get = get, .attr_set = set }
+
+static inline void poll_wait(struct file *f, wait_queue_head_t *q,
+			     poll_table *p) { }
+static inline int nonseekable_open(struct inode *inode, struct file *filp)
+{
+	return 0;
+}
+static inline loff_t no_llseek(struct file *file, loff_t offset, int whence)
+{
+	return -ESPIPE;
+}
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr,
+				      unsigned long pgoff)
+{
+	return 0;
+}
+
+struct seq_file {
+	char		*buf;
+	size_t		size;
+	size_t		count;
+	void		*private;
+	int		(*show)(struct seq_file *, void *);
+};
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos);
+loff_t seq_lseek(struct file *file, loff_t offset, int whence);
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void seq_puts(struct seq_file *m, const char *s);
+
+#define DNAME_INLINE_LEN	32
+
+struct dentry;
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+struct dentry *debugfs_create_u32(const char *name, umode_t mode,
+				  struct dentry *parent, u32 *value);
+struct dentry *debugfs_create_bool(const char *name, umode_t mode,
+				   struct dentry *parent, bool *value);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+#define MISC_DYNAMIC_MINOR	255
+
+struct miscdevice {
+	int				minor;
+	const char			*name;
+	const struct file_operations	*fops;
+	struct device			*parent;
+};
+
+static inline int misc_register(struct miscdevice *misc) { return 0; }
+static inline void misc_deregister(struct miscdevice *misc) { }
+
+struct hwrng {
+	const char	*name;
+	int		(*init)(struct hwrng *rng);
+	void		(*cleanup)(struct hwrng *rng);
+	int		(*read)(struct hwrng *rng, void *data, size_t max,
+				bool wait);
+	unsigned long	priv;
+	unsigned short	quality;
+};
+
+int hwrng_register(struct hwrng *rng);
+void hwrng_unregister(struct hwrng *rng);
+
+/********************************* SPI *********************************/
+
+struct spi_transfer {
+	const void		*tx_buf;
+	void			*rx_buf;
+	unsigned int		len;
+	unsigned int		cs_change:1;
+	u8			bits_per_word;
+	u16			delay_usecs;
+	u32			speed_hz;
+	struct list_head	transfer_list;
+};
+
+struct spi_device;
+
+struct spi_message {
+	struct list_head	transfers;
+	struct spi_device	*spi;
+	void			(*complete)(void *context);
+	void			*context;
+	unsigned int		frame_length;
+	unsigned int		actual_length;
+	int			status;
+	struct list_head	queue;
+};
+
+/* The host side: one message on the wire at a time */
+struct spi_controller {
+	u32			max_speed_hz;
+	struct list_head	queue;
+	struct spi_message	*cur;
+	struct sim_timer	done;
+	u64			start_ns;	/* of the current message */
+	u64			msgs;
+	u64			frames;
+	u64			bytes;
+	u64			busy_ns;
+};
+
+/* The far end of the bus: one call per chip select frame */
+struct sim_spi_slave {
+	void	(*frame)(void *priv, const u8 *tx, u8 *rx, size_t len,
+			 u32 hz);
+	void	*priv;
+};
+
+struct spi_device {
+	struct device		dev;
+	struct spi_controller	*controller;
+	struct spi_controller	*master;
+	u32			max_speed_hz;
+	u8			chip_select;
+	u8			bits_per_word;
+	u16			mode;
+	int			irq;
+	struct sim_spi_slave	*slave;
+};
+
+static inline void spi_message_init(struct spi_message *m)
+{
+	memset(m, 0, sizeof(*m));
+	INIT_LIST_HEAD(&m->transfers);
+	INIT_LIST_HEAD(&m->queue);
+}
+
+static inline void spi_message_add_tail(struct spi_transfer *t,
+					struct spi_message *m)
+{
+	list_add_tail(&t->transfer_list, &m->transfers);
+}
+
+static inline void spi_set_drvdata(struct spi_device *spi, void *data)
+{
+	spi->dev.driver_data = data;
+}
+
+static inline void *spi_get_drvdata(struct spi_device *spi)
+{
+	return spi->dev.driver_data;
+}
+
+int spi_setup(struct spi_device *spi);
+int spi_async(struct spi_device *spi, struct spi_message *message);
+int spi_sync(struct spi_device *spi, struct spi_message *message);
+int spi_write_then_read(struct spi_device *spi, const void *txbuf,
+			unsigned int n_tx, void *rxbuf, unsigned int n_rx);
+
+struct spi_device_id {
+	char		name[32];
+	unsigned long	driver_data;
+};
+
+struct of_device_id {
+	char		compatible[128];
+	const void	*data;
+};
+
+#define of_match_ptr(x)		(x)
+
+struct device_driver {
+	const char			*name;
+	const struct of_device_id	*of_match_table;
+};
+
+struct spi_driver {
+	const struct spi_device_id	*id_table;
+	int				(*probe)(struct spi_device *spi);
+	int				(*remove)(struct spi_device *spi);
+	struct device_driver		driver;
+};
+
+int spi_register_driver(struct spi_driver *sdrv);
+void spi_unregister_driver(struct spi_driver *sdrv);
+
+/******************************** regmap ********************************/
+
+enum regcache_type {
+	REGCACHE_NONE,
+	REGCACHE_RBTREE,
+	REGCACHE_COMPRESSED,
+	REGCACHE_FLAT,
+};
+
+struct regmap_config {
+	int			reg_bits;
+	int			val_bits;
+	bool			(*writeable_reg)(struct device *dev,
+						 unsigned int reg);
+	bool			(*readable_reg)(struct device *dev,
+						unsigned int reg);
+	bool			(*volatile_reg)(struct device *dev,
+						unsigned int reg);
+	bool			(*precious_reg)(struct device *dev,
+						unsigned int reg);
+	unsigned int		max_register;
+	enum regcache_type	cache_type;
+	unsigned long		read_flag_mask;
+	unsigned long		write_flag_mask;
+};
+
+struct regmap;
+
+struct regmap *devm_regmap_init_spi(struct spi_device *spi,
+				    const struct regmap_config *config);
+int regmap_read(struct regmap *map, unsigned int reg, unsigned int *val);
+int regmap_write(struct regmap *map, unsigned int reg, unsigned int val);
+int regmap_update_bits(struct regmap *map, unsigned int reg,
+		       unsigned int mask, unsigned int val);
+int regmap_bulk_write(struct regmap *map, unsigned int reg, const void *val,
+		      size_t val_count);
+void regcache_cache_only(struct regmap *map, bool enable);
+void regcache_mark_dirty(struct regmap *map);
+int regcache_sync(struct regmap *map);
+
+/******************************** sk_buff ********************************/
+
+struct sk_buff {
+	unsigned char	*head;
+	unsigned char	*data;
+	unsigned int	len;
+	unsigned int	end;
+	char		cb[48];
+	u64		sim_ts;
+};
+
+struct sk_buff *dev_alloc_skb(unsigned int length);
+void *skb_put(struct sk_buff *skb, unsigned int len);
+void kfree_skb(struct sk_buff *skb);
+#define dev_kfree_skb_any(skb)	kfree_skb(skb)
+#define dev_kfree_skb(skb)	kfree_skb(skb)
+
+static inline void skb_reserve(struct sk_buff *skb, int len)
+{
+	skb->data += len;
+}
+
+static inline void *skb_put_data(struct sk_buff *skb, const void *data,
+				 unsigned int len)
+{
+	return memcpy(skb_put(skb, len), data, len);
+}
+
+static inline void skb_trim(struct sk_buff *skb, unsigned int len)
+{
+	if (skb->len > len)
+		skb->len = len;
+}
+
+/******************************* IEEE 802.15.4 *******************************/
+
+#define IEEE802154_MTU			127
+#define IEEE802154_ACK_PSDU_LEN		5
+#define IEEE802154_FCS_LEN		2
+#define IEEE802154_ADDR_LEN		8
+#define IEEE802154_EXTENDED_ADDR_LEN	8
+#define IEEE802154_ADDR_NONE		0x0
+#define IEEE802154_ADDR_SHORT		0x2
+#define IEEE802154_ADDR_LONG		0x3
+#define IEEE802154_ADDR_SHORT_BROADCAST	0xffff
+#define IEEE802154_PANID_BROADCAST	0xffff
+#define IEEE802154_FC_TYPE_BEACON	0x0
+#define IEEE802154_FC_TYPE_DATA		0x1
+#define IEEE802154_FC_TYPE_ACK		0x2
+#define IEEE802154_FC_TYPE_MAC_CMD	0x3
+#define IEEE802154_MAX_PAGE		31
+#define IEEE802154_MAX_CHANNEL		26
+
+static inline bool ieee802154_is_valid_psdu_len(u8 len)
+{
+	return len == IEEE802154_ACK_PSDU_LEN ||
+	       (len >= 9 && len <= IEEE802154_MTU);
+}
+
+enum nl802154_cca_modes {
+	__NL802154_CCA_INVALID,
+	NL802154_CCA_ENERGY,
+	NL802154_CCA_CARRIER,
+	NL802154_CCA_ENERGY_CARRIER,
+};
+
+enum nl802154_cca_opts {
+	NL802154_CCA_OPT_ENERGY_CARRIER_AND,
+	NL802154_CCA_OPT_ENERGY_CARRIER_OR,
+};
+
+#define WPAN_PHY_FLAG_TXPOWER		BIT(1)
+#define WPAN_PHY_FLAG_CCA_ED_LEVEL	BIT(2)
+#define WPAN_PHY_FLAG_CCA_MODE		BIT(3)
+
+struct wpan_phy_supported {
+	u32		channels[IEEE802154_MAX_PAGE + 1];
+	u32		cca_modes, cca_opts, iftypes;
+	const s32	*tx_powers, *cca_ed_levels;
+	size_t		tx_powers_size, cca_ed_levels_size;
+	u8		min_minbe, max_minbe, min_maxbe, max_maxbe;
+	u8		min_csma_backoffs, max_csma_backoffs;
+	s8		min_frame_retries, max_frame_retries;
+};
+
+struct wpan_phy_cca {
+	enum nl802154_cca_modes	mode;
+	enum nl802154_cca_opts	opt;
+};
+
+struct wpan_phy {
+	u32				flags;
+	struct wpan_phy_supported	supported;
+	struct wpan_phy_cca		cca;
+	u8				current_channel;
+	u8				current_page;
+	u8				symbol_duration;
+	s32				transmit_power;
+	s32				cca_ed_level;
+	__le64				perm_extended_addr;
+	u16				lifs_period;
+	u16				sifs_period;
+};
+
+#define IEEE802154_HW_TX_OMIT_CKSUM	BIT(0)
+#define IEEE802154_HW_LBT		BIT(1)
+#define IEEE802154_HW_CSMA_PARAMS	BIT(2)
+#define IEEE802154_HW_FRAME_RETRIES	BIT(3)
+#define IEEE802154_HW_AFILT		BIT(4)
+#define IEEE802154_HW_PROMISCUOUS	BIT(5)
+#define IEEE802154_HW_RX_OMIT_CKSUM	BIT(6)
+#define IEEE802154_HW_RX_DROP_BAD_CKSUM	BIT(7)
+
+#define IEEE802154_AFILT_SADDR_CHANGED		BIT(0)
+#define IEEE802154_AFILT_IEEEADDR_CHANGED	BIT(1)
+#define IEEE802154_AFILT_PANID_CHANGED		BIT(2)
+#define IEEE802154_AFILT_PANC_CHANGED		BIT(3)
+
+struct ieee802154_hw_addr_filt {
+	__le16	pan_id;
+	__le16	short_addr;
+	__le64	ieee_addr;
+	bool	pan_coord;
+};
+
+struct ieee802154_hw {
+	int		extra_tx_headroom;
+	u32		flags;
+	struct device	*parent;
+	void		*priv;
+	struct wpan_phy	*phy;
+};
+
+struct ieee802154_ops {
+	struct module	*owner;
+	int		(*start)(struct ieee802154_hw *hw);
+	void		(*stop)(struct ieee802154_hw *hw);
+	int		(*xmit_sync)(struct ieee802154_hw *hw,
+				     struct sk_buff *skb);
+	int		(*xmit_async)(struct ieee802154_hw *hw,
+				      struct sk_buff *skb);
+	int		(*ed)(struct ieee802154_hw *hw, u8 *level);
+	int		(*set_channel)(struct ieee802154_hw *hw, u8 page,
+				       u8 channel);
+	int		(*set_hw_addr_filt)(struct ieee802154_hw *hw,
+					    struct ieee802154_hw_addr_filt *filt,
+					    unsigned long changed);
+	int		(*set_txpower)(struct ieee802154_hw *hw, s32 mbm);
+	int		(*set_lbt)(struct ieee802154_hw *hw, bool on);
+	int		(*set_cca_mode)(struct ieee802154_hw *hw,
+					const struct wpan_phy_cca *cca);
+	int		(*set_cca_ed_level)(struct ieee802154_hw *hw, s32 mbm);
+	int		(*set_csma_params)(struct ieee802154_hw *hw, u8 min_be,
+					   u8 max_be, u8 retries);
+	int		(*set_frame_retries)(struct ieee802154_hw *hw,
+					     s8 retries);
+	int		(*set_promiscuous_mode)(struct ieee802154_hw *hw,
+						const bool on);
+};
+
+struct ieee802154_hw *ieee802154_alloc_hw(size_t priv_data_len,
+					  const struct ieee802154_ops *ops);
+void ieee802154_free_hw(struct ieee802154_hw *hw);
+int ieee802154_register_hw(struct ieee802154_hw *hw);
+void ieee802154_unregister_hw(struct ieee802154_hw *hw);
+void ieee802154_random_extended_addr(__le64 *addr);
+void ieee802154_rx_irqsafe(struct ieee802154_hw *hw, struct sk_buff *skb,
+			   u8 lqi);
+void ieee802154_wake_queue(struct ieee802154_hw *hw);
+void ieee802154_stop_queue(struct ieee802154_hw *hw);
+void ieee802154_xmit_complete(struct ieee802154_hw *hw, struct sk_buff *skb,
+			      bool ifs_handling);
+
+/******************************** version ********************************/
+
+#define KERNEL_VERSION(a, b, c)	(((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE	KERNEL_VERSION(4, 14, 98)
+
+#endif /* SIM_KERNEL_H */
@@ -0,0 +1,1477 @@
+/* The kernel side of the simulator: event loop, workqueues, IRQ line, SPI
+ * controller, regmap, debugfs and a thin mac802154. See sim_kernel.h. */
+#include <sim_kernel.h>
+#include "sim.h"
+
+/******************************** event loop ********************************/
+
+static u64 now_ns;
+static u64 timer_seq;
+static LIST_HEAD(timers);
+static LIST_HEAD(works);
+static int in_work;
+static int in_atomic;
+
+/* Starts close to a wrap, as the kernel does */
+#define SIM_INITIAL_JIFFIES	((unsigned long)(-300 * HZ))
+#define SIM_NS_PER_JIFFY	(NSEC_PER_SEC / HZ)
+
+unsigned long jiffies = SIM_INITIAL_JIFFIES;
+int sim_nr_cpus = 4;
+bool sim_verbose;
+
+void sim_fatal(const char *fmt, ...)
+{
+	va_list args;
+
+	fprintf(stderr, "sim: %.3f ms: ", now_ns / 1e6);
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	exit(2);
+}
+
+void sim_warn(const char *file, int line)
+{
+	fprintf(stderr, "sim: WARNING at %s:%d\n", file, line);
+	sim.warnings++;
+}
+
+int printk(const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	sim.printks++;
+	if (!sim_verbose)
+		return 0;
+
+	fprintf(stderr, "[%10.3f] ", now_ns / 1e3);
+	va_start(args, fmt);
+	n = vfprintf(stderr, fmt, args);
+	va_end(args);
+	if (n > 0 && fmt[strlen(fmt) - 1] != '\n')
+		fputc('\n', stderr);
+	return n;
+}
+
+u64 sim_now(void)
+{
+	return now_ns;
+}
+
+static void sim_set_time(u64 ns)
+{
+	if (ns <= now_ns)
+		return;
+	now_ns = ns;
+	jiffies = SIM_INITIAL_JIFFIES + now_ns / SIM_NS_PER_JIFFY;
+}
+
+u64 sim_jiffies_to_ns(unsigned long j)
+{
+	return (u64)j * SIM_NS_PER_JIFFY;
+}
+
+unsigned long msecs_to_jiffies(unsigned int m)
+{
+	return DIV_ROUND_UP((unsigned long)m * HZ, MSEC_PER_SEC);
+}
+
+unsigned long usecs_to_jiffies(unsigned int u)
+{
+	return DIV_ROUND_UP((unsigned long)u * HZ, USEC_PER_SEC);
+}
+
+unsigned int jiffies_to_msecs(unsigned long j)
+{
+	return j * (MSEC_PER_SEC / HZ);
+}
+
+void sim_timer_add(struct sim_timer *t, u64 expires)
+{
+	struct list_head *pos;
+
+	if (t->queued)
+		sim_timer_del(t);
+	t->expires = expires;
+	t->seq = timer_seq++;
+	t->queued = true;
+
+	/* Sorted by expiry, first come first served on a tie */
+	for (pos = timers.prev; pos != &timers; pos = pos->prev)
+		if (list_entry(pos, struct sim_timer, node)->expires <= expires)
+			break;
+	t->node.prev = pos;
+	t->node.next = pos->next;
+	pos->next->prev = &t->node;
+	pos->next = &t->node;
+}
+
+bool sim_timer_del(struct sim_timer *t)
+{
+	if (!t->queued)
+		return false;
+	list_del_init(&t->node);
+	t->queued = false;
+	return true;
+}
+
+static void sim_timer_fire(struct sim_timer *t)
+{
+	sim_timer_del(t);
+	sim_set_time(t->expires);
+	in_atomic++;
+	t->fn(t);
+	in_atomic--;
+}
+
+static bool sim_irq_service(void);
+
+static void sim_run_work(struct work_struct *work)
+{
+	list_del_init(&work->entry);
+	work->pending = false;
+	in_work++;
+	work->func(work);
+	in_work--;
+	sim.works++;
+}
+
+/* Handles the next event due by @limit. Works run one at a time and never
+ * inside another work or an atomic callback, like a single worker thread;
+ * the IRQ is not taken inside atomic callbacks. */
+static bool sim_step(u64 limit)
+{
+	struct sim_timer *t = NULL;
+
+	if (!in_atomic && sim_irq_service())
+		return true;
+
+	if (!list_empty(&timers))
+		t = list_first_entry(&timers, struct sim_timer, node);
+	if (t && t->expires <= now_ns) {
+		sim_timer_fire(t);
+		return true;
+	}
+
+	if (!in_work && !in_atomic && !list_empty(&works)) {
+		sim_run_work(list_first_entry(&works, struct work_struct, entry));
+		return true;
+	}
+
+	if (t && t->expires <= limit) {
+		sim_timer_fire(t);
+		return true;
+	}
+
+	return false;
+}
+
+bool sim_wait_step(u64 deadline)
+{
+	if (sim_step(deadline))
+		return true;
+	sim_set_time(deadline);
+	return false;
+}
+
+void sim_run_until(u64 deadline)
+{
+	while (sim_step(deadline))
+		;
+	sim_set_time(deadline);
+}
+
+bool sim_run_while(bool (*busy)(void *arg), void *arg, u64 timeout)
+{
+	u64 deadline = now_ns + timeout;
+
+	while (busy(arg))
+		if (!sim_wait_step(deadline))
+			return !busy(arg);
+	return true;
+}
+
+void sim_idle(void)
+{
+	while (sim_step(now_ns))
+		;
+}
+
+static void sim_sleep(u64 ns)
+{
+	sim_run_until(now_ns + ns);
+}
+
+void ndelay(unsigned long nsecs)
+{
+	sim_sleep(nsecs);
+}
+
+void udelay(unsigned long usecs)
+{
+	sim_sleep(usecs * NSEC_PER_USEC);
+}
+
+void mdelay(unsigned long msecs)
+{
+	sim_sleep(msecs * NSEC_PER_MSEC);
+}
+
+/* Wake-up latency is not modelled: the earliest allowed time */
+void usleep_range(unsigned long min, unsigned long max)
+{
+	sim_sleep(min * NSEC_PER_USEC);
+}
+
+void msleep(unsigned int msecs)
+{
+	sim_sleep(msecs * NSEC_PER_MSEC);
+}
+
+/* No signals in the simulator */
+unsigned long msleep_interruptible(unsigned int msecs)
+{
+	msleep(msecs);
+	return 0;
+}
+
+bool in_interrupt(void)
+{
+	return in_atomic;
+}
+
+void mutex_init(struct mutex *lock)
+{
+	lock->locked = 0;
+}
+
+void mutex_lock(struct mutex *lock)
+{
+	if (lock->locked)
+		sim_fatal("mutex deadlock\n");
+	lock->locked = 1;
+}
+
+void mutex_unlock(struct mutex *lock)
+{
+	lock->locked = 0;
+}
+
+void wait_for_completion(struct completion *x)
+{
+	while (!x->done)
+		if (!sim_step(~0ULL))
+			sim_fatal("wait_for_completion: nothing left to run\n");
+	if (x->done != ~0U)
+		x->done--;
+}
+
+unsigned long wait_for_completion_timeout(struct completion *x,
+					  unsigned long timeout)
+{
+	u64 deadline = now_ns + sim_jiffies_to_ns(timeout);
+
+	while (!x->done)
+		if (!sim_wait_step(deadline))
+			return 0;
+	if (x->done != ~0U)
+		x->done--;
+	return max(1UL, (unsigned long)((deadline - now_ns) /
+					SIM_NS_PER_JIFFY));
+}
+
+/********************************* hrtimers *********************************/
+
+static void sim_hrtimer_fn(struct sim_timer *t)
+{
+	struct hrtimer *timer = container_of(t, struct hrtimer, t);
+
+	if (timer->function(timer) == HRTIMER_RESTART)
+		sim_timer_add(&timer->t, timer->expires);
+}
+
+void hrtimer_init(struct hrtimer *timer, int clock, enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+	INIT_LIST_HEAD(&timer->t.node);
+	timer->t.fn = sim_hrtimer_fn;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim, enum hrtimer_mode mode)
+{
+	if (mode == HRTIMER_MODE_REL || mode == HRTIMER_MODE_REL_PINNED)
+		tim += now_ns;
+	timer->expires = tim;
+	sim_timer_add(&timer->t, max_t(u64, tim, now_ns));
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	return sim_timer_del(&timer->t);
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	return sim_timer_del(&timer->t);
+}
+
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+	u64 n = 0;
+
+	while (timer->expires <= (ktime_t)now_ns) {
+		timer->expires += interval;
+		n++;
+	}
+	return n;
+}
+
+/******************************** workqueues ********************************/
+
+struct workqueue_struct {
+	char	name[32];
+};
+
+static struct workqueue_struct sim_system_wq = { "events" };
+struct workqueue_struct *system_wq = &sim_system_wq;
+struct workqueue_struct *system_highpri_wq = &sim_system_wq;
+
+void sim_init_work(struct work_struct *work, void (*func)(struct work_struct *))
+{
+	memset(work, 0, sizeof(*work));
+	INIT_LIST_HEAD(&work->entry);
+	work->func = func;
+}
+
+static void sim_delayed_work_timer(struct sim_timer *t)
+{
+	struct delayed_work *dwork = container_of(t, struct delayed_work, timer);
+
+	queue_work_on(WORK_CPU_UNBOUND, dwork->wq, &dwork->work);
+}
+
+void sim_init_delayed_work(struct delayed_work *dwork,
+			   void (*func)(struct work_struct *))
+{
+	sim_init_work(&dwork->work, func);
+	memset(&dwork->timer, 0, sizeof(dwork->timer));
+	INIT_LIST_HEAD(&dwork->timer.node);
+	dwork->timer.fn = sim_delayed_work_timer;
+}
+
+struct workqueue_struct *alloc_workqueue(const char *fmt, unsigned int flags,
+					 int max_active, ...)
+{
+	struct workqueue_struct *wq = calloc(1, sizeof(*wq));
+	va_list args;
+
+	va_start(args, max_active);
+	vsnprintf(wq->name, sizeof(wq->name), fmt, args);
+	va_end(args);
+	return wq;
+}
+
+void destroy_workqueue(struct workqueue_struct *wq)
+{
+	struct work_struct *work, *next;
+
+	/* Drains: pending works of @wq still run */
+	for (work = list_entry(works.next, struct work_struct, entry);
+	     &work->entry != &works; work = next) {
+		next = list_entry(work->entry.next, struct work_struct, entry);
+		if (work->wq == wq)
+			sim_run_work(work);
+	}
+	free(wq);
+}
+
+bool queue_work_on(int cpu, struct workqueue_struct *wq,
+		   struct work_struct *work)
+{
+	if (work->pending)
+		return false;
+	work->pending = true;
+	work->wq = wq;
+	list_add_tail(&work->entry, &works);
+	return true;
+}
+
+bool mod_delayed_work_on(int cpu, struct workqueue_struct *wq,
+			 struct delayed_work *dwork, unsigned long delay)
+{
+	bool pending = cancel_delayed_work(dwork);
+
+	dwork->wq = wq;
+	if (!delay)
+		queue_work_on(cpu, wq, &dwork->work);
+	else
+		sim_timer_add(&dwork->timer, now_ns + sim_jiffies_to_ns(delay));
+	return pending;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	if (!work->pending)
+		return false;
+	list_del_init(&work->entry);
+	work->pending = false;
+	return true;
+}
+
+bool cancel_delayed_work(struct delayed_work *dwork)
+{
+	bool timer = sim_timer_del(&dwork->timer);
+
+	return cancel_work_sync(&dwork->work) || timer;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	return cancel_delayed_work(dwork);
+}
+
+bool flush_work(struct work_struct *work)
+{
+	if (!work->pending)
+		return false;
+	if (in_work)
+		sim_fatal("flush_work from a work would wait for itself\n");
+	sim_run_work(work);
+	return true;
+}
+
+/************************************ IRQs ************************************/
+
+#define SIM_NR_IRQS	8
+
+static struct sim_irq {
+	irq_handler_t	handler;
+	void		*dev_id;
+	int		depth;
+	bool		(*line)(void *priv);
+	void		*priv;
+	u64		none_at;
+} irqs[SIM_NR_IRQS];
+
+static struct cpumask cpu_masks[64];
+
+const struct cpumask *cpumask_of(int cpu)
+{
+	cpu_masks[cpu].bits[0] = 1UL << cpu;
+	return &cpu_masks[cpu];
+}
+
+unsigned int cpumask_local_spread(unsigned int i, int node)
+{
+	return i % sim_nr_cpus;
+}
+
+int irq_set_affinity_hint(unsigned int irq, const struct cpumask *m)
+{
+	return 0;
+}
+
+static struct sim_irq *sim_irq_desc(unsigned int irq)
+{
+	if (irq >= SIM_NR_IRQS)
+		sim_fatal("bad irq %u\n", irq);
+	return &irqs[irq];
+}
+
+void sim_irq_connect(unsigned int irq, bool (*line)(void *priv), void *priv)
+{
+	struct sim_irq *desc = sim_irq_desc(irq);
+
+	desc->line = line;
+	desc->priv = priv;
+}
+
+unsigned int irq_get_trigger_type(unsigned int irq)
+{
+	return IRQ_TYPE_LEVEL_HIGH;
+}
+
+int devm_request_irq(struct device *dev, unsigned int irq,
+		     irq_handler_t handler, unsigned long flags,
+		     const char *name, void *dev_id)
+{
+	struct sim_irq *desc = sim_irq_desc(irq);
+
+	if (desc->handler)
+		return -EBUSY;
+	desc->handler = handler;
+	desc->dev_id = dev_id;
+	desc->depth = 0;
+	desc->none_at = ~0ULL;
+	return 0;
+}
+
+void disable_irq_nosync(unsigned int irq)
+{
+	sim_irq_desc(irq)->depth++;
+}
+
+void disable_irq(unsigned int irq)
+{
+	disable_irq_nosync(irq);
+}
+
+void enable_irq(unsigned int irq)
+{
+	struct sim_irq *desc = sim_irq_desc(irq);
+
+	if (!desc->depth) {
+		fprintf(stderr, "sim: unbalanced enable for IRQ %u\n", irq);
+		sim.warnings++;
+		return;
+	}
+	desc->depth--;
+}
+
+void sim_irq_release(unsigned int irq)
+{
+	struct sim_irq *desc = sim_irq_desc(irq);
+
+	desc->handler = NULL;
+}
+
+/* A level triggered line the handler did not claim is retried once time
+ * moves on, instead of storming */
+static bool sim_irq_service(void)
+{
+	struct sim_irq *desc;
+	irqreturn_t ret;
+	int i;
+
+	for (i = 0; i < SIM_NR_IRQS; i++) {
+		desc = &irqs[i];
+		if (!desc->handler || desc->depth || !desc->line ||
+		    desc->none_at == now_ns || !desc->line(desc->priv))
+			continue;
+
+		in_atomic++;
+		ret = desc->handler(i, desc->dev_id);
+		in_atomic--;
+		sim.irqs++;
+		desc->none_at = ret == IRQ_NONE ? now_ns : ~0ULL;
+		return true;
+	}
+	return false;
+}
+
+/************************************ SPI ************************************/
+
+/* The controller setup cost of a message, and the chip select gap of a
+ * cs_change inside a message (udelay(10) in the 4.14 SPI core) */
+u64 sim_spi_msg_ns = 8000;
+#define SIM_SPI_CS_GAP_NS	10000
+
+/* Every byte on the bus, in the CSV format of the logic analyser export
+ * read by python_extraction/ (one Packet ID per chip select frame) */
+FILE *sim_spi_trace;
+
+static void sim_spi_trace_frame(struct spi_controller *ctlr, u64 t,
+				const u8 *tx, const u8 *rx, size_t len, u32 hz)
+{
+	size_t i;
+
+	if (!ctlr->frames)
+		fprintf(sim_spi_trace, "Time [s],Packet ID,MOSI,MISO\n");
+	for (i = 0; i < len; i++, t += 8 * NSEC_PER_SEC / hz)
+		fprintf(sim_spi_trace, "%llu.%09llu,%llu,0x%02X,0x%02X\n",
+			t / NSEC_PER_SEC, t % NSEC_PER_SEC, ctlr->frames,
+			tx[i], rx[i]);
+}
+
+static void sim_spi_next(struct spi_controller *ctlr);
+
+static u32 sim_spi_xfer_hz(struct spi_device *spi, struct spi_transfer *xfer)
+{
+	u32 hz = xfer->speed_hz ? xfer->speed_hz : spi->max_speed_hz;
+
+	if (spi->controller->max_speed_hz)
+		hz = min(hz, spi->controller->max_speed_hz);
+	return hz;
+}
+
+/* Runs the message over the wire: the bytes are exchanged with the slave at
+ * the end of the message, one call per chip select frame */
+static void sim_spi_transfer(struct spi_controller *ctlr,
+			     struct spi_message *msg)
+{
+	struct spi_device *spi = msg->spi;
+	struct spi_transfer *xfer;
+	u8 tx[4096], rx[4096];
+	size_t len = 0;
+	u32 hz = 0;
+	/* Start of the current frame and of the next transfer on the wire */
+	u64 t = ctlr->start_ns + sim_spi_msg_ns, t_frame = t;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		if (len + xfer->len > sizeof(tx))
+			sim_fatal("SPI frame too long\n");
+		if (xfer->tx_buf)
+			memcpy(tx + len, xfer->tx_buf, xfer->len);
+		else
+			memset(tx + len, 0, xfer->len);
+
+		hz = sim_spi_xfer_hz(spi, xfer);
+		len += xfer->len;
+		msg->actual_length += xfer->len;
+		t += DIV_ROUND_UP((u64)xfer->len * 8 * NSEC_PER_SEC, hz);
+		t += xfer->delay_usecs * NSEC_PER_USEC;
+
+		if (!xfer->cs_change &&
+		    xfer->transfer_list.next != &msg->transfers)
+			continue;
+
+		/* End of a chip select frame */
+		memset(rx, 0, len);
+		spi->slave->frame(spi->slave->priv, tx, rx, len, hz);
+		if (sim_spi_trace)
+			sim_spi_trace_frame(ctlr, t_frame, tx, rx, len, hz);
+		ctlr->frames++;
+		ctlr->bytes += len;
+
+		/* Hand the read bytes back to the transfers of this frame */
+		{
+			struct spi_transfer *t = xfer;
+			size_t end = len;
+
+			for (;;) {
+				end -= t->len;
+				if (t->rx_buf)
+					memcpy(t->rx_buf, rx + end, t->len);
+				if (!end)
+					break;
+				t = list_entry(t->transfer_list.prev,
+					       struct spi_transfer,
+					       transfer_list);
+			}
+		}
+		len = 0;
+		t += SIM_SPI_CS_GAP_NS;
+		t_frame = t;
+	}
+}
+
+static void sim_spi_done(struct sim_timer *t)
+{
+	struct spi_controller *ctlr = container_of(t, struct spi_controller, done);
+	struct spi_message *msg = ctlr->cur;
+
+	sim_spi_transfer(ctlr, msg);
+	ctlr->cur = NULL;
+	msg->status = 0;
+	if (msg->complete)
+		msg->complete(msg->context);
+	sim_spi_next(ctlr);
+}
+
+static void sim_spi_next(struct spi_controller *ctlr)
+{
+	struct spi_message *msg;
+	struct spi_transfer *xfer;
+	u64 ns = sim_spi_msg_ns;
+	u32 hz;
+
+	if (ctlr->cur || list_empty(&ctlr->queue))
+		return;
+
+	msg = list_first_entry(&ctlr->queue, struct spi_message, queue);
+	list_del_init(&msg->queue);
+	ctlr->cur = msg;
+	ctlr->start_ns = now_ns;
+	ctlr->msgs++;
+
+	list_for_each_entry(xfer, &msg->transfers, transfer_list) {
+		hz = sim_spi_xfer_hz(msg->spi, xfer);
+		ns += DIV_ROUND_UP((u64)xfer->len * 8 * NSEC_PER_SEC, hz);
+		ns += xfer->delay_usecs * NSEC_PER_USEC;
+		if (xfer->cs_change &&
+		    xfer->transfer_list.next != &msg->transfers)
+			ns += SIM_SPI_CS_GAP_NS;
+	}
+	ctlr->busy_ns += ns;
+	sim_timer_add(&ctlr->done, now_ns + ns);
+}
+
+void sim_spi_init(struct spi_controller *ctlr, u32 max_speed_hz)
+{
+	memset(ctlr, 0, sizeof(*ctlr));
+	ctlr->max_speed_hz = max_speed_hz;
+	INIT_LIST_HEAD(&ctlr->queue);
+	INIT_LIST_HEAD(&ctlr->done.node);
+	ctlr->done.fn = sim_spi_done;
+}
+
+int spi_setup(struct spi_device *spi)
+{
+	return spi->max_speed_hz ? 0 : -EINVAL;
+}
+
+int spi_async(struct spi_device *spi, struct spi_message *msg)
+{
+	struct spi_controller *ctlr = spi->controller;
+	struct spi_transfer *xfer;
+
+	if (msg->status == -EINPROGRESS)
+		sim_fatal("SPI message submitted twice\n");
+
+	/* As __spi_validate(): an unset clock is taken from the device, once */
+	list_for_each_entry(xfer, &msg->transfers, transfer_list)
+		if (!xfer->speed_hz)
+			xfer->speed_hz = spi->max_speed_hz;
+
+	msg->spi = spi;
+	msg->status = -EINPROGRESS;
+	msg->actual_length = 0;
+	list_add_tail(&msg->queue, &ctlr->queue);
+	sim_spi_next(ctlr);
+	return 0;
+}
+
+int spi_sync(struct spi_device *spi, struct spi_message *msg)
+{
+	int rc = spi_async(spi, msg);
+
+	if (rc)
+		return rc;
+	while (msg->status == -EINPROGRESS)
+		if (!sim_step(~0ULL))
+			sim_fatal("spi_sync: message never completes\n");
+	return msg->status;
+}
+
+int spi_write_then_read(struct spi_device *spi, const void *txbuf,
+			unsigned int n_tx, void *rxbuf, unsigned int n_rx)
+{
+	struct spi_transfer xfer = { 0 };
+	struct spi_message msg;
+	u8 tx[256] = { 0 }, rx[256];
+	int rc;
+
+	if (n_tx + n_rx > sizeof(tx))
+		return -EINVAL;
+	memcpy(tx, txbuf, n_tx);
+	xfer.tx_buf = tx;
+	xfer.rx_buf = rx;
+	xfer.len = n_tx + n_rx;
+	spi_message_init(&msg);
+	spi_message_add_tail(&xfer, &msg);
+	rc = spi_sync(spi, &msg);
+	if (!rc)
+		memcpy(rxbuf, rx + n_tx, n_rx);
+	return rc;
+}
+
+static struct spi_driver *spi_drv;
+
+int spi_register_driver(struct spi_driver *sdrv)
+{
+	spi_drv = sdrv;
+	return 0;
+}
+
+void spi_unregister_driver(struct spi_driver *sdrv)
+{
+	spi_drv = NULL;
+}
+
+int sim_spi_probe(struct spi_device *spi)
+{
+	return spi_drv ? spi_drv->probe(spi) : -ENODEV;
+}
+
+int sim_spi_remove(struct spi_device *spi)
+{
+	return spi_drv ? spi_drv->remove(spi) : -ENODEV;
+}
+
+/********************************** regmap **********************************/
+
+/* A flat cache over the 16 bit address space; the SPI regmap bus formats
+ * the register big endian with the flag mask in the first byte */
+struct regmap {
+	struct spi_device	*spi;
+	struct regmap_config	config;
+	u8			cache[0x10000];
+	unsigned long		valid[0x10000 / BITS_PER_LONG];
+	bool			cache_only;
+	bool			cache_dirty;
+};
+
+struct regmap *devm_regmap_init_spi(struct spi_device *spi,
+				    const struct regmap_config *config)
+{
+	struct regmap *map;
+
+	if (config->reg_bits != 16 || config->val_bits != 8)
+		return ERR_PTR(-EINVAL);
+
+	map = calloc(1, sizeof(*map));
+	if (!map)
+		return ERR_PTR(-ENOMEM);
+	map->spi = spi;
+	map->config = *config;
+	return map;
+}
+
+static bool regmap_check(struct regmap *map, unsigned int reg,
+			 bool (*fn)(struct device *, unsigned int))
+{
+	if (reg > 0xffff || reg > map->config.max_register)
+		return false;
+	return !fn || fn(&map->spi->dev, reg);
+}
+
+static bool regmap_volatile(struct regmap *map, unsigned int reg)
+{
+	return map->config.cache_type == REGCACHE_NONE ||
+	       regmap_check(map, reg, map->config.volatile_reg) ||
+	       (map->config.precious_reg &&
+		map->config.precious_reg(&map->spi->dev, reg));
+}
+
+static void regmap_format(struct regmap *map, u8 *buf, unsigned int reg,
+			  unsigned long mask)
+{
+	buf[0] = (reg >> 8) | (mask & 0xff);
+	buf[1] = reg & 0xff;
+}
+
+static int regmap_hw_write(struct regmap *map, unsigned int reg,
+			   const u8 *val, size_t count)
+{
+	u8 buf[2 + 256];
+
+	if (count > 256)
+		return -EINVAL;
+	regmap_format(map, buf, reg, map->config.write_flag_mask);
+	memcpy(buf + 2, val, count);
+	sim.regmap_writes++;
+	return spi_write_then_read(map->spi, buf, 2 + count, NULL, 0);
+}
+
+int regmap_read(struct regmap *map, unsigned int reg, unsigned int *val)
+{
+	u8 buf[2], v;
+	int rc;
+
+	if (!regmap_check(map, reg, map->config.readable_reg))
+		return -EIO;
+
+	if (!regmap_volatile(map, reg) && test_bit(reg, map->valid)) {
+		*val = map->cache[reg];
+		return 0;
+	}
+	if (map->cache_only)
+		return -EBUSY;
+
+	regmap_format(map, buf, reg, map->config.read_flag_mask);
+	sim.regmap_reads++;
+	rc = spi_write_then_read(map->spi, buf, 2, &v, 1);
+	if (rc)
+		return rc;
+	*val = v;
+	if (!regmap_volatile(map, reg)) {
+		map->cache[reg] = v;
+		set_bit(reg, map->valid);
+	}
+	return 0;
+}
+
+int regmap_write(struct regmap *map, unsigned int reg, unsigned int val)
+{
+	u8 v = val;
+
+	if (!regmap_check(map, reg, map->config.writeable_reg))
+		return -EIO;
+
+	if (!regmap_volatile(map, reg)) {
+		map->cache[reg] = v;
+		set_bit(reg, map->valid);
+	}
+	/* As regcache: a volatile write in cache only mode is dropped */
+	if (map->cache_only) {
+		map->cache_dirty = true;
+		return 0;
+	}
+	return regmap_hw_write(map, reg, &v, 1);
+}
+
+int regmap_update_bits(struct regmap *map, unsigned int reg,
+		       unsigned int mask, unsigned int val)
+{
+	unsigned int orig, tmp;
+	int rc;
+
+	rc = regmap_read(map, reg, &orig);
+	if (rc)
+		return rc;
+
+	tmp = (orig & ~mask) | (val & mask);
+	if (tmp == orig)
+		return 0;
+	return regmap_write(map, reg, tmp);
+}
+
+int regmap_bulk_write(struct regmap *map, unsigned int reg, const void *val,
+		      size_t val_count)
+{
+	const u8 *v = val;
+	size_t i;
+
+	for (i = 0; i < val_count; i++) {
+		if (!regmap_check(map, reg + i, map->config.writeable_reg))
+			return -EIO;
+		if (!regmap_volatile(map, reg + i)) {
+			map->cache[reg + i] = v[i];
+			set_bit(reg + i, map->valid);
+		}
+	}
+	if (map->cache_only) {
+		map->cache_dirty = true;
+		return 0;
+	}
+	return regmap_hw_write(map, reg, v, val_count);
+}
+
+void regcache_cache_only(struct regmap *map, bool enable)
+{
+	map->cache_only = enable;
+}
+
+void regcache_mark_dirty(struct regmap *map)
+{
+	map->cache_dirty = true;
+}
+
+/* No register defaults: every cached register is written back, contiguous
+ * ones in one raw block like regcache_sync_block() */
+int regcache_sync(struct regmap *map)
+{
+	unsigned int reg, start;
+	int rc;
+
+	if (!map->cache_dirty)
+		return 0;
+
+	for (reg = 0; reg < 0x10000; reg++) {
+		if (!test_bit(reg, map->valid) || regmap_volatile(map, reg))
+			continue;
+		start = reg;
+		while (reg + 1 < 0x10000 && reg + 1 - start < 256 &&
+		       test_bit(reg + 1, map->valid) &&
+		       !regmap_volatile(map, reg + 1))
+			reg++;
+		rc = regmap_hw_write(map, start, map->cache + start,
+				     reg + 1 - start);
+		if (rc)
+			return rc;
+	}
+	map->cache_dirty = false;
+	return 0;
+}
+
+/****************************** memory, strings ******************************/
+
+struct kmem_cache {
+	unsigned int	size;
+	unsigned int	align;
+	long		objects;
+};
+
+struct kmem_cache *kmem_cache_create(const char *name, unsigned int size,
+				     unsigned int align, unsigned long flags,
+				     void (*ctor)(void *))
+{
+	struct kmem_cache *s = calloc(1, sizeof(*s));
+
+	if (!s)
+		return NULL;
+	s->size = size;
+	s->align = (flags & SLAB_HWCACHE_ALIGN) ? max(align, 64U) : max(align, 8U);
+	return s;
+}
+
+void kmem_cache_destroy(struct kmem_cache *s)
+{
+	if (s && s->objects)
+		fprintf(stderr, "sim: kmem_cache leaked %ld objects\n",
+			s->objects);
+	free(s);
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *s, gfp_t flags)
+{
+	void *p;
+
+	if (posix_memalign(&p, s->align, s->size))
+		return NULL;
+	memset(p, 0, s->size);
+	s->objects++;
+	sim.slab_objects++;
+	sim.slab_bytes += ALIGN(s->size, s->align);
+	return p;
+}
+
+void kmem_cache_free(struct kmem_cache *s, void *p)
+{
+	if (!p)
+		return;
+	s->objects--;
+	sim.slab_objects--;
+	sim.slab_bytes -= ALIGN(s->size, s->align);
+	free(p);
+}
+
+char *strim(char *s)
+{
+	size_t size = strlen(s);
+	char *end;
+
+	if (!size)
+		return s;
+	end = s + size - 1;
+	while (end >= s && (*end == ' ' || *end == '\n' || *end == '\t'))
+		end--;
+	*(end + 1) = '\0';
+	while (*s == ' ' || *s == '\n' || *s == '\t')
+		s++;
+	return s;
+}
+
+bool sysfs_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+	if (*s1 == *s2)
+		return true;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return true;
+	if (*s1 == '\n' && !s1[1] && !*s2)
+		return true;
+	return false;
+}
+
+int kstrtou64(const char *s, unsigned int base, u64 *res)
+{
+	char *end;
+
+	if (*s == '-' || !*s)
+		return -EINVAL;
+	*res = strtoull(s, &end, base);
+	if (end == s || (*end && !(*end == '\n' && !end[1])))
+		return -EINVAL;
+	return 0;
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	u64 v;
+	int rc = kstrtou64(s, base, &v);
+
+	if (rc)
+		return rc;
+	if (v > ~0U)
+		return -ERANGE;
+	*res = v;
+	return 0;
+}
+
+int kstrtoint(const char *s, unsigned int base, int *res)
+{
+	char *end;
+	long v = strtol(s, &end, base);
+
+	if (end == s || (*end && !(*end == '\n' && !end[1])))
+		return -EINVAL;
+	*res = v;
+	return 0;
+}
+
+int kstrtobool(const char *s, bool *res)
+{
+	switch (s[0]) {
+	case 'y': case 'Y': case '1':
+		*res = true;
+		return 0;
+	case 'n': case 'N': case '0':
+		*res = false;
+		return 0;
+	}
+	return -EINVAL;
+}
+
+u16 crc_ccitt(u16 crc, const u8 *buffer, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *buffer++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc;
+}
+
+static u64 rnd_state = 0x2545f4914f6cdd1dULL;
+
+u32 prandom_u32(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 7;
+	rnd_state ^= rnd_state << 17;
+	return rnd_state >> 16;
+}
+
+u32 get_random_u32(void)
+{
+	return prandom_u32();
+}
+
+void get_random_bytes(void *buf, int nbytes)
+{
+	u8 *p = buf;
+
+	while (nbytes--)
+		*p++ = prandom_u32();
+}
+
+/*************************** seq_file and debugfs ***************************/
+
+void seq_printf(struct seq_file *m, const char *fmt, ...)
+{
+	va_list args;
+	int n;
+
+	for (;;) {
+		va_start(args, fmt);
+		n = vsnprintf(m->buf + m->count, m->size - m->count, fmt, args);
+		va_end(args);
+		if (n >= 0 && m->count + n < m->size)
+			break;
+		m->size = m->size * 2 + n;
+		m->buf = realloc(m->buf, m->size);
+	}
+	m->count += n;
+}
+
+void seq_puts(struct seq_file *m, const char *s)
+{
+	seq_printf(m, "%s", s);
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+	m->show = show;
+	m->private = data;
+	file->private_data = m;
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	struct seq_file *m = file->private_data;
+
+	free(m->buf);
+	free(m);
+	return 0;
+}
+
+ssize_t seq_read(struct file *file, char __user *buf, size_t size,
+		 loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	size_t n;
+
+	if (!*ppos) {
+		m->count = 0;
+		m->show(m, m->private);
+	}
+	if (*ppos >= (loff_t)m->count)
+		return 0;
+	n = min(size, m->count - (size_t)*ppos);
+	memcpy(buf, m->buf + *ppos, n);
+	*ppos += n;
+	return n;
+}
+
+loff_t seq_lseek(struct file *file, loff_t offset, int whence)
+{
+	return offset;
+}
+
+#define SIM_DEBUGFS_MAX	96
+
+static struct sim_debugfs {
+	char				name[40];
+	void				*data;
+	const struct file_operations	*fops;
+	u32				*u32;
+	bool				*flag;
+} debugfs[SIM_DEBUGFS_MAX];
+static int debugfs_count;
+
+static struct dentry *debugfs_add(const char *name, void *data,
+				  const struct file_operations *fops,
+				  u32 *u, bool *flag)
+{
+	struct sim_debugfs *d;
+
+	if (debugfs_count == SIM_DEBUGFS_MAX)
+		sim_fatal("too many debugfs files\n");
+	d = &debugfs[debugfs_count++];
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->data = data;
+	d->fops = fops;
+	d->u32 = u;
+	d->flag = flag;
+	return (struct dentry *)d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	static struct sim_debugfs root;
+
+	return (struct dentry *)&root;
+}
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	return debugfs_add(name, data, fops, NULL, NULL);
+}
+
+struct dentry *debugfs_create_u32(const char *name, umode_t mode,
+				  struct dentry *parent, u32 *value)
+{
+	return debugfs_add(name, NULL, NULL, value, NULL);
+}
+
+struct dentry *debugfs_create_bool(const char *name, umode_t mode,
+				   struct dentry *parent, bool *value)
+{
+	return debugfs_add(name, NULL, NULL, NULL, value);
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	debugfs_count = 0;
+}
+
+static struct sim_debugfs *debugfs_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < debugfs_count; i++)
+		if (!strcmp(debugfs[i].name, name))
+			return &debugfs[i];
+	return NULL;
+}
+
+/* Reads a debugfs file of the driver into @buf, as cat would */
+ssize_t sim_debugfs_read(const char *name, char *buf, size_t size)
+{
+	struct sim_debugfs *d = debugfs_find(name);
+	struct inode inode;
+	struct file file = { 0 };
+	loff_t pos = 0;
+	ssize_t n, total = 0;
+	u64 val;
+	int rc;
+
+	if (!d || !size)
+		return -ENOENT;
+	if (d->u32 || d->flag || (d->fops && d->fops->attr_get)) {
+		if (d->u32)
+			val = *d->u32;
+		else if (d->flag)
+			val = *d->flag;
+		else if ((rc = d->fops->attr_get(d->data, &val)))
+			return rc;
+		return snprintf(buf, size, "%llu\n", val);
+	}
+	if (!d->fops->read)
+		return -EINVAL;
+
+	inode.i_private = d->data;
+	file.f_inode = &inode;
+	if (d->fops->open && (rc = d->fops->open(&inode, &file)))
+		return rc;
+	while ((n = d->fops->read(&file, buf + total, size - 1 - total,
+				  &pos)) > 0)
+		total += n;
+	buf[total] = '\0';
+	if (d->fops->release)
+		d->fops->release(&inode, &file);
+	return n < 0 ? n : total;
+}
+
+/* Writes @s to a debugfs file of the driver, as echo would */
+int sim_debugfs_write(const char *name, const char *s)
+{
+	struct sim_debugfs *d = debugfs_find(name);
+	struct inode inode;
+	struct file file = { 0 };
+	loff_t pos = 0;
+	u64 val;
+	ssize_t n;
+	int rc;
+
+	if (!d)
+		return -ENOENT;
+	if (d->u32 || d->flag || (d->fops && d->fops->attr_set)) {
+		rc = kstrtou64(s, 0, &val);
+		if (rc)
+			return rc;
+		if (d->u32)
+			*d->u32 = val;
+		else if (d->flag)
+			*d->flag = val;
+		else
+			return d->fops->attr_set(d->data, val);
+		return 0;
+	}
+	if (!d->fops->write)
+		return -EINVAL;
+
+	inode.i_private = d->data;
+	file.f_inode = &inode;
+	if (d->fops->open && (rc = d->fops->open(&inode, &file)))
+		return rc;
+	n = d->fops->write(&file, s, strlen(s), &pos);
+	if (d->fops->release)
+		d->fops->release(&inode, &file);
+	return n < 0 ? n : 0;
+}
+
+int hwrng_register(struct hwrng *rng)
+{
+	sim.hwrng = rng;
+	return 0;
+}
+
+void hwrng_unregister(struct hwrng *rng)
+{
+	sim.hwrng = NULL;
+}
+
+/********************************** sk_buff **********************************/
+
+struct sk_buff *dev_alloc_skb(unsigned int length)
+{
+	struct sk_buff *skb = calloc(1, sizeof(*skb));
+
+	if (!skb)
+		return NULL;
+	skb->head = malloc(length + 32);
+	if (!skb->head) {
+		free(skb);
+		return NULL;
+	}
+	skb->data = skb->head + 32;
+	skb->end = length + 32;
+	sim.skbs++;
+	return skb;
+}
+
+void *skb_put(struct sk_buff *skb, unsigned int len)
+{
+	void *tail = skb->data + skb->len;
+
+	if (skb->data - skb->head + skb->len + len > skb->end)
+		sim_fatal("skb_put over the end\n");
+	skb->len += len;
+	return tail;
+}
+
+void kfree_skb(struct sk_buff *skb)
+{
+	if (!skb)
+		return;
+	free(skb->head);
+	free(skb);
+	sim.skbs--;
+}
+
+/********************************* mac802154 *********************************/
+
+struct sim_hw {
+	struct ieee802154_hw		hw;
+	struct wpan_phy			phy;
+	const struct ieee802154_ops	*ops;
+	long				priv[];
+};
+
+struct ieee802154_hw *ieee802154_alloc_hw(size_t priv_data_len,
+					  const struct ieee802154_ops *ops)
+{
+	struct sim_hw *h = calloc(1, sizeof(*h) + priv_data_len);
+
+	if (!h)
+		return NULL;
+	h->ops = ops;
+	sim.priv_bytes = priv_data_len;
+	h->hw.phy = &h->phy;
+	h->hw.priv = h->priv;
+	return &h->hw;
+}
+
+void ieee802154_free_hw(struct ieee802154_hw *hw)
+{
+	free(container_of(hw, struct sim_hw, hw));
+}
+
+int ieee802154_register_hw(struct ieee802154_hw *hw)
+{
+	sim.hw = hw;
+	sim.ops = container_of(hw, struct sim_hw, hw)->ops;
+	return 0;
+}
+
+void ieee802154_unregister_hw(struct ieee802154_hw *hw)
+{
+	sim.hw = NULL;
+}
+
+void ieee802154_random_extended_addr(__le64 *addr)
+{
+	get_random_bytes(addr, sizeof(*addr));
+}
+
+void ieee802154_stop_queue(struct ieee802154_hw *hw)
+{
+	sim.queue_stopped = true;
+}
+
+void ieee802154_wake_queue(struct ieee802154_hw *hw)
+{
+	sim.queue_stopped = false;
+}
+
+void ieee802154_xmit_complete(struct ieee802154_hw *hw, struct sk_buff *skb,
+			      bool ifs_handling)
+{
+	sim_mac_tx_done(skb);
+	kfree_skb(skb);
+	ieee802154_wake_queue(hw);
+}
+
+void ieee802154_rx_irqsafe(struct ieee802154_hw *hw, struct sk_buff *skb,
+			   u8 lqi)
+{
+	sim_mac_rx(skb, lqi);
+	kfree_skb(skb);
+}
@@ -0,0 +1,665 @@
+/* Behavioural model of the AT86RF215, enough of it for the driver: the SPI
+ * protocol, RF09 state machine with the datasheet transition times, IRQ
+ * status and mask registers, the BBC0 frame buffers, TX air time, frame
+ * reception with the address filter and automatic ACK, and the counter.
+ *
+ * Addresses come from the datasheet, not from at86rf215.h, so the model
+ * catches a wrong define in the driver instead of sharing it. */
+#include "model.h"
+
+#define M_RF09_IRQS		0x0000
+#define M_RF24_IRQS		0x0001
+#define M_BBC0_IRQS		0x0002
+#define M_BBC1_IRQS		0x0003
+#define M_RF_RST		0x0005
+#define M_RF_CFG		0x0006
+#define M_RF_PN			0x000d
+#define M_RF_VN			0x000e
+#define M_RF09_IRQM		0x0100
+#define M_RF09_STATE		0x0102
+#define M_RF09_CMD		0x0103
+#define M_RF09_CNM		0x0108
+#define M_RF09_EDV		0x0110
+#define M_RF09_RNDV		0x0111
+#define M_RF24_IRQM		0x0200
+#define M_RF24_STATE		0x0202
+#define M_RF24_CMD		0x0203
+#define M_BBC0_IRQM		0x0300
+#define M_BBC0_PC		0x0301
+#define M_BBC0_PS		0x0302
+#define M_BBC0_RXFLL		0x0304
+#define M_BBC0_RXFLH		0x0305
+#define M_BBC0_TXFLL		0x0306
+#define M_BBC0_TXFLH		0x0307
+#define M_BBC0_OFDMPHRTX	0x030c
+#define M_BBC0_OFDMC		0x030e
+#define M_BBC0_AFC0		0x0320
+#define M_BBC0_MACEA0		0x0325
+#define M_BBC0_MACPID0F0	0x032d
+#define M_BBC0_MACSHA0F0	0x032f
+#define M_BBC0_AMCS		0x0340
+#define M_BBC0_AMAACKPD		0x0342
+#define M_BBC0_CNTC		0x0390
+#define M_BBC0_CNT0		0x0391
+#define M_BBC1_IRQM		0x0400
+#define M_BBC0_FBRXS		0x2000
+#define M_BBC0_FBTXS		0x2800
+
+#define M_CMD_NOP		0x0
+#define M_CMD_SLEEP		0x1
+#define M_CMD_TRXOFF		0x2
+#define M_CMD_TXPREP		0x3
+#define M_CMD_TX		0x4
+#define M_CMD_RX		0x5
+#define M_CMD_RESET		0x7
+
+#define M_STATE_TRXOFF		0x2
+#define M_STATE_TXPREP		0x3
+#define M_STATE_TX		0x4
+#define M_STATE_RX		0x5
+#define M_STATE_TRANSITION	0x6
+#define M_STATE_RESET		0x7
+/* Not a STATE value: SLEEP reads back as 0 (the SPI is powered down) */
+#define M_STATE_SLEEP		0x1
+
+#define M_RF_IRQ_WAKEUP		BIT(0)
+#define M_RF_IRQ_TRXRDY		BIT(1)
+#define M_BB_IRQ_RXFS		BIT(0)
+#define M_BB_IRQ_RXFE		BIT(1)
+#define M_BB_IRQ_RXAM		BIT(2)
+#define M_BB_IRQ_TXFE		BIT(4)
+
+#define M_CFG_IRQP		BIT(2)
+#define M_CFG_IRQMM		BIT(3)
+#define M_PC_PT			0x03
+#define M_PC_FCST		BIT(3)
+#define M_PC_TXAFCS		BIT(4)
+#define M_PC_FCSOK		BIT(5)
+#define M_PC_FCSFE		BIT(6)
+#define M_PT_MRFSK		1
+#define M_PT_MROFDM		2
+#define M_AFC0_AFEN0		BIT(0)
+#define M_AFC0_PM		BIT(4)
+#define M_AMCS_TX2RX		BIT(0)
+#define M_AMCS_AACK		BIT(3)
+#define M_CNTC_EN		BIT(0)
+#define M_PS_TXUR		BIT(0)
+#define M_CNTC_CAPRXS		BIT(3)
+#define M_CNTC_CAPTXS		BIT(4)
+
+/* Transition times of the datasheet; the ACK turnaround is the SUN PHY one */
+#define M_T_OFF_TO_PREP_NS	200000
+#define M_T_OFF_TO_RX_NS	90000
+#define M_T_FAST_NS		200
+#define M_T_TX_START_NS		4000
+#define M_T_SLEEP_TO_OFF_NS	1000
+#define M_T_DSLEEP_TO_OFF_NS	500000
+#define M_T_RESET_NS		1000
+#define M_T_PLL_CH_NS		100000
+#define M_T_ACK_TURN_NS		1000000
+
+static void model_reset(struct model *m)
+{
+	memset(m->regs, 0, sizeof(m->regs));
+	m->regs[M_RF_PN] = 0x34;
+	m->regs[M_RF_VN] = 0x03;
+	m->regs[M_RF_CFG] = 0x05;
+	m->regs[M_BBC0_PC] = 0x1d;
+	m->regs[M_BBC0_AFC0] = 0x00;
+	m->regs[M_BBC0_MACPID0F0] = 0xff;
+	m->regs[M_BBC0_MACPID0F0 + 1] = 0xff;
+	m->regs[M_BBC0_MACSHA0F0] = 0xff;
+	m->regs[M_BBC0_MACSHA0F0 + 1] = 0xff;
+	m->state = M_STATE_TRXOFF;
+	m->rf24_state = M_STATE_TRXOFF;
+	m->deep_sleep = false;
+	sim_timer_del(&m->state_timer);
+	sim_timer_del(&m->tx_timer);
+	sim_timer_del(&m->rx_timer);
+	m->rx_stage = 0;
+}
+
+/********************************* IRQs *********************************/
+
+static void model_irq(struct model *m, unsigned int irqs, u8 bits)
+{
+	unsigned int irqm = irqs == M_RF09_IRQS ? M_RF09_IRQM : M_BBC0_IRQM;
+
+	/* IRQMM clear: masked sources are not even latched */
+	if (!(m->regs[M_RF_CFG] & M_CFG_IRQMM))
+		bits &= m->regs[irqm];
+	m->regs[irqs] |= bits;
+}
+
+bool model_irq_line(void *priv)
+{
+	struct model *m = priv;
+
+	return (m->regs[M_RF09_IRQS] & m->regs[M_RF09_IRQM]) ||
+	       (m->regs[M_BBC0_IRQS] & m->regs[M_BBC0_IRQM]);
+}
+
+/********************************* PHY *********************************/
+
+/* MR-OFDM option 1 data bits per 120 us symbol for MCS0..6; each further
+ * option halves the subcarriers */
+static const u16 ofdm_bits_opt1[] = { 12, 24, 48, 96, 144, 192, 288 };
+
+static u64 model_phy_ns(struct model *m, u16 len, bool hdr)
+{
+	u8 pt = m->regs[M_BBC0_PC] & M_PC_PT;
+	u8 mcs, opt;
+	u32 bits, syms;
+
+	switch (pt) {
+	case M_PT_MROFDM:
+		mcs = min(m->regs[M_BBC0_OFDMPHRTX] & 0x07, 6);
+		opt = m->regs[M_BBC0_OFDMC] & 0x03;
+		bits = max(ofdm_bits_opt1[mcs] >> opt, 1);
+		/* PSDU plus 6 tail bits; STF + LTF 6 symbols, PHR 3 or 6 */
+		syms = DIV_ROUND_UP(len * 8 + 6, bits);
+		if (hdr)
+			syms += 6 + (opt < 2 ? 3 : 6);
+		return (u64)syms * 120000;
+	case M_PT_MRFSK:
+		/* 50 kb/s, 8 octet preamble, 2 octet SFD and PHR */
+		return ((u64)len + (hdr ? 12 : 0)) * 160000;
+	default:
+		/* O-QPSK 250 kb/s: 5 octet SHR, 1 octet PHR */
+		return ((u64)len + (hdr ? 6 : 0)) * 32000;
+	}
+}
+
+u64 model_airtime_ns(struct model *m, u16 len)
+{
+	return model_phy_ns(m, len, true);
+}
+
+static u16 model_fcs_len(struct model *m)
+{
+	return m->regs[M_BBC0_PC] & M_PC_FCST ? 2 : 4;
+}
+
+static u32 model_crc32(const u8 *p, size_t len)
+{
+	u32 crc = ~0U;
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+static void model_fcs(struct model *m, u8 *psdu, u16 len)
+{
+	u16 n = model_fcs_len(m), crc16;
+	u32 crc;
+
+	if (len < n)
+		return;
+	if (n == 2) {
+		crc16 = crc_ccitt(0, psdu, len - 2);
+		put_unaligned_le16(crc16, psdu + len - 2);
+	} else {
+		crc = model_crc32(psdu, len - 4);
+		psdu[len - 4] = crc;
+		psdu[len - 3] = crc >> 8;
+		psdu[len - 2] = crc >> 16;
+		psdu[len - 1] = crc >> 24;
+	}
+}
+
+u16 model_add_fcs(struct model *m, u8 *psdu, u16 len)
+{
+	len += model_fcs_len(m);
+	model_fcs(m, psdu, len);
+	return len;
+}
+
+static bool model_fcs_ok(struct model *m, const u8 *psdu, u16 len)
+{
+	u8 buf[MODEL_FB_LEN];
+
+	if (len < model_fcs_len(m))
+		return false;
+	memcpy(buf, psdu, len);
+	model_fcs(m, buf, len);
+	return !memcmp(buf, psdu, len);
+}
+
+/****************************** state machine ******************************/
+
+static void model_rx_abort(struct model *m)
+{
+	if (!m->rx_stage)
+		return;
+	sim_timer_del(&m->rx_timer);
+	m->rx_stage = 0;
+	m->stats.rx_aborted++;
+}
+
+static void model_state_done(struct sim_timer *t)
+{
+	struct model *m = container_of(t, struct model, state_timer);
+
+	m->state = m->next_state;
+	if (m->state == M_STATE_TXPREP)
+		model_irq(m, M_RF09_IRQS, M_RF_IRQ_TRXRDY);
+	if (m->state == M_STATE_TRXOFF && m->deep_sleep) {
+		m->deep_sleep = false;
+		model_irq(m, M_RF09_IRQS, M_RF_IRQ_WAKEUP);
+	}
+}
+
+static void model_goto(struct model *m, u8 to, u64 ns)
+{
+	if (m->state == M_STATE_RX && to != M_STATE_RX)
+		model_rx_abort(m);
+	m->next_state = to;
+	m->state = M_STATE_TRANSITION;
+	sim_timer_add(&m->state_timer, sim_now() + ns);
+}
+
+/* An octet of the frame buffer written after the modulator needed it (from
+ * the start of the symbol carrying it on, the start of the octet for the
+ * other PHYs), or not written yet since TXFL was: the frame is dropped and
+ * PS.TXUR tells. The second case is a burst still on the bus at TXFE. */
+static bool model_tx_underrun(struct model *m, u16 len)
+{
+	u64 lead = m->tx_start - model_phy_ns(m, 0, false);
+	u16 i;
+
+	if (m->regs[M_BBC0_PC] & M_PC_TXAFCS)
+		len -= min(len, model_fcs_len(m));
+	for (i = 0; i < len; i++)
+		if (m->fb_tx_gen[i] != m->txfl_gen ||
+		    m->fb_tx_ns[i] > lead + model_phy_ns(m, i, true))
+			return true;
+	return false;
+}
+
+static void model_tx_done(struct sim_timer *t)
+{
+	struct model *m = container_of(t, struct model, tx_timer);
+	u16 len = (m->regs[M_BBC0_TXFLL] | m->regs[M_BBC0_TXFLH] << 8) & 0x7ff;
+	u8 *fb = m->regs + M_BBC0_FBTXS;
+
+	m->stats.tx_air_ns += sim_now() - m->tx_start;
+	if (model_tx_underrun(m, len)) {
+		m->regs[M_BBC0_PS] |= M_PS_TXUR;
+		m->stats.tx_underruns++;
+	} else {
+		if (m->regs[M_BBC0_PC] & M_PC_TXAFCS)
+			model_fcs(m, fb, len);
+		m->stats.tx_frames++;
+		if (m->on_tx)
+			m->on_tx(m, fb, len);
+	}
+
+	m->state = m->regs[M_BBC0_AMCS] & M_AMCS_TX2RX ? M_STATE_RX :
+							 M_STATE_TXPREP;
+	model_irq(m, M_BBC0_IRQS, M_BB_IRQ_TXFE);
+}
+
+static void model_tx(struct model *m)
+{
+	u16 len = (m->regs[M_BBC0_TXFLL] | m->regs[M_BBC0_TXFLH] << 8) & 0x7ff;
+
+	model_rx_abort(m);
+	m->state = M_STATE_TX;
+	m->regs[M_BBC0_PS] &= ~M_PS_TXUR;
+	m->tx_start = sim_now() + M_T_TX_START_NS;
+	if ((m->regs[M_BBC0_CNTC] & (M_CNTC_EN | M_CNTC_CAPTXS)) ==
+	    (M_CNTC_EN | M_CNTC_CAPTXS))
+		m->cnt_capture = (m->tx_start - m->cnt_epoch) / 1000;
+	sim_timer_add(&m->tx_timer, m->tx_start + model_airtime_ns(m, len));
+}
+
+static void model_cmd(struct model *m, u8 cmd)
+{
+	u8 from = m->state;
+
+	m->stats.cmds++;
+
+	/* Commands are ignored while in transition, except RESET */
+	if (from == M_STATE_TRANSITION && cmd != M_CMD_RESET)
+		return;
+
+	switch (cmd) {
+	case M_CMD_SLEEP:
+		if (from == M_STATE_TRXOFF) {
+			m->state = M_STATE_SLEEP;
+			if (m->rf24_state == M_STATE_SLEEP)
+				m->deep_sleep = true;
+		}
+		break;
+	case M_CMD_TRXOFF:
+		if (from == M_STATE_SLEEP) {
+			if (m->deep_sleep) {
+				/* DEEP_SLEEP loses the register contents */
+				model_reset(m);
+				m->state = M_STATE_SLEEP;
+				m->deep_sleep = true;
+			}
+			model_goto(m, M_STATE_TRXOFF, m->deep_sleep ?
+				   M_T_DSLEEP_TO_OFF_NS : M_T_SLEEP_TO_OFF_NS);
+		} else if (from == M_STATE_TX) {
+			sim_timer_del(&m->tx_timer);
+			model_goto(m, M_STATE_TRXOFF, M_T_FAST_NS);
+		} else if (from != M_STATE_TRXOFF) {
+			model_goto(m, M_STATE_TRXOFF, M_T_FAST_NS);
+		}
+		break;
+	case M_CMD_TXPREP:
+		if (from == M_STATE_TRXOFF)
+			model_goto(m, M_STATE_TXPREP, M_T_OFF_TO_PREP_NS);
+		else if (from == M_STATE_RX)
+			model_goto(m, M_STATE_TXPREP, M_T_FAST_NS);
+		break;
+	case M_CMD_TX:
+		if (from == M_STATE_TXPREP || from == M_STATE_RX)
+			model_tx(m);
+		break;
+	case M_CMD_RX:
+		if (from == M_STATE_TRXOFF)
+			model_goto(m, M_STATE_RX, M_T_OFF_TO_RX_NS);
+		else if (from == M_STATE_TXPREP)
+			model_goto(m, M_STATE_RX, M_T_FAST_NS);
+		break;
+	case M_CMD_RESET:
+		model_reset(m);
+		m->state = M_STATE_RESET;
+		model_goto(m, M_STATE_TRXOFF, M_T_RESET_NS);
+		break;
+	default:
+		break;
+	}
+}
+
+/********************************* receive *********************************/
+
+/* Length of the MAC header up to the destination address, 0 if it cannot
+ * match the address filter */
+static u16 model_mhr_dst(const u8 *p, u16 len, u16 *pan, u64 *addr, u8 *mode)
+{
+	u16 fc;
+
+	if (len < 3)
+		return 0;
+	fc = get_unaligned_le16(p);
+	*mode = (fc >> 10) & 0x3;
+	switch (*mode) {
+	case 2:
+		if (len < 7)
+			return 0;
+		*pan = get_unaligned_le16(p + 3);
+		*addr = get_unaligned_le16(p + 5);
+		return 7;
+	case 3:
+		if (len < 13)
+			return 0;
+		*pan = get_unaligned_le16(p + 3);
+		*addr = get_unaligned_le64(p + 5);
+		return 13;
+	default:
+		return 3;
+	}
+}
+
+static bool model_match(struct model *m, const u8 *p, u16 len, u16 *mhr)
+{
+	u16 pan = 0, my_pan, my_short;
+	u64 addr = 0, my_ext;
+	u8 mode = 0;
+
+	*mhr = model_mhr_dst(p, len, &pan, &addr, &mode);
+	if (!*mhr || !(m->regs[M_BBC0_AFC0] & M_AFC0_AFEN0))
+		return false;
+
+	my_pan = get_unaligned_le16(m->regs + M_BBC0_MACPID0F0);
+	my_short = get_unaligned_le16(m->regs + M_BBC0_MACSHA0F0);
+	my_ext = get_unaligned_le64(m->regs + M_BBC0_MACEA0);
+	if (mode == 0)
+		return false;
+	if (pan != my_pan && pan != 0xffff)
+		return false;
+	if (mode == 2)
+		return addr == my_short || addr == 0xffff;
+	return addr == my_ext;
+}
+
+static void model_rx_event(struct sim_timer *t)
+{
+	struct model *m = container_of(t, struct model, rx_timer);
+	bool ack, ok;
+	u16 fc;
+
+	switch (m->rx_stage) {
+	case 1:
+		/* PHR decoded */
+		if ((m->regs[M_BBC0_CNTC] & (M_CNTC_EN | M_CNTC_CAPRXS)) ==
+		    (M_CNTC_EN | M_CNTC_CAPRXS))
+			m->cnt_capture = (sim_now() - m->cnt_epoch) / 1000;
+		model_irq(m, M_BBC0_IRQS, M_BB_IRQ_RXFS);
+		if (m->rx_match) {
+			m->rx_stage = 2;
+			sim_timer_add(t, sim_now() +
+				      model_phy_ns(m, m->rx_mhr_len, false));
+			break;
+		}
+		m->rx_stage = 3;
+		sim_timer_add(t, sim_now() + model_phy_ns(m, m->rx_len, false));
+		break;
+	case 2:
+		/* Destination address matched: the MHR is in the FB */
+		memcpy(m->regs + M_BBC0_FBRXS, m->rx_psdu, m->rx_mhr_len);
+		m->stats.rx_matched++;
+		model_irq(m, M_BBC0_IRQS, M_BB_IRQ_RXAM);
+		m->rx_stage = 3;
+		sim_timer_add(t, sim_now() +
+			      model_phy_ns(m, m->rx_len, false) -
+			      model_phy_ns(m, m->rx_mhr_len, false));
+		break;
+	case 3:
+		m->rx_stage = 0;
+		ok = model_fcs_ok(m, m->rx_psdu, m->rx_len);
+		if (!ok && (m->regs[M_BBC0_PC] & M_PC_FCSFE))
+			break;
+		memcpy(m->regs + M_BBC0_FBRXS, m->rx_psdu, m->rx_len);
+		m->regs[M_BBC0_RXFLL] = m->rx_len;
+		m->regs[M_BBC0_RXFLH] = m->rx_len >> 8;
+		if (ok)
+			m->regs[M_BBC0_PC] |= M_PC_FCSOK;
+		else
+			m->regs[M_BBC0_PC] &= ~M_PC_FCSOK;
+		m->stats.rx_frames++;
+		if (m->on_rx)
+			m->on_rx(m, m->rx_psdu, m->rx_len);
+		model_irq(m, M_BBC0_IRQS, M_BB_IRQ_RXFE);
+
+		/* Automatic ACK, with the pending bit of AMAACKPD */
+		fc = get_unaligned_le16(m->rx_psdu);
+		ack = ok && m->rx_match && (fc & BIT(5)) &&
+		      (m->regs[M_BBC0_AMCS] & M_AMCS_AACK) &&
+		      !(m->regs[M_BBC0_AFC0] & M_AFC0_PM);
+		if (ack) {
+			m->stats.acks++;
+			if (m->regs[M_BBC0_AMAACKPD] & BIT(0))
+				m->stats.acks_pending++;
+			m->deaf_until = sim_now() + M_T_ACK_TURN_NS +
+					model_airtime_ns(m, 3 + model_fcs_len(m));
+		}
+		break;
+	}
+}
+
+bool model_rx(struct model *m, const u8 *psdu, u16 len)
+{
+	if (m->state != M_STATE_RX || m->rx_stage ||
+	    sim_now() < m->deaf_until || len > MODEL_FB_LEN) {
+		m->stats.rx_missed++;
+		return false;
+	}
+
+	memcpy(m->rx_psdu, psdu, len);
+	m->rx_len = len;
+	m->rx_match = model_match(m, psdu, len, &m->rx_mhr_len);
+	m->rx_stage = 1;
+	sim_timer_add(&m->rx_timer,
+		      sim_now() + model_phy_ns(m, 0, true) -
+		      model_phy_ns(m, 0, false));
+	return true;
+}
+
+/********************************** SPI **********************************/
+
+static u8 model_read(struct model *m, u16 addr)
+{
+	u8 val;
+
+	switch (addr) {
+	case M_RF09_STATE:
+		return m->state == M_STATE_SLEEP ? 0 : m->state;
+	case M_RF24_STATE:
+		return m->rf24_state;
+	case M_RF09_IRQS:
+	case M_RF24_IRQS:
+	case M_BBC0_IRQS:
+	case M_BBC1_IRQS:
+		/* Cleared by reading */
+		val = m->regs[addr];
+		m->regs[addr] = 0;
+		return val;
+	case M_RF09_RNDV:
+		return m->state == M_STATE_RX ? prandom_u32() : 0;
+	case M_RF09_EDV:
+		return m->state == M_STATE_RX ? (u8)m->ed_dbm : 127;
+	case M_BBC0_CNT0 ... M_BBC0_CNT0 + 3:
+		return m->cnt_capture >> (8 * (addr - M_BBC0_CNT0));
+	default:
+		return m->regs[addr];
+	}
+}
+
+static void model_write(struct model *m, u16 addr, u8 val)
+{
+	switch (addr) {
+	case M_RF09_IRQS ... M_BBC1_IRQS:
+	case M_RF_PN:
+	case M_RF_VN:
+	case M_RF09_STATE:
+	case M_RF24_STATE:
+	case M_RF09_EDV:
+	case M_RF09_RNDV:
+	case M_BBC0_PS:
+	case M_BBC0_RXFLL:
+	case M_BBC0_RXFLH:
+	case M_BBC0_CNT0 ... M_BBC0_CNT0 + 3:
+		/* Read only */
+		return;
+	case M_RF09_CMD:
+		m->regs[addr] = val & 0x7;
+		model_cmd(m, val & 0x7);
+		return;
+	case M_RF24_CMD:
+		m->regs[addr] = val & 0x7;
+		if ((val & 0x7) == M_CMD_SLEEP) {
+			m->rf24_state = M_STATE_SLEEP;
+			if (m->state == M_STATE_SLEEP)
+				m->deep_sleep = true;
+		} else if ((val & 0x7) == M_CMD_TRXOFF) {
+			m->rf24_state = M_STATE_TRXOFF;
+		}
+		return;
+	case M_RF_RST:
+		if ((val & 0x7) == M_CMD_RESET) {
+			model_reset(m);
+			m->state = M_STATE_RESET;
+			model_goto(m, M_STATE_TRXOFF, M_T_RESET_NS);
+		}
+		return;
+	case M_RF09_CNM:
+		m->regs[addr] = val;
+		m->stats.channel_switches++;
+		/* The PLL settles on the new channel: nothing is received */
+		if (m->state == M_STATE_RX || m->state == M_STATE_TXPREP) {
+			model_rx_abort(m);
+			m->deaf_until = sim_now() + M_T_PLL_CH_NS;
+		}
+		return;
+	case M_BBC0_PC:
+		/* FCSOK is read only */
+		m->regs[addr] = (val & ~M_PC_FCSOK) |
+				(m->regs[addr] & M_PC_FCSOK);
+		return;
+	case M_BBC0_TXFLL:
+		m->regs[addr] = val;
+		m->txfl_gen++;
+		return;
+	case M_BBC0_CNTC:
+		if ((val & M_CNTC_EN) && !(m->regs[addr] & M_CNTC_EN))
+			m->cnt_epoch = sim_now();
+		m->regs[addr] = val;
+		return;
+	default:
+		m->regs[addr] = val;
+		return;
+	}
+}
+
+/* One chip select frame: a 2 byte header (bit 15 set for a write, 14 bit
+ * address), then data with the address auto-incremented. The frame comes
+ * in at the end of its message: the TX frame buffer octets are stamped
+ * with the time they crossed the bus as if the frame ended the message. */
+void model_spi_frame(void *priv, const u8 *tx, u8 *rx, size_t len, u32 hz)
+{
+	struct model *m = priv;
+	bool write, bad = m->max_hz && hz > m->max_hz;
+	u64 octet_ns = 8 * NSEC_PER_SEC / hz;
+	u16 addr;
+	size_t i;
+
+	m->stats.spi_frames++;
+	if (len < 2)
+		return;
+	if (m->state == M_STATE_SLEEP && m->deep_sleep)
+		return;
+
+	write = tx[0] & 0x80;
+	addr = (tx[0] << 8 | tx[1]) & 0x3fff;
+	for (i = 2; i < len; i++, addr = (addr + 1) & 0x3fff) {
+		if (write && addr >= M_BBC0_FBTXS &&
+		    addr < M_BBC0_FBTXS + MODEL_FB_LEN) {
+			m->fb_tx_ns[addr - M_BBC0_FBTXS] =
+				sim_now() - (len - 1 - i) * octet_ns;
+			m->fb_tx_gen[addr - M_BBC0_FBTXS] = m->txfl_gen;
+		}
+		if (write)
+			model_write(m, addr, tx[i]);
+		else
+			rx[i] = model_read(m, addr);
+	}
+
+	/* Too fast a clock: the chip misses bits of what it sends back */
+	if (bad && !write) {
+		m->stats.spi_bad++;
+		for (i = 2; i < len; i++)
+			rx[i] ^= (prandom_u32() & 0x3) ? 0 : 1 << (prandom_u32() & 7);
+	}
+}
+
+void model_init(struct model *m)
+{
+	memset(m, 0, sizeof(*m));
+	INIT_LIST_HEAD(&m->state_timer.node);
+	m->state_timer.fn = model_state_done;
+	INIT_LIST_HEAD(&m->tx_timer.node);
+	m->tx_timer.fn = model_tx_done;
+	INIT_LIST_HEAD(&m->rx_timer.node);
+	m->rx_timer.fn = model_rx_event;
+	m->ed_dbm = -95;
+	model_reset(m);
+}
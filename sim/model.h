@@ -0,0 +1,82 @@
+/* Register level model of the AT86RF215 sub-GHz half (RF09 + BBC0) */
+#ifndef SIM_MODEL_H
+#define SIM_MODEL_H
+
+#include <sim_kernel.h>
+
+#define MODEL_NREGS		0x4000
+#define MODEL_FB_LEN		2048
+
+struct model {
+	u8			regs[MODEL_NREGS];
+
+	/* RF09 state machine */
+	u8			state;
+	u8			next_state;
+	bool			deep_sleep;
+	u8			rf24_state;
+	struct sim_timer	state_timer;
+
+	/* Transmitter; when each TX frame buffer octet was written, and
+	 * after which TXFL write */
+	struct sim_timer	tx_timer;
+	u64			tx_start;
+	u64			fb_tx_ns[MODEL_FB_LEN];
+	u32			fb_tx_gen[MODEL_FB_LEN];
+	u32			txfl_gen;
+
+	/* Receiver: one frame on the air at a time */
+	struct sim_timer	rx_timer;
+	int			rx_stage;
+	u8			rx_psdu[MODEL_FB_LEN];
+	u16			rx_len;
+	u16			rx_mhr_len;
+	bool			rx_match;
+	u64			deaf_until;
+
+	/* Counter (BBC0_CNT0..3) in 1 us ticks */
+	u64			cnt_epoch;
+	u32			cnt_capture;
+
+	/* Reads above this clock come back corrupted, 0 = never */
+	u32			max_hz;
+	s8			ed_dbm;
+
+	/* Called with each frame sent, and each frame delivered to the FB */
+	void			(*on_tx)(struct model *m, const u8 *psdu,
+					 u16 len);
+	void			(*on_rx)(struct model *m, const u8 *psdu,
+					 u16 len);
+
+	struct model_stats {
+		u64		spi_frames;
+		u64		spi_bad;
+		u64		cmds;
+		u64		tx_frames;
+		u64		tx_underruns;
+		u64		tx_air_ns;
+		u64		rx_frames;
+		u64		rx_missed;
+		u64		rx_aborted;
+		u64		rx_matched;
+		u64		acks;
+		u64		acks_pending;
+		u64		channel_switches;
+	} stats;
+};
+
+void model_init(struct model *m);
+void model_spi_frame(void *priv, const u8 *tx, u8 *rx, size_t len, u32 hz);
+bool model_irq_line(void *priv);
+
+/* Starts receiving @psdu (FCS included) now; false if the radio is not
+ * listening */
+bool model_rx(struct model *m, const u8 *psdu, u16 len);
+
+/* Air time of a PSDU of @len octets with the current PHY settings */
+u64 model_airtime_ns(struct model *m, u16 len);
+
+/* Appends the FCS of the current PHY settings; returns the PSDU length */
+u16 model_add_fcs(struct model *m, u8 *psdu, u16 len);
+
+#endif /* SIM_MODEL_H */
@@ -0,0 +1,902 @@
+/* Runs the driver against the chip model and reports what each operation
+ * costs on the SPI bus and how long it takes, in simulated time.
+ *
+ * Usage: at86rf215-sim [-v] [-n FRAMES] [-l LEN] [-g GAP_US] [-c SWITCHES]
+ *                      [-s SPI_HZ] [-o MSG_US] [-w TRACE.csv] [-k CHANNEL]
+ *                      [-d NAME=VALUE]... [SCENARIO...]
+ *
+ * Scenarios: tx (back to back frames), rx (a flood of frames GAP_US apart),
+ * channel (channel switches while listening), budget (one of each driver
+ * operation, checked against the SPI budgets below), txgen (the traffic
+ * generator of the driver, set up with -d), retry (frames with AR set to a
+ * peer which drops some of the ACKs), beacon (FRAMES periodic frames of the
+ * driver, set up with -d) and stats (the debugfs counters, at that point of
+ * the run). Probe and start are always measured.
+ *
+ * -s is the highest SPI clock the chip takes, the device tree clock is capped
+ * at it. -k switches to CHANNEL and -d writes VALUE to the debugfs file NAME after
+ * start, as `echo VALUE > $DBG/NAME` would. -w writes every SPI byte of the
+ * run as a logic analyser capture, for python_extraction/replay.py. */
+#include <getopt.h>
+#include <sim_kernel.h>
+#include "sim.h"
+#include "model.h"
+
+struct sim_state sim;
+
+static struct model chip;
+static struct spi_controller ctlr;
+static struct sim_spi_slave slave = {
+	.frame	= model_spi_frame,
+	.priv	= &chip,
+};
+
+/* Same layout as struct at86rf215_platform_data: no reset GPIO */
+static struct {
+	int rstn;
+} pdata = { -1 };
+
+static struct spi_device spi = {
+	.dev		= {
+		.init_name	= "spi0.0",
+		.platform_data	= &pdata,
+	},
+	.controller	= &ctlr,
+	.master		= &ctlr,
+	/* spi-max-frequency of the device tree */
+	.max_speed_hz	= 7500000,
+	.irq		= 1,
+	.slave		= &slave,
+};
+
+static unsigned int opt_frames = 500;
+static unsigned int opt_len = 100;
+static unsigned int opt_gap_us = 500;
+static unsigned int opt_switches = 50;
+static u32 opt_spi_hz = 25000000;
+static int opt_channel = -1;
+static char *opt_debugfs[16];
+static unsigned int opt_ndebugfs;
+static int failed;
+
+/* SPI cost of probe, for the budget check */
+static u64 probe_msgs, probe_bytes;
+
+/******************************** measurement ********************************/
+
+struct meter {
+	const char	*name;
+	u64		t0;
+	u64		msgs, bytes, busy_ns, irqs;
+	u64		*lat;
+	unsigned int	nlat;
+	unsigned int	ops;
+};
+
+static struct meter *cur;
+
+static void meter_start(struct meter *mt, const char *name, unsigned int max)
+{
+	memset(mt, 0, sizeof(*mt));
+	mt->name = name;
+	mt->lat = calloc(max ? max : 1, sizeof(*mt->lat));
+	mt->t0 = sim_now();
+	mt->msgs = ctlr.msgs;
+	mt->bytes = ctlr.bytes;
+	mt->busy_ns = ctlr.busy_ns;
+	mt->irqs = sim.irqs;
+	cur = mt;
+}
+
+static void meter_lat(struct meter *mt, u64 ns)
+{
+	mt->lat[mt->nlat++] = ns;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	const u64 *x = a, *y = b;
+
+	return *x < *y ? -1 : *x > *y;
+}
+
+static void meter_print_header(void)
+{
+	printf("%-10s %6s %8s %9s %10s %10s %10s %10s %10s\n", "operation",
+	       "ops", "msgs/op", "bytes/op", "bus_us/op", "lat_avg_us",
+	       "lat_p50_us", "lat_p99_us", "lat_max_us");
+}
+
+static void meter_stop(struct meter *mt)
+{
+	unsigned int ops = max(mt->ops, 1U);
+	u64 sum = 0;
+	unsigned int i;
+
+	cur = NULL;
+	mt->msgs = ctlr.msgs - mt->msgs;
+	mt->bytes = ctlr.bytes - mt->bytes;
+	mt->busy_ns = ctlr.busy_ns - mt->busy_ns;
+	mt->irqs = sim.irqs - mt->irqs;
+
+	qsort(mt->lat, mt->nlat, sizeof(*mt->lat), cmp_u64);
+	for (i = 0; i < mt->nlat; i++)
+		sum += mt->lat[i];
+
+	printf("%-10s %6u %8.1f %9.1f %10.1f", mt->name, mt->ops,
+	       (double)mt->msgs / ops, (double)mt->bytes / ops,
+	       mt->busy_ns / 1e3 / ops);
+	if (mt->nlat)
+		printf(" %10.1f %10.1f %10.1f %10.1f\n", sum / 1e3 / mt->nlat,
+		       mt->lat[(mt->nlat - 1) / 2] / 1e3,
+		       mt->lat[(mt->nlat - 1) * 99 / 100] / 1e3,
+		       mt->lat[mt->nlat - 1] / 1e3);
+	else
+		printf(" %10s %10s %10s %10s\n", "-", "-", "-", "-");
+	free(mt->lat);
+}
+
+/******************************** frames ********************************/
+
+#define SIM_MHR_LEN	9
+
+/* Broadcast data frame, the frame index in the first payload octets */
+static u16 sim_frame(u8 *buf, u32 idx, u16 payload)
+{
+	u16 i;
+
+	buf[0] = 0x41;			/* data, PAN ID compression */
+	buf[1] = 0x88;			/* short destination and source */
+	buf[2] = idx;
+	put_unaligned_le16(0xffff, buf + 3);
+	put_unaligned_le16(0xffff, buf + 5);
+	put_unaligned_le16(0x0001, buf + 7);
+	for (i = 0; i < payload; i++)
+		buf[SIM_MHR_LEN + i] = i < 4 ? idx >> (8 * i) : i;
+	return SIM_MHR_LEN + payload;
+}
+
+static u64 *rx_end;
+static unsigned int rx_count;
+
+void sim_mac_tx_done(struct sk_buff *skb)
+{
+	if (cur)
+		meter_lat(cur, sim_now() - skb->sim_ts);
+}
+
+void sim_mac_rx(struct sk_buff *skb, u8 lqi)
+{
+	u32 idx;
+
+	rx_count++;
+	if (!cur || !rx_end || skb->len < SIM_MHR_LEN + 4)
+		return;
+	idx = get_unaligned_le32(skb->data + SIM_MHR_LEN);
+	if (idx < cur->ops)
+		meter_lat(cur, sim_now() - rx_end[idx]);
+}
+
+static bool sim_queue_stopped(void *arg)
+{
+	return sim.queue_stopped;
+}
+
+/******************************** scenarios ********************************/
+
+static int sim_probe(void)
+{
+	struct meter mt;
+	int rc;
+
+	meter_start(&mt, "probe", 1);
+	rc = sim_module_init();
+	if (!rc)
+		rc = sim_spi_probe(&spi);
+	sim_idle();
+	mt.ops = 1;
+	meter_lat(&mt, sim_now() - mt.t0);
+	meter_stop(&mt);
+	probe_msgs = mt.msgs;
+	probe_bytes = mt.bytes;
+	if (rc || !sim.hw) {
+		fprintf(stderr, "probe failed: %d\n", rc);
+		return rc ? rc : -ENODEV;
+	}
+
+	meter_start(&mt, "start", 1);
+	rc = sim.ops->start(sim.hw);
+	sim_run_until(sim_now() + 2 * NSEC_PER_MSEC);
+	mt.ops = 1;
+	meter_stop(&mt);
+	return rc;
+}
+
+/* xmit to the start of the frame on air, in the tx scenario */
+static u64 tx_xmit_ns, tx_to_air_ns, tx_to_air_max;
+
+static void sim_tx_on_air(struct model *m, const u8 *psdu, u16 len)
+{
+	u64 ns = m->tx_start - tx_xmit_ns;
+
+	tx_to_air_ns += ns;
+	tx_to_air_max = max(tx_to_air_max, ns);
+}
+
+static void sim_tx(void)
+{
+	struct meter mt;
+	struct sk_buff *skb;
+	u64 t0, underruns = chip.stats.tx_underruns;
+	unsigned int i;
+
+	meter_start(&mt, "tx", opt_frames);
+	t0 = chip.stats.tx_air_ns;
+	tx_to_air_ns = 0;
+	tx_to_air_max = 0;
+	chip.on_tx = sim_tx_on_air;
+	for (i = 0; i < opt_frames; i++) {
+		if (!sim_run_while(sim_queue_stopped, NULL, NSEC_PER_SEC)) {
+			fprintf(stderr, "tx: frame %u never completed\n", i);
+			failed = 1;
+			break;
+		}
+		skb = dev_alloc_skb(SIM_MHR_LEN + opt_len);
+		skb_put(skb, sim_frame(skb->data, i, opt_len));
+		skb->sim_ts = sim_now();
+		tx_xmit_ns = skb->sim_ts;
+
+		/* As ieee802154_tx(): the queue is stopped for each frame */
+		ieee802154_stop_queue(sim.hw);
+		if (sim.ops->xmit_async(sim.hw, skb)) {
+			ieee802154_wake_queue(sim.hw);
+			kfree_skb(skb);
+		}
+		mt.ops++;
+	}
+	if (!sim_run_while(sim_queue_stopped, NULL, NSEC_PER_SEC)) {
+		fprintf(stderr, "tx: last frame never completed\n");
+		failed = 1;
+	}
+	sim_idle();
+	chip.on_tx = NULL;
+	meter_stop(&mt);
+	printf("  %u/%u sent, %.1f frames/s, %.1f%% of the time on air\n",
+	       mt.nlat, mt.ops, mt.nlat * 1e9 / (sim_now() - mt.t0),
+	       100.0 * (chip.stats.tx_air_ns - t0) / (sim_now() - mt.t0));
+	printf("  xmit to air %.1f us avg, %.1f us max, %llu underruns\n",
+	       tx_to_air_ns / 1e3 / max(mt.nlat, 1U), tx_to_air_max / 1e3,
+	       chip.stats.tx_underruns - underruns);
+	if (mt.nlat != mt.ops)
+		failed = 1;
+}
+
+/* Peer of the retry scenario: it answers the frames with AR set after the
+ * turnaround, but drops the ACK of the first attempt of every 4th frame and
+ * every ACK of every 16th one */
+static struct sim_timer peer_ack;
+static u8 peer_psdu[8];
+static u32 peer_idx;
+static unsigned int peer_attempt, peer_tx, peer_acks;
+
+static unsigned int sim_peer_drops(u32 idx)
+{
+	if (idx % 16 == 15)
+		return ~0U;
+	return idx % 4 == 1;
+}
+
+static void sim_peer_ack(struct sim_timer *t)
+{
+	model_rx(&chip, peer_psdu, model_add_fcs(&chip, peer_psdu, 3));
+}
+
+static void sim_peer_on_tx(struct model *m, const u8 *psdu, u16 len)
+{
+	u32 idx;
+
+	if (len < SIM_MHR_LEN + 4 || !(psdu[0] & 0x20))
+		return;
+	idx = get_unaligned_le32(psdu + SIM_MHR_LEN);
+	peer_attempt = peer_tx && idx == peer_idx ? peer_attempt + 1 : 0;
+	peer_idx = idx;
+	peer_tx++;
+	if (peer_attempt < sim_peer_drops(idx))
+		return;
+
+	peer_acks++;
+	peer_psdu[0] = IEEE802154_FC_TYPE_ACK;
+	peer_psdu[1] = 0;
+	peer_psdu[2] = psdu[2];
+	/* aTurnaroundTime of the SUN PHYs */
+	sim_timer_add(&peer_ack, sim_now() + NSEC_PER_MSEC);
+}
+
+static void sim_retry(void)
+{
+	unsigned int i, retries = 0, lost = 0;
+	u32 uploads = chip.txfl_gen;
+	struct sk_buff *skb;
+	struct meter mt;
+	u16 len;
+
+	/* Each frame is retried up to 3 times from the frame buffer */
+	if (sim.ops->set_frame_retries(sim.hw, 3)) {
+		failed = 1;
+		return;
+	}
+	INIT_LIST_HEAD(&peer_ack.node);
+	peer_ack.fn = sim_peer_ack;
+	peer_tx = 0;
+	peer_acks = 0;
+	chip.on_tx = sim_peer_on_tx;
+	meter_start(&mt, "retry", opt_frames);
+	for (i = 0; i < opt_frames; i++) {
+		if (!sim_run_while(sim_queue_stopped, NULL, NSEC_PER_SEC)) {
+			fprintf(stderr, "retry: frame %u never completed\n", i);
+			failed = 1;
+			break;
+		}
+		skb = dev_alloc_skb(SIM_MHR_LEN + opt_len);
+		len = sim_frame(skb->data, i, opt_len);
+		skb->data[0] |= 0x20;			/* AR */
+		put_unaligned_le16(0x0002, skb->data + 5);
+		skb_put(skb, len);
+		skb->sim_ts = sim_now();
+		retries += min(sim_peer_drops(i), 3U);
+		lost += sim_peer_drops(i) > 3;
+
+		ieee802154_stop_queue(sim.hw);
+		if (sim.ops->xmit_async(sim.hw, skb)) {
+			ieee802154_wake_queue(sim.hw);
+			kfree_skb(skb);
+		}
+		mt.ops++;
+	}
+	if (!sim_run_while(sim_queue_stopped, NULL, NSEC_PER_SEC)) {
+		fprintf(stderr, "retry: last frame never completed\n");
+		failed = 1;
+	}
+	sim_idle();
+	chip.on_tx = NULL;
+	meter_stop(&mt);
+	uploads = chip.txfl_gen - uploads;
+	printf("  %u/%u acked, %u sent again, %u given up, %u uploads for %u "
+	       "frames on air\n", mt.ops - lost, mt.ops, peer_tx - mt.ops, lost,
+	       uploads, peer_tx);
+	/* Given up frames are dropped, before 6.0 they do not complete */
+	if (mt.nlat != mt.ops - lost || peer_tx != mt.ops + retries ||
+	    peer_acks != mt.ops - lost || uploads != mt.ops)
+		failed = 1;
+}
+
+static struct sim_timer inject;
+static u8 rx_psdu[MODEL_FB_LEN];
+static u16 rx_len;
+static unsigned int rx_next;
+static struct meter *rx_meter;
+
+static void sim_inject(struct sim_timer *t)
+{
+	u64 air;
+
+	rx_len = sim_frame(rx_psdu, rx_next, opt_len);
+	rx_len = model_add_fcs(&chip, rx_psdu, rx_len);
+	air = model_airtime_ns(&chip, rx_len);
+	rx_end[rx_next] = sim_now() + air;
+	model_rx(&chip, rx_psdu, rx_len);
+	rx_meter->ops = ++rx_next;
+	if (rx_next < opt_frames)
+		sim_timer_add(t, sim_now() + air + opt_gap_us * NSEC_PER_USEC);
+}
+
+static void sim_rx(void)
+{
+	struct meter mt;
+	u64 missed = chip.stats.rx_missed + chip.stats.rx_aborted;
+
+	rx_end = calloc(opt_frames, sizeof(*rx_end));
+	rx_count = 0;
+	rx_next = 0;
+	rx_meter = &mt;
+	meter_start(&mt, "rx", opt_frames);
+
+	INIT_LIST_HEAD(&inject.node);
+	inject.fn = sim_inject;
+	sim_timer_add(&inject, sim_now());
+	while (rx_next < opt_frames || inject.queued)
+		sim_run_until(sim_now() + NSEC_PER_MSEC);
+	sim_run_until(sim_now() + 50 * NSEC_PER_MSEC);
+
+	meter_stop(&mt);
+	printf("  %u/%u delivered, %llu lost on air, %u us between frames\n",
+	       rx_count, opt_frames,
+	       chip.stats.rx_missed + chip.stats.rx_aborted - missed,
+	       opt_gap_us);
+	free(rx_end);
+	rx_end = NULL;
+	if (!rx_count)
+		failed = 1;
+}
+
+static void sim_channel(void)
+{
+	struct meter mt;
+	unsigned int i;
+	u64 t;
+	int rc;
+
+	meter_start(&mt, "channel", opt_switches);
+	for (i = 0; i < opt_switches; i++) {
+		t = sim_now();
+		rc = sim.ops->set_channel(sim.hw, 0, (i + 1) % 11);
+		if (rc) {
+			fprintf(stderr, "channel: switch %u failed: %d\n", i, rc);
+			failed = 1;
+			break;
+		}
+		meter_lat(&mt, sim_now() - t);
+		mt.ops++;
+		sim_run_until(sim_now() + NSEC_PER_MSEC);
+	}
+	sim_idle();
+	meter_stop(&mt);
+	printf("  %llu channel writes seen by the chip\n",
+	       chip.stats.channel_switches);
+}
+
+/******************************** budgets ********************************/
+
+/* SPI messages and bytes one operation may cost, idle radio in RX, settled
+ * until the chip is back in RX. An extra register access in a path shows up
+ * as one more message; raise a budget only along with the change that needs
+ * it, in the same commit. */
+struct budget {
+	const char	*name;
+	int		(*op)(unsigned int arg);
+	unsigned int	arg;
+	u32		msgs;
+	u32		bytes;
+};
+
+static int budget_xmit(unsigned int len)
+{
+	struct sk_buff *skb = dev_alloc_skb(SIM_MHR_LEN + len);
+
+	skb_put(skb, sim_frame(skb->data, 0, len));
+	skb->sim_ts = sim_now();
+	ieee802154_stop_queue(sim.hw);
+	if (sim.ops->xmit_async(sim.hw, skb)) {
+		ieee802154_wake_queue(sim.hw);
+		kfree_skb(skb);
+		return -EIO;
+	}
+	if (!sim_run_while(sim_queue_stopped, NULL, NSEC_PER_SEC))
+		return -ETIMEDOUT;
+	return 0;
+}
+
+static int budget_rx(unsigned int len)
+{
+	unsigned int count = rx_count;
+	u16 n = sim_frame(rx_psdu, 0, len);
+
+	n = model_add_fcs(&chip, rx_psdu, n);
+	if (!model_rx(&chip, rx_psdu, n))
+		return -EBUSY;
+	sim_run_until(sim_now() + model_airtime_ns(&chip, n) +
+		      NSEC_PER_MSEC);
+	return rx_count == count + 1 ? 0 : -EIO;
+}
+
+static int budget_channel(unsigned int channel)
+{
+	return sim.ops->set_channel(sim.hw, 0, channel);
+}
+
+static int budget_txpower(unsigned int mbm)
+{
+	return sim.ops->set_txpower(sim.hw, mbm);
+}
+
+static int budget_promisc(unsigned int on)
+{
+	return sim.ops->set_promiscuous_mode(sim.hw, on);
+}
+
+static const struct budget budgets[] = {
+	{ "probe",	NULL,		0,	74,	470 },
+	{ "xmit 20",	budget_xmit,	20,	8,	56 },
+	{ "xmit 127",	budget_xmit,	127,	8,	163 },
+	{ "xmit 1000",	budget_xmit,	1000,	8,	1036 },
+	{ "rx 20",	budget_rx,	20,	4,	41 },
+	{ "rx 127",	budget_rx,	127,	4,	148 },
+	{ "channel",	budget_channel,	5,	1,	6 },
+	{ "txpower",	budget_txpower,	1500,	1,	3 },
+	{ "promisc on",	budget_promisc,	1,	2,	9 },
+	{ "promisc off", budget_promisc, 0,	2,	6 },
+};
+
+static void sim_budget(void)
+{
+	const struct budget *b;
+	u64 msgs, bytes;
+	unsigned int i;
+	int rc;
+
+	printf("%-12s %6s %6s %8s %8s\n", "budget", "msgs", "max", "bytes",
+	       "max");
+	for (i = 0; i < ARRAY_SIZE(budgets); i++) {
+		b = &budgets[i];
+		if (b->op) {
+			sim_run_until(sim_now() + 10 * NSEC_PER_MSEC);
+			msgs = ctlr.msgs;
+			bytes = ctlr.bytes;
+			rc = b->op(b->arg);
+			sim_run_until(sim_now() + 5 * NSEC_PER_MSEC);
+			msgs = ctlr.msgs - msgs;
+			bytes = ctlr.bytes - bytes;
+		} else {
+			rc = 0;
+			msgs = probe_msgs;
+			bytes = probe_bytes;
+		}
+
+		printf("%-12s %6llu %6u %8llu %8u", b->name, msgs, b->msgs,
+		       bytes, b->bytes);
+		if (rc) {
+			printf("  FAILED (%d)\n", rc);
+			failed = 1;
+		} else if (msgs > b->msgs || bytes > b->bytes) {
+			printf("  OVER BUDGET\n");
+			failed = 1;
+		} else {
+			printf("\n");
+		}
+	}
+}
+
+/* Runs the generator with the settings of its debugfs files and prints its
+ * report, indented. The frames of the stack must go out with the PHY
+ * settings they had before. */
+static void sim_txgen(void)
+{
+	static char buf[1024];
+	u64 airtime = model_airtime_ns(&chip, 127);
+	struct meter mt;
+	unsigned int sent = 0, count;
+	char *line, *next;
+	int rc;
+
+	meter_start(&mt, "txgen", 1);
+	rc = sim_debugfs_write("txgen", "start");
+	if (rc)
+		fprintf(stderr, "txgen: start failed: %d\n", rc);
+	while (!rc && sim_debugfs_read("txgen", buf, sizeof(buf)) > 0 &&
+	       strstr(buf, "running"))
+		sim_run_until(sim_now() + NSEC_PER_MSEC);
+	sim_idle();
+	if (!rc && sim_debugfs_read("txgen", buf, sizeof(buf)) <= 0)
+		rc = -EIO;
+
+	line = strstr(buf, "sent:");
+	if (!rc && line)
+		sscanf(line, "sent: %u/%u", &sent, &count);
+	mt.ops = sent;
+	meter_stop(&mt);
+	if (rc) {
+		failed = 1;
+		return;
+	}
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		next = next ? next + 1 : line + strlen(line);
+		printf("  %.*s", (int)(next - line), line);
+	}
+	if (!sent || sent != count)
+		failed = 1;
+	if (model_airtime_ns(&chip, 127) != airtime) {
+		printf("  PHY settings of the stack not restored\n");
+		failed = 1;
+	}
+}
+
+/* TX start of the beacons, in the beacon scenario. A frame of the stack
+ * follows every 4th beacon, it is held back until the beacon is done and
+ * the next beacon is uploaded whole again. */
+static u64 bcn_period, bcn_last, bcn_dev_sum, bcn_dev_max;
+static unsigned int bcn_frames, bcn_stack;
+
+static void sim_bcn_on_air(struct model *m, const u8 *psdu, u16 len)
+{
+	struct sk_buff *skb;
+	u64 d, dev;
+
+	if ((psdu[0] & 0x7) != IEEE802154_FC_TYPE_BEACON)
+		return;
+	if (bcn_frames % 4 == 0 && !sim.queue_stopped) {
+		skb = dev_alloc_skb(SIM_MHR_LEN + opt_len);
+		skb_put(skb, sim_frame(skb->data, bcn_stack++, opt_len));
+		skb->sim_ts = sim_now();
+		ieee802154_stop_queue(sim.hw);
+		if (sim.ops->xmit_async(sim.hw, skb)) {
+			ieee802154_wake_queue(sim.hw);
+			kfree_skb(skb);
+		}
+	}
+	if (bcn_frames++) {
+		/* Off the nearest multiple of the interval */
+		d = (m->tx_start - bcn_last) % bcn_period;
+		dev = min(d, bcn_period - d);
+		bcn_dev_sum += dev;
+		bcn_dev_max = max(bcn_dev_max, dev);
+	}
+	bcn_last = m->tx_start;
+}
+
+static void sim_beacon(void)
+{
+	static char buf[1024];
+	struct meter mt;
+	char *line, *next;
+	int rc;
+
+	rc = sim_debugfs_read("beacon_interval_us", buf, sizeof(buf));
+	bcn_period = rc > 0 ? strtoull(buf, NULL, 0) * NSEC_PER_USEC : 0;
+	if (!bcn_period) {
+		failed = 1;
+		return;
+	}
+	bcn_frames = 0;
+	bcn_stack = 0;
+	bcn_dev_sum = 0;
+	bcn_dev_max = 0;
+	chip.on_tx = sim_bcn_on_air;
+
+	meter_start(&mt, "beacon", opt_frames);
+	rc = sim_debugfs_write("beacon", "start");
+	if (rc)
+		fprintf(stderr, "beacon: start failed: %d\n", rc);
+	else
+		sim_run_until(sim_now() + opt_frames * bcn_period -
+			      bcn_period / 2);
+	sim_debugfs_write("beacon", "stop");
+	sim_idle();
+	chip.on_tx = NULL;
+	mt.ops = bcn_frames;
+	meter_stop(&mt);
+	if (rc || sim_debugfs_read("beacon", buf, sizeof(buf)) <= 0) {
+		failed = 1;
+		return;
+	}
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		next = next ? next + 1 : line + strlen(line);
+		printf("  %.*s", (int)(next - line), line);
+	}
+	printf("  on air: %u beacons, period off by %.3f us avg, %.3f us max, "
+	       "%u/%u frames of the stack in between\n",
+	       bcn_frames, bcn_dev_sum / 1e3 / max(bcn_frames - 1, 1U),
+	       bcn_dev_max / 1e3, mt.nlat, bcn_stack);
+	if (bcn_frames != opt_frames || mt.nlat != bcn_stack)
+		failed = 1;
+}
+
+/* hwrng reads of AT86RF215_RNG_BATCH octets while the radio listens; a
+ * blocking read while it is down must give up with -EAGAIN */
+static void sim_rng(void)
+{
+	struct hwrng *rng = sim.hwrng;
+	struct meter mt;
+	u8 buf[64];
+	u64 t0, bytes = 0;
+	unsigned int i;
+	int rc;
+
+	if (!rng) {
+		failed = 1;
+		return;
+	}
+
+	sim.ops->stop(sim.hw);
+	t0 = sim_now();
+	rc = rng->read(rng, buf, sizeof(buf), true);
+	printf("  radio down: blocking read %d after %.1f ms\n", rc,
+	       (sim_now() - t0) / 1e6);
+	if (rc != -EAGAIN)
+		failed = 1;
+	sim.ops->start(sim.hw);
+	sim_run_until(sim_now() + NSEC_PER_MSEC);
+
+	meter_start(&mt, "rng", opt_frames);
+	t0 = sim_now();
+	for (i = 0; i < opt_frames; i++) {
+		u64 t = sim_now();
+
+		rc = rng->read(rng, buf, sizeof(buf), true);
+		if (rc <= 0)
+			break;
+		bytes += rc;
+		meter_lat(&mt, sim_now() - t);
+		mt.ops++;
+	}
+	meter_stop(&mt);
+	printf("  %llu octets in %.3f ms: %.0f B/s\n",
+	       (unsigned long long)bytes, (sim_now() - t0) / 1e6,
+	       bytes * 1e9 / max(sim_now() - t0, 1ULL));
+	if (rc <= 0)
+		failed = 1;
+}
+
+/* Memory held by the probed device, as laid out by the shim headers */
+static void sim_memory(void)
+{
+	printf("--- memory\n");
+	printf("  private area:\t%zu bytes\n", sim.priv_bytes);
+	printf("  slab:\t\t%ld objects, %ld bytes\n", sim.slab_objects,
+	       sim.slab_bytes);
+}
+
+static void sim_stats(void)
+{
+	static char buf[16384];
+
+	printf("--- stats\n");
+	if (sim_debugfs_read("stats", buf, sizeof(buf)) > 0)
+		fputs(buf, stdout);
+}
+
+/* -k and -d, once the radio is started */
+static int sim_setup(void)
+{
+	char name[64], *eq;
+	unsigned int i;
+	int rc;
+
+	if (opt_channel >= 0) {
+		rc = sim.ops->set_channel(sim.hw, 0, opt_channel);
+		if (rc) {
+			fprintf(stderr, "channel %d: %d\n", opt_channel, rc);
+			return rc;
+		}
+		sim_run_until(sim_now() + NSEC_PER_MSEC);
+	}
+
+	for (i = 0; i < opt_ndebugfs; i++) {
+		eq = strchr(opt_debugfs[i], '=');
+		if (!eq || eq - opt_debugfs[i] >= (int)sizeof(name))
+			return -EINVAL;
+		memcpy(name, opt_debugfs[i], eq - opt_debugfs[i]);
+		name[eq - opt_debugfs[i]] = 0;
+		rc = sim_debugfs_write(name, eq + 1);
+		if (rc) {
+			fprintf(stderr, "%s: %d\n", opt_debugfs[i], rc);
+			return rc;
+		}
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: at86rf215-sim [-v] [-n FRAMES] [-l LEN] [-g GAP_US]\n"
+		"                     [-c SWITCHES] [-s SPI_HZ] [-o MSG_US]\n"
+		"                     [-w TRACE.csv] [-k CHANNEL] [-d NAME=VALUE]\n"
+		"                     [tx] [rx] [channel] [budget] [txgen] [retry]\n"
+		"                     [beacon] [rng] [memory] [stats]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	bool all = true;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "vn:l:g:c:s:o:w:k:d:")) != -1) {
+		switch (opt) {
+		case 'v':
+			sim_verbose = true;
+			break;
+		case 'n':
+			opt_frames = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			opt_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			opt_gap_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			opt_switches = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opt_spi_hz = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			sim_spi_msg_ns = strtod(optarg, NULL) * NSEC_PER_USEC;
+			break;
+		case 'k':
+			opt_channel = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			if (opt_ndebugfs == ARRAY_SIZE(opt_debugfs))
+				usage();
+			opt_debugfs[opt_ndebugfs++] = optarg;
+			break;
+		case 'w':
+			sim_spi_trace = fopen(optarg, "w");
+			if (!sim_spi_trace) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+		}
+	}
+	if (!opt_frames || opt_len < 4 || opt_len > 2000)
+		usage();
+
+	model_init(&chip);
+	chip.max_hz = opt_spi_hz ? opt_spi_hz : 25000000;
+	/* A board with a slower chip has it in its device tree */
+	spi.max_speed_hz = min(spi.max_speed_hz, chip.max_hz);
+	sim_spi_init(&ctlr, 125000000);
+	sim_irq_connect(spi.irq, model_irq_line, &chip);
+
+	printf("AT86RF215 simulator: chip SPI up to %u Hz, %.1f us per message\n",
+	       chip.max_hz, sim_spi_msg_ns / 1e3);
+	meter_print_header();
+	if (sim_probe() || sim_setup())
+		return 1;
+
+	for (i = optind; i < argc; i++)
+		if (strcmp(argv[i], "stats"))
+			all = false;
+	if (all) {
+		sim_tx();
+		sim_rx();
+		sim_channel();
+	}
+
+	for (i = optind; i < argc; i++) {
+		if (!strcmp(argv[i], "tx"))
+			sim_tx();
+		else if (!strcmp(argv[i], "rx"))
+			sim_rx();
+		else if (!strcmp(argv[i], "channel"))
+			sim_channel();
+		else if (!strcmp(argv[i], "budget"))
+			sim_budget();
+		else if (!strcmp(argv[i], "txgen"))
+			sim_txgen();
+		else if (!strcmp(argv[i], "retry"))
+			sim_retry();
+		else if (!strcmp(argv[i], "beacon"))
+			sim_beacon();
+		else if (!strcmp(argv[i], "rng"))
+			sim_rng();
+		else if (!strcmp(argv[i], "memory"))
+			sim_memory();
+		else if (!strcmp(argv[i], "stats"))
+			sim_stats();
+		else
+			usage();
+	}
+
+	sim.ops->stop(sim.hw);
+	sim_idle();
+	sim_spi_remove(&spi);
+	sim_module_exit();
+
+	if (sim.skbs) {
+		fprintf(stderr, "%ld sk_buffs leaked\n", sim.skbs);
+		failed = 1;
+	}
+	if (sim.warnings)
+		failed = 1;
+	if (sim_spi_trace)
+		fclose(sim_spi_trace);
+	return failed;
+}
@@ -0,0 +1,56 @@
+/* Glue between the kernel shim, the chip model and the scenarios */
+#ifndef SIM_SIM_H
+#define SIM_SIM_H
+
+#include <stdio.h>
+#include <sim_kernel.h>
+
+struct sim_state {
+	struct ieee802154_hw		*hw;
+	const struct ieee802154_ops	*ops;
+	struct hwrng			*hwrng;
+	bool				queue_stopped;
+
+	u64				warnings;
+	u64				printks;
+	u64				irqs;
+	u64				works;
+	long				skbs;
+	u64				regmap_reads;
+	u64				regmap_writes;
+	/* Memory of the device: private area, slab objects in use */
+	size_t				priv_bytes;
+	long				slab_objects;
+	long				slab_bytes;
+};
+
+extern struct sim_state sim;
+extern bool sim_verbose;
+extern u64 sim_spi_msg_ns;
+extern FILE *sim_spi_trace;
+
+/* Event loop */
+void sim_run_until(u64 deadline);
+bool sim_run_while(bool (*busy)(void *arg), void *arg, u64 timeout);
+void sim_idle(void);
+
+/* Hardware hookup */
+void sim_irq_connect(unsigned int irq, bool (*line)(void *priv), void *priv);
+void sim_irq_release(unsigned int irq);
+void sim_spi_init(struct spi_controller *ctlr, u32 max_speed_hz);
+int sim_spi_probe(struct spi_device *spi);
+int sim_spi_remove(struct spi_device *spi);
+
+/* Driver under test, from driver.c */
+int sim_module_init(void);
+void sim_module_exit(void);
+
+/* debugfs files of the driver, by name */
+ssize_t sim_debugfs_read(const char *name, char *buf, size_t size);
+int sim_debugfs_write(const char *name, const char *s);
+
+/* mac802154 callbacks, implemented by the scenarios */
+void sim_mac_tx_done(struct sk_buff *skb);
+void sim_mac_rx(struct sk_buff *skb, u8 lqi);
+
+#endif /* SIM_SIM_H */